@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2015-2018, Intel Corporation */
+/* Copyright 2015-2020, Intel Corporation */
 
 /*
  * obj_lanes.cpp -- lane benchmark definition
@@ -7,11 +7,14 @@
 
 #include <cassert>
 #include <cerrno>
+#include <cstring>
+#include <string>
 #include <unistd.h>
 
 #include "benchmark.hpp"
 #include "file.h"
 #include "libpmemobj.h"
+#include "os.h"
 
 /* an internal libpmemobj code */
 #include "lane.h"
@@ -23,6 +26,14 @@
  */
 #define OPERATION_REPEAT_COUNT 10000
 
+/*
+ * prog_args - command line parsed arguments
+ */
+struct prog_args {
+	char *lane_mode; /* "thread" or "cpu" */
+	unsigned nlanes; /* number of lanes, 0 for the default */
+};
+
 /*
  * obj_bench - variables used in benchmark, passed within functions
  */
@@ -63,13 +74,41 @@ lanes_init(struct benchmark *bench, struct benchmark_args *args)
 	else
 		psize = PMEMOBJ_MIN_POOL;
 
+	enum pobj_lane_mode mode;
+	if (strcmp(ob->pa->lane_mode, "thread") == 0) {
+		mode = POBJ_LANE_MODE_THREAD;
+	} else if (strcmp(ob->pa->lane_mode, "cpu") == 0) {
+		mode = POBJ_LANE_MODE_CPU;
+	} else {
+		fprintf(stderr, "unknown lane mode: %s\n", ob->pa->lane_mode);
+		goto err;
+	}
+
+	/* the number of lanes is read from the environment on create */
+	if (ob->pa->nlanes != 0 &&
+	    os_setenv("PMEMOBJ_NLANES",
+		      std::to_string(ob->pa->nlanes).c_str(), 1) != 0) {
+		perror("os_setenv");
+		goto err;
+	}
+
 	/* create pmemobj pool */
 	ob->pop = pmemobj_create(args->fname, "obj_lanes", psize, args->fmode);
+
+	if (ob->pa->nlanes != 0)
+		os_unsetenv("PMEMOBJ_NLANES");
+
 	if (ob->pop == nullptr) {
 		fprintf(stderr, "%s\n", pmemobj_errormsg());
 		goto err;
 	}
 
+	if (pmemobj_ctl_set(ob->pop, "lane.mode", &mode) != 0) {
+		perror("pmemobj_ctl_set");
+		pmemobj_close(ob->pop);
+		goto err;
+	}
+
 	return 0;
 
 err:
@@ -108,12 +147,33 @@ lanes_op(struct benchmark *bench, struct operation_info *info)
 
 	return 0;
 }
+static struct benchmark_clo lanes_clo[2];
 static struct benchmark_info lanes_info;
 
 CONSTRUCTOR(obj_lines_constructor)
 void
 obj_lines_constructor(void)
 {
+	lanes_clo[0].opt_short = 0;
+	lanes_clo[0].opt_long = "lane-mode";
+	lanes_clo[0].descr = "The way lanes are picked by threads: "
+			     "thread or cpu";
+	lanes_clo[0].type = CLO_TYPE_STR;
+	lanes_clo[0].off = clo_field_offset(struct prog_args, lane_mode);
+	lanes_clo[0].def = "thread";
+
+	lanes_clo[1].opt_short = 0;
+	lanes_clo[1].opt_long = "nlanes";
+	lanes_clo[1].descr = "The number of lanes in the pool, "
+			     "0 for the default";
+	lanes_clo[1].type = CLO_TYPE_UINT;
+	lanes_clo[1].off = clo_field_offset(struct prog_args, nlanes);
+	lanes_clo[1].def = "0";
+	lanes_clo[1].type_uint.size = clo_field_size(struct prog_args, nlanes);
+	lanes_clo[1].type_uint.base = CLO_INT_BASE_DEC;
+	lanes_clo[1].type_uint.min = 0;
+	lanes_clo[1].type_uint.max = UINT_MAX;
+
 	lanes_info.name = "obj_lanes";
 	lanes_info.brief = "Benchmark for internal lanes "
 			   "operation";
@@ -123,9 +183,9 @@ obj_lines_constructor(void)
 	lanes_info.multiops = true;
 	lanes_info.operation = lanes_op;
 	lanes_info.measure_time = true;
-	lanes_info.clos = NULL;
-	lanes_info.nclos = 0;
-	lanes_info.opts_size = 0;
+	lanes_info.clos = lanes_clo;
+	lanes_info.nclos = ARRAY_SIZE(lanes_clo);
+	lanes_info.opts_size = sizeof(struct prog_args);
 	lanes_info.rm_file = true;
 	lanes_info.allow_poolset = true;
 	REGISTER_BENCHMARK(lanes_info);
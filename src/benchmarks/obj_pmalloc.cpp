@@ -42,6 +42,7 @@ struct prog_args {
 	size_t minsize;	      /* minimum size for random allocation size */
 	bool use_random_size; /* if set, use random size allocations */
 	unsigned seed;	      /* PRNG seed */
+	size_t batch;	      /* number of objects allocated at once */
 };
 
 POBJ_LAYOUT_BEGIN(pmalloc_layout);
@@ -65,6 +66,7 @@ struct obj_bench {
 	size_t *sizes;		   /* sizes for allocations */
 	TOID(struct my_root) root; /* root object's OID */
 	uint64_t *offs;		   /* pointer to the vector of offsets */
+	size_t nobjs;		   /* number of objects in the vector */
 };
 
 /*
@@ -107,6 +109,10 @@ obj_init(struct benchmark *bench, struct benchmark_args *args)
 	size_t n_ops_total = args->n_ops_per_thread * args->n_threads;
 	assert(n_ops_total != 0);
 
+	/* only the bulk allocation benchmark creates batches of objects */
+	size_t batch = ob->pa->batch != 0 ? ob->pa->batch : 1;
+	ob->nobjs = n_ops_total * batch;
+
 	/* Create pmemobj pool. */
 	size_t alloc_size = args->dsize;
 	if (alloc_size < ALLOC_MIN_SIZE)
@@ -114,9 +120,9 @@ obj_init(struct benchmark *bench, struct benchmark_args *args)
 
 	/* For data objects */
 	size_t poolsize = PMEMOBJ_MIN_POOL +
-		(n_ops_total * (alloc_size + OOB_HEADER_SIZE))
+		(ob->nobjs * (alloc_size + OOB_HEADER_SIZE))
 		/* for offsets */
-		+ n_ops_total * sizeof(uint64_t);
+		+ ob->nobjs * sizeof(uint64_t);
 
 	/* multiply by FACTOR for metadata, fragmentation, etc. */
 	poolsize = (size_t)(poolsize * FACTOR);
@@ -158,7 +164,7 @@ obj_init(struct benchmark *bench, struct benchmark_args *args)
 	root = D_RW(ob->root);
 	assert(root != nullptr);
 	POBJ_ZALLOC(ob->pop, &root->offs, uint64_t,
-		    n_ops_total * sizeof(PMEMoid));
+		    ob->nobjs * sizeof(PMEMoid));
 	if (TOID_IS_NULL(root->offs)) {
 		fprintf(stderr, "POBJ_ZALLOC off_vect: %s\n",
 			pmemobj_errormsg());
@@ -243,6 +249,63 @@ pmalloc_op(struct benchmark *bench, struct operation_info *info)
 	return 0;
 }
 
+/*
+ * pmalloc_bulk_worker_init -- allocates the buffer for the identifiers of the
+ * objects allocated by a single operation
+ */
+static int
+pmalloc_bulk_worker_init(struct benchmark *bench, struct benchmark_args *args,
+			 struct worker_info *worker)
+{
+	auto *ob = (struct obj_bench *)pmembench_get_priv(bench);
+
+	auto *oids = (PMEMoid *)calloc(ob->pa->batch, sizeof(PMEMoid));
+	if (oids == nullptr)
+		return -1;
+
+	worker->priv = oids;
+
+	return 0;
+}
+
+/*
+ * pmalloc_bulk_worker_fini -- frees the buffer for the object identifiers
+ */
+static void
+pmalloc_bulk_worker_fini(struct benchmark *bench, struct benchmark_args *args,
+			 struct worker_info *worker)
+{
+	free(worker->priv);
+}
+
+/*
+ * pmalloc_bulk_op -- actual benchmark operation. Allocates a batch of objects
+ * with a single pmemobj_xalloc_bulk() call.
+ */
+static int
+pmalloc_bulk_op(struct benchmark *bench, struct operation_info *info)
+{
+	auto *ob = (struct obj_bench *)pmembench_get_priv(bench);
+	auto *oids = (PMEMoid *)info->worker->priv;
+	size_t batch = ob->pa->batch;
+
+	uint64_t i = info->index +
+		info->worker->index * info->args->n_ops_per_thread;
+
+	int ret = pmemobj_xalloc_bulk(ob->pop, oids, batch, ob->sizes[i], 0,
+				      0, nullptr, nullptr);
+	if (ret) {
+		fprintf(stderr, "pmemobj_xalloc_bulk: %s\n",
+			pmemobj_errormsg());
+		return ret;
+	}
+
+	for (size_t j = 0; j < batch; j++)
+		ob->offs[i * batch + j] = oids[j].off;
+
+	return 0;
+}
+
 struct pmix_worker {
 	size_t nobjects;
 	size_t shuffle_start;
@@ -345,7 +408,7 @@ pmalloc_exit(struct benchmark *bench, struct benchmark_args *args)
 {
 	auto *ob = (struct obj_bench *)pmembench_get_priv(bench);
 
-	for (size_t i = 0; i < args->n_ops_per_thread * args->n_threads; i++) {
+	for (size_t i = 0; i < ob->nobjs; i++) {
 		if (ob->offs[i])
 			pfree(ob->pop, &ob->offs[i]);
 	}
@@ -402,10 +465,16 @@ pfree_op(struct benchmark *bench, struct operation_info *info)
 
 /* command line options definition */
 static struct benchmark_clo pmalloc_clo[3];
+/* command line options of the bulk allocation benchmark */
+static struct benchmark_clo pmalloc_bulk_clo[4];
 /*
  * Stores information about pmalloc benchmark.
  */
 static struct benchmark_info pmalloc_info;
+/*
+ * Stores information about pmalloc_bulk benchmark.
+ */
+static struct benchmark_info pmalloc_bulk_info;
 /*
  * Stores information about pfree benchmark.
  */
@@ -467,6 +536,39 @@ obj_pmalloc_constructor(void)
 	pmalloc_info.allow_poolset = true;
 	REGISTER_BENCHMARK(pmalloc_info);
 
+	for (size_t i = 0; i < ARRAY_SIZE(pmalloc_clo); i++)
+		pmalloc_bulk_clo[i] = pmalloc_clo[i];
+
+	pmalloc_bulk_clo[3].opt_short = 'b';
+	pmalloc_bulk_clo[3].opt_long = "batch";
+	pmalloc_bulk_clo[3].descr = "Number of objects allocated at once";
+	pmalloc_bulk_clo[3].type = CLO_TYPE_UINT;
+	pmalloc_bulk_clo[3].off = clo_field_offset(struct prog_args, batch);
+	pmalloc_bulk_clo[3].def = "64";
+	pmalloc_bulk_clo[3].type_uint.size =
+		clo_field_size(struct prog_args, batch);
+	pmalloc_bulk_clo[3].type_uint.base = CLO_INT_BASE_DEC;
+	pmalloc_bulk_clo[3].type_uint.min = 1;
+	pmalloc_bulk_clo[3].type_uint.max = UINT_MAX;
+
+	pmalloc_bulk_info.name = "pmalloc_bulk";
+	pmalloc_bulk_info.brief = "Benchmark for pmemobj_xalloc_bulk() "
+				  "operation";
+	pmalloc_bulk_info.init = pmalloc_init;
+	pmalloc_bulk_info.exit = pmalloc_exit; /* same as for pmalloc */
+	pmalloc_bulk_info.multithread = true;
+	pmalloc_bulk_info.multiops = true;
+	pmalloc_bulk_info.operation = pmalloc_bulk_op;
+	pmalloc_bulk_info.init_worker = pmalloc_bulk_worker_init;
+	pmalloc_bulk_info.free_worker = pmalloc_bulk_worker_fini;
+	pmalloc_bulk_info.measure_time = true;
+	pmalloc_bulk_info.clos = pmalloc_bulk_clo;
+	pmalloc_bulk_info.nclos = ARRAY_SIZE(pmalloc_bulk_clo);
+	pmalloc_bulk_info.opts_size = sizeof(struct prog_args);
+	pmalloc_bulk_info.rm_file = true;
+	pmalloc_bulk_info.allow_poolset = true;
+	REGISTER_BENCHMARK(pmalloc_bulk_info);
+
 	pfree_info.name = "pfree";
 	pfree_info.brief = "Benchmark for internal pfree() "
 			   "operation";
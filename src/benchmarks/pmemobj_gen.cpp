@@ -8,6 +8,7 @@
 
 #include <cassert>
 #include <cerrno>
+#include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -15,9 +16,13 @@
 #include <file.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
 
 #include "benchmark.hpp"
 #include "libpmemobj.h"
+#include "os_thread.h"
 
 #define LAYOUT_NAME "benchmark"
 #define FACTOR 4
@@ -66,6 +71,12 @@ enum type_mode {
  * obj_size	: Size of each allocated object
  *
  * n_ops	: Number of operations
+ *
+ * boot_threads	: Number of threads used to recover and boot the pool
+ *
+ * crash_lanes	: Number of transactions interrupted before each open
+ *
+ * extra_size	: Additional pool size required by the benchmark
  */
 struct pobj_args {
 	char *type_num;
@@ -76,6 +87,9 @@ struct pobj_args {
 	bool one_obj;
 	size_t obj_size;
 	size_t n_ops;
+	unsigned boot_threads;
+	unsigned crash_lanes;
+	size_t extra_size;
 };
 
 /*
@@ -307,7 +321,8 @@ pobj_init(struct benchmark *bench, struct benchmark_args *args)
 	if (bench_priv->n_pools == 1)
 		n_objs *= args->n_threads;
 	psize = PMEMOBJ_MIN_POOL +
-		n_objs * args->dsize * args->n_threads * FACTOR;
+		n_objs * args->dsize * args->n_threads * FACTOR +
+		bench_priv->args_priv->extra_size;
 
 	/* assign type_number determining function */
 	bench_priv->type_mode =
@@ -432,6 +447,7 @@ pobj_direct_init(struct benchmark *bench, struct benchmark_args *args)
 {
 	auto *pa = (struct pobj_args *)args->opts;
 	pa->n_objs = pa->one_obj ? 1 : args->n_ops_per_thread;
+	pa->extra_size = 0;
 	if (pobj_init(bench, args) != 0)
 		return -1;
 	return 0;
@@ -461,6 +477,51 @@ pobj_exit(struct benchmark *bench, struct benchmark_args *args)
 	return 0;
 }
 
+/*
+ * pobj_open_nsecs, pobj_open_nops -- total time spent in pmemobj_open()
+ * and the number of measured opens, reported as an extra value
+ */
+static uint64_t pobj_open_nsecs;
+static uint64_t pobj_open_nops;
+
+/*
+ * pobj_open_init -- special part of pobj_open benchmark initialization.
+ */
+static int
+pobj_open_init(struct benchmark *bench, struct benchmark_args *args)
+{
+	auto *pa = (struct pobj_args *)args->opts;
+#ifdef _WIN32
+	if (pa->crash_lanes != 0) {
+		fprintf(stderr, "crash-lanes is not supported on Windows\n");
+		return -1;
+	}
+#endif
+	/* the crashed transactions snapshot and allocate dsize bytes each */
+	pa->extra_size = pa->crash_lanes * args->dsize * FACTOR;
+
+	long long nthreads = pa->boot_threads;
+	if (pmemobj_ctl_set(nullptr, "heap.boot.nthreads", &nthreads) != 0) {
+		perror("pmemobj_ctl_set");
+		return -1;
+	}
+
+	return pobj_init(bench, args);
+}
+
+/*
+ * pobj_open_exit -- obj_open benchmark exit function
+ */
+static int
+pobj_open_exit(struct benchmark *bench, struct benchmark_args *args)
+{
+	long long nthreads = 0;
+	if (pmemobj_ctl_set(nullptr, "heap.boot.nthreads", &nthreads) != 0)
+		perror("pmemobj_ctl_set");
+
+	return pobj_exit(bench, args);
+}
+
 /*
  * pobj_init_worker -- worker initialization
  */
@@ -530,21 +591,200 @@ pobj_direct_op(struct benchmark *bench, struct operation_info *info)
 #undef OBJ_DIRECT_NITER
 }
 
+#ifndef _WIN32
+/*
+ * pobj_crash -- state shared by the threads of the crashing process
+ */
+struct pobj_crash {
+	PMEMobjpool *pop;
+	PMEMoid root;
+	size_t size;
+	os_mutex_t lock;
+	os_cond_t cond;
+	unsigned nstarted;
+};
+
+/*
+ * pobj_crash_lane -- arguments of a single interrupted transaction
+ */
+struct pobj_crash_lane {
+	struct pobj_crash *crash;
+	unsigned idx;
+};
+
+/*
+ * pobj_crash_worker -- starts a transaction which is never finished
+ */
+static void *
+pobj_crash_worker(void *arg)
+{
+	auto *lane = (struct pobj_crash_lane *)arg;
+	struct pobj_crash *crash = lane->crash;
+	size_t off = lane->idx * crash->size;
+	auto *data = (char *)pmemobj_direct(crash->root);
+
+	if (pmemobj_tx_begin(crash->pop, nullptr, TX_PARAM_NONE) != 0)
+		_exit(1);
+
+	if (pmemobj_tx_add_range(crash->root, off, crash->size) != 0)
+		_exit(1);
+	memset(data + off, (int)lane->idx, crash->size);
+
+	if (OID_IS_NULL(pmemobj_tx_alloc(crash->size, 0)))
+		_exit(1);
+
+	os_mutex_lock(&crash->lock);
+	crash->nstarted++;
+	os_cond_signal(&crash->cond);
+
+	/* the process exits while the transaction is still in progress */
+	while (true)
+		os_cond_wait(&crash->cond, &crash->lock);
+
+	return nullptr;
+}
+
+/*
+ * pobj_crash_child -- leaves the pool with the given number of interrupted
+ * transactions, runs in a separate process
+ */
+static void
+pobj_crash_child(const char *path, unsigned nlanes, size_t size)
+{
+	struct pobj_crash crash;
+	crash.size = size;
+	crash.nstarted = 0;
+	crash.pop = pmemobj_open(path, LAYOUT_NAME);
+	if (crash.pop == nullptr)
+		_exit(1);
+
+	crash.root = pmemobj_root(crash.pop, nlanes * size);
+	if (OID_IS_NULL(crash.root))
+		_exit(1);
+
+	if (os_mutex_init(&crash.lock) != 0 || os_cond_init(&crash.cond) != 0)
+		_exit(1);
+
+	auto *lanes = (struct pobj_crash_lane *)malloc(
+		nlanes * sizeof(struct pobj_crash_lane));
+	auto *threads = (os_thread_t *)malloc(nlanes * sizeof(os_thread_t));
+	if (lanes == nullptr || threads == nullptr)
+		_exit(1);
+
+	for (unsigned i = 0; i < nlanes; ++i) {
+		lanes[i].crash = &crash;
+		lanes[i].idx = i;
+		if (os_thread_create(&threads[i], nullptr, pobj_crash_worker,
+				     &lanes[i]) != 0)
+			_exit(1);
+	}
+
+	os_mutex_lock(&crash.lock);
+	while (crash.nstarted != nlanes)
+		os_cond_wait(&crash.cond, &crash.lock);
+
+	_exit(0);
+}
+
+/*
+ * pobj_crash_pool -- closes the pool and reopens it in a child process which
+ * is terminated in the middle of the transactions
+ */
+static int
+pobj_crash_pool(struct pobj_bench *bench_priv, size_t idx, size_t size)
+{
+	pmemobj_close(bench_priv->pop[idx]);
+	bench_priv->pop[idx] = nullptr;
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return -1;
+	}
+
+	if (pid == 0)
+		pobj_crash_child(bench_priv->sets[idx],
+				 bench_priv->args_priv->crash_lanes, size);
+
+	int status;
+	if (waitpid(pid, &status, 0) != pid) {
+		perror("waitpid");
+		return -1;
+	}
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "crashing process failed\n");
+		return -1;
+	}
+
+	return 0;
+}
+#endif
+
 /*
  * pobj_open_op -- main operations of the obj_open benchmark.
+ *
+ * If the crash-lanes option is set, the pool is left with interrupted
+ * transactions before being reopened. Only the time of pmemobj_open()
+ * is reported as the open latency.
  */
 static int
 pobj_open_op(struct benchmark *bench, struct operation_info *info)
 {
 	auto *bench_priv = (struct pobj_bench *)pmembench_get_priv(bench);
 	size_t idx = bench_priv->pool(info->worker->index);
+#ifndef _WIN32
+	if (bench_priv->args_priv->crash_lanes != 0) {
+		if (pobj_crash_pool(bench_priv, idx,
+				    bench_priv->args_priv->obj_size) != 0)
+			return -1;
+	} else {
+		pmemobj_close(bench_priv->pop[idx]);
+	}
+#else
 	pmemobj_close(bench_priv->pop[idx]);
+#endif
+
+	benchmark_time_t start, stop, diff;
+	benchmark_time_get(&start);
 	bench_priv->pop[idx] = pmemobj_open(bench_priv->sets[idx], LAYOUT_NAME);
+	benchmark_time_get(&stop);
 	if (bench_priv->pop[idx] == nullptr)
 		return -1;
+
+	benchmark_time_diff(&diff, &start, &stop);
+	util_fetch_and_add64(&pobj_open_nsecs,
+			     benchmark_time_get_nsecs(&diff));
+	util_fetch_and_add64(&pobj_open_nops, 1);
+
 	return 0;
 }
 
+/*
+ * pobj_open_print_extra_headers -- print additional headers of the
+ * obj_open benchmark
+ */
+static void
+pobj_open_print_extra_headers()
+{
+	printf(";open-avg[nsec]");
+}
+
+/*
+ * pobj_open_print_extra_values -- print the average pmemobj_open() time
+ */
+static void
+pobj_open_print_extra_values(struct benchmark *bench,
+			     struct benchmark_args *args,
+			     struct total_results *res)
+{
+	uint64_t nops = pobj_open_nops;
+	printf(";%" PRIu64, nops == 0 ? 0 : pobj_open_nsecs / nops);
+
+	pobj_open_nsecs = 0;
+	pobj_open_nops = 0;
+}
+
 /*
  * pobj_free_worker -- worker exit function
  */
@@ -566,7 +806,7 @@ static struct benchmark_info obj_direct;
 /* Array defining common command line arguments. */
 static struct benchmark_clo pobj_direct_clo[4];
 
-static struct benchmark_clo pobj_open_clo[3];
+static struct benchmark_clo pobj_open_clo[5];
 
 CONSTRUCTOR(pmemobj_gen_constructor)
 void
@@ -635,15 +875,43 @@ pmemobj_gen_constructor(void)
 	pobj_open_clo[2].type_uint.min = 1;
 	pobj_open_clo[2].type_uint.max = UINT_MAX;
 
+	pobj_open_clo[3].opt_short = 'b';
+	pobj_open_clo[3].opt_long = "boot-threads";
+	pobj_open_clo[3].type = CLO_TYPE_UINT;
+	pobj_open_clo[3].descr = "Number of threads recovering and booting "
+				 "the pool (heap.boot.nthreads)";
+	pobj_open_clo[3].off = clo_field_offset(struct pobj_args, boot_threads);
+	pobj_open_clo[3].def = "0";
+	pobj_open_clo[3].type_uint.size =
+		clo_field_size(struct pobj_args, boot_threads);
+	pobj_open_clo[3].type_uint.base = CLO_INT_BASE_DEC;
+	pobj_open_clo[3].type_uint.min = 0;
+	pobj_open_clo[3].type_uint.max = 1024;
+
+	pobj_open_clo[4].opt_short = 'c';
+	pobj_open_clo[4].opt_long = "crash-lanes";
+	pobj_open_clo[4].type = CLO_TYPE_UINT;
+	pobj_open_clo[4].descr = "Number of transactions interrupted by "
+				 "a crash before each open";
+	pobj_open_clo[4].off = clo_field_offset(struct pobj_args, crash_lanes);
+	pobj_open_clo[4].def = "0";
+	pobj_open_clo[4].type_uint.size =
+		clo_field_size(struct pobj_args, crash_lanes);
+	pobj_open_clo[4].type_uint.base = CLO_INT_BASE_DEC;
+	pobj_open_clo[4].type_uint.min = 0;
+	pobj_open_clo[4].type_uint.max = 1024;
+
 	obj_open.name = "obj_open";
 	obj_open.brief = "pmemobj_open() benchmark";
-	obj_open.init = pobj_init;
-	obj_open.exit = pobj_exit;
+	obj_open.init = pobj_open_init;
+	obj_open.exit = pobj_open_exit;
 	obj_open.multithread = true;
 	obj_open.multiops = true;
 	obj_open.init_worker = pobj_init_worker;
 	obj_open.free_worker = pobj_free_worker;
 	obj_open.operation = pobj_open_op;
+	obj_open.print_extra_headers = pobj_open_print_extra_headers;
+	obj_open.print_extra_values = pobj_open_print_extra_values;
 	obj_open.measure_time = true;
 	obj_open.clos = pobj_open_clo;
 	obj_open.nclos = ARRAY_SIZE(pobj_open_clo);
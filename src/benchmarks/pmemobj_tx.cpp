@@ -158,6 +158,8 @@ struct obj_tx_args {
 	size_t obj_size;    /* size of each allocated object */
 	size_t n_ops;	    /* number of operations */
 	int parse_mode;	    /* type of parsing function */
+	unsigned group_commit; /* group commit window in microseconds */
+	char *checksum;	    /* checksum of the logs */
 };
 
 /*
@@ -1030,6 +1032,38 @@ obj_tx_init(struct benchmark *bench, struct benchmark_args *args)
 		goto free_all;
 	}
 
+	if (obj_bench.obj_args->group_commit != 0) {
+		long long window = obj_bench.obj_args->group_commit;
+		if (pmemobj_ctl_set(obj_bench.pop, "tx.group_commit.window",
+				    &window) != 0) {
+			perror("pmemobj_ctl_set");
+			pmemobj_close(obj_bench.pop);
+			goto free_all;
+		}
+	}
+
+	if (strcmp(obj_bench.obj_args->checksum, "auto") != 0) {
+		int crc32c;
+		if (strcmp(obj_bench.obj_args->checksum, "crc32c") == 0) {
+			crc32c = 1;
+		} else if (strcmp(obj_bench.obj_args->checksum,
+				  "fletcher64") == 0) {
+			crc32c = 0;
+		} else {
+			fprintf(stderr, "unknown checksum: %s\n",
+				obj_bench.obj_args->checksum);
+			pmemobj_close(obj_bench.pop);
+			goto free_all;
+		}
+
+		if (pmemobj_ctl_set(obj_bench.pop, "tx.checksum.crc32c",
+				    &crc32c) != 0) {
+			perror("pmemobj_ctl_set");
+			pmemobj_close(obj_bench.pop);
+			goto free_all;
+		}
+	}
+
 	return 0;
 free_all:
 	free(obj_bench.sizes);
@@ -1069,7 +1103,7 @@ obj_tx_realloc_exit(struct benchmark *bench, struct benchmark_args *args)
 }
 
 /* Array defining common command line arguments. */
-static struct benchmark_clo obj_tx_clo[8];
+static struct benchmark_clo obj_tx_clo[10];
 
 static struct benchmark_info obj_tx_alloc;
 static struct benchmark_info obj_tx_free;
@@ -1094,71 +1128,90 @@ pmemobj_tx_constructor(void)
 	obj_tx_clo[1].off = clo_field_offset(struct obj_tx_args, operation);
 	obj_tx_clo[1].type = CLO_TYPE_STR;
 
-	obj_tx_clo[2].opt_short = 'm';
-	obj_tx_clo[2].opt_long = "min-size";
+	obj_tx_clo[2].opt_short = 'g';
+	obj_tx_clo[2].opt_long = "group-commit";
 	obj_tx_clo[2].type = CLO_TYPE_UINT;
-	obj_tx_clo[2].descr = "Minimum allocation size";
-	obj_tx_clo[2].off = clo_field_offset(struct obj_tx_args, min_size);
+	obj_tx_clo[2].descr = "Group commit window in microseconds";
+	obj_tx_clo[2].off = clo_field_offset(struct obj_tx_args, group_commit);
 	obj_tx_clo[2].def = "0";
 	obj_tx_clo[2].type_uint.size =
-		clo_field_size(struct obj_tx_args, min_size);
-	obj_tx_clo[2].type_uint.base = CLO_INT_BASE_DEC | CLO_INT_BASE_HEX;
+		clo_field_size(struct obj_tx_args, group_commit);
+	obj_tx_clo[2].type_uint.base = CLO_INT_BASE_DEC;
 	obj_tx_clo[2].type_uint.min = 0;
-	obj_tx_clo[2].type_uint.max = UINT_MAX;
-	/*
-	 * nclos field in benchmark_info structures is decremented to make this
-	 * options available only for obj_tx_alloc, obj_tx_free and
-	 * obj_tx_realloc benchmarks.
-	 */
-	obj_tx_clo[3].opt_short = 'L';
-	obj_tx_clo[3].opt_long = "lib";
-	obj_tx_clo[3].descr = "Type of library";
-	obj_tx_clo[3].def = "tx";
-	obj_tx_clo[3].off = clo_field_offset(struct obj_tx_args, lib);
+	obj_tx_clo[2].type_uint.max = 1000000;
+
+	obj_tx_clo[3].opt_short = 'C';
+	obj_tx_clo[3].opt_long = "checksum";
+	obj_tx_clo[3].descr = "Checksum of the logs - auto, crc32c, fletcher64";
+	obj_tx_clo[3].def = "auto";
+	obj_tx_clo[3].off = clo_field_offset(struct obj_tx_args, checksum);
 	obj_tx_clo[3].type = CLO_TYPE_STR;
 
-	obj_tx_clo[4].opt_short = 'N';
-	obj_tx_clo[4].opt_long = "nestings";
+	obj_tx_clo[4].opt_short = 'm';
+	obj_tx_clo[4].opt_long = "min-size";
 	obj_tx_clo[4].type = CLO_TYPE_UINT;
-	obj_tx_clo[4].descr = "Number of nested transactions";
-	obj_tx_clo[4].off = clo_field_offset(struct obj_tx_args, nested);
+	obj_tx_clo[4].descr = "Minimum allocation size";
+	obj_tx_clo[4].off = clo_field_offset(struct obj_tx_args, min_size);
 	obj_tx_clo[4].def = "0";
 	obj_tx_clo[4].type_uint.size =
-		clo_field_size(struct obj_tx_args, nested);
+		clo_field_size(struct obj_tx_args, min_size);
 	obj_tx_clo[4].type_uint.base = CLO_INT_BASE_DEC | CLO_INT_BASE_HEX;
 	obj_tx_clo[4].type_uint.min = 0;
-	obj_tx_clo[4].type_uint.max = MAX_OPS;
-
-	obj_tx_clo[5].opt_short = 'r';
-	obj_tx_clo[5].opt_long = "min-rsize";
-	obj_tx_clo[5].type = CLO_TYPE_UINT;
-	obj_tx_clo[5].descr = "Minimum reallocation size";
-	obj_tx_clo[5].off = clo_field_offset(struct obj_tx_args, min_rsize);
-	obj_tx_clo[5].def = "0";
-	obj_tx_clo[5].type_uint.size =
-		clo_field_size(struct obj_tx_args, min_rsize);
-	obj_tx_clo[5].type_uint.base = CLO_INT_BASE_DEC | CLO_INT_BASE_HEX;
-	obj_tx_clo[5].type_uint.min = 0;
-	obj_tx_clo[5].type_uint.max = UINT_MAX;
-
-	obj_tx_clo[6].opt_short = 'R';
-	obj_tx_clo[6].opt_long = "realloc-size";
+	obj_tx_clo[4].type_uint.max = UINT_MAX;
+	/*
+	 * nclos field in benchmark_info structures is decremented to make this
+	 * options available only for obj_tx_alloc, obj_tx_free and
+	 * obj_tx_realloc benchmarks.
+	 */
+	obj_tx_clo[5].opt_short = 'L';
+	obj_tx_clo[5].opt_long = "lib";
+	obj_tx_clo[5].descr = "Type of library";
+	obj_tx_clo[5].def = "tx";
+	obj_tx_clo[5].off = clo_field_offset(struct obj_tx_args, lib);
+	obj_tx_clo[5].type = CLO_TYPE_STR;
+
+	obj_tx_clo[6].opt_short = 'N';
+	obj_tx_clo[6].opt_long = "nestings";
 	obj_tx_clo[6].type = CLO_TYPE_UINT;
-	obj_tx_clo[6].descr = "Reallocation size";
-	obj_tx_clo[6].off = clo_field_offset(struct obj_tx_args, rsize);
-	obj_tx_clo[6].def = "1";
+	obj_tx_clo[6].descr = "Number of nested transactions";
+	obj_tx_clo[6].off = clo_field_offset(struct obj_tx_args, nested);
+	obj_tx_clo[6].def = "0";
 	obj_tx_clo[6].type_uint.size =
-		clo_field_size(struct obj_tx_args, rsize);
+		clo_field_size(struct obj_tx_args, nested);
 	obj_tx_clo[6].type_uint.base = CLO_INT_BASE_DEC | CLO_INT_BASE_HEX;
-	obj_tx_clo[6].type_uint.min = 1;
-	obj_tx_clo[6].type_uint.max = ULONG_MAX;
+	obj_tx_clo[6].type_uint.min = 0;
+	obj_tx_clo[6].type_uint.max = MAX_OPS;
+
+	obj_tx_clo[7].opt_short = 'r';
+	obj_tx_clo[7].opt_long = "min-rsize";
+	obj_tx_clo[7].type = CLO_TYPE_UINT;
+	obj_tx_clo[7].descr = "Minimum reallocation size";
+	obj_tx_clo[7].off = clo_field_offset(struct obj_tx_args, min_rsize);
+	obj_tx_clo[7].def = "0";
+	obj_tx_clo[7].type_uint.size =
+		clo_field_size(struct obj_tx_args, min_rsize);
+	obj_tx_clo[7].type_uint.base = CLO_INT_BASE_DEC | CLO_INT_BASE_HEX;
+	obj_tx_clo[7].type_uint.min = 0;
+	obj_tx_clo[7].type_uint.max = UINT_MAX;
+
+	obj_tx_clo[8].opt_short = 'R';
+	obj_tx_clo[8].opt_long = "realloc-size";
+	obj_tx_clo[8].type = CLO_TYPE_UINT;
+	obj_tx_clo[8].descr = "Reallocation size";
+	obj_tx_clo[8].off = clo_field_offset(struct obj_tx_args, rsize);
+	obj_tx_clo[8].def = "1";
+	obj_tx_clo[8].type_uint.size =
+		clo_field_size(struct obj_tx_args, rsize);
+	obj_tx_clo[8].type_uint.base = CLO_INT_BASE_DEC | CLO_INT_BASE_HEX;
+	obj_tx_clo[8].type_uint.min = 1;
+	obj_tx_clo[8].type_uint.max = ULONG_MAX;
 
-	obj_tx_clo[7].opt_short = 'c';
-	obj_tx_clo[7].opt_long = "changed-type";
-	obj_tx_clo[7].descr = "Use another type number in "
+	obj_tx_clo[9].opt_short = 'c';
+	obj_tx_clo[9].opt_long = "changed-type";
+	obj_tx_clo[9].descr = "Use another type number in "
 			      "reallocation than in allocation";
-	obj_tx_clo[7].type = CLO_TYPE_FLAG;
-	obj_tx_clo[7].off = clo_field_offset(struct obj_tx_args, change_type);
+	obj_tx_clo[9].type = CLO_TYPE_FLAG;
+	obj_tx_clo[9].off = clo_field_offset(struct obj_tx_args, change_type);
 
 	obj_tx_alloc.name = "obj_tx_alloc";
 	obj_tx_alloc.brief = "pmemobj_tx_alloc() benchmark";
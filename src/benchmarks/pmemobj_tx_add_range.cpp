@@ -10,6 +10,7 @@
 #include <cstddef>
 #include <cstdio>
 #include <cstdlib>
+#include <cinttypes>
 #include <cstring>
 #include <fcntl.h>
 #include <sys/file.h>
@@ -62,6 +63,14 @@ struct obj_bench {
 	rng_t rng;		   /* PRNG */
 };
 
+/*
+ * cache lines covered by the ranges and cache lines actually flushed at
+ * commit, summed over all repeats of the benchmark
+ */
+static uint64_t tx_range_lines;
+static uint64_t tx_flushed_lines;
+static uint64_t tx_ntxs;
+
 /*
  * shuffle_ranges -- randomly shuffles elements in an array
  * to avoid sequential pattern in the transaction loop
@@ -153,6 +162,7 @@ tx_add_range_init(struct benchmark *bench, struct benchmark_args *args)
 	ob->nallocs = (args->dsize * bargs->nranges / MAX_ALLOC_SIZE) + 1;
 
 	size_t pool_size;
+	enum pobj_stats_enabled stats_enabled = POBJ_STATS_ENABLED_TRANSIENT;
 
 	if (args->is_poolset || type == TYPE_DEVDAX)
 		pool_size = 0;
@@ -169,6 +179,11 @@ tx_add_range_init(struct benchmark *bench, struct benchmark_args *args)
 		goto err;
 	}
 
+	if (pmemobj_ctl_set(ob->pop, "stats.enabled", &stats_enabled) != 0) {
+		perror("pmemobj_ctl_set");
+		goto err_pop_close;
+	}
+
 	ob->nranges = bargs->nranges;
 	ob->obj_size = args->dsize;
 	ob->shuffle_objs = bargs->shuffle_objs;
@@ -222,6 +237,13 @@ tx_add_range_exit(struct benchmark *bench, struct benchmark_args *args)
 {
 	auto *ob = (struct obj_bench *)pmembench_get_priv(bench);
 
+	uint64_t lines;
+	if (pmemobj_ctl_get(ob->pop, "stats.tx.range_lines", &lines) == 0)
+		tx_range_lines += lines;
+	if (pmemobj_ctl_get(ob->pop, "stats.tx.flushed_lines", &lines) == 0)
+		tx_flushed_lines += lines;
+	tx_ntxs += args->n_ops_per_thread * args->n_threads;
+
 	pmemobj_close(ob->pop);
 	free(ob->ranges);
 	free(ob);
@@ -229,6 +251,34 @@ tx_add_range_exit(struct benchmark *bench, struct benchmark_args *args)
 	return 0;
 }
 
+/*
+ * tx_add_range_print_extra_headers -- print additional headers of the
+ * pmemobj_tx_add_range benchmark
+ */
+static void
+tx_add_range_print_extra_headers()
+{
+	printf(";range-lines-per-tx;flushed-lines-per-tx");
+}
+
+/*
+ * tx_add_range_print_extra_values -- print the average number of cache lines
+ * covered by the ranges of a transaction and flushed at its commit
+ */
+static void
+tx_add_range_print_extra_values(struct benchmark *bench,
+				struct benchmark_args *args,
+				struct total_results *res)
+{
+	uint64_t ntxs = tx_ntxs == 0 ? 1 : tx_ntxs;
+	printf(";%" PRIu64 ";%" PRIu64, tx_range_lines / ntxs,
+	       tx_flushed_lines / ntxs);
+
+	tx_range_lines = 0;
+	tx_flushed_lines = 0;
+	tx_ntxs = 0;
+}
+
 static struct benchmark_clo tx_add_range_clo[2];
 
 /* Stores information about benchmark. */
@@ -268,6 +318,9 @@ tx_add_range_constructor(void)
 	tx_add_range_info.multithread = true;
 	tx_add_range_info.multiops = true;
 	tx_add_range_info.operation = tx_add_range_op;
+	tx_add_range_info.print_extra_headers =
+		tx_add_range_print_extra_headers;
+	tx_add_range_info.print_extra_values = tx_add_range_print_extra_values;
 	tx_add_range_info.measure_time = true;
 	tx_add_range_info.clos = tx_add_range_clo;
 	tx_add_range_info.nclos = ARRAY_SIZE(tx_add_range_clo);
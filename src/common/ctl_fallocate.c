@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2018-2019, Intel Corporation */
+/* Copyright 2018-2020, Intel Corporation */
 
 /*
  * ctl_fallocate.c -- implementation of the fallocate CTL namespace
@@ -33,8 +33,31 @@ CTL_WRITE_HANDLER(at_create)(void *ctx, enum ctl_query_source source,
 
 static struct ctl_argument CTL_ARG(at_create) = CTL_ARG_BOOLEAN;
 
+static int
+CTL_READ_HANDLER(punch_hole)(void *ctx, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	int *arg_out = arg;
+	*arg_out = Fallocate_punch_hole;
+
+	return 0;
+}
+
+static int
+CTL_WRITE_HANDLER(punch_hole)(void *ctx, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	int arg_in = *(int *)arg;
+	Fallocate_punch_hole = arg_in;
+
+	return 0;
+}
+
+static struct ctl_argument CTL_ARG(punch_hole) = CTL_ARG_BOOLEAN;
+
 static const struct ctl_node CTL_NODE(fallocate)[] = {
 	CTL_LEAF_RW(at_create),
+	CTL_LEAF_RW(punch_hole),
 
 	CTL_NODE_END
 };
@@ -100,6 +100,7 @@ void util_mmap_fini(void);
 int util_range_ro(void *addr, size_t len);
 int util_range_rw(void *addr, size_t len);
 int util_range_none(void *addr, size_t len);
+int util_range_punch_hole(void *addr, size_t len);
 
 char *util_map_hint_unused(void *minaddr, size_t len, size_t align);
 char *util_map_hint(size_t len, size_t req_align);
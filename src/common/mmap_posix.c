@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2014-2018, Intel Corporation */
+/* Copyright 2014-2020, Intel Corporation */
 
 /*
  * mmap_posix.c -- memory-mapped files for Posix
@@ -191,3 +191,30 @@ util_map_sync(void *addr, size_t len, int proto, int flags, int fd,
 	/* other error */
 	return MAP_FAILED;
 }
+
+/*
+ * util_range_punch_hole -- deallocates the file blocks backing the given
+ *	range of a shared file mapping
+ *
+ * The range reads back as zeroes afterwards and the blocks are allocated
+ * again by the file system when the range is written to.
+ */
+int
+util_range_punch_hole(void *addr, size_t len)
+{
+	LOG(3, "addr %p len %zu", addr, len);
+
+	ASSERTeq((uintptr_t)addr & (Pagesize - 1), 0);
+	ASSERTeq(len & (Pagesize - 1), 0);
+
+#ifdef MADV_REMOVE
+	int ret = os_madvise(addr, len, MADV_REMOVE);
+	if (ret < 0)
+		LOG(2, "!madvise: MADV_REMOVE");
+
+	return ret;
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
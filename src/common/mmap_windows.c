@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2015-2018, Intel Corporation */
+/* Copyright 2015-2020, Intel Corporation */
 /*
  * Copyright (c) 2015-2017, Microsoft Corporation. All rights reserved.
  *
@@ -148,3 +148,16 @@ util_map_sync(void *addr, size_t len, int proto, int flags, int fd,
 
 	return mmap(addr, len, proto, flags, fd, offset);
 }
+
+/*
+ * util_range_punch_hole -- deallocates the file blocks backing the given
+ *	range of a file mapping, not supported on Windows
+ */
+int
+util_range_punch_hole(void *addr, size_t len)
+{
+	LOG(3, "addr %p len %zu", addr, len);
+
+	errno = ENOTSUP;
+	return -1;
+}
@@ -188,9 +188,11 @@ static const features_t features_zero =
 #define POOL_FEAT_SINGLEHDR	0x0001U	/* pool header only in the first part */
 #define POOL_FEAT_CKSUM_2K	0x0002U	/* only first 2K of hdr checksummed */
 #define POOL_FEAT_SDS		0x0004U	/* check shutdown state */
+#define POOL_FEAT_ULOG_CRC32C	0x0008U	/* logs may be checksummed w/ CRC32C */
 
 #define POOL_FEAT_INCOMPAT_ALL \
-	(POOL_FEAT_SINGLEHDR | POOL_FEAT_CKSUM_2K | POOL_FEAT_SDS)
+	(POOL_FEAT_SINGLEHDR | POOL_FEAT_CKSUM_2K | POOL_FEAT_SDS | \
+	POOL_FEAT_ULOG_CRC32C)
 
 /*
  * incompat features effective values (if applicable)
@@ -205,7 +207,8 @@ static const features_t features_zero =
 	(POOL_FEAT_CHECK_BAD_BLOCKS)
 
 #define POOL_FEAT_INCOMPAT_VALID \
-	(POOL_FEAT_SINGLEHDR | POOL_FEAT_CKSUM_2K | POOL_E_FEAT_SDS)
+	(POOL_FEAT_SINGLEHDR | POOL_FEAT_CKSUM_2K | POOL_E_FEAT_SDS | \
+	POOL_FEAT_ULOG_CRC32C)
 
 #if defined(_WIN32) || NDCTL_ENABLED
 #define POOL_FEAT_INCOMPAT_DEFAULT \
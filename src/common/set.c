@@ -105,6 +105,7 @@ int Prefault_at_open = 0;
 int Prefault_at_create = 0;
 int SDS_at_create = POOL_FEAT_INCOMPAT_DEFAULT & POOL_E_FEAT_SDS ? 1 : 0;
 int Fallocate_at_create = 1;
+int Fallocate_punch_hole = 0;
 int COW_at_open = 0;
 
 /* list of pool set option names and flags */
@@ -3745,6 +3746,79 @@ util_pool_has_device_dax(struct pool_set *set)
 	return 0;
 }
 
+/*
+ * util_pool_feature_enable -- enables the feature in the headers of all parts
+ *	of the open pool set
+ *
+ * The headers are not kept mapped once the pool set is opened, so each part is
+ * reopened to update its header. Pool sets with remote replicas are not
+ * supported.
+ */
+int
+util_pool_feature_enable(struct pool_set *set, features_t feature)
+{
+	LOG(3, "set %p", set);
+
+	if (set->remote) {
+		ERR("poolsets with remote replicas are not supported");
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	for (unsigned r = 0; r < set->nreplicas; r++) {
+		struct pool_replica *rep = set->replica[r];
+
+		for (unsigned p = 0; p < rep->nhdrs; p++) {
+			struct pool_set_part *part = &rep->part[p];
+
+			/*
+			 * The files might be held open, see fdclose. They are
+			 * still locked by the mappings of the pool, so they
+			 * are reopened without taking the lock.
+			 */
+			int opened = part->fd == -1;
+			if (opened &&
+			    (part->fd = os_open(part->path, O_RDWR)) < 0) {
+				ERR("!open \"%s\"", part->path);
+				part->fd = -1;
+				return -1;
+			}
+
+			if (util_map_hdr(part, MAP_SHARED, 0) != 0) {
+				LOG(1, "header mapping failed -- \"%s\"",
+					part->path);
+				if (opened)
+					util_part_fdclose(part);
+				return -1;
+			}
+
+			struct pool_hdr *hdrp = part->hdr;
+			struct pool_hdr hdr;
+			memcpy(&hdr, hdrp, sizeof(hdr));
+			util_convert2h_hdr_nocheck(&hdr);
+
+			if (!util_feature_is_set(hdr.features, feature)) {
+				util_feature_enable(&hdr.features, feature);
+
+				size_t skip_off = POOL_HDR_CSUM_END_OFF(&hdr);
+				util_convert2le_hdr(&hdr);
+				util_checksum(&hdr, sizeof(hdr), &hdr.checksum,
+					1, skip_off);
+
+				memcpy(hdrp, &hdr, sizeof(hdr));
+				util_persist_auto(part->is_dev_dax, hdrp,
+					sizeof(*hdrp));
+			}
+
+			util_unmap_hdr(part);
+			if (opened)
+				util_part_fdclose(part);
+		}
+	}
+
+	return 0;
+}
+
 /*
  * util_pool_open_nocheck -- open a memory pool (set or a single file)
  *
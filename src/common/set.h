@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2014-2019, Intel Corporation */
+/* Copyright 2014-2020, Intel Corporation */
 /*
  * Copyright (c) 2016, Microsoft Corporation. All rights reserved.
  *
@@ -333,6 +333,7 @@ extern int Prefault_at_open;
 extern int Prefault_at_create;
 extern int SDS_at_create;
 extern int Fallocate_at_create;
+extern int Fallocate_punch_hole;
 extern int COW_at_open;
 
 int util_poolset_parse(struct pool_set **setp, const char *path, int fd);
@@ -388,6 +389,7 @@ int util_map_hdr(struct pool_set_part *part, int flags, int rdonly);
 void util_unmap_hdr(struct pool_set_part *part);
 
 int util_pool_has_device_dax(struct pool_set *set);
+int util_pool_feature_enable(struct pool_set *set, features_t feature);
 
 int util_pool_open_nocheck(struct pool_set *set, unsigned flags);
 int util_pool_open(struct pool_set **setp, const char *path, size_t minpartsize,
@@ -99,7 +99,8 @@ VECQ_INSERT(vec, element))
 #define VECQ_FOREACH(el, vec)\
 for (size_t _vec_i = 0;\
 	_vec_i < VECQ_SIZE(vec) &&\
-	(((el) = (vec)->buffer[_vec_i & ((vec)->capacity - 1)]), 1);\
+	(((el) = (vec)->buffer[((vec)->front + _vec_i) &\
+		((vec)->capacity - 1)]), 1);\
 	++_vec_i)
 
 #define VECQ_FOREACH_REVERSE(el, vec)\
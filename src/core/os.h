@@ -99,6 +99,10 @@ int os_setenv(const char *name, const char *value, int overwrite);
 char *os_getenv(const char *name);
 const char *os_strsignal(int sig);
 int os_execv(const char *path, char *const argv[]);
+int os_getcpu(unsigned *cpu, unsigned *node);
+int os_sched_getcpu(void);
+int os_get_numa_node(const void *addr, unsigned *node);
+unsigned os_backtrace(void **frames, unsigned nframes);
 
 /*
  * XXX: missing APis (used in ut_file.c)
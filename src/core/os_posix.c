@@ -16,11 +16,16 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>
+#include <sys/syscall.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <errno.h>
+#ifdef __GLIBC__
+#include <execinfo.h>
+#endif
 #include "util.h"
 #include "out.h"
 #include "os.h"
@@ -351,3 +356,73 @@ os_execv(const char *path, char *const argv[])
 {
 	return execv(path, argv);
 }
+
+/*
+ * os_getcpu -- returns the cpu and the NUMA node the calling thread is
+ *	running on
+ */
+int
+os_getcpu(unsigned *cpu, unsigned *node)
+{
+#ifdef SYS_getcpu
+	return (int)syscall(SYS_getcpu, cpu, node, NULL);
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+/*
+ * os_sched_getcpu -- returns the cpu the calling thread is running on, without
+ *	entering the kernel where possible
+ */
+int
+os_sched_getcpu(void)
+{
+#ifdef __linux__
+	return sched_getcpu();
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+/*
+ * os_get_numa_node -- returns the NUMA node backing the page of the given
+ *	address
+ */
+int
+os_get_numa_node(const void *addr, unsigned *node)
+{
+#ifdef SYS_get_mempolicy
+	/* MPOL_F_NODE | MPOL_F_ADDR, not to depend on numaif.h */
+	unsigned long flags = (1 << 0) | (1 << 1);
+	int mode;
+
+	if (syscall(SYS_get_mempolicy, &mode, NULL, 0, addr, flags) != 0)
+		return -1;
+
+	*node = (unsigned)mode;
+
+	return 0;
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+/*
+ * os_backtrace -- stores up to nframes return addresses of the calling
+ *	thread stack, innermost first, and returns their number
+ */
+unsigned
+os_backtrace(void **frames, unsigned nframes)
+{
+#ifdef __GLIBC__
+	int n = backtrace(frames, (int)nframes);
+
+	return n < 0 ? 0 : (unsigned)n;
+#else
+	return 0;
+#endif
+}
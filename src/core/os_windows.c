@@ -678,3 +678,61 @@ wargv_alloc_failed:
 
 	return ret;
 }
+
+/*
+ * os_getcpu -- returns the cpu and the NUMA node the calling thread is
+ *	running on
+ */
+int
+os_getcpu(unsigned *cpu, unsigned *node)
+{
+	PROCESSOR_NUMBER proc;
+	USHORT proc_node;
+
+	GetCurrentProcessorNumberEx(&proc);
+	if (!GetNumaProcessorNodeEx(&proc, &proc_node)) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	*cpu = (unsigned)proc.Group * 64 + proc.Number;
+	*node = proc_node;
+
+	return 0;
+}
+
+/*
+ * os_sched_getcpu -- returns the cpu the calling thread is running on
+ */
+int
+os_sched_getcpu(void)
+{
+	PROCESSOR_NUMBER proc;
+	GetCurrentProcessorNumberEx(&proc);
+
+	return (int)proc.Group * 64 + proc.Number;
+}
+
+/*
+ * os_get_numa_node -- returns the NUMA node backing the page of the given
+ *	address
+ */
+int
+os_get_numa_node(const void *addr, unsigned *node)
+{
+	UNREFERENCED_PARAMETER(addr);
+	UNREFERENCED_PARAMETER(node);
+
+	errno = ENOTSUP;
+	return -1;
+}
+
+/*
+ * os_backtrace -- stores up to nframes return addresses of the calling
+ *	thread stack, innermost first, and returns their number
+ */
+unsigned
+os_backtrace(void **frames, unsigned nframes)
+{
+	return CaptureStackBackTrace(0, (DWORD)nframes, frames, NULL);
+}
@@ -210,6 +210,267 @@ util_checksum_seq(const void *addr, size_t len, uint64_t csum)
 	return (uint64_t)hi32 << 32 | lo32;
 }
 
+/* bit-reflected CRC32C (Castagnoli) polynomial */
+#define CRC32C_POLY 0x82F63B78U
+
+/* block sizes of the three-way parallel hardware CRC32C, powers of two */
+#define CRC32C_LONG 8192
+#define CRC32C_SHORT 256
+
+static uint32_t Crc32c_table[256];
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CRC32C_TARGET
+#else
+#include <cpuid.h>
+#define CRC32C_TARGET __attribute__((target("sse4.2")))
+#endif
+#include <nmmintrin.h>
+
+#define CRC32C_HW_SUPPORTED 1
+
+static int Crc32c_hw;
+
+/* operators which append CRC32C_LONG and CRC32C_SHORT zero bytes to a crc */
+static uint32_t Crc32c_long[4][256];
+static uint32_t Crc32c_short[4][256];
+
+/*
+ * crc32c_gf2_times -- (internal) multiplies a matrix by a vector over GF(2)
+ */
+static uint32_t
+crc32c_gf2_times(const uint32_t *mat, uint32_t vec)
+{
+	uint32_t sum = 0;
+	while (vec) {
+		if (vec & 1)
+			sum ^= *mat;
+		vec >>= 1;
+		mat++;
+	}
+
+	return sum;
+}
+
+/*
+ * crc32c_gf2_square -- (internal) multiplies a 32x32 matrix by itself over
+ *	GF(2)
+ */
+static void
+crc32c_gf2_square(uint32_t *square, const uint32_t *mat)
+{
+	for (unsigned n = 0; n < 32; n++)
+		square[n] = crc32c_gf2_times(mat, mat[n]);
+}
+
+/*
+ * crc32c_zeros -- (internal) builds the tables which append len zero bytes
+ *	to a crc, one byte of the crc at a time; len must be a power of two
+ */
+static void
+crc32c_zeros(uint32_t zeros[4][256], size_t len)
+{
+	uint32_t even[32];
+	uint32_t odd[32];
+
+	/* operator for one zero bit */
+	odd[0] = CRC32C_POLY;
+	for (unsigned n = 1; n < 32; n++)
+		odd[n] = 1U << (n - 1);
+
+	/* operators for two and four zero bits */
+	crc32c_gf2_square(even, odd);
+	crc32c_gf2_square(odd, even);
+
+	/* square until the operator for len zero bytes is in even */
+	uint32_t *op = even;
+	do {
+		crc32c_gf2_square(even, odd);
+		op = even;
+		len >>= 1;
+		if (len == 0)
+			break;
+		crc32c_gf2_square(odd, even);
+		op = odd;
+		len >>= 1;
+	} while (len);
+
+	for (uint32_t n = 0; n < 256; n++) {
+		zeros[0][n] = crc32c_gf2_times(op, n);
+		zeros[1][n] = crc32c_gf2_times(op, n << 8);
+		zeros[2][n] = crc32c_gf2_times(op, n << 16);
+		zeros[3][n] = crc32c_gf2_times(op, n << 24);
+	}
+}
+
+/*
+ * crc32c_shift -- (internal) appends the zero bytes of the table to a crc
+ */
+static inline uint32_t
+crc32c_shift(uint32_t zeros[4][256], uint32_t crc)
+{
+	return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^
+		zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+
+/*
+ * crc32c_hw_present -- (internal) checks whether the CPU supports the SSE4.2
+ *	crc32 instruction
+ */
+static int
+crc32c_hw_present(void)
+{
+	unsigned cpuinfo[4] = {0};
+
+#ifdef _MSC_VER
+	__cpuid((int *)cpuinfo, 1);
+#else
+	if (!__get_cpuid(1, &cpuinfo[0], &cpuinfo[1], &cpuinfo[2],
+	    &cpuinfo[3]))
+		return 0;
+#endif
+
+	/* ECX bit 20 */
+	return (cpuinfo[2] & (1U << 20)) != 0;
+}
+
+/*
+ * crc32c_hw_blocks -- (internal) computes the crc of len bytes made of three
+ *	blocks processed at once, which hides the latency of the instruction
+ */
+CRC32C_TARGET static uint32_t
+crc32c_hw_blocks(uint32_t crc, const uint8_t **next, size_t *len,
+	size_t block, uint32_t zeros[4][256])
+{
+	const uint8_t *p = *next;
+	uint64_t crc0 = crc;
+
+	while (*len >= block * 3) {
+		uint64_t crc1 = 0;
+		uint64_t crc2 = 0;
+		const uint8_t *end = p + block;
+		uint64_t v0, v1, v2;
+		do {
+			memcpy(&v0, p, sizeof(v0));
+			memcpy(&v1, p + block, sizeof(v1));
+			memcpy(&v2, p + 2 * block, sizeof(v2));
+			crc0 = _mm_crc32_u64(crc0, v0);
+			crc1 = _mm_crc32_u64(crc1, v1);
+			crc2 = _mm_crc32_u64(crc2, v2);
+			p += sizeof(uint64_t);
+		} while (p < end);
+
+		crc0 = crc32c_shift(zeros, (uint32_t)crc0) ^ crc1;
+		crc0 = crc32c_shift(zeros, (uint32_t)crc0) ^ crc2;
+
+		p += 2 * block;
+		*len -= 3 * block;
+	}
+
+	*next = p;
+
+	return (uint32_t)crc0;
+}
+
+/*
+ * crc32c_hw -- (internal) continues the raw crc using the SSE4.2 crc32
+ *	instruction
+ */
+CRC32C_TARGET static uint32_t
+crc32c_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+	/* bring the data pointer to an eight byte boundary */
+	while (len && ((uintptr_t)p & 7) != 0) {
+		crc = _mm_crc32_u8(crc, *p++);
+		len--;
+	}
+
+	crc = crc32c_hw_blocks(crc, &p, &len, CRC32C_LONG, Crc32c_long);
+	crc = crc32c_hw_blocks(crc, &p, &len, CRC32C_SHORT, Crc32c_short);
+
+	uint64_t crc64 = crc;
+	for (; len >= sizeof(uint64_t); len -= sizeof(uint64_t)) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		crc64 = _mm_crc32_u64(crc64, v);
+		p += sizeof(uint64_t);
+	}
+	crc = (uint32_t)crc64;
+
+	while (len--)
+		crc = _mm_crc32_u8(crc, *p++);
+
+	return crc;
+}
+
+#endif
+
+/*
+ * util_crc32c_init -- (internal) prepares the lookup tables of CRC32C
+ */
+static void
+util_crc32c_init(void)
+{
+	for (uint32_t n = 0; n < 256; n++) {
+		uint32_t crc = n;
+		for (unsigned k = 0; k < 8; k++)
+			crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		Crc32c_table[n] = crc;
+	}
+
+#ifdef CRC32C_HW_SUPPORTED
+	crc32c_zeros(Crc32c_long, CRC32C_LONG);
+	crc32c_zeros(Crc32c_short, CRC32C_SHORT);
+	Crc32c_hw = crc32c_hw_present();
+#endif
+}
+
+/*
+ * util_crc32c_seq -- compute sequential CRC32C checksum
+ *
+ * Continues the checksum of the previous buffer, or starts a new one if csum
+ * is 0. The checksum occupies the lower 32 bits of the returned value.
+ */
+uint64_t
+util_crc32c_seq(const void *addr, size_t len, uint64_t csum)
+{
+	const uint8_t *p = addr;
+	uint32_t crc = ~(uint32_t)csum;
+
+#ifdef CRC32C_HW_SUPPORTED
+	if (Crc32c_hw)
+		return ~crc32c_hw(crc, p, len);
+#endif
+
+	while (len--)
+		crc = Crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+/*
+ * util_crc32c_compute -- compute CRC32C checksum
+ *
+ * csump points to where the checksum lives, so that location
+ * is treated as zeros while calculating the checksum.
+ */
+uint64_t
+util_crc32c_compute(void *addr, size_t len, uint64_t *csump)
+{
+	static const uint64_t zero;
+
+	size_t before = (size_t)((char *)csump - (char *)addr);
+	size_t after = len - before - sizeof(*csump);
+
+	uint64_t csum = util_crc32c_seq(addr, before, 0);
+	csum = util_crc32c_seq(&zero, sizeof(zero), csum);
+
+	return util_crc32c_seq(csump + 1, after, csum);
+}
+
 /*
  * util_fgets -- fgets wrapper with conversion CRLF to LF
  */
@@ -308,6 +569,8 @@ util_init(void)
 	}
 #endif
 
+	util_crc32c_init();
+
 #if ANY_VG_TOOL_ENABLED
 	_On_valgrind = RUNNING_ON_VALGRIND;
 #endif
@@ -88,6 +88,8 @@ uint64_t util_checksum_compute(void *addr, size_t len, uint64_t *csump,
 int util_checksum(void *addr, size_t len, uint64_t *csump,
 		int insert, size_t skip_off);
 uint64_t util_checksum_seq(const void *addr, size_t len, uint64_t csum);
+uint64_t util_crc32c_seq(const void *addr, size_t len, uint64_t csum);
+uint64_t util_crc32c_compute(void *addr, size_t len, uint64_t *csump);
 int util_parse_size(const char *str, size_t *sizep);
 char *util_fgets(char *buffer, int max, FILE *stream);
 char *util_getexecname(char *path, size_t pathlen);
@@ -250,6 +252,7 @@ typedef enum {
  * void atomic_store_explicit(volatile A *object, C desired,
  *                            memory_order order);
  */
+#define util_atomic_store_explicit8 __atomic_store_n
 #define util_atomic_store_explicit32 __atomic_store_n
 #define util_atomic_store_explicit64 __atomic_store_n
 
@@ -371,6 +374,21 @@ typedef enum {
 		}\
 	} while (0)
 
+#define util_atomic_store_explicit8(object, desired, order)\
+	do {\
+		COMPILE_ERROR_ON(order != memory_order_seq_cst &&\
+				order != memory_order_release &&\
+				order != memory_order_relaxed);\
+		if (order == memory_order_seq_cst) {\
+			_InterlockedExchange8(\
+				    (volatile char *)object, desired);\
+		} else {\
+			if (order == memory_order_release)\
+				_ReadWriteBarrier();\
+			*object = desired;\
+		}\
+	} while (0)
+
 /*
  * https://msdn.microsoft.com/en-us/library/hh977022.aspx
  */
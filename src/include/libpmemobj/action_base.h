@@ -49,12 +49,15 @@ struct pobj_action {
 #define POBJ_ACTION_XRESERVE_VALID_FLAGS\
 	(POBJ_XALLOC_CLASS_MASK |\
 	POBJ_XALLOC_ARENA_MASK |\
+	POBJ_XALLOC_ALIGN_MASK |\
 	POBJ_XALLOC_ZERO)
 
 PMEMoid pmemobj_reserve(PMEMobjpool *pop, struct pobj_action *act,
 	size_t size, uint64_t type_num);
 PMEMoid pmemobj_xreserve(PMEMobjpool *pop, struct pobj_action *act,
 	size_t size, uint64_t type_num, uint64_t flags);
+int pmemobj_xreserve_bulk(PMEMobjpool *pop, struct pobj_action *actv,
+	size_t actvcnt, size_t size, uint64_t type_num, uint64_t flags);
 void pmemobj_set_value(PMEMobjpool *pop, struct pobj_action *act,
 	uint64_t *ptr, uint64_t value);
 void pmemobj_defer_free(PMEMobjpool *pop, PMEMoid oid, struct pobj_action *act);
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2014-2019, Intel Corporation */
+/* Copyright 2014-2020, Intel Corporation */
 
 /*
  * libpmemobj/atomic_base.h -- definitions of libpmemobj atomic entry points
@@ -22,7 +22,8 @@ extern "C" {
  */
 
 #define POBJ_XALLOC_VALID_FLAGS	(POBJ_XALLOC_ZERO |\
-	POBJ_XALLOC_CLASS_MASK)
+	POBJ_XALLOC_CLASS_MASK |\
+	POBJ_XALLOC_ALIGN_MASK)
 
 /*
  * Allocates a new object from the pool and calls a constructor function before
@@ -40,6 +41,14 @@ int pmemobj_xalloc(PMEMobjpool *pop, PMEMoid *oidp, size_t size,
 	uint64_t type_num, uint64_t flags,
 	pmemobj_constr constructor, void *arg);
 
+/*
+ * Allocates with flags multiple objects of the same size from the pool,
+ * all of which are published at once.
+ */
+int pmemobj_xalloc_bulk(PMEMobjpool *pop, PMEMoid *oidv, size_t oidcnt,
+	size_t size, uint64_t type_num, uint64_t flags,
+	pmemobj_constr constructor, void *arg);
+
 /*
  * Allocates a new zeroed object from the pool.
  */
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2014-2019, Intel Corporation */
+/* Copyright 2014-2020, Intel Corporation */
 
 /*
  * libpmemobj/base.h -- definitions of base libpmemobj entry points
@@ -47,12 +47,21 @@ typedef struct pmemobjpool PMEMobjpool;
 #define POBJ_FLAG_NO_SNAPSHOT		(((uint64_t)1) << 2)
 #define POBJ_FLAG_ASSUME_INITIALIZED	(((uint64_t)1) << 3)
 #define POBJ_FLAG_TX_NO_ABORT		(((uint64_t)1) << 4)
+#define POBJ_FLAG_LAZY_SNAPSHOT		(((uint64_t)1) << 5)
 
 #define POBJ_CLASS_ID(id)	(((uint64_t)(id)) << 48)
 #define POBJ_ARENA_ID(id)	(((uint64_t)(id)) << 32)
 
+/*
+ * Requests the allocated object to be aligned to the given power of two
+ * number of bytes, up to 2 megabytes.
+ */
+#define POBJ_XALLOC_ALIGN(n)\
+	((((uint64_t)(n)) & (((uint64_t)1 << 24) - 1)) << 8)
+
 #define POBJ_XALLOC_CLASS_MASK	((((uint64_t)1 << 16) - 1) << 48)
 #define POBJ_XALLOC_ARENA_MASK	((((uint64_t)1 << 16) - 1) << 32)
+#define POBJ_XALLOC_ALIGN_MASK	((((uint64_t)1 << 24) - 1) << 8)
 #define POBJ_XALLOC_ZERO	POBJ_FLAG_ZERO
 #define POBJ_XALLOC_NO_FLUSH	POBJ_FLAG_NO_FLUSH
 #define POBJ_XALLOC_NO_ABORT	POBJ_FLAG_TX_NO_ABORT
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2017-2019, Intel Corporation */
+/* Copyright 2017-2020, Intel Corporation */
 
 /*
  * libpmemobj/ctl.h -- definitions of pmemobj_ctl related entry points
@@ -137,6 +137,51 @@ struct pobj_alloc_class_desc {
 	unsigned class_id;
 };
 
+/*
+ * Background defragmentation interface
+ *
+ * The allocator can compact the heap incrementally, a batch of objects at a
+ * time, by moving objects out of sparsely occupied runs. Emptied runs are
+ * given back to the heap as free chunks.
+ * The library does not know where the references to objects are stored, so
+ * the application has to provide a callback that finds them.
+ *
+ * These are the CTL entry points that control the defragmentation:
+ * - heap.defrag.callbacks
+ *	Sets/retrieves the callbacks used to find references to the objects
+ * - heap.defrag.step
+ *	Performs a single batch of defragmentation
+ * - heap.defrag.worker
+ *	Performs the defragmentation until stopped, called from a dedicated
+ *	thread
+ *
+ * Please see the libpmemobj man page for more information about entry points.
+ */
+struct pobj_defrag_callbacks {
+	/*
+	 * Called for every object picked for relocation. It has to store
+	 * the pointers to all PMEMoids that refer to the object in refs,
+	 * at most nrefs of them, and return the number of stored pointers.
+	 * The PMEMoids can reside in the pool or in volatile memory.
+	 * The object is left in place if the callback returns a negative
+	 * value or if any of the returned PMEMoids doesn't point to the object.
+	 */
+	int (*refs)(PMEMobjpool *pop, PMEMoid oid, PMEMoid **refs,
+		size_t nrefs, void *arg);
+
+	/*
+	 * Optional, called before the references of a batch are collected
+	 * and after the objects of the batch are relocated. In between, the
+	 * application must neither access the objects nor modify the
+	 * references to them.
+	 */
+	void (*lock)(PMEMobjpool *pop, void *arg);
+	void (*unlock)(PMEMobjpool *pop, void *arg);
+
+	/* user argument passed to all of the callbacks */
+	void *arg;
+};
+
 enum pobj_stats_enabled {
 	POBJ_STATS_ENABLED_TRANSIENT,
 	POBJ_STATS_ENABLED_BOTH,
@@ -144,6 +189,55 @@ enum pobj_stats_enabled {
 	POBJ_STATS_DISABLED,
 };
 
+enum pobj_arena_mode {
+	POBJ_ARENA_MODE_THREAD, /* each thread is bound to a single arena */
+	POBJ_ARENA_MODE_CPU, /* the arena is picked by the current CPU */
+};
+
+enum pobj_lane_mode {
+	POBJ_LANE_MODE_THREAD, /* each thread prefers its own lane */
+	POBJ_LANE_MODE_CPU, /* the lane is picked by the current CPU */
+};
+
+/*
+ * Allocation sampling interface
+ *
+ * Every N-th allocation of a thread can be recorded, along with the stack
+ * of the allocating thread, in an in-memory ring of the most recent samples.
+ *
+ * These are the CTL entry points that control the sampling:
+ * - heap.sample.rate
+ *	Sets/retrieves N, 0 disables the sampling
+ * - heap.sample.capacity
+ *	Sets/retrieves the number of samples the ring holds
+ * - heap.sample.dump
+ *	Copies the most recent samples into a pobj_alloc_samples buffer
+ *
+ * Please see the libpmemobj man page for more information about entry points.
+ */
+#define POBJ_ALLOC_SAMPLE_FRAMES 12
+
+struct pobj_alloc_sample {
+	uint64_t seq; /* number of the sample, counted from 0 */
+	size_t size; /* requested size of the allocation */
+	uint64_t off; /* offset of the object in the pool */
+	uint64_t type_num;
+	unsigned class_id;
+	unsigned arena_id;
+
+	/*
+	 * Return addresses of the allocating thread stack, innermost first,
+	 * the unused entries are NULL. The first ones belong to the library.
+	 */
+	void *frames[POBJ_ALLOC_SAMPLE_FRAMES];
+};
+
+struct pobj_alloc_samples {
+	/* number of entries in the buffer, set to the number of samples */
+	size_t nsamples;
+	struct pobj_alloc_sample *samples;
+};
+
 #ifndef _WIN32
 /* EXPERIMENTAL */
 int pmemobj_ctl_get(PMEMobjpool *pop, const char *name, void *arg);
@@ -97,20 +97,25 @@ enum tx_lock_deprecated pobj_tx_lock {
 typedef void (*pmemobj_tx_callback)(PMEMobjpool *pop, enum pobj_tx_stage stage,
 		void *);
 
+typedef void (*pmemobj_tx_durable_cb)(PMEMobjpool *pop, void *arg);
+
 #define POBJ_TX_XALLOC_VALID_FLAGS	(POBJ_XALLOC_ZERO |\
 	POBJ_XALLOC_NO_FLUSH |\
 	POBJ_XALLOC_ARENA_MASK |\
 	POBJ_XALLOC_CLASS_MASK |\
+	POBJ_XALLOC_ALIGN_MASK |\
 	POBJ_XALLOC_NO_ABORT)
 
 #define POBJ_XADD_NO_FLUSH		POBJ_FLAG_NO_FLUSH
 #define POBJ_XADD_NO_SNAPSHOT		POBJ_FLAG_NO_SNAPSHOT
 #define POBJ_XADD_ASSUME_INITIALIZED	POBJ_FLAG_ASSUME_INITIALIZED
 #define POBJ_XADD_NO_ABORT		POBJ_FLAG_TX_NO_ABORT
+#define POBJ_XADD_LAZY_SNAPSHOT		POBJ_FLAG_LAZY_SNAPSHOT
 #define POBJ_XADD_VALID_FLAGS	(POBJ_XADD_NO_FLUSH |\
 	POBJ_XADD_NO_SNAPSHOT |\
 	POBJ_XADD_ASSUME_INITIALIZED |\
-	POBJ_XADD_NO_ABORT)
+	POBJ_XADD_NO_ABORT |\
+	POBJ_XADD_LAZY_SNAPSHOT)
 
 #define POBJ_XLOCK_NO_ABORT		POBJ_FLAG_TX_NO_ABORT
 #define POBJ_XLOCK_VALID_FLAGS	(POBJ_XLOCK_NO_ABORT)
@@ -162,6 +167,22 @@ void pmemobj_tx_abort(int errnum);
  */
 void pmemobj_tx_commit(void);
 
+/*
+ * Commits current transaction without waiting for it to become durable
+ *
+ * The outermost transaction can no longer be aborted once this function
+ * returns, but making it durable is left to one of the post-commit workers,
+ * which calls 'cb' afterwards. The transactions and allocations depending on
+ * it become durable only after it. If there are no workers available, the
+ * transaction is committed in place and 'cb' is called before this function
+ * returns.
+ *
+ * Causes transition to TX_STAGE_ONCOMMIT.
+ *
+ * This function must be called during TX_STAGE_WORK.
+ */
+void pmemobj_tx_commit_async(pmemobj_tx_durable_cb cb, void *arg);
+
 /*
  * Cleanups current transaction. Must always be called after pmemobj_tx_begin,
  * even if starting the transaction failed.
@@ -227,6 +248,8 @@ int pmemobj_tx_add_range_direct(const void *ptr, size_t size);
  *  - POBJ_XADD_ASSUME_INITIALIZED - added range is assumed to be initialized
  *  - POBJ_XADD_NO_ABORT - if the function does not end successfully,
  *  do not abort the transaction and return the error number.
+ *  - POBJ_XADD_LAZY_SNAPSHOT - the whole pages of the range are snapshotted
+ *  one by one, when they are written to for the first time.
  */
 int pmemobj_tx_xadd_range(PMEMoid oid, uint64_t off, size_t size,
 		uint64_t flags);
@@ -239,9 +262,50 @@ int pmemobj_tx_xadd_range(PMEMoid oid, uint64_t off, size_t size,
  *  - POBJ_XADD_ASSUME_INITIALIZED - added range is assumed to be initialized
  *  - POBJ_XADD_NO_ABORT - if the function does not end successfully,
  *  do not abort the transaction and return the error number.
+ *  - POBJ_XADD_LAZY_SNAPSHOT - the whole pages of the range are snapshotted
+ *  one by one, when they are written to for the first time.
  */
 int pmemobj_tx_xadd_range_direct(const void *ptr, size_t size, uint64_t flags);
 
+/*
+ * Creates a volatile "shadow" copy of the memory block of given size and
+ * located at given offset 'off' in the object 'oid'. The application modifies
+ * the returned copy instead of the object, and the copy is written back to
+ * the object through the redo log when the transaction commits. In case of
+ * failure or abort, the object is not modified at all.
+ *
+ * The returned pointer is valid until the end of the transaction. Ranges
+ * already contained in a shadow copy return the address of that copy.
+ *
+ * If successful, returns the address of the copy.
+ * Otherwise, stage changes to TX_STAGE_ONABORT and NULL is returned.
+ *
+ * This function must be called during TX_STAGE_WORK.
+ */
+void *pmemobj_tx_shadow_range(PMEMoid oid, uint64_t off, size_t size);
+
+/*
+ * Creates a volatile "shadow" copy of the given memory region, which is
+ * written back to the pool when the transaction commits. The supplied block
+ * of memory has to be within the given pool.
+ *
+ * If successful, returns the address of the copy.
+ * Otherwise, stage changes to TX_STAGE_ONABORT and NULL is returned.
+ *
+ * This function must be called during TX_STAGE_WORK.
+ */
+void *pmemobj_tx_shadow_range_direct(const void *ptr, size_t size);
+
+/*
+ * Returns the address at which the current contents of the given memory
+ * region can be read - its shadow copy if one was created in the current
+ * transaction, or 'ptr' otherwise.
+ *
+ * If the region is only partially covered by shadow copies, stage changes to
+ * TX_STAGE_ONABORT and NULL is returned.
+ */
+const void *pmemobj_tx_read_direct(const void *ptr, size_t size);
+
 /*
  * Transactionally allocates a new object.
  *
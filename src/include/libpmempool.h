@@ -268,6 +268,7 @@ enum pmempool_feature {
 	PMEMPOOL_FEAT_CKSUM_2K,
 	PMEMPOOL_FEAT_SHUTDOWN_STATE,
 	PMEMPOOL_FEAT_CHECK_BAD_BLOCKS,
+	PMEMPOOL_FEAT_ULOG_CRC32C,
 };
 
 /* PMEMPOOL FEATURE ENABLE */
@@ -261,17 +261,13 @@ alloc_class_delete(struct alloc_class_collection *ac,
 }
 
 /*
- * alloc_class_find_or_create -- (internal) searches for the
- * biggest allocation class for which unit_size is evenly divisible by n.
- * If no such class exists, create one.
+ * alloc_class_min_run_size_idx -- (internal) returns the number of chunks a
+ *	run needs to fit RUN_MIN_NALLOCS units of the given size
  */
-static struct alloc_class *
-alloc_class_find_or_create(struct alloc_class_collection *ac, size_t n)
+static uint32_t
+alloc_class_min_run_size_idx(size_t unit_size)
 {
-	LOG(10, NULL);
-
-	COMPILE_ERROR_ON(MAX_ALLOCATION_CLASSES > UINT8_MAX);
-	uint64_t required_size_bytes = n * RUN_MIN_NALLOCS;
+	uint64_t required_size_bytes = unit_size * RUN_MIN_NALLOCS;
 	uint32_t required_size_idx = 1;
 	if (required_size_bytes > RUN_DEFAULT_SIZE) {
 		required_size_bytes -= RUN_DEFAULT_SIZE;
@@ -281,6 +277,22 @@ alloc_class_find_or_create(struct alloc_class_collection *ac, size_t n)
 			required_size_idx = RUN_SIZE_IDX_CAP;
 	}
 
+	return required_size_idx;
+}
+
+/*
+ * alloc_class_find_or_create -- (internal) searches for the
+ * biggest allocation class for which unit_size is evenly divisible by n.
+ * If no such class exists, create one.
+ */
+static struct alloc_class *
+alloc_class_find_or_create(struct alloc_class_collection *ac, size_t n)
+{
+	LOG(10, NULL);
+
+	COMPILE_ERROR_ON(MAX_ALLOCATION_CLASSES > UINT8_MAX);
+	uint32_t required_size_idx = alloc_class_min_run_size_idx(n);
+
 	for (int i = MAX_ALLOCATION_CLASSES - 1; i >= 0; --i) {
 		struct alloc_class *c = ac->aclasses[i];
 
@@ -586,6 +598,141 @@ alloc_class_by_alloc_size(struct alloc_class_collection *ac, size_t size)
 	}
 }
 
+/*
+ * alloc_class_derive -- creates a run allocation class whose unit size
+ *	exactly fits allocations of the given size
+ *
+ * Returns NULL if the class currently assigned to the size wastes no more
+ * than max_waste percent of every unit, or if a new class cannot be created.
+ * The waste of the current class is stored in *waste. The new class is not
+ * assigned to the size, see alloc_class_assign.
+ */
+struct alloc_class *
+alloc_class_derive(struct alloc_class_collection *ac, size_t size,
+	unsigned max_waste, unsigned *waste)
+{
+	LOG(10, NULL);
+
+	ASSERTne(size, 0);
+
+	size_t class_map_index = SIZE_TO_CLASS_MAP_INDEX(size,
+		ac->granularity);
+	size_t n = class_map_index * ac->granularity;
+	if (n >= ac->last_run_max_size)
+		return NULL;
+
+	struct alloc_class *c = alloc_class_by_alloc_size(ac, n);
+	if (c == NULL)
+		return NULL;
+
+	ssize_t units = alloc_class_calc_size_idx(c, n);
+	if (units < 0)
+		return NULL;
+
+	size_t real_size = n + header_type_to_size[c->header_type];
+	size_t total = c->unit_size * (size_t)units;
+	*waste = (unsigned)((total - real_size) * 100 / total);
+	if (*waste <= max_waste)
+		return NULL;
+
+	size_t unit_size = n + header_type_to_size[HEADER_COMPACT];
+	uint16_t flags = (uint16_t)(header_type_to_flag[HEADER_COMPACT] |
+		ALLOC_CLASS_DEFAULT_FLAGS);
+
+	/*
+	 * Pick the smallest run that ends with no more than
+	 * MAX_RUN_WASTED_BYTES of unusable space, or the one that wastes the
+	 * least if there's no such run.
+	 */
+	struct run_bitmap b;
+	uint32_t best_size_idx = 0;
+	size_t lowest_waste = SIZE_MAX;
+	for (uint32_t i = alloc_class_min_run_size_idx(unit_size);
+			i <= RUN_SIZE_IDX_CAP; ++i) {
+		uint32_t size_idx = i;
+		memblock_run_bitmap(&size_idx, flags, unit_size, 0, NULL, &b);
+
+		size_t runsize_bytes =
+			RUN_CONTENT_SIZE_BYTES(size_idx) - b.size;
+		size_t wasted_bytes = runsize_bytes % unit_size;
+		if (wasted_bytes < lowest_waste) {
+			lowest_waste = wasted_bytes;
+			best_size_idx = size_idx;
+		}
+
+		if (wasted_bytes <= MAX_RUN_WASTED_BYTES)
+			break;
+	}
+
+	c = alloc_class_by_run(ac, unit_size, flags, best_size_idx);
+	if (c != NULL)
+		return c;
+
+	return alloc_class_new(-1, ac, CLASS_RUN, HEADER_COMPACT, unit_size, 0,
+		best_size_idx);
+}
+
+/*
+ * alloc_class_aligned -- returns a run allocation class whose every unit
+ *	begins with user data aligned to the unit size, creating a new class if
+ *	there's none yet
+ *
+ * The runs of the class have room for at least nunits units. The unit size
+ * has to be a power of two. The new class has no buckets, see
+ * heap_create_alloc_class_buckets.
+ */
+struct alloc_class *
+alloc_class_aligned(struct alloc_class_collection *ac, size_t unit_size,
+	unsigned nunits)
+{
+	LOG(10, NULL);
+
+	ASSERT(util_is_pow2(unit_size));
+
+	uint16_t flags = (uint16_t)(header_type_to_flag[HEADER_COMPACT] |
+		CHUNK_FLAG_ALIGNED | ALLOC_CLASS_DEFAULT_FLAGS);
+
+	/* aligning the data might require up-to one unit of the run */
+	size_t runsize_bytes = CHUNK_ALIGN_UP(nunits * unit_size +
+		RUN_BASE_METADATA_SIZE) + unit_size;
+	uint32_t size_idx = (uint32_t)(runsize_bytes / CHUNKSIZE);
+
+	struct run_bitmap b;
+	memblock_run_bitmap(&size_idx, flags, unit_size, unit_size, NULL, &b);
+
+	struct alloc_class *c = alloc_class_by_run(ac, unit_size, flags,
+		size_idx);
+	if (c != NULL)
+		return c;
+
+	return alloc_class_new(-1, ac, CLASS_RUN, HEADER_COMPACT, unit_size,
+		unit_size, size_idx);
+}
+
+/*
+ * alloc_class_assign -- assigns the allocation class to handle allocations
+ *	of the provided size
+ *
+ * Only the allocations made after this call use the new class, the memory
+ * blocks already allocated from the previous one remain where they are.
+ */
+void
+alloc_class_assign(struct alloc_class_collection *ac, size_t size,
+	struct alloc_class *c)
+{
+	LOG(10, NULL);
+
+	ASSERTeq(c->type, CLASS_RUN);
+	ASSERT(size < ac->last_run_max_size);
+
+	size_t class_map_index = SIZE_TO_CLASS_MAP_INDEX(size,
+		ac->granularity);
+
+	/* the map holds a byte per size, a wider access would touch others */
+	uint8_t *map = &ac->class_map_by_alloc_size[class_map_index];
+	util_atomic_store_explicit8(map, c->id, memory_order_release);
+}
+
 /*
  * alloc_class_by_run -- returns the allocation class that has the given
  *	unit size
@@ -72,6 +72,17 @@ alloc_class_new(int id, struct alloc_class_collection *ac,
 void alloc_class_delete(struct alloc_class_collection *ac,
 	struct alloc_class *c);
 
+struct alloc_class *
+alloc_class_derive(struct alloc_class_collection *ac, size_t size,
+	unsigned max_waste, unsigned *waste);
+
+struct alloc_class *
+alloc_class_aligned(struct alloc_class_collection *ac, size_t unit_size,
+	unsigned nunits);
+
+void alloc_class_assign(struct alloc_class_collection *ac, size_t size,
+	struct alloc_class *c);
+
 #ifdef __cplusplus
 }
 #endif
@@ -37,6 +37,7 @@ bucket_new(struct block_container *c, struct alloc_class *aclass)
 	b->c_ops = c->c_ops;
 
 	util_mutex_init(&b->lock);
+	util_rwlock_init(&b->claim_lock);
 
 	b->is_active = 0;
 	b->active_memory_block = NULL;
@@ -48,11 +49,13 @@ bucket_new(struct block_container *c, struct alloc_class *aclass)
 			goto error_active_alloc;
 	}
 	b->aclass = aclass;
+	b->arena = NULL;
 
 	return b;
 
 error_active_alloc:
 
+	util_rwlock_destroy(&b->claim_lock);
 	util_mutex_destroy(&b->lock);
 	Free(b);
 	return NULL;
@@ -84,6 +87,7 @@ bucket_delete(struct bucket *b)
 	if (b->active_memory_block)
 		Free(b->active_memory_block);
 
+	util_rwlock_destroy(&b->claim_lock);
 	util_mutex_destroy(&b->lock);
 	b->c_ops->destroy(b->container);
 	Free(b);
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2015-2019, Intel Corporation */
+/* Copyright 2015-2020, Intel Corporation */
 
 /*
  * bucket.h -- internal definitions for bucket
@@ -25,6 +25,14 @@ extern "C" {
 struct bucket {
 	os_mutex_t lock;
 
+	/*
+	 * Taken for reading by the threads which take blocks out of the
+	 * container without the bucket lock, which is only possible if the
+	 * container allows it, and for writing, under the bucket lock, to
+	 * change the active memory block or the container.
+	 */
+	os_rwlock_t claim_lock;
+
 	struct alloc_class *aclass;
 
 	struct block_container *container;
@@ -32,6 +40,9 @@ struct bucket {
 
 	struct memory_block_reserved *active_memory_block;
 	int is_active;
+
+	/* arena the bucket belongs to, NULL for the buckets shared by all */
+	struct arena *arena;
 };
 
 struct bucket *bucket_new(struct block_container *c,
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2015-2019, Intel Corporation */
+/* Copyright 2015-2020, Intel Corporation */
 
 /*
  * container.h -- internal definitions for block containers
@@ -19,6 +19,15 @@ struct block_container {
 	struct palloc_heap *heap;
 };
 
+/*
+ * Summary of the memory blocks held by a container.
+ */
+struct block_container_stats {
+	uint64_t nblocks;	/* number of blocks */
+	uint64_t nunits;	/* total size of the blocks, in units */
+	uint32_t largest;	/* size of the largest block, in units */
+};
+
 struct block_container_ops {
 	/* inserts a new memory block into the container */
 	int (*insert)(struct block_container *c, const struct memory_block *m);
@@ -31,12 +40,25 @@ struct block_container_ops {
 	int (*get_rm_bestfit)(struct block_container *c,
 		struct memory_block *m);
 
+	/*
+	 * removes and returns the best-fit memory block for size that is
+	 * accepted by the filter, optional
+	 */
+	int (*get_rm_bestfit_filter)(struct block_container *c,
+		struct memory_block *m,
+		int (*filter)(const struct memory_block *m, void *arg),
+		void *arg);
+
 	/* checks whether the container is empty */
 	int (*is_empty)(struct block_container *c);
 
 	/* removes all elements from the container */
 	void (*rm_all)(struct block_container *c);
 
+	/* returns the summary of the blocks in the container, optional */
+	void (*get_stats)(struct block_container *c,
+		struct block_container_stats *s);
+
 	/* deletes the container */
 	void (*destroy)(struct block_container *c);
 };
@@ -0,0 +1,297 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * container_bitmap.c -- implementation of atomic bitmap block container
+ *
+ * This container holds the free units of a single run in a volatile copy of
+ * the run bitmap, in which a set bit means that the unit cannot be taken.
+ * Blocks are removed from the container by atomically setting their bits,
+ * and inserted back by atomically clearing them, which means that multiple
+ * threads can take blocks out of the same container at once. Only the
+ * functions which change the run the container describes (inserting the
+ * first block, removing all of them) need exclusive access.
+ *
+ * Blocks cannot span multiple bitmap values, exactly like in the persistent
+ * bitmap of the run.
+ */
+
+#include "container_bitmap.h"
+#include "out.h"
+#include "sys_util.h"
+#include "util.h"
+#include "valgrind_internal.h"
+
+struct block_container_bitmap {
+	struct block_container super;
+
+	/* the run described by the bitmap */
+	struct memory_block m;
+
+	/* set bits are the units which are not in the container */
+	uint64_t *values;
+	unsigned nvalues;
+	unsigned capacity;
+
+	/* bitmap value to begin the search from */
+	unsigned hint;
+};
+
+/*
+ * container_bitmap_mask -- (internal) returns the mask of the block's bits in
+ *	its bitmap value
+ */
+static inline uint64_t
+container_bitmap_mask(uint32_t block_off, uint32_t size_idx)
+{
+	uint64_t mask = size_idx == RUN_BITS_PER_VALUE ?
+		UINT64_MAX : ((1ULL << size_idx) - 1);
+
+	return mask << (block_off % RUN_BITS_PER_VALUE);
+}
+
+/*
+ * container_bitmap_init -- (internal) makes the container describe the run
+ *	of the memory block, with none of its units free
+ */
+static int
+container_bitmap_init(struct block_container_bitmap *c,
+	const struct memory_block *m)
+{
+	struct run_bitmap b;
+	m->m_ops->get_bitmap(m, &b);
+
+	if (b.nvalues > c->capacity) {
+		uint64_t *values = Realloc(c->values,
+			b.nvalues * sizeof(*values));
+		if (values == NULL)
+			return -1;
+
+		c->values = values;
+		c->capacity = b.nvalues;
+	}
+
+	for (unsigned i = 0; i < b.nvalues; ++i)
+		c->values[i] = UINT64_MAX;
+
+	c->m = *m;
+	c->hint = 0;
+
+	/* the values must be visible before anyone searches through them */
+	util_atomic_store_explicit32(&c->nvalues, b.nvalues,
+		memory_order_release);
+
+	return 0;
+}
+
+/*
+ * container_bitmap_insert_block -- (internal) inserts a new memory block
+ *	into the container
+ */
+static int
+container_bitmap_insert_block(struct block_container *bc,
+	const struct memory_block *m)
+{
+	ASSERT(m->chunk_id < MAX_CHUNK);
+	ASSERT(m->zone_id < UINT16_MAX);
+	ASSERTne(m->size_idx, 0);
+	ASSERT(m->size_idx <= RUN_BITS_PER_VALUE);
+
+	struct block_container_bitmap *c =
+		(struct block_container_bitmap *)bc;
+
+	if (c->nvalues == 0 && container_bitmap_init(c, m) != 0)
+		return -1;
+
+	ASSERT(m->chunk_id == c->m.chunk_id);
+	ASSERT(m->zone_id == c->m.zone_id);
+
+	unsigned i = m->block_off / RUN_BITS_PER_VALUE;
+	ASSERT(i < c->nvalues);
+
+	uint64_t mask = container_bitmap_mask(m->block_off, m->size_idx);
+	uint64_t old = util_fetch_and_and64(&c->values[i], ~mask);
+	ASSERTeq(old & mask, mask);
+	(void) old;
+
+	return 0;
+}
+
+/*
+ * container_bitmap_find -- (internal) returns the mask of the first range of
+ *	size_idx clear bits in the value, 0 if there's none
+ */
+static inline uint64_t
+container_bitmap_find(uint64_t value, uint32_t size_idx)
+{
+	/* the set bits mark the units which begin a free range of size_idx */
+	uint64_t starts = ~value;
+	for (uint32_t i = 1; i < size_idx && starts != 0; ++i)
+		starts &= ~value >> i;
+
+	if (starts == 0)
+		return 0;
+
+	return container_bitmap_mask(util_lssb_index64(starts), size_idx);
+}
+
+/*
+ * container_bitmap_get_rm_block_bestfit -- (internal) removes and returns
+ *	a memory block of the requested size
+ *
+ * The bits are claimed with a compare-and-swap on their bitmap value, so the
+ * container can be searched by multiple threads at once. Since all blocks
+ * come from the same run, the first one that fits is as good as any other.
+ */
+static int
+container_bitmap_get_rm_block_bestfit(struct block_container *bc,
+	struct memory_block *m)
+{
+	struct block_container_bitmap *c =
+		(struct block_container_bitmap *)bc;
+
+	ASSERT(m->size_idx <= RUN_BITS_PER_VALUE);
+	ASSERTne(m->size_idx, 0);
+
+	unsigned nvalues;
+	util_atomic_load_explicit32(&c->nvalues, &nvalues,
+		memory_order_acquire);
+	if (nvalues == 0)
+		return ENOMEM;
+
+	unsigned hint;
+	util_atomic_load_explicit32(&c->hint, &hint, memory_order_relaxed);
+
+	for (unsigned n = 0; n < nvalues; ++n) {
+		unsigned i = (hint + n) % nvalues;
+
+		uint64_t value;
+		util_atomic_load_explicit64(&c->values[i], &value,
+			memory_order_relaxed);
+
+		uint64_t mask;
+		while ((mask = container_bitmap_find(value,
+		    m->size_idx)) != 0) {
+			if (util_bool_compare_and_swap64(&c->values[i], value,
+			    value | mask))
+				goto claimed;
+
+			util_atomic_load_explicit64(&c->values[i], &value,
+				memory_order_relaxed);
+		}
+
+		continue;
+
+claimed:
+		if (i != hint)
+			util_atomic_store_explicit32(&c->hint, i,
+				memory_order_relaxed);
+
+		uint32_t size_idx = m->size_idx;
+		*m = c->m;
+		m->block_off = (uint32_t)(i * RUN_BITS_PER_VALUE +
+			util_lssb_index64(mask));
+		m->size_idx = size_idx;
+
+		return 0;
+	}
+
+	return ENOMEM;
+}
+
+/*
+ * container_bitmap_is_empty -- (internal) checks whether the container is
+ *	empty
+ */
+static int
+container_bitmap_is_empty(struct block_container *bc)
+{
+	struct block_container_bitmap *c =
+		(struct block_container_bitmap *)bc;
+
+	for (unsigned i = 0; i < c->nvalues; ++i) {
+		uint64_t value;
+		util_atomic_load_explicit64(&c->values[i], &value,
+			memory_order_relaxed);
+		if (value != UINT64_MAX)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * container_bitmap_rm_all -- (internal) removes all elements from the
+ *	container
+ */
+static void
+container_bitmap_rm_all(struct block_container *bc)
+{
+	struct block_container_bitmap *c =
+		(struct block_container_bitmap *)bc;
+
+	c->nvalues = 0;
+}
+
+/*
+ * container_bitmap_destroy -- (internal) deletes the container
+ */
+static void
+container_bitmap_destroy(struct block_container *bc)
+{
+	struct block_container_bitmap *c =
+		(struct block_container_bitmap *)bc;
+
+	Free(c->values);
+	Free(c);
+}
+
+/*
+ * This container does not support retrieval of exact memory blocks, but
+ * allows multiple threads to take blocks of up to 64 units out of it without
+ * any locks.
+ */
+static const struct block_container_ops container_bitmap_ops = {
+	.insert = container_bitmap_insert_block,
+	.get_rm_exact = NULL,
+	.get_rm_bestfit = container_bitmap_get_rm_block_bestfit,
+	.is_empty = container_bitmap_is_empty,
+	.rm_all = container_bitmap_rm_all,
+	.destroy = container_bitmap_destroy,
+};
+
+/*
+ * container_new_bitmap -- allocates and initializes an atomic bitmap
+ *	container
+ */
+struct block_container *
+container_new_bitmap(struct palloc_heap *heap)
+{
+	struct block_container_bitmap *bc = Malloc(sizeof(*bc));
+	if (bc == NULL)
+		goto error_container_malloc;
+
+	bc->super.heap = heap;
+	bc->super.c_ops = &container_bitmap_ops;
+
+	bc->m = MEMORY_BLOCK_NONE;
+	bc->values = NULL;
+	bc->nvalues = 0;
+	bc->capacity = 0;
+	bc->hint = 0;
+
+	return (struct block_container *)&bc->super;
+
+error_container_malloc:
+	return NULL;
+}
+
+/*
+ * container_is_bitmap -- returns whether the container allows taking blocks
+ *	out of it concurrently
+ */
+int
+container_is_bitmap(struct block_container *c)
+{
+	return c->c_ops == &container_bitmap_ops;
+}
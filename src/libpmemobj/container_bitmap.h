@@ -0,0 +1,26 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * container_bitmap.h -- internal definitions for the atomic bitmap block
+ *	container
+ */
+
+#ifndef LIBPMEMOBJ_CONTAINER_BITMAP_H
+#define LIBPMEMOBJ_CONTAINER_BITMAP_H 1
+
+#include "container.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct block_container *container_new_bitmap(struct palloc_heap *heap);
+
+int container_is_bitmap(struct block_container *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBPMEMOBJ_CONTAINER_BITMAP_H */
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2018-2019, Intel Corporation */
+/* Copyright 2018-2020, Intel Corporation */
 
 /*
  * container_ravl.c -- implementation of ravl-based block container
@@ -10,11 +10,38 @@
 #include "out.h"
 #include "sys_util.h"
 
+/*
+ * Max number of blocks inspected by the filtered best-fit search before
+ * giving up.
+ */
+#define CONTAINER_RAVL_FILTER_MAX_SCAN 128
+
 struct block_container_ravl {
 	struct block_container super;
 	struct ravl *tree;
+
+	/* number of blocks in the tree and their total size */
+	uint64_t nblocks;
+	uint64_t nunits;
 };
 
+/*
+ * container_ravl_account -- (internal) updates the summary of the blocks
+ *	after one was inserted into or removed from the tree
+ */
+static void
+container_ravl_account(struct block_container_ravl *c,
+	const struct memory_block *m, int inserted)
+{
+	if (inserted) {
+		c->nblocks++;
+		c->nunits += m->size_idx;
+	} else {
+		c->nblocks--;
+		c->nunits -= m->size_idx;
+	}
+}
+
 /*
  * container_compare_memblocks -- (internal) compares two memory blocks
  */
@@ -61,7 +88,11 @@ container_ravl_insert_block(struct block_container *bc,
 	VALGRIND_SET_CLEAN(e, sizeof(*e));
 	VALGRIND_REMOVE_FROM_TX(e, sizeof(*e));
 
-	return ravl_insert(c->tree, e);
+	int ret = ravl_insert(c->tree, e);
+	if (ret == 0)
+		container_ravl_account(c, e, 1);
+
+	return ret;
 }
 
 /*
@@ -83,10 +114,46 @@ container_ravl_get_rm_block_bestfit(struct block_container *bc,
 	struct memory_block *e = ravl_data(n);
 	*m = *e;
 	ravl_remove(c->tree, n);
+	container_ravl_account(c, m, 0);
 
 	return 0;
 }
 
+/*
+ * container_ravl_get_rm_block_bestfit_filter -- (internal) removes and returns
+ *	the best-fit memory block for size that is accepted by the filter
+ *
+ * The blocks are inspected in the best-fit order, the search is bounded so
+ * that a filter rejecting most of the blocks doesn't degrade the performance
+ * of the container.
+ */
+static int
+container_ravl_get_rm_block_bestfit_filter(struct block_container *bc,
+	struct memory_block *m,
+	int (*filter)(const struct memory_block *m, void *arg), void *arg)
+{
+	struct block_container_ravl *c =
+		(struct block_container_ravl *)bc;
+
+	struct ravl_node *n = ravl_find(c->tree, m,
+		RAVL_PREDICATE_GREATER_EQUAL);
+
+	for (int i = 0; n != NULL && i < CONTAINER_RAVL_FILTER_MAX_SCAN; ++i) {
+		struct memory_block *e = ravl_data(n);
+		if (filter(e, arg)) {
+			*m = *e;
+			ravl_remove(c->tree, n);
+			container_ravl_account(c, m, 0);
+
+			return 0;
+		}
+
+		n = ravl_find(c->tree, e, RAVL_PREDICATE_GREATER);
+	}
+
+	return ENOMEM;
+}
+
 /*
  * container_ravl_get_rm_block_exact --
  *	(internal) removes exact match memory block
@@ -102,6 +169,7 @@ container_ravl_get_rm_block_exact(struct block_container *bc,
 	if (n == NULL)
 		return ENOMEM;
 
+	container_ravl_account(c, ravl_data(n), 0);
 	ravl_remove(c->tree, n);
 
 	return 0;
@@ -129,6 +197,35 @@ container_ravl_rm_all(struct block_container *bc)
 		(struct block_container_ravl *)bc;
 
 	ravl_clear(c->tree);
+	c->nblocks = 0;
+	c->nunits = 0;
+}
+
+/*
+ * container_ravl_get_stats -- (internal) returns the summary of the blocks
+ *	in the tree, the largest block is the last one in the tree's order
+ */
+static void
+container_ravl_get_stats(struct block_container *bc,
+	struct block_container_stats *s)
+{
+	struct block_container_ravl *c =
+		(struct block_container_ravl *)bc;
+
+	s->nblocks = c->nblocks;
+	s->nunits = c->nunits;
+	s->largest = 0;
+
+	struct memory_block last = MEMORY_BLOCK_NONE;
+	last.size_idx = UINT32_MAX;
+	last.zone_id = UINT32_MAX;
+	last.chunk_id = UINT32_MAX;
+	last.block_off = UINT32_MAX;
+
+	struct ravl_node *n = ravl_find(c->tree, &last,
+		RAVL_PREDICATE_LESS_EQUAL);
+	if (n != NULL)
+		s->largest = ((struct memory_block *)ravl_data(n))->size_idx;
 }
 
 /*
@@ -157,8 +254,10 @@ static const struct block_container_ops container_ravl_ops = {
 	.insert = container_ravl_insert_block,
 	.get_rm_exact = container_ravl_get_rm_block_exact,
 	.get_rm_bestfit = container_ravl_get_rm_block_bestfit,
+	.get_rm_bestfit_filter = container_ravl_get_rm_block_bestfit_filter,
 	.is_empty = container_ravl_is_empty,
 	.rm_all = container_ravl_rm_all,
+	.get_stats = container_ravl_get_stats,
 	.destroy = container_ravl_destroy,
 };
 
@@ -178,6 +277,9 @@ container_new_ravl(struct palloc_heap *heap)
 	if (bc->tree == NULL)
 		goto error_ravl_new;
 
+	bc->nblocks = 0;
+	bc->nunits = 0;
+
 	return (struct block_container *)&bc->super;
 
 error_ravl_new:
@@ -17,11 +17,15 @@
 #include "sys_util.h"
 #include "valgrind_internal.h"
 #include "recycler.h"
+#include "container_bitmap.h"
 #include "container_ravl.h"
 #include "container_seglists.h"
 #include "alloc_class.h"
+#include "os.h"
 #include "os_thread.h"
 #include "set.h"
+#include "mmap.h"
+#include "ctl.h"
 
 #define MAX_RUN_LOCKS MAX_CHUNK
 #define MAX_RUN_LOCKS_VG 1024 /* avoid perf issues /w drd */
@@ -32,9 +36,82 @@
 #define HEAP_DEFAULT_GROW_SIZE (1 << 27) /* 128 megabytes */
 #define MAX_DEFAULT_ARENAS (1 << 10) /* 1024 arenas */
 
+/*
+ * Upper limit for the number of blocks a single thread can cache per
+ * allocation class.
+ */
+#define MAX_THREAD_CACHE_SIZE (1 << 10) /* 1024 blocks */
+
+#define MAX_NUMA_NODES 64
+
+/*
+ * The allocation size histogram has one bin per allocation class map entry,
+ * bigger sizes are rare enough for the default classes to fit them well.
+ */
+#define ADAPTIVE_BIN_SIZE 16
+#define ADAPTIVE_MAX_SIZE (1 << 14) /* 16 kilobytes */
+#define ADAPTIVE_NBINS (ADAPTIVE_MAX_SIZE / ADAPTIVE_BIN_SIZE)
+
+/*
+ * Number of samples after which the histogram is evaluated and cleared.
+ */
+#define ADAPTIVE_WINDOW 1024
+
+/*
+ * Percentage of the samples in a window a single bin has to collect for
+ * a class to be derived for it.
+ */
+#define ADAPTIVE_MIN_SHARE 5
+
+#define ADAPTIVE_MAX_CLASSES 32
+#define ADAPTIVE_DEFAULT_SAMPLE_RATE 64
+#define ADAPTIVE_DEFAULT_MAX_WASTE 10
+
+/*
+ * Allocations with a requested alignment are served from runs whose unit size
+ * is a power of two not lower than the alignment. The blocks of such classes
+ * span at most ALIGNED_MAX_UNITS units, and their runs fit at least
+ * ALIGNED_RUN_UNITS units.
+ */
+#define ALIGNED_MIN_UNIT_SIZE_LOG2 6 /* 64 bytes */
+#define ALIGNED_MAX_UNIT_SIZE_LOG2 21 /* 2 megabytes */
+#define ALIGNED_NCLASSES\
+	(ALIGNED_MAX_UNIT_SIZE_LOG2 - ALIGNED_MIN_UNIT_SIZE_LOG2 + 1)
+#define ALIGNED_MAX_UNITS 8
+#define ALIGNED_RUN_UNITS (ALIGNED_MAX_UNITS * 2)
+
+/*
+ * Free chunk extents smaller than this aren't worth returning to the file
+ * system, as they are likely to be reused soon.
+ */
+#define PUNCH_HOLE_DEFAULT_MIN_SIZE (1 << 21) /* 2 megabytes */
+#define PUNCH_HOLE_DEFAULT_INTERVAL 1000 /* milliseconds */
+
+/* position of a chunk in the bitmaps of the punch hole state */
+#define PUNCH_HOLE_CHUNK_IDX(zone_id, chunk_id)\
+	((uint64_t)(zone_id) * MAX_CHUNK + (chunk_id))
+#define PUNCH_HOLE_BITMAP_WORDS(nzones)\
+	((PUNCH_HOLE_CHUNK_IDX(nzones, 0) + 63) / 64)
+
+/*
+ * Upper limit for the number of threads used to boot the pool.
+ */
+#define MAX_BOOT_THREADS (1 << 10) /* 1024 threads */
+
+/*
+ * Number of threads used to recover the lanes and populate the zones when
+ * a pool is opened, 0 means the legacy serial and lazy boot.
+ */
+unsigned Heap_boot_nthreads;
+
+/*
+ * If set, the persistent zone summaries are used to pick the order in which
+ * the zones are populated, and are kept up to date.
+ */
+static int Heap_boot_zone_summary;
+
 struct arenas {
 	VEC(, struct arena *) vec;
-	size_t nactive;
 
 	/*
 	 * When nesting with other locks, this one must be acquired first,
@@ -44,13 +121,44 @@ struct arenas {
 
 	/* stores a pointer to one of the arenas */
 	os_tls_key_t thread;
+
+	/* stores a pointer to the arena explicitly assigned to a thread */
+	os_tls_key_t bound;
+
+	/* one of enum pobj_arena_mode */
+	unsigned mode;
+
+	/*
+	 * In the per-CPU mode, the arenas assigned to the CPUs, NULL for
+	 * CPUs which haven't been used yet.
+	 */
+	struct arena **cpu_arenas;
+	unsigned ncpus;
 };
 
+/* number of arenas of other CPUs tried before waiting for a bucket */
+#define HEAP_CPU_ARENA_ATTEMPTS 4
+
 /*
  * Arenas store the collection of buckets for allocation classes.
  * Each thread is assigned an arena on its first allocator operation
  * if arena is set to auto.
  */
+enum heap_counter {
+	HEAP_COUNTER_ALLOCATIONS,
+	HEAP_COUNTER_FREES,
+	HEAP_COUNTER_ALLOC_BYTES,
+	HEAP_COUNTER_FREE_BYTES,
+	HEAP_COUNTER_LOCK_WAITS,
+	HEAP_COUNTER_CLAIMS,
+
+	MAX_HEAP_COUNTERS
+};
+
+struct heap_counters {
+	uint64_t v[MAX_HEAP_COUNTERS];
+};
+
 struct arena {
 	/* one bucket per allocation class */
 	struct bucket *buckets[MAX_ALLOCATION_CLASSES];
@@ -62,6 +170,267 @@ struct arena {
 	int automatic;
 	size_t nthreads;
 	struct arenas *arenas;
+
+	/* position of the arena in the vector of arenas, starting from 1 */
+	unsigned id;
+
+	/* NUMA node on which the arena prefers to allocate new chunks */
+	unsigned node;
+
+	/* counters flushed by the threads that stopped using the arena */
+	struct heap_counters counters;
+};
+
+/*
+ * Single run block reserved by a thread cache. Just like any other
+ * reservation, it holds a reference to the run it was taken from.
+ */
+struct thread_cache_entry {
+	struct memory_block m;
+	struct memory_block_reserved *mresv;
+};
+
+VEC(thread_cache_bin, struct thread_cache_entry);
+
+/*
+ * Thread caches store small batches of run blocks, reserved up front from
+ * the bucket of the thread's arena, so that most small allocations can be
+ * served without taking the bucket lock.
+ */
+struct thread_cache {
+	struct palloc_heap *heap;
+
+	/*
+	 * Taken by the owning thread whenever it uses the bins, which makes it
+	 * uncontended unless the cache is drained by another thread.
+	 */
+	os_mutex_t lock;
+
+	/* one bin per allocation class */
+	struct thread_cache_bin bins[MAX_ALLOCATION_CLASSES];
+};
+
+struct thread_caches {
+	VEC(, struct thread_cache *) vec;
+
+	/* protects the vector of caches */
+	os_mutex_t lock;
+
+	/* stores a pointer to the cache of the current thread */
+	os_tls_key_t thread;
+
+	/* max number of blocks cached per allocation class, 0 disables */
+	unsigned size;
+};
+
+/*
+ * Statistics counters of a single thread. They are only ever modified by
+ * the owning thread, without atomic read-modify-write operations, and are
+ * summed up when the statistics are read.
+ */
+struct thread_stats {
+	struct palloc_heap *heap;
+
+	/* arena for which the arena counters are gathered */
+	struct arena *arena;
+	struct heap_counters arena_counters;
+
+	struct heap_counters classes[MAX_ALLOCATION_CLASSES];
+};
+
+struct thread_stats_list {
+	VEC(, struct thread_stats *) vec;
+
+	/* protects the vector and the counters of exited threads */
+	os_mutex_t lock;
+
+	/* stores a pointer to the counters of the current thread */
+	os_tls_key_t thread;
+
+	/* counters of the threads that already exited */
+	struct heap_counters classes[MAX_ALLOCATION_CLASSES];
+};
+
+/*
+ * Part of the heap address space backed by a single NUMA node.
+ */
+struct numa_range {
+	uintptr_t start;
+	uintptr_t end;
+	unsigned node;
+};
+
+struct numa_node_stats {
+	/* chunks reserved for threads of the node from its own memory */
+	uint64_t local;
+	/* chunks reserved for threads of the node from other nodes */
+	uint64_t remote;
+};
+
+struct heap_numa {
+	/* if set, arenas and new chunks are placed according to topology */
+	int enabled;
+
+	/* number of nodes backing the heap, 0 if topology is not known */
+	unsigned nnodes;
+
+	/* number of faked nodes, 0 if the real topology is used */
+	unsigned fake_nodes;
+
+	/* one range per pool set part */
+	VEC(, struct numa_range) ranges;
+
+	struct numa_node_stats stats[MAX_NUMA_NODES];
+};
+
+/*
+ * Where the free space of a zone is, see the description of zone_header.
+ */
+struct zone_summary {
+	uint64_t flags;
+	uint64_t run_classes[ZONE_SUMMARY_CLASS_WORDS];
+};
+
+/*
+ * Runtime state of a single zone.
+ */
+struct heap_zone_rt {
+	int populated;
+
+	/* the summary of the zone, as read when the heap was booted */
+	struct zone_summary summary;
+};
+
+struct heap_zones {
+	/* if set, the persistent zone summaries are used and maintained */
+	int summary;
+
+	/* the run id with which the maintained summaries are stamped */
+	uint64_t run_id;
+
+	VEC(, struct heap_zone_rt) vec;
+
+	/* there are no unpopulated zones with free chunks below this one */
+	uint32_t next_free;
+
+	/* there are no unpopulated zones below this one */
+	uint32_t next_any;
+
+	/* number of unpopulated zones with partially-free runs of a class */
+	uint32_t nrun_zones[MAX_ALLOCATION_CLASSES];
+};
+
+/*
+ * Sampled histogram of allocation sizes and the classes that were derived
+ * from it.
+ */
+struct heap_adaptive {
+	/* if set, allocation sizes are sampled and classes are derived */
+	int enabled;
+
+	/* every sample_rate-th allocation of a thread is sampled */
+	unsigned sample_rate;
+
+	/* maximum percentage of a unit that a class may waste */
+	unsigned max_waste;
+
+	/* serializes the derivation of classes */
+	os_mutex_t lock;
+
+	uint64_t nsamples;
+	uint64_t bins[ADAPTIVE_NBINS];
+
+	unsigned nclasses;
+	struct heap_adaptive_class classes[ADAPTIVE_MAX_CLASSES];
+};
+
+/*
+ * State of the reclamation of the file blocks backing idle free chunks.
+ */
+struct heap_punch_hole {
+	/* if set, passes are performed when huge chunks are freed */
+	int enabled;
+
+	/* minimum time between two automatic passes, in milliseconds */
+	uint64_t interval;
+
+	/* minimum size of a free extent for its blocks to be reclaimed */
+	uint64_t min_size;
+
+	/* time of the last pass, in milliseconds */
+	uint64_t last_pass;
+
+	/* total number of bytes returned to the file system */
+	uint64_t reclaimed;
+
+	/*
+	 * Bitmaps of the chunks which were free during the last pass and of
+	 * the chunks whose file blocks were deallocated. A chunk is cleared
+	 * in both once it's taken out of the default bucket. Protected by the
+	 * lock of the default bucket, allocated by the first pass.
+	 */
+	unsigned nzones;
+	uint64_t *idle;
+	uint64_t *punched;
+};
+
+/*
+ * Background extension of the heap. Once all zones are populated and the
+ * default bucket no longer has a free extent of at least the watermark size,
+ * the worker thread extends the heap by the grow size, so that allocations
+ * find the new chunks ready instead of waiting for the file system.
+ */
+struct heap_extender {
+	os_mutex_t lock; /* protects the state of the worker */
+	os_cond_t cond; /* signaled when an extension is requested */
+	os_thread_t thread;
+	int running; /* set once the worker is started */
+	int stop;
+	int requested; /* set if the worker should extend the heap */
+	int failed; /* set if the last background extension failed */
+
+	uint64_t watermark; /* in bytes, 0 if disabled */
+
+	struct heap_extend_stats stats;
+};
+
+#define HEAP_SAMPLE_DEFAULT_CAPACITY 1024
+#define HEAP_SAMPLE_MAX_CAPACITY (1 << 20)
+
+/*
+ * Slot of the ring of sampled allocations. The slots are written and read
+ * without locks, so all of the fields are accessed atomically and the number
+ * of the sample is used to detect the slots overwritten during a read.
+ */
+struct heap_sample {
+	uint64_t seq; /* number of the sample + 1, 0 while it's written */
+	uint64_t size;
+	uint64_t off;
+	uint64_t type_num;
+	uint64_t class_id;
+	uint64_t arena_id;
+	uint64_t frames[POBJ_ALLOC_SAMPLE_FRAMES];
+};
+
+/*
+ * Sampling of allocations, for finding the code responsible for leaks and
+ * fragmentation.
+ */
+struct heap_sampler {
+	/* every rate-th allocation of a thread is sampled, 0 if disabled */
+	unsigned rate;
+
+	/* number of slots in the ring, can't change once it's allocated */
+	uint64_t capacity;
+
+	/* allocated when the sampling is first enabled */
+	struct heap_sample *ring;
+
+	/* number of samples taken so far */
+	uint64_t total;
+
+	/* serializes the changes of the rate and the allocation of the ring */
+	os_mutex_t lock;
 };
 
 struct heap_rt {
@@ -72,6 +441,10 @@ struct heap_rt {
 
 	struct arenas arenas;
 
+	struct thread_caches tcaches;
+
+	struct thread_stats_list tstats;
+
 	struct recycler *recyclers[MAX_ALLOCATION_CLASSES];
 
 	os_mutex_t run_locks[MAX_RUN_LOCKS];
@@ -79,21 +452,74 @@ struct heap_rt {
 
 	unsigned nzones;
 	unsigned zones_exhausted;
+	struct heap_zones zones;
+
+	struct heap_numa numa;
+
+	struct heap_adaptive adaptive;
+
+	struct heap_punch_hole punch_hole;
+
+	struct heap_extender extender;
+
+	struct heap_sampler sampler;
+
+	/*
+	 * Ids of the classes serving the aligned allocations, indexed by the
+	 * log2 of the unit size, 0 if not created yet.
+	 */
+	unsigned aligned_classes[ALIGNED_NCLASSES];
+
+	/*
+	 * If set, the buckets of run classes use containers whose blocks can
+	 * be claimed by multiple threads at once, see heap_claim_block.
+	 */
+	int shared_runs;
 };
 
+/*
+ * Number of allocations the current thread makes before the next one is
+ * sampled.
+ */
+static __thread unsigned Adaptive_countdown;
+
+/*
+ * Number of allocations the current thread makes before the next one is
+ * recorded by the allocation sampler.
+ */
+static __thread unsigned Sample_countdown;
+
+/*
+ * Number of heaps with the allocation sampling enabled, lets the allocations
+ * skip the sampler with a single check while it's not used.
+ */
+unsigned Heap_nsamplers;
+
 /*
  * heap_arenas_init - (internal) initialize generic arenas info
  */
 static int
-heap_arenas_init(struct arenas *arenas)
+heap_arenas_init(struct arenas *arenas, unsigned ncpus)
 {
 	util_mutex_init(&arenas->lock);
 	VEC_INIT(&arenas->vec);
-	arenas->nactive = 0;
+	arenas->mode = POBJ_ARENA_MODE_THREAD;
+	arenas->ncpus = ncpus;
+
+	arenas->cpu_arenas = Zalloc(sizeof(struct arena *) * ncpus);
+	if (arenas->cpu_arenas == NULL)
+		goto error_cpu_arenas;
 
 	if (VEC_RESERVE(&arenas->vec, MAX_DEFAULT_ARENAS) == -1)
-		return -1;
+		goto error_vec_reserve;
+
 	return 0;
+
+error_vec_reserve:
+	Free(arenas->cpu_arenas);
+error_cpu_arenas:
+	util_mutex_destroy(&arenas->lock);
+	return -1;
 }
 
 /*
@@ -102,6 +528,7 @@ heap_arenas_init(struct arenas *arenas)
 static void
 heap_arenas_fini(struct arenas *arenas)
 {
+	Free(arenas->cpu_arenas);
 	util_mutex_destroy(&arenas->lock);
 	VEC_DELETE(&arenas->vec);
 }
@@ -127,11 +554,41 @@ heap_arena_delete(struct arena *arena)
 	Free(arena);
 }
 
+/*
+ * heap_bucket_container_new -- (internal) creates the block container for
+ *	a bucket of the allocation class
+ */
+static struct block_container *
+heap_bucket_container_new(struct palloc_heap *heap, struct alloc_class *c)
+{
+	int shared;
+	util_atomic_load_explicit32(&heap->rt->shared_runs, &shared,
+		memory_order_relaxed);
+
+	return shared && c->type == CLASS_RUN ?
+		container_new_bitmap(heap) : container_new_seglists(heap);
+}
+
+/*
+ * heap_arena_bucket_new -- (internal) creates the bucket of the allocation
+ *	class for the arena
+ */
+static struct bucket *
+heap_arena_bucket_new(struct palloc_heap *heap, struct arena *arena,
+	struct alloc_class *c)
+{
+	struct bucket *b = bucket_new(heap_bucket_container_new(heap, c), c);
+	if (b != NULL)
+		b->arena = arena;
+
+	return b;
+}
+
 /*
  * heap_arena_new -- (internal) initializes arena instance
  */
 static struct arena *
-heap_arena_new(struct palloc_heap *heap, int automatic)
+heap_arena_new(struct palloc_heap *heap, int automatic, unsigned id)
 {
 	struct heap_rt *rt = heap->rt;
 
@@ -143,14 +600,15 @@ heap_arena_new(struct palloc_heap *heap, int automatic)
 	arena->nthreads = 0;
 	arena->automatic = automatic;
 	arena->arenas = &heap->rt->arenas;
+	arena->id = id;
 
 	COMPILE_ERROR_ON(MAX_ALLOCATION_CLASSES > UINT8_MAX);
 	for (uint8_t i = 0; i < MAX_ALLOCATION_CLASSES; ++i) {
 		struct alloc_class *ac =
 			alloc_class_by_id(rt->alloc_classes, i);
 		if (ac != NULL) {
-			arena->buckets[i] =
-				bucket_new(container_new_seglists(heap), ac);
+			arena->buckets[i] = heap_arena_bucket_new(heap,
+				arena, ac);
 			if (arena->buckets[i] == NULL)
 				goto error_bucket_create;
 		} else {
@@ -166,82 +624,291 @@ error_bucket_create:
 }
 
 /*
- * heap_get_best_class -- returns the alloc class that best fits the
- *	requested size
+ * heap_adaptive_register -- (internal) makes a derived class available in
+ *	all arenas and assigns it to the allocation size
  */
-struct alloc_class *
-heap_get_best_class(struct palloc_heap *heap, size_t size)
+static int
+heap_adaptive_register(struct palloc_heap *heap, struct alloc_class *c,
+	size_t size, unsigned waste)
 {
-	return alloc_class_by_alloc_size(heap->rt->alloc_classes, size);
+	struct heap_rt *rt = heap->rt;
+	struct heap_adaptive *a = &rt->adaptive;
+
+	/* the buckets of arenas created from now on are made by the arena */
+	util_mutex_lock(&rt->arenas.lock);
+	int ret = rt->recyclers[c->id] == NULL ?
+		heap_create_alloc_class_buckets(heap, c) : 0;
+	util_mutex_unlock(&rt->arenas.lock);
+
+	if (ret != 0)
+		return -1;
+
+	alloc_class_assign(rt->alloc_classes, size, c);
+
+	struct heap_adaptive_class *ac = &a->classes[a->nclasses];
+	ac->size = size;
+	ac->class_id = c->id;
+	ac->waste = waste;
+	util_atomic_store_explicit32(&a->nclasses, a->nclasses + 1,
+		memory_order_release);
+
+	LOG(3, "derived class %u (unit size %zu) for allocations of %zu "
+		"bytes, previous waste %u%%", c->id, c->unit_size, size,
+		waste);
+
+	return 0;
 }
 
 /*
- * heap_arena_thread_detach -- detaches arena from the current thread
+ * heap_adaptive_derive -- (internal) derives allocation classes for the
+ *	sizes that were sampled often in the last window, and clears the
+ *	histogram
  *
- * Must be called with arenas lock taken.
+ * Must be called with the adaptive lock taken.
  */
 static void
-heap_arena_thread_detach(struct arena *a)
+heap_adaptive_derive(struct palloc_heap *heap)
 {
-	/*
-	 * Even though this is under a lock, nactive variable can also be read
-	 * concurrently from the recycler (without the arenas lock).
-	 * That's why we are using an atomic operation.
-	 */
-	if ((--a->nthreads) == 0)
-		util_fetch_and_sub64(&a->arenas->nactive, 1);
+	struct heap_adaptive *a = &heap->rt->adaptive;
+
+	uint64_t nsamples;
+	util_atomic_load_explicit64(&a->nsamples, &nsamples,
+		memory_order_acquire);
+
+	unsigned max_waste;
+	util_atomic_load_explicit32(&a->max_waste, &max_waste,
+		memory_order_relaxed);
+
+	for (size_t i = 0; i < ADAPTIVE_NBINS; ++i) {
+		uint64_t count;
+		util_atomic_load_explicit64(&a->bins[i], &count,
+			memory_order_relaxed);
+		util_atomic_store_explicit64(&a->bins[i], 0,
+			memory_order_relaxed);
+
+		if (a->nclasses == ADAPTIVE_MAX_CLASSES ||
+		    count * 100 < nsamples * ADAPTIVE_MIN_SHARE)
+			continue;
+
+		size_t size = (i + 1) * ADAPTIVE_BIN_SIZE;
+		unsigned waste;
+		struct alloc_class *c = alloc_class_derive(
+			heap->rt->alloc_classes, size, max_waste, &waste);
+		if (c == NULL)
+			continue;
+
+		if (heap_adaptive_register(heap, c, size, waste) != 0)
+			LOG(2, "unable to register class for %zu bytes", size);
+	}
+
+	util_atomic_store_explicit64(&a->nsamples, 0, memory_order_release);
 }
 
 /*
- * heap_arena_thread_attach -- assign arena to the current thread
- *
- * Must be called with arenas lock taken.
+ * heap_adaptive_sample -- (internal) records the allocation size in the
+ *	histogram if the current allocation is sampled
  */
 static void
-heap_arena_thread_attach(struct palloc_heap *heap, struct arena *a)
+heap_adaptive_sample(struct palloc_heap *heap, size_t size)
 {
-	struct heap_rt *h = heap->rt;
+	struct heap_adaptive *a = &heap->rt->adaptive;
 
-	struct arena *thread_arena = os_tls_get(h->arenas.thread);
-	if (thread_arena)
-		heap_arena_thread_detach(thread_arena);
+	if (Adaptive_countdown != 0) {
+		Adaptive_countdown--;
+		return;
+	}
 
-	ASSERTne(a, NULL);
+	unsigned rate;
+	util_atomic_load_explicit32(&a->sample_rate, &rate,
+		memory_order_relaxed);
+	Adaptive_countdown = rate - 1;
 
-	/*
-	 * Even though this is under a lock, nactive variable can also be read
-	 * concurrently from the recycler (without the arenas lock).
-	 * That's why we are using an atomic operation.
-	 */
-	if ((a->nthreads++) == 0)
-		util_fetch_and_add64(&a->arenas->nactive, 1);
+	util_fetch_and_add64(&a->bins[(size - 1) / ADAPTIVE_BIN_SIZE], 1);
+	uint64_t nsamples = util_fetch_and_add64(&a->nsamples, 1) + 1;
+	if (nsamples < ADAPTIVE_WINDOW)
+		return;
 
-	os_tls_set(h->arenas.thread, a);
+	/* whoever is already deriving the classes will clear the window */
+	if (util_mutex_trylock(&a->lock) != 0)
+		return;
+
+	util_atomic_load_explicit64(&a->nsamples, &nsamples,
+		memory_order_acquire);
+	if (nsamples >= ADAPTIVE_WINDOW)
+		heap_adaptive_derive(heap);
+
+	util_mutex_unlock(&a->lock);
 }
 
 /*
- * heap_thread_arena_destructor -- (internal) removes arena thread assignment
+ * heap_get_best_class -- returns the alloc class that best fits the
+ *	requested size
  */
-static void
-heap_thread_arena_destructor(void *arg)
+struct alloc_class *
+heap_get_best_class(struct palloc_heap *heap, size_t size)
 {
-	struct arena *a = arg;
-	os_mutex_lock(&a->arenas->lock);
-	heap_arena_thread_detach(a);
-	os_mutex_unlock(&a->arenas->lock);
+	struct heap_adaptive *a = &heap->rt->adaptive;
+
+	int enabled;
+	util_atomic_load_explicit32(&a->enabled, &enabled,
+		memory_order_relaxed);
+	if (enabled && size != 0 && size <= ADAPTIVE_MAX_SIZE)
+		heap_adaptive_sample(heap, size);
+
+	return alloc_class_by_alloc_size(heap->rt->alloc_classes, size);
 }
 
 /*
- * heap_get_arena_by_id -- returns arena by id
- *
- * Must be called with arenas lock taken.
+ * heap_get_aligned_class -- returns the alloc class whose blocks fit the
+ *	requested size with the user data aligned to the given alignment, the
+ *	class is created on first use
  */
-static struct arena *
+struct alloc_class *
+heap_get_aligned_class(struct palloc_heap *heap, size_t size,
+	size_t alignment)
+{
+	struct heap_rt *rt = heap->rt;
+
+	ASSERT(util_is_pow2(alignment));
+
+	size_t real_size = size + header_type_to_size[HEADER_COMPACT];
+	unsigned unit_log2 = ALIGNED_MIN_UNIT_SIZE_LOG2;
+	while (unit_log2 <= ALIGNED_MAX_UNIT_SIZE_LOG2 &&
+	    ((1ULL << unit_log2) < alignment ||
+	    ((size_t)ALIGNED_MAX_UNITS << unit_log2) < real_size))
+		unit_log2++;
+
+	if (unit_log2 > ALIGNED_MAX_UNIT_SIZE_LOG2) {
+		ERR("no allocation class for %zu bytes aligned to %zu bytes",
+			size, alignment);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	unsigned *cached =
+		&rt->aligned_classes[unit_log2 - ALIGNED_MIN_UNIT_SIZE_LOG2];
+	unsigned id;
+	util_atomic_load_explicit32(cached, &id, memory_order_acquire);
+	if (id != 0)
+		return alloc_class_by_id(rt->alloc_classes, (uint8_t)id);
+
+	/* the buckets of arenas created from now on are made by the arena */
+	util_mutex_lock(&rt->arenas.lock);
+	struct alloc_class *c = alloc_class_aligned(rt->alloc_classes,
+		1ULL << unit_log2, ALIGNED_RUN_UNITS);
+	if (c != NULL && rt->recyclers[c->id] == NULL &&
+	    heap_create_alloc_class_buckets(heap, c) != 0)
+		c = NULL;
+	if (c != NULL)
+		util_atomic_store_explicit32(cached, c->id,
+			memory_order_release);
+	util_mutex_unlock(&rt->arenas.lock);
+
+	if (c == NULL) {
+		ERR("unable to create an allocation class for %zu bytes "
+			"aligned to %zu bytes", size, alignment);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	LOG(3, "class %u (unit size %zu) for allocations aligned to %zu "
+		"bytes", c->id, c->unit_size, alignment);
+
+	return c;
+}
+
+/*
+ * heap_arena_thread_detach -- detaches arena from the current thread
+ *
+ * Must be called with arenas lock taken.
+ */
+static void
+heap_arena_thread_detach(struct arena *a)
+{
+	--a->nthreads;
+}
+
+/*
+ * heap_arena_attach -- (internal) accounts a new user of the arena, either
+ *	a thread or a CPU
+ *
+ * Must be called with arenas lock taken.
+ */
+static void
+heap_arena_attach(struct arena *a)
+{
+	ASSERTne(a, NULL);
+
+	a->nthreads++;
+}
+
+/*
+ * heap_arena_thread_attach -- assign arena to the current thread
+ *
+ * Must be called with arenas lock taken.
+ */
+static void
+heap_arena_thread_attach(struct palloc_heap *heap, struct arena *a)
+{
+	struct heap_rt *h = heap->rt;
+
+	struct arena *thread_arena = os_tls_get(h->arenas.thread);
+	if (thread_arena)
+		heap_arena_thread_detach(thread_arena);
+
+	heap_arena_attach(a);
+
+	os_tls_set(h->arenas.thread, a);
+}
+
+/*
+ * heap_thread_arena_destructor -- (internal) removes arena thread assignment
+ */
+static void
+heap_thread_arena_destructor(void *arg)
+{
+	struct arena *a = arg;
+	os_mutex_lock(&a->arenas->lock);
+	heap_arena_thread_detach(a);
+	os_mutex_unlock(&a->arenas->lock);
+}
+
+/*
+ * heap_get_arena_by_id -- returns arena by id
+ *
+ * Must be called with arenas lock taken.
+ */
+static struct arena *
 heap_get_arena_by_id(struct palloc_heap *heap, unsigned arena_id)
 {
 	return VEC_ARR(&heap->rt->arenas.vec)[arena_id - 1];
 }
 
+/*
+ * heap_arena_least_used -- (internal) returns the least used automatic arena,
+ *	optionally limited to arenas of the given NUMA node
+ *
+ * Must be called with arenas lock taken.
+ */
+static struct arena *
+heap_arena_least_used(struct palloc_heap *heap, int node)
+{
+	struct arena *least_used = NULL;
+
+	struct arena *a;
+	VEC_FOREACH(a, &heap->rt->arenas.vec) {
+		if (!a->automatic)
+			continue;
+		if (node >= 0 && a->node != (unsigned)node)
+			continue;
+		if (least_used == NULL ||
+			a->nthreads < least_used->nthreads)
+			least_used = a;
+	}
+
+	return least_used;
+}
+
 /*
  * heap_thread_arena_assign -- (internal) assigns the least used arena
  *	to current thread
@@ -260,14 +927,19 @@ heap_thread_arena_assign(struct palloc_heap *heap)
 
 	ASSERTne(VEC_SIZE(&heap->rt->arenas.vec), 0);
 
-	struct arena *a;
-	VEC_FOREACH(a, &heap->rt->arenas.vec) {
-		if (!a->automatic)
-			continue;
-		if (least_used == NULL ||
-			a->nthreads < least_used->nthreads)
-			least_used = a;
-	}
+	/*
+	 * If the heap is NUMA aware, the thread is steered to an arena on
+	 * the node it's currently running on, if there's one.
+	 */
+	unsigned cpu;
+	unsigned node;
+	struct heap_numa *numa = &heap->rt->numa;
+	if (numa->enabled && numa->nnodes > 1 &&
+	    os_getcpu(&cpu, &node) == 0 && node < numa->nnodes)
+		least_used = heap_arena_least_used(heap, (int)node);
+
+	if (least_used == NULL)
+		least_used = heap_arena_least_used(heap, -1);
 
 	LOG(4, "assigning %p arena to current thread", least_used);
 
@@ -280,20 +952,148 @@ heap_thread_arena_assign(struct palloc_heap *heap)
 	return least_used;
 }
 
+/*
+ * heap_cpu_arenas_reset -- (internal) removes the arenas assignment of all
+ *	CPUs, or only of those assigned the given arena if it isn't NULL
+ *
+ * Must be called with arenas lock taken.
+ */
+static void
+heap_cpu_arenas_reset(struct arenas *arenas, struct arena *arena)
+{
+	for (unsigned cpu = 0; cpu < arenas->ncpus; ++cpu) {
+		struct arena *a = arenas->cpu_arenas[cpu];
+		if (a == NULL || (arena != NULL && a != arena))
+			continue;
+
+		heap_arena_thread_detach(a);
+		util_atomic_store_explicit64(&arenas->cpu_arenas[cpu], NULL,
+			memory_order_release);
+	}
+}
+
+/*
+ * heap_cpu_arena_assign -- (internal) assigns the least used automatic arena
+ *	to the CPU, preferring the arenas of the NUMA node of the CPU
+ *
+ * Returns NULL if the per-CPU mode was disabled in the meantime.
+ */
+static struct arena *
+heap_cpu_arena_assign(struct palloc_heap *heap, unsigned cpu)
+{
+	struct arenas *arenas = &heap->rt->arenas;
+
+	util_mutex_lock(&arenas->lock);
+
+	struct arena *a = arenas->cpu_arenas[cpu];
+	if (a != NULL || arenas->mode != POBJ_ARENA_MODE_CPU)
+		goto out;
+
+	unsigned c;
+	unsigned node;
+	struct heap_numa *numa = &heap->rt->numa;
+	if (numa->enabled && numa->nnodes > 1 &&
+	    os_getcpu(&c, &node) == 0 && node < numa->nnodes)
+		a = heap_arena_least_used(heap, (int)node);
+
+	if (a == NULL)
+		a = heap_arena_least_used(heap, -1);
+
+	LOG(4, "assigning %p arena to cpu %u", a, cpu);
+
+	heap_arena_attach(a);
+	util_atomic_store_explicit64(&arenas->cpu_arenas[cpu], a,
+		memory_order_release);
+
+out:
+	util_mutex_unlock(&arenas->lock);
+
+	return a;
+}
+
+/*
+ * heap_cpu_arena -- (internal) returns the arena assigned to the CPU the
+ *	calling thread is running on, or NULL if the arena isn't picked by
+ *	the CPU
+ *
+ * The CPU is only a hint, the thread can be migrated at any moment, which
+ * doesn't affect the correctness because buckets are always locked.
+ */
+static struct arena *
+heap_cpu_arena(struct palloc_heap *heap, unsigned *cpup)
+{
+	struct arenas *arenas = &heap->rt->arenas;
+
+	unsigned mode;
+	util_atomic_load_explicit32(&arenas->mode, &mode,
+		memory_order_relaxed);
+	if (mode != POBJ_ARENA_MODE_CPU)
+		return NULL;
+
+	/* an explicit assignment of the thread takes precedence */
+	if (os_tls_get(arenas->bound) != NULL)
+		return NULL;
+
+	int cpu = os_sched_getcpu();
+	if (cpu < 0)
+		return NULL;
+
+	*cpup = (unsigned)cpu % arenas->ncpus;
+
+	struct arena *a;
+	util_atomic_load_explicit64(&arenas->cpu_arenas[*cpup], &a,
+		memory_order_acquire);
+	if (a == NULL)
+		a = heap_cpu_arena_assign(heap, *cpup);
+
+	return a;
+}
+
 /*
  * heap_thread_arena -- (internal) returns the arena assigned to the current
- *	thread
+ *	thread or, in the per-CPU mode, to the CPU it's running on
  */
 static struct arena *
 heap_thread_arena(struct palloc_heap *heap)
 {
-	struct arena *a;
+	unsigned cpu;
+	struct arena *a = heap_cpu_arena(heap, &cpu);
+	if (a != NULL)
+		return a;
+
 	if ((a = os_tls_get(heap->rt->arenas.thread)) == NULL)
 		a = heap_thread_arena_assign(heap);
 
 	return a;
 }
 
+/*
+ * heap_current_arena -- (internal) returns the arena the operations of the
+ *	calling thread are attributed to, without assigning one
+ */
+static struct arena *
+heap_current_arena(struct palloc_heap *heap)
+{
+	struct arenas *arenas = &heap->rt->arenas;
+
+	unsigned mode;
+	util_atomic_load_explicit32(&arenas->mode, &mode,
+		memory_order_relaxed);
+
+	int cpu;
+	if (mode == POBJ_ARENA_MODE_CPU && os_tls_get(arenas->bound) == NULL &&
+	    (cpu = os_sched_getcpu()) >= 0) {
+		struct arena *a;
+		util_atomic_load_explicit64(
+			&arenas->cpu_arenas[(unsigned)cpu % arenas->ncpus], &a,
+			memory_order_acquire);
+		if (a != NULL)
+			return a;
+	}
+
+	return os_tls_get(arenas->thread);
+}
+
 /*
  * heap_get_thread_arena_id -- returns the arena id assigned to the current
  *	thread
@@ -321,103 +1121,323 @@ heap_get_thread_arena_id(struct palloc_heap *heap)
 }
 
 /*
- * heap_bucket_acquire -- fetches by arena or by id a bucket exclusive
- * for the thread until heap_bucket_release is called
+ * heap_counter_add -- (internal) increases a counter owned by the calling
+ *	thread
  */
-struct bucket *
-heap_bucket_acquire(struct palloc_heap *heap, uint8_t class_id,
-		uint16_t arena_id)
+static inline void
+heap_counter_add(uint64_t *counter, uint64_t value)
 {
-	struct heap_rt *rt = heap->rt;
-	struct bucket *b;
-
-	if (class_id == DEFAULT_ALLOC_CLASS_ID) {
-		b = rt->default_bucket;
-		goto out;
-	}
-
-	if (arena_id == HEAP_ARENA_PER_THREAD) {
-		struct arena *arena = heap_thread_arena(heap);
-		ASSERTne(arena->buckets, NULL);
-		b = arena->buckets[class_id];
-	} else {
-		b = (VEC_ARR(&heap->rt->arenas.vec)
-			[arena_id - 1])->buckets[class_id];
-	}
-
-out:
-	util_mutex_lock(&b->lock);
-
-	return b;
+	util_atomic_store_explicit64(counter, *counter + value,
+		memory_order_relaxed);
 }
 
 /*
- * heap_bucket_release -- puts the bucket back into the heap
+ * heap_thread_stats_flush -- (internal) moves the arena counters of the
+ *	thread to the arena
  */
-void
-heap_bucket_release(struct palloc_heap *heap, struct bucket *b)
+static void
+heap_thread_stats_flush(struct thread_stats *ts)
 {
-	util_mutex_unlock(&b->lock);
+	if (ts->arena == NULL)
+		return;
+
+	for (int i = 0; i < MAX_HEAP_COUNTERS; ++i) {
+		util_fetch_and_add64(&ts->arena->counters.v[i],
+			ts->arena_counters.v[i]);
+		util_atomic_store_explicit64(&ts->arena_counters.v[i], 0,
+			memory_order_relaxed);
+	}
 }
 
 /*
- * heap_get_run_lock -- returns the lock associated with memory block
+ * heap_thread_stats_destructor -- (internal) hands over the counters of an
+ *	exiting thread to the heap
  */
-os_mutex_t *
-heap_get_run_lock(struct palloc_heap *heap, uint32_t chunk_id)
+static void
+heap_thread_stats_destructor(void *arg)
 {
-	return &heap->rt->run_locks[chunk_id % heap->rt->nlocks];
+	struct thread_stats *ts = arg;
+	struct thread_stats_list *list = &ts->heap->rt->tstats;
+
+	util_mutex_lock(&list->lock);
+
+	for (int i = 0; i < MAX_ALLOCATION_CLASSES; ++i)
+		for (int j = 0; j < MAX_HEAP_COUNTERS; ++j)
+			list->classes[i].v[j] += ts->classes[i].v[j];
+
+	heap_thread_stats_flush(ts);
+
+	struct thread_stats **tsp;
+	VEC_FOREACH_BY_PTR(tsp, &list->vec) {
+		if (*tsp == ts) {
+			VEC_ERASE_BY_PTR(&list->vec, tsp);
+			break;
+		}
+	}
+
+	util_mutex_unlock(&list->lock);
+
+	Free(ts);
 }
 
 /*
- * heap_max_zone -- (internal) calculates how many zones can the heap fit
+ * heap_thread_stats -- (internal) returns the counters of the current
+ *	thread, creating them if needed
  */
-static unsigned
-heap_max_zone(size_t size)
+static struct thread_stats *
+heap_thread_stats(struct palloc_heap *heap)
 {
-	unsigned max_zone = 0;
-	size -= sizeof(struct heap_header);
+	struct thread_stats_list *list = &heap->rt->tstats;
 
-	while (size >= ZONE_MIN_SIZE) {
-		max_zone++;
-		size -= size <= ZONE_MAX_SIZE ? size : ZONE_MAX_SIZE;
+	struct thread_stats *ts = os_tls_get(list->thread);
+	if (ts != NULL)
+		return ts;
+
+	ts = Zalloc(sizeof(*ts));
+	if (ts == NULL)
+		return NULL;
+	ts->heap = heap;
+
+	util_mutex_lock(&list->lock);
+	int ret = VEC_PUSH_BACK(&list->vec, ts);
+	util_mutex_unlock(&list->lock);
+
+	if (ret != 0) {
+		Free(ts);
+		return NULL;
 	}
 
-	return max_zone;
+	os_tls_set(list->thread, ts);
+
+	return ts;
 }
 
 /*
- * zone_calc_size_idx -- (internal) calculates zone size index
+ * heap_stats_count -- (internal) increases the counter of the allocation
+ *	class and, if provided, of the arena
  */
-static uint32_t
-zone_calc_size_idx(uint32_t zone_id, unsigned max_zone, size_t heap_size)
+static void
+heap_stats_count(struct palloc_heap *heap, struct arena *arena,
+	uint8_t class_id, enum heap_counter counter, uint64_t value)
 {
-	ASSERT(max_zone > 0);
-	if (zone_id < max_zone - 1)
-		return MAX_CHUNK;
+	if (heap->stats == NULL || !STATS_ENABLED(heap->stats, transient))
+		return;
 
-	ASSERT(heap_size >= zone_id * ZONE_MAX_SIZE);
-	size_t zone_raw_size = heap_size - zone_id * ZONE_MAX_SIZE;
+	struct thread_stats *ts = heap_thread_stats(heap);
+	if (ts == NULL)
+		return;
 
-	ASSERT(zone_raw_size >= (sizeof(struct zone_header) +
-			sizeof(struct chunk_header) * MAX_CHUNK) +
-			sizeof(struct heap_header));
-	zone_raw_size -= sizeof(struct zone_header) +
-		sizeof(struct chunk_header) * MAX_CHUNK +
-		sizeof(struct heap_header);
+	heap_counter_add(&ts->classes[class_id].v[counter], value);
 
-	size_t zone_size_idx = zone_raw_size / CHUNKSIZE;
-	ASSERT(zone_size_idx <= UINT32_MAX);
+	if (arena == NULL)
+		return;
 
-	return (uint32_t)zone_size_idx;
+	/* threads rarely switch arenas, so only the last one is tracked */
+	if (ts->arena != arena) {
+		heap_thread_stats_flush(ts);
+		ts->arena = arena;
+	}
+
+	heap_counter_add(&ts->arena_counters.v[counter], value);
 }
 
 /*
- * heap_zone_init -- (internal) writes zone's first chunk and header
+ * heap_get_arena -- returns the arena of the given id, or NULL for the arena
+ *	of the calling thread
+ *
+ * The arena is looked up the same way its buckets are by
+ * heap_bucket_acquire(), so the reservations from explicit arenas can keep
+ * the pointer instead of looking it up again when they are published.
  */
-static void
-heap_zone_init(struct palloc_heap *heap, uint32_t zone_id,
-	uint32_t first_chunk_id)
+struct arena *
+heap_get_arena(struct palloc_heap *heap, uint16_t arena_id)
+{
+	if (arena_id == HEAP_ARENA_PER_THREAD)
+		return NULL;
+
+	return VEC_ARR(&heap->rt->arenas.vec)[arena_id - 1];
+}
+
+/*
+ * heap_stats_on_alloc -- accounts a published allocation in the statistics,
+ *	the allocations reserved from the arena of the thread are attributed to
+ *	the arena of the publishing thread
+ */
+void
+heap_stats_on_alloc(struct palloc_heap *heap, uint8_t class_id,
+	struct arena *arena, size_t size)
+{
+	if (heap->stats == NULL || !STATS_ENABLED(heap->stats, transient))
+		return;
+
+	if (arena == NULL)
+		arena = heap_current_arena(heap);
+
+	heap_stats_count(heap, arena, class_id, HEAP_COUNTER_ALLOCATIONS, 1);
+	heap_stats_count(heap, arena, class_id, HEAP_COUNTER_ALLOC_BYTES,
+		size);
+}
+
+/*
+ * heap_stats_on_free -- (internal) accounts a free in the statistics, the
+ *	free is attributed to the arena of the calling thread
+ */
+static void
+heap_stats_on_free(struct palloc_heap *heap, uint8_t class_id,
+	const struct memory_block *m)
+{
+	struct arena *arena = heap_current_arena(heap);
+
+	heap_stats_count(heap, arena, class_id, HEAP_COUNTER_FREES, 1);
+	heap_stats_count(heap, arena, class_id, HEAP_COUNTER_FREE_BYTES,
+		m->m_ops->get_real_size(m));
+}
+
+/*
+ * heap_cpu_bucket_acquire -- (internal) locks the bucket of the arena of the
+ *	current CPU or, if it's busy, of one of the arenas of the next CPUs,
+ *	waits for the bucket of its own arena only if all of them are busy
+ */
+static struct bucket *
+heap_cpu_bucket_acquire(struct palloc_heap *heap, uint8_t class_id)
+{
+	struct arenas *arenas = &heap->rt->arenas;
+
+	unsigned cpu;
+	struct arena *home = heap_cpu_arena(heap, &cpu);
+	if (home == NULL)
+		return NULL;
+
+	struct bucket *b = home->buckets[class_id];
+	if (util_mutex_trylock(&b->lock) == 0)
+		return b;
+
+	unsigned attempts = arenas->ncpus - 1;
+	if (attempts > HEAP_CPU_ARENA_ATTEMPTS)
+		attempts = HEAP_CPU_ARENA_ATTEMPTS;
+	for (unsigned i = 1; i <= attempts; ++i) {
+		struct arena *a;
+		util_atomic_load_explicit64(
+			&arenas->cpu_arenas[(cpu + i) % arenas->ncpus], &a,
+			memory_order_acquire);
+		if (a == NULL || a == home)
+			continue;
+
+		if (util_mutex_trylock(&a->buckets[class_id]->lock) == 0)
+			return a->buckets[class_id];
+	}
+
+	heap_stats_count(heap, home, class_id, HEAP_COUNTER_LOCK_WAITS, 1);
+	util_mutex_lock(&b->lock);
+
+	return b;
+}
+
+/*
+ * heap_bucket_acquire -- fetches by arena or by id a bucket exclusive
+ * for the thread until heap_bucket_release is called
+ */
+struct bucket *
+heap_bucket_acquire(struct palloc_heap *heap, uint8_t class_id,
+		uint16_t arena_id)
+{
+	struct heap_rt *rt = heap->rt;
+	struct arena *arena = NULL;
+	struct bucket *b;
+
+	if (class_id == DEFAULT_ALLOC_CLASS_ID) {
+		b = rt->default_bucket;
+		goto out;
+	}
+
+	if (arena_id == HEAP_ARENA_PER_THREAD) {
+		if ((b = heap_cpu_bucket_acquire(heap, class_id)) != NULL)
+			return b;
+
+		arena = heap_thread_arena(heap);
+		ASSERTne(arena->buckets, NULL);
+	} else {
+		arena = heap_get_arena(heap, arena_id);
+	}
+	b = arena->buckets[class_id];
+
+out:
+	if (util_mutex_trylock(&b->lock) != 0) {
+		heap_stats_count(heap, arena, class_id,
+			HEAP_COUNTER_LOCK_WAITS, 1);
+		util_mutex_lock(&b->lock);
+	}
+
+	return b;
+}
+
+/*
+ * heap_bucket_release -- puts the bucket back into the heap
+ */
+void
+heap_bucket_release(struct palloc_heap *heap, struct bucket *b)
+{
+	util_mutex_unlock(&b->lock);
+}
+
+/*
+ * heap_get_run_lock -- returns the lock associated with memory block
+ */
+os_mutex_t *
+heap_get_run_lock(struct palloc_heap *heap, uint32_t chunk_id)
+{
+	return &heap->rt->run_locks[chunk_id % heap->rt->nlocks];
+}
+
+/*
+ * heap_max_zone -- (internal) calculates how many zones can the heap fit
+ */
+static unsigned
+heap_max_zone(size_t size)
+{
+	unsigned max_zone = 0;
+	size -= sizeof(struct heap_header);
+
+	while (size >= ZONE_MIN_SIZE) {
+		max_zone++;
+		size -= size <= ZONE_MAX_SIZE ? size : ZONE_MAX_SIZE;
+	}
+
+	return max_zone;
+}
+
+/*
+ * zone_calc_size_idx -- (internal) calculates zone size index
+ */
+static uint32_t
+zone_calc_size_idx(uint32_t zone_id, unsigned max_zone, size_t heap_size)
+{
+	ASSERT(max_zone > 0);
+	if (zone_id < max_zone - 1)
+		return MAX_CHUNK;
+
+	ASSERT(heap_size >= zone_id * ZONE_MAX_SIZE);
+	size_t zone_raw_size = heap_size - zone_id * ZONE_MAX_SIZE;
+
+	ASSERT(zone_raw_size >= (sizeof(struct zone_header) +
+			sizeof(struct chunk_header) * MAX_CHUNK) +
+			sizeof(struct heap_header));
+	zone_raw_size -= sizeof(struct zone_header) +
+		sizeof(struct chunk_header) * MAX_CHUNK +
+		sizeof(struct heap_header);
+
+	size_t zone_size_idx = zone_raw_size / CHUNKSIZE;
+	ASSERT(zone_size_idx <= UINT32_MAX);
+
+	return (uint32_t)zone_size_idx;
+}
+
+/*
+ * heap_zone_init -- (internal) writes zone's first chunk and header
+ */
+static void
+heap_zone_init(struct palloc_heap *heap, uint32_t zone_id,
+	uint32_t first_chunk_id)
 {
 	struct zone *z = ZID_TO_ZONE(heap->layout, zone_id);
 	uint32_t size_idx = zone_calc_size_idx(zone_id, heap->rt->nzones,
@@ -427,855 +1447,3604 @@ heap_zone_init(struct palloc_heap *heap, uint32_t zone_id,
 	memblock_huge_init(heap, first_chunk_id, zone_id,
 		size_idx - first_chunk_id);
 
-	struct zone_header nhdr = {
-		.size_idx = size_idx,
-		.magic = ZONE_HEADER_MAGIC,
-	};
-	z->header = nhdr; /* write the entire header (8 bytes) at once */
-	pmemops_persist(&heap->p_ops, &z->header, sizeof(z->header));
+	struct zone_header nhdr = {
+		.size_idx = size_idx,
+		.magic = ZONE_HEADER_MAGIC,
+	};
+	z->header = nhdr; /* write the entire header (8 bytes) at once */
+	pmemops_persist(&heap->p_ops, &z->header, sizeof(z->header));
+}
+
+#define ZONE_SUMMARY_CLASS_WORD(id) ((id) / 64)
+#define ZONE_SUMMARY_CLASS_BIT(id) (1ULL << ((id) % 64))
+
+/*
+ * zone_summary_add_class -- (internal) records a partially-free run of the
+ *	given class in the summary
+ */
+static inline void
+zone_summary_add_class(struct zone_summary *s, uint8_t class_id)
+{
+	s->run_classes[ZONE_SUMMARY_CLASS_WORD(class_id)] |=
+		ZONE_SUMMARY_CLASS_BIT(class_id);
+}
+
+/*
+ * zone_summary_has_class -- (internal) checks whether the summary reports
+ *	partially-free runs of the given class
+ */
+static inline int
+zone_summary_has_class(const struct zone_summary *s, uint8_t class_id)
+{
+	return (s->run_classes[ZONE_SUMMARY_CLASS_WORD(class_id)] &
+		ZONE_SUMMARY_CLASS_BIT(class_id)) != 0;
+}
+
+/*
+ * zone_summary_has_free_chunks -- (internal) checks whether the zone might
+ *	have free chunks, which is assumed if the summary is not valid
+ */
+static inline int
+zone_summary_has_free_chunks(const struct zone_summary *s)
+{
+	return (s->flags & ZONE_SUMMARY_VALID) == 0 ||
+		(s->flags & ZONE_SUMMARY_FREE_CHUNKS) != 0;
+}
+
+/* the version bits of the flags of the summaries written by this library */
+#define ZONE_SUMMARY_VERSION_FLAGS\
+	(ZONE_SUMMARY_VERSION << ZONE_SUMMARY_VERSION_SHIFT)
+
+/*
+ * heap_zone_summary_trusted -- (internal) checks whether the persistent
+ *	summary of the zone was maintained by the previous instance of the pool
+ *
+ * Any other instance in between (a library which doesn't know about the
+ * summaries, or one which had them disabled) might have freed some memory
+ * without recording it, so the summary is only a hint if the run id
+ * matches.
+ */
+static int
+heap_zone_summary_trusted(struct heap_zones *zs, const struct zone_header *hdr)
+{
+	/* run_id is incremented by 2 on every open, skipping 0 */
+	uint64_t prev_run_id = zs->run_id == 2 ? UINT64_MAX - 1 :
+		zs->run_id - 2;
+
+	return (hdr->summary_flags & ZONE_SUMMARY_VALID) &&
+		(hdr->summary_flags & ZONE_SUMMARY_VERSION_MASK) ==
+			ZONE_SUMMARY_VERSION_FLAGS &&
+		hdr->summary_run_id == prev_run_id;
+}
+
+/*
+ * heap_zone_summary_invalidate -- (internal) marks the persistent summary of
+ *	the zone as invalid, so that it's ignored when the heap is booted
+ */
+static void
+heap_zone_summary_invalidate(struct palloc_heap *heap, uint32_t zone_id)
+{
+	struct zone_header *hdr = &ZID_TO_ZONE(heap->layout, zone_id)->header;
+
+	uint64_t flags;
+	util_atomic_load_explicit64(&hdr->summary_flags, &flags,
+		memory_order_acquire);
+	if ((flags & ZONE_SUMMARY_VALID) == 0)
+		return;
+
+	util_fetch_and_and64(&hdr->summary_flags,
+		~(uint64_t)ZONE_SUMMARY_VALID);
+	pmemops_persist(&heap->p_ops, &hdr->summary_flags,
+		sizeof(hdr->summary_flags));
+}
+
+/*
+ * heap_zone_summary_reset -- (internal) clears the persistent summary of
+ *	the zone before it's rebuilt by populating the zone
+ *
+ * The summary is only ever modified with atomic read-modify-write operations,
+ * so that the bits set by concurrent frees in the zone are never lost.
+ */
+static void
+heap_zone_summary_reset(struct palloc_heap *heap, uint32_t zone_id)
+{
+	struct zone_header *hdr = &ZID_TO_ZONE(heap->layout, zone_id)->header;
+
+	/* the summary must be invalid before any of its bits is cleared */
+	util_fetch_and_and64(&hdr->summary_flags, 0);
+	pmemops_persist(&heap->p_ops, &hdr->summary_flags,
+		sizeof(hdr->summary_flags));
+
+	for (unsigned i = 0; i < ZONE_SUMMARY_CLASS_WORDS; ++i)
+		util_fetch_and_and64(&hdr->summary_run_classes[i], 0);
+	pmemops_persist(&heap->p_ops, hdr->summary_run_classes,
+		sizeof(hdr->summary_run_classes));
+}
+
+/*
+ * heap_zone_summary_store -- (internal) records the summary of the zone
+ *	built when the zone was populated and marks it as valid
+ */
+static void
+heap_zone_summary_store(struct palloc_heap *heap, uint32_t zone_id,
+	const struct zone_summary *s)
+{
+	struct zone_header *hdr = &ZID_TO_ZONE(heap->layout, zone_id)->header;
+
+	for (unsigned i = 0; i < ZONE_SUMMARY_CLASS_WORDS; ++i) {
+		if (s->run_classes[i] != 0)
+			util_fetch_and_or64(&hdr->summary_run_classes[i],
+				s->run_classes[i]);
+	}
+	util_atomic_store_explicit64(&hdr->summary_run_id,
+		heap->rt->zones.run_id, memory_order_release);
+	pmemops_persist(&heap->p_ops, hdr->summary_run_classes,
+		sizeof(hdr->summary_run_classes) +
+		sizeof(hdr->summary_run_id));
+
+	util_fetch_and_or64(&hdr->summary_flags,
+		s->flags | ZONE_SUMMARY_VALID | ZONE_SUMMARY_VERSION_FLAGS);
+	pmemops_persist(&heap->p_ops, &hdr->summary_flags,
+		sizeof(hdr->summary_flags));
+}
+
+/*
+ * heap_zone_summary_update -- (internal) records new free space in the
+ *	persistent summary of the zone, either free chunks (if c is NULL) or
+ *	a partially-free run of the class
+ *
+ * The summary is only written when a bit actually changes, which happens at
+ * most once per bit after the zone is populated, so this is cheap enough to
+ * be done on every free. If the summaries are disabled, the summary of
+ * the zone is invalidated instead, because it no longer describes the zone.
+ */
+static void
+heap_zone_summary_update(struct palloc_heap *heap, uint32_t zone_id,
+	const struct alloc_class *c)
+{
+	if (!heap->rt->zones.summary) {
+		heap_zone_summary_invalidate(heap, zone_id);
+		return;
+	}
+
+	struct zone_header *hdr = &ZID_TO_ZONE(heap->layout, zone_id)->header;
+
+	uint64_t *word = c == NULL ? &hdr->summary_flags :
+		&hdr->summary_run_classes[ZONE_SUMMARY_CLASS_WORD(c->id)];
+	uint64_t bits = c == NULL ? ZONE_SUMMARY_FREE_CHUNKS :
+		ZONE_SUMMARY_CLASS_BIT(c->id);
+
+	uint64_t cur;
+	util_atomic_load_explicit64(word, &cur, memory_order_acquire);
+	if ((cur & bits) == bits)
+		return;
+
+	util_fetch_and_or64(word, bits);
+	pmemops_persist(&heap->p_ops, word, sizeof(*word));
+}
+
+/*
+ * heap_zone_summary_on_free -- records the block which is about to be freed
+ *	in the persistent summary of its zone
+ *
+ * This is called before the free is made persistent, so that the summary
+ * covers the freed block even if the pool is interrupted right after that.
+ */
+void
+heap_zone_summary_on_free(struct palloc_heap *heap,
+	const struct memory_block *m)
+{
+	if (!heap->rt->zones.summary || m->type != MEMORY_BLOCK_RUN) {
+		heap_zone_summary_update(heap, m->zone_id, NULL);
+		return;
+	}
+
+	struct chunk_header *hdr = heap_get_chunk_hdr(heap, m);
+	struct chunk_run *run = heap_get_chunk_run(heap, m);
+
+	struct alloc_class *c = alloc_class_by_run(
+		heap->rt->alloc_classes,
+		run->hdr.block_size, hdr->flags, hdr->size_idx);
+
+	if (c == NULL)
+		heap_zone_summary_invalidate(heap, m->zone_id);
+	else
+		heap_zone_summary_update(heap, m->zone_id, c);
+}
+
+/*
+ * heap_zones_grow -- (internal) creates the runtime state of the zones
+ *	up to nzones, reading their persistent summaries
+ */
+static int
+heap_zones_grow(struct palloc_heap *heap, uint32_t nzones)
+{
+	struct heap_zones *zs = &heap->rt->zones;
+
+	for (uint32_t i = (uint32_t)VEC_SIZE(&zs->vec); i < nzones; ++i) {
+		struct heap_zone_rt z;
+		z.populated = 0;
+		memset(&z.summary, 0, sizeof(z.summary));
+
+		struct zone_header *hdr = &ZID_TO_ZONE(heap->layout, i)->header;
+		if (zs->summary && hdr->magic == ZONE_HEADER_MAGIC) {
+			/* the summary is updated outside of transactions */
+			VALGRIND_ADD_TO_GLOBAL_TX_IGNORE(hdr, sizeof(*hdr));
+
+			if (heap_zone_summary_trusted(zs, hdr)) {
+				z.summary.flags = hdr->summary_flags;
+				memcpy(z.summary.run_classes,
+					hdr->summary_run_classes,
+					sizeof(z.summary.run_classes));
+
+				/* from now on, maintained by this instance */
+				hdr->summary_run_id = zs->run_id;
+				pmemops_persist(&heap->p_ops,
+					&hdr->summary_run_id,
+					sizeof(hdr->summary_run_id));
+			} else {
+				heap_zone_summary_invalidate(heap, i);
+			}
+		}
+
+		if (VEC_PUSH_BACK(&zs->vec, z) != 0)
+			return -1;
+
+		for (unsigned c = 0; c < MAX_ALLOCATION_CLASSES; ++c) {
+			if (zone_summary_has_class(&z.summary, (uint8_t)c))
+				zs->nrun_zones[c]++;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * heap_zones_init -- (internal) creates the runtime state of all zones
+ */
+static int
+heap_zones_init(struct palloc_heap *heap, uint64_t run_id)
+{
+	struct heap_zones *zs = &heap->rt->zones;
+
+	util_atomic_load_explicit32(&Heap_boot_zone_summary, &zs->summary,
+		memory_order_acquire);
+	zs->run_id = run_id;
+	VEC_INIT(&zs->vec);
+	zs->next_free = 0;
+	zs->next_any = 0;
+	memset(zs->nrun_zones, 0, sizeof(zs->nrun_zones));
+
+	if (heap_zones_grow(heap, heap->rt->nzones) != 0) {
+		VEC_DELETE(&zs->vec);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * heap_zone_mark_populated -- (internal) marks the zone as populated
+ */
+static void
+heap_zone_mark_populated(struct palloc_heap *heap, uint32_t zone_id)
+{
+	struct heap_rt *h = heap->rt;
+	struct heap_zone_rt *z = VEC_GET(&h->zones.vec, zone_id);
+
+	ASSERTeq(z->populated, 0);
+	z->populated = 1;
+	h->zones_exhausted++;
+
+	STATS_INC(heap->stats, transient, heap_zones_populated, 1);
+
+	for (unsigned c = 0; c < MAX_ALLOCATION_CLASSES; ++c) {
+		if (zone_summary_has_class(&z->summary, (uint8_t)c))
+			h->zones.nrun_zones[c]--;
+	}
+}
+
+/*
+ * heap_zone_claim -- (internal) picks the next zone to be populated
+ *
+ * The zones with partially-free runs of the requested class are preferred,
+ * then the zones which might have free chunks, and only then the ones that
+ * are known to be full. Without the summaries, this always picks the first
+ * unpopulated zone.
+ */
+static uint32_t
+heap_zone_claim(struct palloc_heap *heap, uint8_t class_id)
+{
+	struct heap_rt *h = heap->rt;
+	struct heap_zones *zs = &h->zones;
+	struct heap_zone_rt *z;
+	uint32_t zone_id;
+
+	ASSERT(h->zones_exhausted < h->nzones);
+
+	if (class_id != DEFAULT_ALLOC_CLASS_ID &&
+	    zs->nrun_zones[class_id] != 0) {
+		for (zone_id = zs->next_any; zone_id < h->nzones; ++zone_id) {
+			z = VEC_GET(&zs->vec, zone_id);
+			if (!z->populated &&
+			    zone_summary_has_class(&z->summary, class_id))
+				goto out;
+		}
+	}
+
+	for (; zs->next_free < h->nzones; ++zs->next_free) {
+		z = VEC_GET(&zs->vec, zs->next_free);
+		if (!z->populated &&
+		    zone_summary_has_free_chunks(&z->summary)) {
+			zone_id = zs->next_free++;
+			goto out;
+		}
+	}
+
+	for (; zs->next_any < h->nzones; ++zs->next_any) {
+		z = VEC_GET(&zs->vec, zs->next_any);
+		if (!z->populated) {
+			zone_id = zs->next_any++;
+			goto out;
+		}
+	}
+
+	ASSERT(0);
+	zone_id = 0;
+
+out:
+	heap_zone_mark_populated(heap, zone_id);
+
+	return zone_id;
+}
+
+/*
+ * heap_memblock_insert_block -- (internal) bucket insert wrapper for callbacks
+ */
+static int
+heap_memblock_insert_block(const struct memory_block *m, void *b)
+{
+	return bucket_insert_block(b, m);
+}
+
+/*
+ * heap_bucket_activate -- (internal) makes the run the active memory block of
+ *	the bucket, the blocks of the run were already inserted into the bucket
+ */
+static void
+heap_bucket_activate(struct bucket *b, const struct memory_block *m)
+{
+	util_rwlock_wrlock(&b->claim_lock);
+
+	b->active_memory_block->m = *m;
+	b->active_memory_block->bucket = b;
+	b->is_active = 1;
+	util_fetch_and_add64(&b->active_memory_block->nresv, 1);
+
+	util_rwlock_unlock(&b->claim_lock);
+}
+
+/*
+ * heap_run_create -- (internal) initializes a new run on an existing free chunk
+ */
+static int
+heap_run_create(struct palloc_heap *heap, struct bucket *b,
+	struct memory_block *m)
+{
+	/* the summary must cover the run before it's created */
+	heap_zone_summary_update(heap, m->zone_id, b->aclass);
+
+	*m = memblock_run_init(heap, m->chunk_id, m->zone_id, &b->aclass->rdsc);
+
+	if (m->m_ops->iterate_free(m, heap_memblock_insert_block, b) != 0) {
+		b->c_ops->rm_all(b->container);
+		return -1;
+	}
+
+	STATS_INC(heap->stats, transient, heap_run_active,
+		m->size_idx * CHUNKSIZE);
+
+	return 0;
+}
+
+/*
+ * heap_run_reuse -- (internal) reuses existing run
+ */
+static int
+heap_run_reuse(struct palloc_heap *heap, struct bucket *b,
+	const struct memory_block *m)
+{
+	int ret = 0;
+
+	ASSERTeq(m->type, MEMORY_BLOCK_RUN);
+	os_mutex_t *lock = m->m_ops->get_lock(m);
+
+	util_mutex_lock(lock);
+
+	ret = m->m_ops->iterate_free(m, heap_memblock_insert_block, b);
+
+	util_mutex_unlock(lock);
+
+	if (ret == 0)
+		heap_bucket_activate(b, m);
+	else
+		b->c_ops->rm_all(b->container);
+
+	return ret;
+}
+
+/*
+ * heap_free_chunk_reuse -- reuses existing free chunk
+ */
+int
+heap_free_chunk_reuse(struct palloc_heap *heap,
+	struct bucket *bucket,
+	struct memory_block *m)
+{
+	/*
+	 * Perform coalescing just in case there
+	 * are any neighboring free chunks.
+	 */
+	struct memory_block nm = heap_coalesce_huge(heap, bucket, m);
+	if (nm.size_idx != m->size_idx) {
+		m->m_ops->prep_hdr(&nm, MEMBLOCK_FREE, NULL);
+	}
+
+	*m = nm;
+
+	return bucket_insert_block(bucket, m);
+}
+
+/*
+ * heap_run_into_free_chunk -- (internal) creates a new free chunk in place of
+ *	a run.
+ */
+static void
+heap_run_into_free_chunk(struct palloc_heap *heap,
+	struct bucket *bucket,
+	struct memory_block *m)
+{
+	struct chunk_header *hdr = heap_get_chunk_hdr(heap, m);
+
+	m->block_off = 0;
+	m->size_idx = hdr->size_idx;
+
+	STATS_SUB(heap->stats, transient, heap_run_active,
+		m->size_idx * CHUNKSIZE);
+
+	/*
+	 * The only thing this could race with is heap_memblock_on_free()
+	 * because that function is called after processing the operation,
+	 * which means that a different thread might immediately call this
+	 * function if the free() made the run empty.
+	 * We could forgo this lock if it weren't for helgrind which needs it
+	 * to establish happens-before relation for the chunk metadata.
+	 */
+	os_mutex_t *lock = m->m_ops->get_lock(m);
+	util_mutex_lock(lock);
+
+	*m = memblock_huge_init(heap, m->chunk_id, m->zone_id, m->size_idx);
+
+	heap_free_chunk_reuse(heap, bucket, m);
+
+	util_mutex_unlock(lock);
+}
+
+/*
+ * heap_reclaim_run -- checks the run for available memory if unclaimed.
+ *
+ * The summary is only provided at startup, when the zone is being populated,
+ * and it's updated with the class of the run if the run is partially free.
+ *
+ * Returns 1 if reclaimed chunk, 0 otherwise.
+ */
+static int
+heap_reclaim_run(struct palloc_heap *heap, struct memory_block *m,
+	struct zone_summary *summary)
+{
+	struct chunk_run *run = heap_get_chunk_run(heap, m);
+	struct chunk_header *hdr = heap_get_chunk_hdr(heap, m);
+
+	struct alloc_class *c = alloc_class_by_run(
+		heap->rt->alloc_classes,
+		run->hdr.block_size, hdr->flags, m->size_idx);
+
+	/*
+	 * The free space of the run is calculated and the run is put into
+	 * the recycler under the run lock, which is also held by the frees
+	 * when they account the block in the recycler. Otherwise, a free
+	 * could be counted both in the bitmap and by the recycler.
+	 */
+	os_mutex_t *lock = m->m_ops->get_lock(m);
+	util_mutex_lock(lock);
+
+	struct recycler_element e = {
+		.free_space = 0,
+		.max_free_block = 0,
+		.chunk_id = m->chunk_id,
+		.zone_id = m->zone_id,
+	};
+	m->m_ops->calc_free(m, &e.free_space, &e.max_free_block);
+
+	int empty;
+	if (c == NULL) {
+		uint32_t size_idx = m->size_idx;
+		struct run_bitmap b;
+		m->m_ops->get_bitmap(m, &b);
+
+		ASSERTeq(size_idx, m->size_idx);
+
+		empty = e.free_space == b.nbits;
+		goto out;
+	}
+
+	empty = e.free_space == c->rdsc.nallocs;
+	if (empty)
+		goto out;
+
+	if (summary != NULL) {
+		STATS_INC(heap->stats, transient, heap_run_active,
+			m->size_idx * CHUNKSIZE);
+		STATS_INC(heap->stats, transient, heap_run_allocated,
+			c->rdsc.nallocs - e.free_space);
+		if (e.free_space != 0)
+			zone_summary_add_class(summary, c->id);
+	}
+
+	if (recycler_put(heap->rt->recyclers[c->id], m, e) < 0)
+		ERR("lost runtime tracking info of %u run due to OOM", c->id);
+
+out:
+	util_mutex_unlock(lock);
+
+	return empty;
+}
+
+/*
+ * heap_reclaim_zone_garbage -- (internal) creates volatile state of unused runs
+ *	and builds the summary of the zone
+ */
+static void
+heap_reclaim_zone_garbage(struct palloc_heap *heap, struct bucket *bucket,
+	uint32_t zone_id, struct zone_summary *summary)
+{
+	struct zone *z = ZID_TO_ZONE(heap->layout, zone_id);
+
+	for (uint32_t i = 0; i < z->header.size_idx; ) {
+		struct chunk_header *hdr = &z->chunk_headers[i];
+		ASSERT(hdr->size_idx != 0);
+
+		struct memory_block m = MEMORY_BLOCK_NONE;
+		m.zone_id = zone_id;
+		m.chunk_id = i;
+		m.size_idx = hdr->size_idx;
+
+		memblock_rebuild_state(heap, &m);
+		m.m_ops->reinit_chunk(&m);
+
+		switch (hdr->type) {
+			case CHUNK_TYPE_RUN:
+				if (heap_reclaim_run(heap, &m, summary) != 0) {
+					heap_run_into_free_chunk(heap, bucket,
+						&m);
+					summary->flags |=
+						ZONE_SUMMARY_FREE_CHUNKS;
+				}
+				break;
+			case CHUNK_TYPE_FREE:
+				heap_free_chunk_reuse(heap, bucket, &m);
+				summary->flags |= ZONE_SUMMARY_FREE_CHUNKS;
+				break;
+			case CHUNK_TYPE_USED:
+				break;
+			default:
+				ASSERT(0);
+		}
+
+		i = m.chunk_id + m.size_idx; /* hdr might have changed */
+	}
+}
+
+/*
+ * heap_zone_populate -- (internal) creates volatile state of the memory blocks
+ *	of a single zone
+ */
+static void
+heap_zone_populate(struct palloc_heap *heap, struct bucket *bucket,
+	uint32_t zone_id)
+{
+	struct zone *z = ZID_TO_ZONE(heap->layout, zone_id);
+
+	/* ignore zone and chunk headers */
+	VALGRIND_ADD_TO_GLOBAL_TX_IGNORE(z, sizeof(z->header) +
+		sizeof(z->chunk_headers));
+
+	if (z->header.magic != ZONE_HEADER_MAGIC)
+		heap_zone_init(heap, zone_id, 0);
+
+	struct zone_summary summary;
+	memset(&summary, 0, sizeof(summary));
+	summary.flags = ZONE_SUMMARY_VALID;
+
+	if (heap->rt->zones.summary)
+		heap_zone_summary_reset(heap, zone_id);
+
+	heap_reclaim_zone_garbage(heap, bucket, zone_id, &summary);
+
+	if (heap->rt->zones.summary)
+		heap_zone_summary_store(heap, zone_id, &summary);
+}
+
+/*
+ * heap_populate_bucket -- (internal) creates volatile state of memory blocks
+ *
+ * The class for which the memory is needed is used to pick the most useful
+ * zone, it's the default class if free chunks are needed.
+ */
+static int
+heap_populate_bucket(struct palloc_heap *heap, struct bucket *bucket,
+	uint8_t class_id)
+{
+	struct heap_rt *h = heap->rt;
+
+	/* at this point we are sure that there's no more memory in the heap */
+	if (h->zones_exhausted == h->nzones)
+		return ENOMEM;
+
+	uint32_t zone_id = heap_zone_claim(heap, class_id);
+
+	heap_zone_populate(heap, bucket, zone_id);
+
+	/*
+	 * It doesn't matter that this function might not have found any
+	 * free blocks because there is still potential that subsequent calls
+	 * will find something in later zones.
+	 */
+	return 0;
+}
+
+/*
+ * State shared by the threads that populate the zones when the heap boots.
+ */
+struct heap_boot_zones {
+	struct palloc_heap *heap;
+	uint32_t next; /* id of the next zone to be claimed */
+};
+
+/*
+ * heap_boot_zones_worker -- (internal) populates the claimed zones
+ *
+ * Free chunks are first gathered in a private bucket, so that the zones
+ * can be processed without holding the lock of the default bucket, and only
+ * then moved to the default bucket. Chunks are never coalesced across zones,
+ * so nothing is lost by doing this one zone at a time.
+ */
+static void *
+heap_boot_zones_worker(void *arg)
+{
+	struct heap_boot_zones *bz = arg;
+	struct palloc_heap *heap = bz->heap;
+	struct heap_rt *h = heap->rt;
+
+	struct bucket *b = bucket_new(container_new_ravl(heap),
+		alloc_class_by_id(h->alloc_classes, DEFAULT_ALLOC_CLASS_ID));
+	if (b == NULL) {
+		LOG(2, "unable to create a bucket for the zones population");
+		return NULL;
+	}
+
+	uint32_t zone_id;
+	while ((zone_id = util_fetch_and_add32(&bz->next, 1)) < h->nzones) {
+		heap_zone_populate(heap, b, zone_id);
+
+		struct bucket *defb = heap_bucket_acquire(heap,
+			DEFAULT_ALLOC_CLASS_ID, HEAP_ARENA_PER_THREAD);
+
+		struct memory_block m = MEMORY_BLOCK_NONE;
+		while (b->c_ops->get_rm_bestfit(b->container, &m) == 0) {
+			if (bucket_insert_block(defb, &m) != 0)
+				ERR("lost runtime tracking info of a free "
+					"chunk due to OOM");
+			m = MEMORY_BLOCK_NONE;
+		}
+
+		heap_bucket_release(heap, defb);
+	}
+
+	bucket_delete(b);
+
+	return NULL;
+}
+
+/*
+ * heap_boot_zones -- eagerly populates all zones of the heap using up to
+ *	nthreads threads
+ *
+ * By default the zones are populated lazily, one at a time, by whichever
+ * thread first runs out of free chunks. For very large heaps it's faster to
+ * do it upfront and in parallel. If some of the threads cannot be started,
+ * the work is done by the remaining ones.
+ */
+void
+heap_boot_zones(struct palloc_heap *heap, unsigned nthreads)
+{
+	struct heap_rt *h = heap->rt;
+
+	ASSERTeq(h->zones_exhausted, 0);
+
+	if (nthreads > h->nzones)
+		nthreads = h->nzones;
+
+	if (nthreads == 0)
+		return;
+
+	struct heap_boot_zones bz;
+	bz.heap = heap;
+	bz.next = 0;
+
+	os_thread_t *threads = NULL;
+	unsigned nstarted = 0;
+	if (nthreads > 1) {
+		threads = Malloc(sizeof(*threads) * (nthreads - 1));
+		if (threads == NULL)
+			LOG(2, "!Malloc");
+	}
+
+	for (; threads != NULL && nstarted < nthreads - 1; ++nstarted) {
+		errno = os_thread_create(&threads[nstarted], NULL,
+			heap_boot_zones_worker, &bz);
+		if (errno != 0) {
+			LOG(2, "!os_thread_create");
+			break;
+		}
+	}
+
+	heap_boot_zones_worker(&bz);
+
+	for (unsigned i = 0; i < nstarted; ++i)
+		os_thread_join(&threads[i], NULL);
+
+	Free(threads);
+
+	/* zones are claimed in order, all the claimed ones are populated */
+	uint32_t nclaimed = bz.next < h->nzones ? bz.next : h->nzones;
+	for (uint32_t i = 0; i < nclaimed; ++i)
+		heap_zone_mark_populated(heap, i);
+}
+
+/*
+ * heap_recycle_unused -- turn any empty runs in the recycler into free chunks
+ *
+ * If force is set, the free space of all runs in the recycler is recalculated
+ * first, to find the runs which became empty without the recycler noticing.
+ */
+static int
+heap_recycle_unused(struct palloc_heap *heap, struct recycler *recycler,
+	struct bucket *defb, int force)
+{
+	struct empty_runs r = recycler_recalc(recycler, force);
+	if (VEC_SIZE(&r) == 0)
+		return ENOMEM;
+
+	struct bucket *nb = defb == NULL ? heap_bucket_acquire(heap,
+		DEFAULT_ALLOC_CLASS_ID, HEAP_ARENA_PER_THREAD) : NULL;
+
+	ASSERT(defb != NULL || nb != NULL);
+
+	struct memory_block *nm;
+	VEC_FOREACH_BY_PTR(nm, &r) {
+		heap_zone_summary_update(heap, nm->zone_id, NULL);
+		heap_run_into_free_chunk(heap, defb ? defb : nb, nm);
+	}
+
+	if (nb != NULL)
+		heap_bucket_release(heap, nb);
+
+	VEC_DELETE(&r);
+
+	return 0;
+}
+
+/*
+ * heap_reclaim_garbage -- (internal) creates volatile state of unused runs
+ */
+static int
+heap_reclaim_garbage(struct palloc_heap *heap, struct bucket *bucket)
+{
+	int ret = ENOMEM;
+	struct recycler *r;
+	for (size_t i = 0; i < MAX_ALLOCATION_CLASSES; ++i) {
+		if ((r = heap->rt->recyclers[i]) == NULL)
+			continue;
+
+		if (heap_recycle_unused(heap, r, bucket, 1) == 0)
+			ret = 0;
+	}
+
+	return ret;
+}
+
+/*
+ * heap_extend_now -- (internal) returns the current time in nanoseconds
+ */
+static uint64_t
+heap_extend_now(void)
+{
+	struct timespec ts;
+	os_clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * heap_grow -- (internal) extends the heap by the grow size and makes the new
+ *	chunks available in the default bucket, accounts the extension in
+ *	the statistics
+ *
+ * Must be called with the default bucket lock taken.
+ */
+static int
+heap_grow(struct palloc_heap *heap, struct bucket *defb, int background)
+{
+	struct heap_extend_stats *stats = &heap->rt->extender.stats;
+	uint64_t start = heap_extend_now();
+
+	int ret = 0;
+	int extend = heap_extend(heap, defb, heap->growsize);
+
+	/*
+	 * Extending the pool does not automatically add the chunks into the
+	 * runtime state of the bucket - we need to traverse the new zone if
+	 * it was created.
+	 */
+	if (extend < 0 || (extend == 0 &&
+	    heap_populate_bucket(heap, defb, DEFAULT_ALLOC_CLASS_ID) != 0))
+		ret = -1;
+
+	uint64_t elapsed = heap_extend_now() - start;
+
+	if (ret != 0) {
+		util_fetch_and_add64(&stats->failed, 1);
+		return ret;
+	}
+
+	util_fetch_and_add64(background ? &stats->async : &stats->sync, 1);
+	util_fetch_and_add64(&stats->time_ns, elapsed);
+
+	/* the writers are serialized by the lock of the default bucket */
+	uint64_t max;
+	util_atomic_load_explicit64(&stats->max_ns, &max, memory_order_relaxed);
+	if (elapsed > max)
+		util_atomic_store_explicit64(&stats->max_ns, elapsed,
+			memory_order_relaxed);
+
+	return 0;
+}
+
+/*
+ * heap_extender_worker -- (internal) extends the heap whenever requested,
+ *	until stopped
+ */
+static void *
+heap_extender_worker(void *arg)
+{
+	struct palloc_heap *heap = arg;
+	struct heap_extender *e = &heap->rt->extender;
+
+	util_mutex_lock(&e->lock);
+
+	while (!e->stop) {
+		if (!e->requested) {
+			os_cond_wait(&e->cond, &e->lock);
+			continue;
+		}
+
+		/* the extension might have been disabled in the meantime */
+		if (e->watermark == 0) {
+			e->requested = 0;
+			continue;
+		}
+
+		util_mutex_unlock(&e->lock);
+
+		struct bucket *defb = heap_bucket_acquire(heap,
+			DEFAULT_ALLOC_CLASS_ID, HEAP_ARENA_PER_THREAD);
+		int ret = heap_grow(heap, defb, 1);
+		heap_bucket_release(heap, defb);
+
+		util_mutex_lock(&e->lock);
+
+		/* don't retry until the configuration changes */
+		if (ret != 0) {
+			LOG(2, "background heap extension failed");
+			e->failed = 1;
+		}
+
+		e->requested = 0;
+	}
+
+	util_mutex_unlock(&e->lock);
+
+	return NULL;
+}
+
+/*
+ * heap_extender_check -- (internal) requests a background extension if the
+ *	free chunks of the default bucket fell below the watermark
+ *
+ * Must be called with the default bucket lock taken. The largest free extent
+ * is read from the summary the container maintains, without taking any of
+ * the blocks out.
+ */
+static void
+heap_extender_check(struct palloc_heap *heap, struct bucket *defb)
+{
+	struct heap_rt *h = heap->rt;
+	struct heap_extender *e = &h->extender;
+
+	uint64_t watermark;
+	util_atomic_load_explicit64(&e->watermark, &watermark,
+		memory_order_relaxed);
+	if (watermark == 0 || heap->growsize == 0)
+		return;
+
+	/* the zones that aren't populated yet still have free chunks */
+	if (h->zones_exhausted != h->nzones)
+		return;
+
+	struct block_container_stats cs;
+	defb->c_ops->get_stats(defb->container, &cs);
+	if ((uint64_t)cs.largest * CHUNKSIZE >= watermark)
+		return;
+
+	util_mutex_lock(&e->lock);
+	if (e->running && !e->requested && !e->failed) {
+		e->requested = 1;
+		os_cond_signal(&e->cond);
+	}
+	util_mutex_unlock(&e->lock);
+}
+
+/*
+ * heap_ensure_huge_bucket_filled --
+ *	(internal) refills the default bucket if needed
+ */
+static int
+heap_ensure_huge_bucket_filled(struct palloc_heap *heap, struct bucket *bucket)
+{
+	if (heap_reclaim_garbage(heap, bucket) == 0)
+		return 0;
+
+	if (heap_populate_bucket(heap, bucket, DEFAULT_ALLOC_CLASS_ID) == 0)
+		return 0;
+
+	if (heap_grow(heap, bucket, 0) != 0)
+		return ENOMEM;
+
+	return 0;
+}
+
+/*
+ * heap_bucket_swap_container -- (internal) replaces the container of the
+ *	bucket if it doesn't match the current heap.shared_runs setting
+ *
+ * Must be called with the bucket write-locked for claiming, while there's no
+ * active memory block.
+ */
+static void
+heap_bucket_swap_container(struct palloc_heap *heap, struct bucket *b)
+{
+	int shared;
+	util_atomic_load_explicit32(&heap->rt->shared_runs, &shared,
+		memory_order_relaxed);
+
+	if (b->aclass->type != CLASS_RUN ||
+	    (shared != 0) == container_is_bitmap(b->container))
+		return;
+
+	struct block_container *c = heap_bucket_container_new(heap, b->aclass);
+	if (c == NULL) {
+		LOG(2, "unable to change the container of the bucket");
+		return;
+	}
+
+	b->c_ops->destroy(b->container);
+	b->container = c;
+	b->c_ops = c->c_ops;
+}
+
+/*
+ * heap_bucket_deref_active -- detaches active blocks from the bucket
+ */
+static int
+heap_bucket_deref_active(struct palloc_heap *heap, struct bucket *b)
+{
+	/* get rid of the active block in the bucket */
+	struct memory_block_reserved **active = &b->active_memory_block;
+	int discard = 0;
+
+	/* waits for the threads claiming blocks from the active run */
+	util_rwlock_wrlock(&b->claim_lock);
+
+	if (b->is_active) {
+		b->c_ops->rm_all(b->container);
+		if (util_fetch_and_sub64(&(*active)->nresv, 1) == 1) {
+			VALGRIND_ANNOTATE_HAPPENS_AFTER(&(*active)->nresv);
+			discard = 1;
+		} else {
+			VALGRIND_ANNOTATE_HAPPENS_BEFORE(&(*active)->nresv);
+			*active = NULL;
+		}
+		b->is_active = 0;
+	}
+
+	heap_bucket_swap_container(heap, b);
+
+	util_rwlock_unlock(&b->claim_lock);
+
+	if (discard)
+		heap_discard_run(heap, &(*active)->m);
+
+	if (*active == NULL) {
+		*active = Zalloc(sizeof(struct memory_block_reserved));
+		if (*active == NULL)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * heap_force_recycle -- detaches all memory from arenas, and forces global
+ *	recycling of all memory blocks
+ */
+void
+heap_force_recycle(struct palloc_heap *heap)
+{
+	heap_thread_cache_flush_all(heap);
+
+	util_mutex_lock(&heap->rt->arenas.lock);
+	struct arena *arenap;
+	VEC_FOREACH(arenap, &heap->rt->arenas.vec) {
+		for (int i = 0; i < MAX_ALLOCATION_CLASSES; ++i) {
+			struct bucket *b = arenap->buckets[i];
+			if (b == NULL)
+				continue;
+			util_mutex_lock(&b->lock);
+			/*
+			 * There's no need to check if this fails, as that
+			 * will not prevent progress in this function.
+			 */
+			heap_bucket_deref_active(heap, b);
+			util_mutex_unlock(&b->lock);
+		}
+	}
+	util_mutex_unlock(&heap->rt->arenas.lock);
+	heap_reclaim_garbage(heap, NULL);
+}
+
+/*
+ * heap_reuse_from_recycler -- (internal) try reusing runs that are currently
+ *	in the recycler
+ */
+static int
+heap_reuse_from_recycler(struct palloc_heap *heap,
+	struct bucket *b, uint32_t units, int force)
+{
+	struct memory_block m = MEMORY_BLOCK_NONE;
+	m.size_idx = units;
+
+	struct recycler *r = heap->rt->recyclers[b->aclass->id];
+	if (!force && recycler_get(r, &m) == 0)
+		return heap_run_reuse(heap, b, &m);
+
+	heap_recycle_unused(heap, r, NULL, force);
+
+	if (recycler_get(r, &m) == 0)
+		return heap_run_reuse(heap, b, &m);
+
+	return ENOMEM;
+}
+
+/*
+ * heap_discard_run -- puts the memory block back into the global heap,
+ *	returns 1 if the run was empty and got converted into free chunks
+ */
+int
+heap_discard_run(struct palloc_heap *heap, struct memory_block *m)
+{
+	if (heap_reclaim_run(heap, m, NULL)) {
+		struct bucket *defb =
+			heap_bucket_acquire(heap,
+			DEFAULT_ALLOC_CLASS_ID, 0);
+
+		heap_zone_summary_update(heap, m->zone_id, NULL);
+		heap_run_into_free_chunk(heap, defb, m);
+
+		heap_bucket_release(heap, defb);
+
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * heap_get_sparse_run -- takes a run, whose occupancy doesn't exceed
+ *	max_fill_pct percent, out of the recyclers
+ *
+ * The run cannot be used for allocations until it is given back with
+ * heap_discard_run().
+ */
+int
+heap_get_sparse_run(struct palloc_heap *heap, unsigned max_fill_pct,
+	struct memory_block *m)
+{
+	struct recycler *r;
+	for (size_t i = 0; i < MAX_ALLOCATION_CLASSES; ++i) {
+		if ((r = heap->rt->recyclers[i]) == NULL)
+			continue;
+
+		/* runs that are already empty go straight back to chunks */
+		heap_recycle_unused(heap, r, NULL, 0);
+
+		if (recycler_get_sparse(r, max_fill_pct, m) == 0)
+			return 0;
+	}
+
+	return ENOMEM;
+}
+
+static int heap_get_bestfit_block_arena(struct palloc_heap *heap,
+	struct bucket *b, struct memory_block *m, struct arena *a);
+
+/*
+ * heap_ensure_run_bucket_filled -- (internal) refills the bucket if needed
+ *
+ * The chunk of a new run is preferably taken from the NUMA node of the arena
+ * the bucket belongs to.
+ */
+static int
+heap_ensure_run_bucket_filled(struct palloc_heap *heap, struct bucket *b,
+	uint32_t units)
+{
+	ASSERTeq(b->aclass->type, CLASS_RUN);
+	int ret = 0;
+
+	if (heap_bucket_deref_active(heap, b) != 0)
+		return ENOMEM;
+
+	if (heap_reuse_from_recycler(heap, b, units, 0) == 0)
+		goto out;
+
+	/* search in the next zone before attempting to create a new run */
+	struct bucket *defb = heap_bucket_acquire(heap,
+		DEFAULT_ALLOC_CLASS_ID,
+		HEAP_ARENA_PER_THREAD);
+	heap_populate_bucket(heap, defb, b->aclass->id);
+	heap_bucket_release(heap, defb);
+
+	if (heap_reuse_from_recycler(heap, b, units, 0) == 0)
+		goto out;
+
+	struct memory_block m = MEMORY_BLOCK_NONE;
+	m.size_idx = b->aclass->rdsc.size_idx;
+
+	defb = heap_bucket_acquire(heap,
+		DEFAULT_ALLOC_CLASS_ID,
+		HEAP_ARENA_PER_THREAD);
+	/* cannot reuse an existing run, create a new one */
+	if (heap_get_bestfit_block_arena(heap, defb, &m, b->arena) == 0) {
+		ASSERTeq(m.block_off, 0);
+		if (heap_run_create(heap, b, &m) != 0) {
+			heap_bucket_release(heap, defb);
+			return ENOMEM;
+		}
+
+		heap_bucket_activate(b, &m);
+
+		heap_bucket_release(heap, defb);
+
+		goto out;
+	}
+	heap_bucket_release(heap, defb);
+
+	if (heap_reuse_from_recycler(heap, b, units, 0) == 0)
+		goto out;
+
+	ret = ENOMEM;
+out:
+
+	return ret;
+}
+
+/*
+ * heap_chunk_bit_test -- (internal) checks whether the bit of a chunk is set
+ */
+static inline int
+heap_chunk_bit_test(const uint64_t *bitmap, uint64_t idx)
+{
+	return (bitmap[idx / 64] & (1ULL << (idx % 64))) != 0;
+}
+
+/*
+ * heap_chunk_bits_set -- (internal) sets the bits of a range of chunks
+ */
+static inline void
+heap_chunk_bits_set(uint64_t *bitmap, uint64_t idx, uint32_t nchunks)
+{
+	for (uint64_t i = idx; i < idx + nchunks; ++i)
+		bitmap[i / 64] |= 1ULL << (i % 64);
+}
+
+/*
+ * heap_chunk_bits_clear -- (internal) clears the bits of a range of chunks
+ */
+static inline void
+heap_chunk_bits_clear(uint64_t *bitmap, uint64_t idx, uint32_t nchunks)
+{
+	for (uint64_t i = idx; i < idx + nchunks; ++i)
+		bitmap[i / 64] &= ~(1ULL << (i % 64));
+}
+
+/*
+ * heap_punch_hole_now -- (internal) returns the current time in milliseconds
+ */
+static uint64_t
+heap_punch_hole_now(void)
+{
+	struct timespec ts;
+	os_clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/*
+ * heap_punch_hole_supported -- (internal) returns whether the file blocks
+ *	backing the heap can be deallocated, which isn't the case on Device DAX
+ */
+static int
+heap_punch_hole_supported(struct pool_set *set)
+{
+	return set == NULL || !set->replica[0]->part[0].is_dev_dax;
+}
+
+/*
+ * heap_punch_hole_resize -- (internal) makes sure that the chunk bitmaps
+ *	cover all of the zones of the heap
+ */
+static int
+heap_punch_hole_resize(struct heap_punch_hole *ph, unsigned nzones)
+{
+	if (nzones <= ph->nzones)
+		return 0;
+
+	size_t old_words = PUNCH_HOLE_BITMAP_WORDS(ph->nzones);
+	size_t new_words = PUNCH_HOLE_BITMAP_WORDS(nzones);
+	size_t nbytes = (new_words - old_words) * sizeof(uint64_t);
+
+	uint64_t *idle = Realloc(ph->idle, new_words * sizeof(uint64_t));
+	if (idle == NULL)
+		return -1;
+	memset(idle + old_words, 0, nbytes);
+	ph->idle = idle;
+
+	uint64_t *punched = Realloc(ph->punched, new_words * sizeof(uint64_t));
+	if (punched == NULL)
+		return -1;
+	memset(punched + old_words, 0, nbytes);
+	ph->punched = punched;
+
+	ph->nzones = nzones;
+
+	return 0;
+}
+
+/*
+ * heap_punch_hole_on_reuse -- (internal) forgets about the state of the file
+ *	blocks of chunks taken out of the default bucket
+ */
+static void
+heap_punch_hole_on_reuse(struct palloc_heap *heap,
+	const struct memory_block *m)
+{
+	struct heap_punch_hole *ph = &heap->rt->punch_hole;
+	if (m->zone_id >= ph->nzones)
+		return;
+
+	uint64_t idx = PUNCH_HOLE_CHUNK_IDX(m->zone_id, m->chunk_id);
+	heap_chunk_bits_clear(ph->idle, idx, m->size_idx);
+	heap_chunk_bits_clear(ph->punched, idx, m->size_idx);
+}
+
+/*
+ * Range of the pages of an extent whose file blocks are to be deallocated.
+ */
+struct heap_punch_hole_range {
+	uintptr_t start;
+	uintptr_t end;
+	uint64_t idx; /* position of the first chunk in the bitmaps */
+	uint32_t nchunks;
+};
+
+VEC(heap_punch_hole_extents, struct memory_block);
+
+/*
+ * heap_punch_hole_collect -- (internal) picks the free extents whose chunks
+ *	were already free during the previous pass, the default bucket has to
+ *	be locked
+ */
+static int
+heap_punch_hole_collect(struct palloc_heap *heap,
+	struct heap_punch_hole_extents *extents)
+{
+	struct heap_rt *rt = heap->rt;
+	struct heap_punch_hole *ph = &rt->punch_hole;
+
+	if (heap_punch_hole_resize(ph, rt->nzones) != 0)
+		return -1;
+
+	uint64_t min_size;
+	util_atomic_load_explicit64(&ph->min_size, &min_size,
+		memory_order_relaxed);
+
+	for (uint32_t zone_id = 0; zone_id < rt->nzones; ++zone_id) {
+		struct zone *z = ZID_TO_ZONE(heap->layout, zone_id);
+		if (z->header.magic != ZONE_HEADER_MAGIC)
+			continue;
+
+		for (uint32_t i = 0; i < z->header.size_idx; ) {
+			struct chunk_header *hdr = &z->chunk_headers[i];
+			uint32_t size_idx = hdr->size_idx != 0 ?
+				hdr->size_idx : 1;
+			uint32_t chunk_id = i;
+			i += size_idx;
+
+			if (hdr->type != CHUNK_TYPE_FREE)
+				continue;
+
+			uint64_t first = PUNCH_HOLE_CHUNK_IDX(zone_id,
+				chunk_id);
+
+			int idle = 1;
+			int punched = 1;
+			for (uint64_t c = first; c < first + size_idx; ++c) {
+				idle &= heap_chunk_bit_test(ph->idle, c);
+				punched &= heap_chunk_bit_test(ph->punched, c);
+			}
+
+			heap_chunk_bits_set(ph->idle, first, size_idx);
+
+			if (!idle || punched ||
+			    (uint64_t)size_idx * CHUNKSIZE < min_size)
+				continue;
+
+			struct memory_block m = MEMORY_BLOCK_NONE;
+			m.zone_id = zone_id;
+			m.chunk_id = chunk_id;
+			m.size_idx = size_idx;
+			if (VEC_PUSH_BACK(extents, m) != 0)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * heap_punch_hole_extent -- (internal) deallocates the file blocks backing
+ *	the chunks of a free extent picked by the pass
+ *
+ * The extent is taken out of the default bucket for the duration of the
+ * operation, which is performed without the lock of the bucket. If it's no
+ * longer there, or its chunks were reused since they were picked, it's left
+ * alone.
+ */
+static int
+heap_punch_hole_extent(struct palloc_heap *heap, struct memory_block *m,
+	uint64_t *reclaimed)
+{
+	struct heap_punch_hole *ph = &heap->rt->punch_hole;
+	uint64_t first = PUNCH_HOLE_CHUNK_IDX(m->zone_id, m->chunk_id);
+	struct zone *z = ZID_TO_ZONE(heap->layout, m->zone_id);
+
+	VEC(, struct heap_punch_hole_range) ranges;
+	VEC_INIT(&ranges);
+
+	int ret = 0;
+
+	struct bucket *defb = heap_bucket_acquire(heap,
+		DEFAULT_ALLOC_CLASS_ID, HEAP_ARENA_PER_THREAD);
+
+	memblock_rebuild_state(heap, m);
+	if (defb->c_ops->get_rm_exact(defb->container, m) != 0) {
+		heap_bucket_release(heap, defb);
+		return 0;
+	}
+
+	for (uint32_t i = 0; i < m->size_idx; ) {
+		if (!heap_chunk_bit_test(ph->idle, first + i) ||
+		    heap_chunk_bit_test(ph->punched, first + i)) {
+			++i;
+			continue;
+		}
+
+		uint32_t n = 1;
+		while (i + n < m->size_idx &&
+		    heap_chunk_bit_test(ph->idle, first + i + n) &&
+		    !heap_chunk_bit_test(ph->punched, first + i + n))
+			++n;
+
+		/* chunks aren't necessarily aligned to the page size */
+		struct heap_punch_hole_range r;
+		r.start = (uintptr_t)&z->chunks[m->chunk_id + i];
+		r.end = r.start + (uintptr_t)n * CHUNKSIZE;
+		r.start = ALIGN_UP(r.start, Pagesize);
+		r.end = ALIGN_DOWN(r.end, Pagesize);
+		r.idx = first + i;
+		r.nchunks = n;
+
+		if (VEC_PUSH_BACK(&ranges, r) != 0) {
+			ret = -1;
+			break;
+		}
+
+		i += n;
+	}
+
+	heap_bucket_release(heap, defb);
+
+	size_t npunched = 0;
+	int err = errno;
+	struct heap_punch_hole_range *r;
+	VEC_FOREACH_BY_PTR(r, &ranges) {
+		if (ret != 0)
+			break;
+
+		ret = util_range_punch_hole((void *)r->start,
+			r->end - r->start);
+		if (ret == 0)
+			npunched++;
+		else
+			err = errno;
+	}
+
+	defb = heap_bucket_acquire(heap,
+		DEFAULT_ALLOC_CLASS_ID, HEAP_ARENA_PER_THREAD);
+
+	for (size_t i = 0; i < npunched; ++i) {
+		r = &VEC_ARR(&ranges)[i];
+		heap_chunk_bits_set(ph->punched, r->idx, r->nchunks);
+		*reclaimed += r->end - r->start;
+	}
+
+	if (bucket_insert_block(defb, m) != 0)
+		LOG(2, "failed to allocate memory block runtime tracking info");
+
+	heap_bucket_release(heap, defb);
+
+	VEC_DELETE(&ranges);
+
+	errno = err;
+	return ret;
+}
+
+/*
+ * heap_punch_hole_pass -- (internal) deallocates the file blocks backing the
+ *	free extents that weren't used since the previous pass, if at least
+ *	interval milliseconds elapsed since then
+ *
+ * The extents are picked with the default bucket locked, but the blocks are
+ * deallocated without the lock, one extent at a time. If the file blocks
+ * can't be deallocated at all, the automatic passes are disabled.
+ */
+static int
+heap_punch_hole_pass(struct palloc_heap *heap, uint64_t interval,
+	uint64_t *reclaimed)
+{
+	struct heap_punch_hole *ph = &heap->rt->punch_hole;
+
+	struct heap_punch_hole_extents extents;
+	VEC_INIT(&extents);
+
+	*reclaimed = 0;
+	int ret = 0;
+
+	struct bucket *defb = heap_bucket_acquire(heap,
+		DEFAULT_ALLOC_CLASS_ID, HEAP_ARENA_PER_THREAD);
+
+	/* the pass might have been just performed by a different thread */
+	if (heap_punch_hole_now() - ph->last_pass < interval) {
+		heap_bucket_release(heap, defb);
+		return 0;
+	}
+
+	ret = heap_punch_hole_collect(heap, &extents);
+
+	util_atomic_store_explicit64(&ph->last_pass, heap_punch_hole_now(),
+		memory_order_relaxed);
+
+	heap_bucket_release(heap, defb);
+
+	struct memory_block *m;
+	VEC_FOREACH_BY_PTR(m, &extents) {
+		if (ret != 0)
+			break;
+
+		ret = heap_punch_hole_extent(heap, m, reclaimed);
+	}
+
+	VEC_DELETE(&extents);
+
+	util_fetch_and_add64(&ph->reclaimed, *reclaimed);
+
+	/* none of these can change for the lifetime of the mapping */
+	if (ret != 0 && (errno == EINVAL || errno == EOPNOTSUPP ||
+	    errno == ENOTSUP || errno == EACCES)) {
+		LOG(2, "!file blocks can't be deallocated, "
+			"disabling automatic passes");
+		util_atomic_store_explicit32(&ph->enabled, 0,
+			memory_order_relaxed);
+	}
+
+	return ret;
+}
+
+/*
+ * heap_punch_hole_auto -- performs a pass if enough time elapsed since
+ *	the previous one
+ *
+ * The pass takes the lock of the default bucket, so this must not be called
+ * with any other bucket or run lock held.
+ */
+void
+heap_punch_hole_auto(struct palloc_heap *heap)
+{
+	struct heap_punch_hole *ph = &heap->rt->punch_hole;
+
+	int enabled;
+	util_atomic_load_explicit32(&ph->enabled, &enabled,
+		memory_order_relaxed);
+	if (!enabled)
+		return;
+
+	uint64_t last_pass;
+	uint64_t interval;
+	util_atomic_load_explicit64(&ph->last_pass, &last_pass,
+		memory_order_relaxed);
+	util_atomic_load_explicit64(&ph->interval, &interval,
+		memory_order_relaxed);
+
+	if (heap_punch_hole_now() - last_pass < interval)
+		return;
+
+	uint64_t reclaimed;
+	if (heap_punch_hole_pass(heap, interval, &reclaimed) != 0)
+		LOG(2, "!unable to deallocate the blocks of free chunks");
+}
+
+/*
+ * heap_memblock_on_free -- bookkeeping actions executed at every free of a
+ *	block
+ */
+void
+heap_memblock_on_free(struct palloc_heap *heap, const struct memory_block *m)
+{
+	if (m->type != MEMORY_BLOCK_RUN) {
+		heap_stats_on_free(heap, DEFAULT_ALLOC_CLASS_ID, m);
+		heap_zone_summary_update(heap, m->zone_id, NULL);
+		return;
+	}
+
+	struct chunk_header *hdr = heap_get_chunk_hdr(heap, m);
+	struct chunk_run *run = heap_get_chunk_run(heap, m);
+
+	ASSERTeq(hdr->type, CHUNK_TYPE_RUN);
+
+	struct alloc_class *c = alloc_class_by_run(
+		heap->rt->alloc_classes,
+		run->hdr.block_size, hdr->flags, hdr->size_idx);
+
+	if (c == NULL) {
+		heap_zone_summary_invalidate(heap, m->zone_id);
+		return;
+	}
+
+	heap_stats_on_free(heap, c->id, m);
+
+	heap_zone_summary_update(heap, m->zone_id, c);
+
+	recycler_on_free(heap->rt->recyclers[c->id], m);
+}
+
+/*
+ * heap_split_block -- (internal) splits unused part of the memory block
+ */
+static void
+heap_split_block(struct palloc_heap *heap, struct bucket *b,
+		struct memory_block *m, uint32_t units)
+{
+	ASSERT(units <= UINT16_MAX);
+	ASSERT(units > 0);
+
+	if (b->aclass->type == CLASS_RUN) {
+		ASSERT((uint64_t)m->block_off + (uint64_t)units <= UINT32_MAX);
+		struct memory_block r = {m->chunk_id, m->zone_id,
+			m->size_idx - units, (uint32_t)(m->block_off + units),
+			NULL, NULL, 0, 0, NULL};
+		memblock_rebuild_state(heap, &r);
+		if (bucket_insert_block(b, &r) != 0)
+			LOG(2,
+				"failed to allocate memory block runtime tracking info");
+	} else {
+		uint32_t new_chunk_id = m->chunk_id + units;
+		uint32_t new_size_idx = m->size_idx - units;
+
+		*m = memblock_huge_init(heap, m->chunk_id, m->zone_id, units);
+
+		struct memory_block n = memblock_huge_init(heap,
+			new_chunk_id, m->zone_id, new_size_idx);
+
+		if (bucket_insert_block(b, &n) != 0)
+			LOG(2,
+				"failed to allocate memory block runtime tracking info");
+	}
+
+	m->size_idx = units;
+}
+
+/*
+ * Arguments of the NUMA chunk filter.
+ */
+struct heap_numa_filter {
+	struct palloc_heap *heap;
+	unsigned node;
+	uint32_t units;
+
+	/* index of the first chunk of the matched block on the node */
+	uint32_t offset;
+};
+
+/*
+ * heap_numa_filter_chunk -- (internal) checks whether the free chunk has
+ *	enough space backed by the requested node
+ */
+static int
+heap_numa_filter_chunk(const struct memory_block *m, void *arg)
+{
+	struct heap_numa_filter *f = arg;
+	struct heap_numa *numa = &f->heap->rt->numa;
+
+	uintptr_t start = (uintptr_t)heap_get_chunk(f->heap, m);
+	uintptr_t end = start + (uintptr_t)m->size_idx * CHUNKSIZE;
+
+	struct numa_range *r;
+	VEC_FOREACH_BY_PTR(r, &numa->ranges) {
+		if (r->node != f->node || r->end <= start || r->start >= end)
+			continue;
+
+		uintptr_t first = ALIGN_UP(MAX(r->start, start) - start,
+			CHUNKSIZE) / CHUNKSIZE;
+		uintptr_t last = (MIN(r->end, end) - start) / CHUNKSIZE;
+
+		if (last > first && last - first >= f->units) {
+			f->offset = (uint32_t)first;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * heap_numa_get_rm_bestfit -- (internal) removes the best-fit free chunk,
+ *	preferring memory backed by the NUMA node of the given arena, or of the
+ *	arena of the current thread if NULL
+ *
+ * If the chosen free chunk only partially lies on the node, the part before
+ * the node memory is put back into the bucket.
+ */
+static int
+heap_numa_get_rm_bestfit(struct palloc_heap *heap, struct bucket *b,
+	struct memory_block *m, struct arena *a)
+{
+	struct heap_numa *numa = &heap->rt->numa;
+
+	if (!numa->enabled || numa->nnodes < 2 ||
+	    b->c_ops->get_rm_bestfit_filter == NULL)
+		return b->c_ops->get_rm_bestfit(b->container, m);
+
+	if (a == NULL && (a = heap_current_arena(heap)) == NULL)
+		return b->c_ops->get_rm_bestfit(b->container, m);
+
+	unsigned node = a->node;
+	struct heap_numa_filter f = {heap, node, m->size_idx, 0};
+	struct numa_node_stats *stats = &numa->stats[node];
+
+	struct memory_block nm = *m;
+	if (b->c_ops->get_rm_bestfit_filter(b->container, &nm,
+		heap_numa_filter_chunk, &f) == 0) {
+		if (f.offset != 0) {
+			struct memory_block prefix = memblock_huge_init(heap,
+				nm.chunk_id, nm.zone_id, f.offset);
+			if (bucket_insert_block(b, &prefix) != 0)
+				LOG(2,
+				"failed to allocate memory block runtime tracking info");
+
+			nm = memblock_huge_init(heap, nm.chunk_id + f.offset,
+				nm.zone_id, nm.size_idx - f.offset);
+		}
+
+		*m = nm;
+		util_fetch_and_add64(&stats->local, 1);
+
+		return 0;
+	}
+
+	/*
+	 * Zones are populated lazily, which means that the memory of the node
+	 * might not have been discovered yet. Instead of populating all zones
+	 * in search for it, the request is served from the memory of other
+	 * nodes, and the next zone is only populated once the bucket cannot
+	 * satisfy the request at all.
+	 */
+	int ret = b->c_ops->get_rm_bestfit(b->container, m);
+	if (ret == 0)
+		util_fetch_and_add64(&stats->remote, 1);
+
+	return ret;
+}
+
+/*
+ * heap_get_bestfit_block_arena -- (internal) extracts a memory block of equal
+ *	size index, huge blocks are preferably taken from the NUMA node of the
+ *	given arena
+ */
+static int
+heap_get_bestfit_block_arena(struct palloc_heap *heap, struct bucket *b,
+	struct memory_block *m, struct arena *a)
+{
+	uint32_t units = m->size_idx;
+
+	while ((b->aclass->type == CLASS_HUGE ?
+	    heap_numa_get_rm_bestfit(heap, b, m, a) :
+	    b->c_ops->get_rm_bestfit(b->container, m)) != 0) {
+		if (b->aclass->type == CLASS_HUGE) {
+			if (heap_ensure_huge_bucket_filled(heap, b) != 0)
+				return ENOMEM;
+		} else {
+			if (heap_ensure_run_bucket_filled(heap, b, units) != 0)
+				return ENOMEM;
+		}
+	}
+
+	ASSERT(m->size_idx >= units);
+
+	if (units != m->size_idx)
+		heap_split_block(heap, b, m, units);
+
+	if (b->aclass->type == CLASS_HUGE) {
+		heap_punch_hole_on_reuse(heap, m);
+		heap_extender_check(heap, b);
+	}
+
+	m->m_ops->ensure_header_type(m, b->aclass->header_type);
+	m->header_type = b->aclass->header_type;
+
+	return 0;
+}
+
+/*
+ * heap_get_bestfit_block --
+ *	extracts a memory block of equal size index
+ */
+int
+heap_get_bestfit_block(struct palloc_heap *heap, struct bucket *b,
+	struct memory_block *m)
+{
+	return heap_get_bestfit_block_arena(heap, b, m, b->arena);
+}
+
+/*
+ * heap_claim_block -- takes a block of the given class out of the active run
+ *	of the arena's bucket without locking the bucket
+ *
+ * This is only possible if the bucket uses a container whose blocks can be
+ * claimed by multiple threads at once, see heap_set_shared_runs. The claimed
+ * block holds a reservation of its run, exactly as if it was taken directly
+ * from the bucket. Returns non-zero if the block has to be taken from the
+ * bucket the regular way.
+ */
+int
+heap_claim_block(struct palloc_heap *heap, struct alloc_class *c,
+	uint16_t arena_id, struct memory_block *m,
+	struct memory_block_reserved **mresv)
+{
+	int shared;
+	util_atomic_load_explicit32(&heap->rt->shared_runs, &shared,
+		memory_order_relaxed);
+
+	if (!shared || c->type != CLASS_RUN)
+		return -1;
+
+	struct arena *arena = arena_id == HEAP_ARENA_PER_THREAD ?
+		heap_thread_arena(heap) : heap_get_arena(heap, arena_id);
+	struct bucket *b = arena->buckets[c->id];
+
+	int ret = -1;
+
+	util_rwlock_rdlock(&b->claim_lock);
+	if (b->is_active && container_is_bitmap(b->container) &&
+	    b->c_ops->get_rm_bestfit(b->container, m) == 0) {
+		*mresv = b->active_memory_block;
+		util_fetch_and_add64(&(*mresv)->nresv, 1);
+		ret = 0;
+	}
+	util_rwlock_unlock(&b->claim_lock);
+
+	if (ret != 0)
+		return ret;
+
+	m->m_ops->ensure_header_type(m, c->header_type);
+	m->header_type = c->header_type;
+
+	heap_stats_count(heap, arena, c->id, HEAP_COUNTER_CLAIMS, 1);
+
+	return 0;
+}
+
+/*
+ * heap_get_shared_runs -- returns whether the blocks of runs can be claimed
+ *	without locking the buckets
+ */
+int
+heap_get_shared_runs(struct palloc_heap *heap)
+{
+	int shared;
+	util_atomic_load_explicit32(&heap->rt->shared_runs, &shared,
+		memory_order_relaxed);
+
+	return shared;
+}
+
+/*
+ * heap_set_shared_runs -- enables or disables claiming the blocks of runs
+ *	without locking the buckets
+ *
+ * The buckets switch their containers once their active run is used up, or
+ * on the next heap_force_recycle.
+ */
+void
+heap_set_shared_runs(struct palloc_heap *heap, int shared)
+{
+	util_atomic_store_explicit32(&heap->rt->shared_runs, shared != 0,
+		memory_order_relaxed);
+}
+
+/*
+ * heap_thread_cache_entry_release -- (internal) gives the cached block back
+ *	to its bucket and drops the reservation of the run
+ */
+static void
+heap_thread_cache_entry_release(struct palloc_heap *heap,
+	struct thread_cache_entry *e)
+{
+	struct memory_block_reserved *mresv = e->mresv;
+	struct bucket *b = mresv->bucket;
+
+	util_mutex_lock(&b->lock);
+
+	/*
+	 * The block can only be inserted back into the bucket if the run it
+	 * belongs to is still the active one, otherwise it will be picked up
+	 * once the run is reclaimed.
+	 */
+	if (b->is_active && b->active_memory_block == mresv)
+		bucket_insert_block(b, &e->m);
+
+	util_mutex_unlock(&b->lock);
+
+	if (util_fetch_and_sub64(&mresv->nresv, 1) == 1) {
+		VALGRIND_ANNOTATE_HAPPENS_AFTER(&mresv->nresv);
+		heap_discard_run(heap, &mresv->m);
+		Free(mresv);
+	} else {
+		VALGRIND_ANNOTATE_HAPPENS_BEFORE(&mresv->nresv);
+	}
+}
+
+/*
+ * heap_thread_cache_drain -- (internal) releases all blocks held by the cache
+ */
+static void
+heap_thread_cache_drain(struct thread_cache *tcache)
+{
+	struct thread_cache_entry *e;
+
+	for (int i = 0; i < MAX_ALLOCATION_CLASSES; ++i) {
+		struct thread_cache_bin *bin = &tcache->bins[i];
+
+		VEC_FOREACH_BY_PTR(e, bin)
+			heap_thread_cache_entry_release(tcache->heap, e);
+		VEC_CLEAR(bin);
+	}
+}
+
+/*
+ * heap_thread_cache_delete -- (internal) drains and destroys the cache
+ */
+static void
+heap_thread_cache_delete(struct thread_cache *tcache)
+{
+	util_mutex_lock(&tcache->lock);
+	heap_thread_cache_drain(tcache);
+	util_mutex_unlock(&tcache->lock);
+
+	for (int i = 0; i < MAX_ALLOCATION_CLASSES; ++i)
+		VEC_DELETE(&tcache->bins[i]);
+
+	util_mutex_destroy(&tcache->lock);
+
+	Free(tcache);
+}
+
+/*
+ * heap_thread_cache_destructor -- (internal) drains the cache of an exiting
+ *	thread
+ */
+static void
+heap_thread_cache_destructor(void *arg)
+{
+	struct thread_cache *tcache = arg;
+	struct thread_caches *tcaches = &tcache->heap->rt->tcaches;
+
+	util_mutex_lock(&tcaches->lock);
+
+	struct thread_cache **tcachep;
+	VEC_FOREACH_BY_PTR(tcachep, &tcaches->vec) {
+		if (*tcachep == tcache) {
+			VEC_ERASE_BY_PTR(&tcaches->vec, tcachep);
+			break;
+		}
+	}
+
+	util_mutex_unlock(&tcaches->lock);
+
+	heap_thread_cache_delete(tcache);
+}
+
+/*
+ * heap_thread_cache -- (internal) returns the cache of the current thread,
+ *	creating it if needed
+ */
+static struct thread_cache *
+heap_thread_cache(struct palloc_heap *heap)
+{
+	struct thread_caches *tcaches = &heap->rt->tcaches;
+
+	struct thread_cache *tcache = os_tls_get(tcaches->thread);
+	if (tcache != NULL)
+		return tcache;
+
+	tcache = Zalloc(sizeof(*tcache));
+	if (tcache == NULL) {
+		ERR("!heap: thread cache malloc error");
+		return NULL;
+	}
+	tcache->heap = heap;
+	util_mutex_init(&tcache->lock);
+
+	util_mutex_lock(&tcaches->lock);
+	int ret = VEC_PUSH_BACK(&tcaches->vec, tcache);
+	util_mutex_unlock(&tcaches->lock);
+
+	if (ret != 0) {
+		util_mutex_destroy(&tcache->lock);
+		Free(tcache);
+		return NULL;
+	}
+
+	os_tls_set(tcaches->thread, tcache);
+
+	return tcache;
+}
+
+/*
+ * heap_thread_cache_fill -- (internal) reserves up to size single unit
+ *	blocks from the bucket of the thread's arena
+ *
+ * Only the first block is allowed to trigger a refill of the bucket, the
+ * remaining ones are taken from the currently active run, which means that
+ * the bucket lock is held only once per batch.
+ */
+static int
+heap_thread_cache_fill(struct palloc_heap *heap, struct thread_cache *tcache,
+	struct alloc_class *c, unsigned size)
+{
+	struct thread_cache_bin *bin = &tcache->bins[c->id];
+	if (VEC_CAPACITY(bin) < size && VEC_RESERVE(bin, size) != 0)
+		return ENOMEM;
+
+	struct bucket *b = heap_bucket_acquire(heap, c->id,
+		HEAP_ARENA_PER_THREAD);
+
+	struct thread_cache_entry e;
+	e.m = MEMORY_BLOCK_NONE;
+	e.m.size_idx = 1;
+
+	int ret = heap_get_bestfit_block(heap, b, &e.m);
+	if (ret != 0)
+		goto out;
+
+	for (;;) {
+		e.mresv = b->active_memory_block;
+		ASSERTne(e.mresv, NULL);
+		util_fetch_and_add64(&e.mresv->nresv, 1);
+
+		/* the capacity was reserved above, this cannot fail */
+		ret = VEC_PUSH_BACK(bin, e);
+		ASSERTeq(ret, 0);
+
+		if (VEC_SIZE(bin) >= size)
+			break;
+
+		e.m = MEMORY_BLOCK_NONE;
+		e.m.size_idx = 1;
+		if (b->c_ops->get_rm_bestfit(b->container, &e.m) != 0)
+			break;
+
+		if (e.m.size_idx != 1)
+			heap_split_block(heap, b, &e.m, 1);
+
+		e.m.m_ops->ensure_header_type(&e.m, b->aclass->header_type);
+		e.m.header_type = b->aclass->header_type;
+	}
+
+out:
+	heap_bucket_release(heap, b);
+
+	return ret;
+}
+
+/*
+ * heap_thread_cache_get -- takes a single unit block of the given class from
+ *	the cache of the current thread, refilling the cache if it's empty
+ *
+ * The returned block holds a reservation of its run, exactly as if it was
+ * taken directly from the bucket. Returns non-zero if the cache is disabled
+ * or cannot be used for this request.
+ */
+int
+heap_thread_cache_get(struct palloc_heap *heap, struct alloc_class *c,
+	struct memory_block *m, struct memory_block_reserved **mresv)
+{
+	unsigned size;
+	util_atomic_load_explicit32(&heap->rt->tcaches.size, &size,
+		memory_order_relaxed);
+
+	if (size == 0 || c->type != CLASS_RUN || m->size_idx != 1)
+		return -1;
+
+	struct thread_cache *tcache = heap_thread_cache(heap);
+	if (tcache == NULL)
+		return -1;
+
+	util_mutex_lock(&tcache->lock);
+
+	int ret = -1;
+	struct thread_cache_bin *bin = &tcache->bins[c->id];
+	if (VEC_SIZE(bin) == 0 &&
+	    heap_thread_cache_fill(heap, tcache, c, size) != 0)
+		goto out;
+
+	*m = VEC_BACK(bin).m;
+	*mresv = VEC_BACK(bin).mresv;
+	VEC_POP_BACK(bin);
+	ret = 0;
+
+out:
+	util_mutex_unlock(&tcache->lock);
+
+	return ret;
+}
+
+/*
+ * heap_thread_cache_put -- puts back a block that was taken without locking
+ *	the bucket, either from the cache of the current thread or claimed from
+ *	a run, but ended up not being used
+ *
+ * Blocks which don't fit in the cache are given back to their bucket.
+ */
+void
+heap_thread_cache_put(struct palloc_heap *heap, struct alloc_class *c,
+	const struct memory_block *m, struct memory_block_reserved *mresv)
+{
+	struct thread_cache *tcache = os_tls_get(heap->rt->tcaches.thread);
+
+	struct thread_cache_entry e;
+	e.m = *m;
+	e.mresv = mresv;
+
+	if (tcache == NULL || m->size_idx != 1 ||
+	    heap_get_thread_cache_size(heap) == 0) {
+		heap_thread_cache_entry_release(heap, &e);
+		return;
+	}
+
+	util_mutex_lock(&tcache->lock);
+	int ret = VEC_PUSH_BACK(&tcache->bins[c->id], e);
+	util_mutex_unlock(&tcache->lock);
+
+	if (ret != 0)
+		heap_thread_cache_entry_release(heap, &e);
+}
+
+/*
+ * heap_thread_cache_flush -- releases all blocks cached by the current thread
+ */
+void
+heap_thread_cache_flush(struct palloc_heap *heap)
+{
+	struct thread_cache *tcache = os_tls_get(heap->rt->tcaches.thread);
+	if (tcache == NULL)
+		return;
+
+	util_mutex_lock(&tcache->lock);
+	heap_thread_cache_drain(tcache);
+	util_mutex_unlock(&tcache->lock);
+}
+
+/*
+ * heap_thread_cache_flush_all -- releases the blocks cached by all threads
+ */
+void
+heap_thread_cache_flush_all(struct palloc_heap *heap)
+{
+	struct thread_caches *tcaches = &heap->rt->tcaches;
+
+	util_mutex_lock(&tcaches->lock);
+
+	struct thread_cache *tcache;
+	VEC_FOREACH(tcache, &tcaches->vec) {
+		util_mutex_lock(&tcache->lock);
+		heap_thread_cache_drain(tcache);
+		util_mutex_unlock(&tcache->lock);
+	}
+
+	util_mutex_unlock(&tcaches->lock);
+}
+
+/*
+ * heap_get_thread_cache_size -- returns the max number of blocks cached per
+ *	allocation class
+ */
+unsigned
+heap_get_thread_cache_size(struct palloc_heap *heap)
+{
+	unsigned size;
+	util_atomic_load_explicit32(&heap->rt->tcaches.size, &size,
+		memory_order_relaxed);
+
+	return size;
+}
+
+/*
+ * heap_set_thread_cache_size -- changes the max number of blocks cached per
+ *	allocation class, 0 disables the thread caches
+ *
+ * Blocks that are already cached by all threads are released.
+ */
+int
+heap_set_thread_cache_size(struct palloc_heap *heap, unsigned size)
+{
+	if (size > MAX_THREAD_CACHE_SIZE) {
+		ERR("thread cache size %u larger than maximum (%u)",
+			size, MAX_THREAD_CACHE_SIZE);
+		errno = EINVAL;
+		return -1;
+	}
+
+	util_atomic_store_explicit32(&heap->rt->tcaches.size, size,
+		memory_order_relaxed);
+
+	heap_thread_cache_flush_all(heap);
+
+	return 0;
+}
+
+/*
+ * heap_get_adjacent_free_block -- locates adjacent free memory block in heap
+ */
+static int
+heap_get_adjacent_free_block(struct palloc_heap *heap,
+	const struct memory_block *in, struct memory_block *out, int prev)
+{
+	struct zone *z = ZID_TO_ZONE(heap->layout, in->zone_id);
+	struct chunk_header *hdr = &z->chunk_headers[in->chunk_id];
+	out->zone_id = in->zone_id;
+
+	if (prev) {
+		if (in->chunk_id == 0)
+			return ENOENT;
+
+		struct chunk_header *prev_hdr =
+			&z->chunk_headers[in->chunk_id - 1];
+		out->chunk_id = in->chunk_id - prev_hdr->size_idx;
+
+		if (z->chunk_headers[out->chunk_id].type != CHUNK_TYPE_FREE)
+			return ENOENT;
+
+		out->size_idx = z->chunk_headers[out->chunk_id].size_idx;
+	} else { /* next */
+		if (in->chunk_id + hdr->size_idx == z->header.size_idx)
+			return ENOENT;
+
+		out->chunk_id = in->chunk_id + hdr->size_idx;
+
+		if (z->chunk_headers[out->chunk_id].type != CHUNK_TYPE_FREE)
+			return ENOENT;
+
+		out->size_idx = z->chunk_headers[out->chunk_id].size_idx;
+	}
+	memblock_rebuild_state(heap, out);
+
+	return 0;
+}
+
+/*
+ * heap_coalesce -- (internal) merges adjacent memory blocks
+ */
+static struct memory_block
+heap_coalesce(struct palloc_heap *heap,
+	const struct memory_block *blocks[], int n)
+{
+	struct memory_block ret = MEMORY_BLOCK_NONE;
+
+	const struct memory_block *b = NULL;
+	ret.size_idx = 0;
+	for (int i = 0; i < n; ++i) {
+		if (blocks[i] == NULL)
+			continue;
+		b = b ? b : blocks[i];
+		ret.size_idx += blocks[i] ? blocks[i]->size_idx : 0;
+	}
+
+	ASSERTne(b, NULL);
+
+	ret.chunk_id = b->chunk_id;
+	ret.zone_id = b->zone_id;
+	ret.block_off = b->block_off;
+	memblock_rebuild_state(heap, &ret);
+
+	return ret;
+}
+
+/*
+ * heap_coalesce_huge -- finds neighbours of a huge block, removes them from the
+ *	volatile state and returns the resulting block
+ */
+struct memory_block
+heap_coalesce_huge(struct palloc_heap *heap, struct bucket *b,
+	const struct memory_block *m)
+{
+	const struct memory_block *blocks[3] = {NULL, m, NULL};
+
+	struct memory_block prev = MEMORY_BLOCK_NONE;
+	if (heap_get_adjacent_free_block(heap, m, &prev, 1) == 0 &&
+		b->c_ops->get_rm_exact(b->container, &prev) == 0) {
+		blocks[0] = &prev;
+	}
+
+	struct memory_block next = MEMORY_BLOCK_NONE;
+	if (heap_get_adjacent_free_block(heap, m, &next, 0) == 0 &&
+		b->c_ops->get_rm_exact(b->container, &next) == 0) {
+		blocks[2] = &next;
+	}
+
+	return heap_coalesce(heap, blocks, 3);
+}
+
+/*
+ * heap_end -- returns first address after heap
+ */
+void *
+heap_end(struct palloc_heap *h)
+{
+	ASSERT(h->rt->nzones > 0);
+
+	struct zone *last_zone = ZID_TO_ZONE(h->layout, h->rt->nzones - 1);
+
+	return &last_zone->chunks[last_zone->header.size_idx];
+}
+
+/*
+ * heap_arena_create -- create a new arena, push it to the vector
+ * and return new arena id or -1 on failure
+ */
+int
+heap_arena_create(struct palloc_heap *heap)
+{
+	struct heap_rt *h = heap->rt;
+
+	/*
+	 * Allocation classes can be derived at runtime, the arena has to be
+	 * created under the lock so that it's not missing any of their buckets.
+	 */
+	util_mutex_lock(&h->arenas.lock);
+
+	struct arena *arena = heap_arena_new(heap, 0,
+		(unsigned)VEC_SIZE(&h->arenas.vec) + 1);
+	if (arena == NULL) {
+		util_mutex_unlock(&h->arenas.lock);
+		return -1;
+	}
+
+	if (VEC_PUSH_BACK(&h->arenas.vec, arena))
+		goto err_push_back;
+
+	int ret = (int)VEC_SIZE(&h->arenas.vec);
+	if (h->numa.nnodes != 0)
+		arena->node = (unsigned)(ret - 1) % h->numa.nnodes;
+	util_mutex_unlock(&h->arenas.lock);
+
+	return ret;
+
+err_push_back:
+	util_mutex_unlock(&h->arenas.lock);
+	heap_arena_delete(arena);
+	return -1;
+}
+
+/*
+ * heap_get_narenas_total -- returns the number of all arenas in the heap
+ */
+unsigned
+heap_get_narenas_total(struct palloc_heap *heap)
+{
+	struct heap_rt *h = heap->rt;
+
+	util_mutex_lock(&h->arenas.lock);
+	unsigned total = (unsigned)VEC_SIZE(&h->arenas.vec);
+	util_mutex_unlock(&h->arenas.lock);
+
+	return total;
+}
+
+/*
+ * heap_get_narenas_max -- returns the max number of arenas
+ */
+unsigned
+heap_get_narenas_max(struct palloc_heap *heap)
+{
+	struct heap_rt *h = heap->rt;
+
+	util_mutex_lock(&h->arenas.lock);
+	unsigned max = (unsigned)VEC_CAPACITY(&h->arenas.vec);
+	util_mutex_unlock(&h->arenas.lock);
+
+	return max;
+}
+
+/*
+ * heap_set_narenas_max -- change the max number of arenas
+ */
+int
+heap_set_narenas_max(struct palloc_heap *heap, unsigned size)
+{
+	struct heap_rt *h = heap->rt;
+	int ret = -1;
+
+	util_mutex_lock(&h->arenas.lock);
+	unsigned capacity = (unsigned)VEC_CAPACITY(&h->arenas.vec);
+	if (size < capacity) {
+		LOG(2, "cannot decrease max number of arenas");
+		goto out;
+	} else if (size == capacity) {
+		ret = 0;
+		goto out;
+	}
+
+	ret = VEC_RESERVE(&h->arenas.vec, size);
+
+out:
+	util_mutex_unlock(&h->arenas.lock);
+	return ret;
+}
+
+/*
+ * heap_get_narenas_auto -- returns the number of all automatic arenas
+ */
+unsigned
+heap_get_narenas_auto(struct palloc_heap *heap)
+{
+	struct heap_rt *h = heap->rt;
+	struct arena *arena;
+	unsigned narenas = 0;
+
+	util_mutex_lock(&h->arenas.lock);
+
+	VEC_FOREACH(arena, &h->arenas.vec) {
+		if (arena->automatic)
+			narenas++;
+	}
+
+	util_mutex_unlock(&h->arenas.lock);
+
+	return narenas;
+}
+
+/*
+ * heap_get_arena_buckets -- returns a pointer to buckets from the arena
+ */
+struct bucket **
+heap_get_arena_buckets(struct palloc_heap *heap, unsigned arena_id)
+{
+	util_mutex_lock(&heap->rt->arenas.lock);
+	struct arena *a = heap_get_arena_by_id(heap, arena_id);
+	util_mutex_unlock(&heap->rt->arenas.lock);
+
+	return a->buckets;
+}
+
+/*
+ * heap_get_arena_auto -- returns arena automatic value
+ */
+int
+heap_get_arena_auto(struct palloc_heap *heap, unsigned arena_id)
+{
+	util_mutex_lock(&heap->rt->arenas.lock);
+	struct arena *a = heap_get_arena_by_id(heap, arena_id);
+	util_mutex_unlock(&heap->rt->arenas.lock);
+
+	return a->automatic;
+}
+
+/*
+ * heap_set_arena_auto -- sets arena automatic value
+ */
+int
+heap_set_arena_auto(struct palloc_heap *heap, unsigned arena_id,
+		int automatic)
+{
+	unsigned nautomatic = 0;
+	struct arena *a;
+	struct heap_rt *h = heap->rt;
+	int ret = 0;
+
+	util_mutex_lock(&h->arenas.lock);
+	VEC_FOREACH(a, &h->arenas.vec)
+		if (a->automatic)
+			nautomatic++;
+
+	a = VEC_ARR(&heap->rt->arenas.vec)[arena_id - 1];
+
+	if (!automatic && nautomatic <= 1 && a->automatic) {
+		ERR("at least one automatic arena must exist");
+		ret = -1;
+		goto out;
+	}
+	a->automatic = automatic;
+
+	/* only automatic arenas can be picked by the CPUs */
+	if (!automatic)
+		heap_cpu_arenas_reset(&h->arenas, a);
+
+out:
+	util_mutex_unlock(&h->arenas.lock);
+	return ret;
+
+}
+
+/*
+ * heap_set_arena_thread -- assign arena with given id to the current thread
+ */
+void
+heap_set_arena_thread(struct palloc_heap *heap, unsigned arena_id)
+{
+	os_mutex_lock(&heap->rt->arenas.lock);
+	struct arena *a = heap_get_arena_by_id(heap, arena_id);
+	heap_arena_thread_attach(heap, a);
+	os_tls_set(heap->rt->arenas.bound, a);
+	os_mutex_unlock(&heap->rt->arenas.lock);
+
+	/* blocks cached so far belong to the previous arena */
+	heap_thread_cache_flush(heap);
+}
+
+/*
+ * heap_get_arena_mode -- returns the way arenas are picked for allocations
+ */
+enum pobj_arena_mode
+heap_get_arena_mode(struct palloc_heap *heap)
+{
+	unsigned mode;
+	util_atomic_load_explicit32(&heap->rt->arenas.mode, &mode,
+		memory_order_relaxed);
+
+	return (enum pobj_arena_mode)mode;
+}
+
+/*
+ * heap_set_arena_mode -- changes the way arenas are picked for allocations,
+ *	leaving the per-CPU mode drops the assignment of arenas to CPUs
+ */
+int
+heap_set_arena_mode(struct palloc_heap *heap, enum pobj_arena_mode mode)
+{
+	struct arenas *arenas = &heap->rt->arenas;
+
+	if (mode != POBJ_ARENA_MODE_THREAD && mode != POBJ_ARENA_MODE_CPU) {
+		ERR("invalid arena mode %d", mode);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (mode == POBJ_ARENA_MODE_CPU && os_sched_getcpu() < 0) {
+		ERR("!cannot determine the current cpu");
+		return -1;
+	}
+
+	util_mutex_lock(&arenas->lock);
+
+	util_atomic_store_explicit32(&arenas->mode, (unsigned)mode,
+		memory_order_relaxed);
+	if (mode == POBJ_ARENA_MODE_THREAD)
+		heap_cpu_arenas_reset(arenas, NULL);
+
+	util_mutex_unlock(&arenas->lock);
+
+	return 0;
+}
+
+/*
+ * heap_numa_update -- (internal) rebuilds the NUMA topology of the heap
+ *
+ * Every part of the pool set is assumed to be backed by a single node. If the
+ * topology is faked, the parts are assigned to the nodes in round-robin.
+ *
+ * Must be called with default bucket lock taken.
+ */
+static int
+heap_numa_update(struct palloc_heap *heap)
+{
+	struct heap_numa *numa = &heap->rt->numa;
+
+	VEC_CLEAR(&numa->ranges);
+	numa->nnodes = 0;
+
+	uintptr_t heap_start = (uintptr_t)heap->layout;
+	uintptr_t heap_stop = heap_start + *heap->sizep;
+
+	struct pool_replica *rep = heap->set ? heap->set->replica[0] : NULL;
+	unsigned nparts = rep ? rep->nparts : 1;
+
+	for (unsigned p = 0; p < nparts; ++p) {
+		struct numa_range r;
+		if (rep != NULL) {
+			r.start = (uintptr_t)rep->part[p].addr;
+			r.end = r.start + rep->part[p].size;
+		} else {
+			r.start = heap_start;
+			r.end = heap_stop;
+		}
+		r.start = MAX(r.start, heap_start);
+		r.end = MIN(r.end, heap_stop);
+		if (r.start >= r.end)
+			continue;
+
+		if (numa->fake_nodes != 0) {
+			r.node = p % numa->fake_nodes;
+		} else if (os_get_numa_node((void *)r.start, &r.node) != 0) {
+			LOG(3, "!unable to determine the NUMA node of part %u",
+				p);
+			r.node = 0;
+		}
+
+		if (r.node >= MAX_NUMA_NODES) {
+			LOG(3, "NUMA node %u of part %u not supported",
+				r.node, p);
+			r.node %= MAX_NUMA_NODES;
+		}
+
+		if (VEC_PUSH_BACK(&numa->ranges, r) != 0)
+			return -1;
+
+		numa->nnodes = MAX(numa->nnodes, r.node + 1);
+	}
+
+	if (numa->fake_nodes != 0)
+		numa->nnodes = numa->fake_nodes;
+
+	return 0;
+}
+
+/*
+ * heap_numa_reconfigure -- (internal) applies a NUMA configuration change and
+ *	distributes the arenas evenly among the nodes
+ */
+static int
+heap_numa_reconfigure(struct palloc_heap *heap, int enabled,
+	unsigned fake_nodes)
+{
+	struct heap_rt *h = heap->rt;
+	int ret = 0;
+
+	util_mutex_lock(&h->arenas.lock);
+	util_mutex_lock(&h->default_bucket->lock);
+
+	h->numa.enabled = enabled;
+	h->numa.fake_nodes = fake_nodes;
+	if (enabled) {
+		ret = heap_numa_update(heap);
+	} else {
+		VEC_CLEAR(&h->numa.ranges);
+		h->numa.nnodes = 0;
+	}
+
+	unsigned i = 0;
+	struct arena *a;
+	VEC_FOREACH(a, &h->arenas.vec)
+		a->node = h->numa.nnodes ? i++ % h->numa.nnodes : 0;
+
+	util_mutex_unlock(&h->default_bucket->lock);
+	util_mutex_unlock(&h->arenas.lock);
+
+	return ret;
+}
+
+/*
+ * heap_get_numa_enabled -- returns whether the heap is NUMA aware
+ */
+int
+heap_get_numa_enabled(struct palloc_heap *heap)
+{
+	return heap->rt->numa.enabled;
+}
+
+/*
+ * heap_set_numa_enabled -- enables or disables NUMA aware placement
+ *
+ * The topology is detected every time the placement is enabled, threads that
+ * already have an arena assigned keep it.
+ */
+int
+heap_set_numa_enabled(struct palloc_heap *heap, int enabled)
+{
+	return heap_numa_reconfigure(heap, enabled,
+		heap->rt->numa.fake_nodes);
+}
+
+/*
+ * heap_get_numa_fake_nodes -- returns the number of faked NUMA nodes
+ */
+unsigned
+heap_get_numa_fake_nodes(struct palloc_heap *heap)
+{
+	return heap->rt->numa.fake_nodes;
+}
+
+/*
+ * heap_set_numa_fake_nodes -- fakes the NUMA topology with the given number
+ *	of nodes, 0 restores the real topology
+ */
+int
+heap_set_numa_fake_nodes(struct palloc_heap *heap, unsigned nnodes)
+{
+	if (nnodes > MAX_NUMA_NODES) {
+		ERR("number of NUMA nodes %u larger than maximum (%u)",
+			nnodes, MAX_NUMA_NODES);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return heap_numa_reconfigure(heap, heap->rt->numa.enabled, nnodes);
 }
 
 /*
- * heap_memblock_insert_block -- (internal) bucket insert wrapper for callbacks
+ * heap_get_numa_nnodes -- returns the number of NUMA nodes backing the heap
  */
-static int
-heap_memblock_insert_block(const struct memory_block *m, void *b)
+unsigned
+heap_get_numa_nnodes(struct palloc_heap *heap)
 {
-	return bucket_insert_block(b, m);
+	return heap->rt->numa.nnodes;
 }
 
 /*
- * heap_run_create -- (internal) initializes a new run on an existing free chunk
+ * heap_get_numa_node_stats -- returns statistics of the given NUMA node
  */
-static int
-heap_run_create(struct palloc_heap *heap, struct bucket *b,
-	struct memory_block *m)
+int
+heap_get_numa_node_stats(struct palloc_heap *heap, unsigned node,
+	struct heap_numa_node_stats *stats)
 {
-	*m = memblock_run_init(heap, m->chunk_id, m->zone_id, &b->aclass->rdsc);
+	struct heap_rt *h = heap->rt;
 
-	if (m->m_ops->iterate_free(m, heap_memblock_insert_block, b) != 0) {
-		b->c_ops->rm_all(b->container);
-		return -1;
+	util_mutex_lock(&h->arenas.lock);
+	util_mutex_lock(&h->default_bucket->lock);
+
+	int ret = -1;
+	if (node >= h->numa.nnodes) {
+		ERR("NUMA node %u does not exist", node);
+		errno = EINVAL;
+		goto out;
 	}
 
-	STATS_INC(heap->stats, transient, heap_run_active,
-		m->size_idx * CHUNKSIZE);
+	stats->narenas = 0;
+	struct arena *a;
+	VEC_FOREACH(a, &h->arenas.vec) {
+		if (a->node == node)
+			stats->narenas++;
+	}
 
-	return 0;
+	stats->size = 0;
+	struct numa_range *r;
+	VEC_FOREACH_BY_PTR(r, &h->numa.ranges) {
+		if (r->node == node)
+			stats->size += r->end - r->start;
+	}
+
+	util_atomic_load64(&h->numa.stats[node].local, &stats->local);
+	util_atomic_load64(&h->numa.stats[node].remote, &stats->remote);
+
+	ret = 0;
+
+out:
+	util_mutex_unlock(&h->default_bucket->lock);
+	util_mutex_unlock(&h->arenas.lock);
+
+	return ret;
 }
 
 /*
- * heap_run_reuse -- (internal) reuses existing run
+ * heap_get_arena_node -- returns the NUMA node of the arena
  */
-static int
-heap_run_reuse(struct palloc_heap *heap, struct bucket *b,
-	const struct memory_block *m)
+unsigned
+heap_get_arena_node(struct palloc_heap *heap, unsigned arena_id)
 {
-	int ret = 0;
-
-	ASSERTeq(m->type, MEMORY_BLOCK_RUN);
-	os_mutex_t *lock = m->m_ops->get_lock(m);
+	util_mutex_lock(&heap->rt->arenas.lock);
+	unsigned node = heap_get_arena_by_id(heap, arena_id)->node;
+	util_mutex_unlock(&heap->rt->arenas.lock);
 
-	util_mutex_lock(lock);
+	return node;
+}
 
-	ret = m->m_ops->iterate_free(m, heap_memblock_insert_block, b);
+/*
+ * heap_set_arena_node -- changes the NUMA node of the arena
+ */
+int
+heap_set_arena_node(struct palloc_heap *heap, unsigned arena_id,
+	unsigned node)
+{
+	struct heap_rt *h = heap->rt;
+	int ret = 0;
 
-	util_mutex_unlock(lock);
+	util_mutex_lock(&h->arenas.lock);
+	util_mutex_lock(&h->default_bucket->lock);
 
-	if (ret == 0) {
-		b->active_memory_block->m = *m;
-		b->active_memory_block->bucket = b;
-		b->is_active = 1;
-		util_fetch_and_add64(&b->active_memory_block->nresv, 1);
+	if (node >= h->numa.nnodes) {
+		ERR("NUMA node %u does not exist", node);
+		errno = EINVAL;
+		ret = -1;
 	} else {
-		b->c_ops->rm_all(b->container);
+		heap_get_arena_by_id(heap, arena_id)->node = node;
 	}
 
+	util_mutex_unlock(&h->default_bucket->lock);
+	util_mutex_unlock(&h->arenas.lock);
+
 	return ret;
 }
 
 /*
- * heap_free_chunk_reuse -- reuses existing free chunk
+ * heap_get_thread_numa_node -- returns the NUMA node of the arena assigned to
+ *	the current thread
  */
-int
-heap_free_chunk_reuse(struct palloc_heap *heap,
-	struct bucket *bucket,
-	struct memory_block *m)
+unsigned
+heap_get_thread_numa_node(struct palloc_heap *heap)
 {
-	/*
-	 * Perform coalescing just in case there
-	 * are any neighboring free chunks.
-	 */
-	struct memory_block nm = heap_coalesce_huge(heap, bucket, m);
-	if (nm.size_idx != m->size_idx) {
-		m->m_ops->prep_hdr(&nm, MEMBLOCK_FREE, NULL);
-	}
+	struct arena *a = heap_thread_arena(heap);
 
-	*m = nm;
+	util_mutex_lock(&heap->rt->arenas.lock);
+	unsigned node = a->node;
+	util_mutex_unlock(&heap->rt->arenas.lock);
 
-	return bucket_insert_block(bucket, m);
+	return node;
 }
 
 /*
- * heap_run_into_free_chunk -- (internal) creates a new free chunk in place of
- *	a run.
+ * heap_set_thread_numa_node -- assigns the least used automatic arena of the
+ *	given NUMA node to the current thread
  */
-static void
-heap_run_into_free_chunk(struct palloc_heap *heap,
-	struct bucket *bucket,
-	struct memory_block *m)
+int
+heap_set_thread_numa_node(struct palloc_heap *heap, unsigned node)
 {
-	struct chunk_header *hdr = heap_get_chunk_hdr(heap, m);
+	struct heap_rt *h = heap->rt;
 
-	m->block_off = 0;
-	m->size_idx = hdr->size_idx;
+	util_mutex_lock(&h->arenas.lock);
 
-	STATS_SUB(heap->stats, transient, heap_run_active,
-		m->size_idx * CHUNKSIZE);
+	struct arena *a = node < h->numa.nnodes ?
+		heap_arena_least_used(heap, (int)node) : NULL;
+	if (a == NULL) {
+		util_mutex_unlock(&h->arenas.lock);
+		ERR("no automatic arena on NUMA node %u", node);
+		errno = EINVAL;
+		return -1;
+	}
 
-	/*
-	 * The only thing this could race with is heap_memblock_on_free()
-	 * because that function is called after processing the operation,
-	 * which means that a different thread might immediately call this
-	 * function if the free() made the run empty.
-	 * We could forgo this lock if it weren't for helgrind which needs it
-	 * to establish happens-before relation for the chunk metadata.
-	 */
-	os_mutex_t *lock = m->m_ops->get_lock(m);
-	util_mutex_lock(lock);
+	heap_arena_thread_attach(heap, a);
 
-	*m = memblock_huge_init(heap, m->chunk_id, m->zone_id, m->size_idx);
+	util_mutex_unlock(&h->arenas.lock);
 
-	heap_free_chunk_reuse(heap, bucket, m);
+	heap_thread_cache_flush(heap);
 
-	util_mutex_unlock(lock);
+	return 0;
 }
 
 /*
- * heap_reclaim_run -- checks the run for available memory if unclaimed.
- *
- * Returns 1 if reclaimed chunk, 0 otherwise.
+ * heap_get_adaptive_enabled -- returns whether allocation classes are derived
+ *	from the sampled allocation sizes
  */
-static int
-heap_reclaim_run(struct palloc_heap *heap, struct memory_block *m, int startup)
+int
+heap_get_adaptive_enabled(struct palloc_heap *heap)
 {
-	struct chunk_run *run = heap_get_chunk_run(heap, m);
-	struct chunk_header *hdr = heap_get_chunk_hdr(heap, m);
-
-	struct alloc_class *c = alloc_class_by_run(
-		heap->rt->alloc_classes,
-		run->hdr.block_size, hdr->flags, m->size_idx);
+	int enabled;
+	util_atomic_load_explicit32(&heap->rt->adaptive.enabled, &enabled,
+		memory_order_relaxed);
 
-	struct recycler_element e = recycler_element_new(heap, m);
-	if (c == NULL) {
-		uint32_t size_idx = m->size_idx;
-		struct run_bitmap b;
-		m->m_ops->get_bitmap(m, &b);
+	return enabled;
+}
 
-		ASSERTeq(size_idx, m->size_idx);
+/*
+ * heap_set_adaptive_enabled -- enables or disables the sampling of allocation
+ *	sizes and the derivation of classes
+ *
+ * The classes that were already derived remain in use.
+ */
+void
+heap_set_adaptive_enabled(struct palloc_heap *heap, int enabled)
+{
+	util_atomic_store_explicit32(&heap->rt->adaptive.enabled, enabled,
+		memory_order_relaxed);
+}
 
-		return e.free_space == b.nbits;
-	}
+/*
+ * heap_get_adaptive_sample_rate -- returns how many allocations of a thread
+ *	make up a single sample
+ */
+unsigned
+heap_get_adaptive_sample_rate(struct palloc_heap *heap)
+{
+	unsigned rate;
+	util_atomic_load_explicit32(&heap->rt->adaptive.sample_rate, &rate,
+		memory_order_relaxed);
 
-	if (e.free_space == c->rdsc.nallocs)
-		return 1;
+	return rate;
+}
 
-	if (startup) {
-		STATS_INC(heap->stats, transient, heap_run_active,
-			m->size_idx * CHUNKSIZE);
-		STATS_INC(heap->stats, transient, heap_run_allocated,
-			c->rdsc.nallocs - e.free_space);
+/*
+ * heap_set_adaptive_sample_rate -- changes how many allocations of a thread
+ *	make up a single sample
+ */
+int
+heap_set_adaptive_sample_rate(struct palloc_heap *heap, unsigned rate)
+{
+	if (rate == 0) {
+		ERR("sample rate has to be positive");
+		errno = EINVAL;
+		return -1;
 	}
 
-	if (recycler_put(heap->rt->recyclers[c->id], m, e) < 0)
-		ERR("lost runtime tracking info of %u run due to OOM", c->id);
+	util_atomic_store_explicit32(&heap->rt->adaptive.sample_rate, rate,
+		memory_order_relaxed);
 
 	return 0;
 }
 
 /*
- * heap_reclaim_zone_garbage -- (internal) creates volatile state of unused runs
+ * heap_get_adaptive_max_waste -- returns the percentage of a unit above which
+ *	a better fitting class is derived
  */
-static void
-heap_reclaim_zone_garbage(struct palloc_heap *heap, struct bucket *bucket,
-	uint32_t zone_id)
+unsigned
+heap_get_adaptive_max_waste(struct palloc_heap *heap)
 {
-	struct zone *z = ZID_TO_ZONE(heap->layout, zone_id);
-
-	for (uint32_t i = 0; i < z->header.size_idx; ) {
-		struct chunk_header *hdr = &z->chunk_headers[i];
-		ASSERT(hdr->size_idx != 0);
+	unsigned max_waste;
+	util_atomic_load_explicit32(&heap->rt->adaptive.max_waste, &max_waste,
+		memory_order_relaxed);
 
-		struct memory_block m = MEMORY_BLOCK_NONE;
-		m.zone_id = zone_id;
-		m.chunk_id = i;
-		m.size_idx = hdr->size_idx;
+	return max_waste;
+}
 
-		memblock_rebuild_state(heap, &m);
-		m.m_ops->reinit_chunk(&m);
+/*
+ * heap_set_adaptive_max_waste -- changes the percentage of a unit above which
+ *	a better fitting class is derived
+ */
+int
+heap_set_adaptive_max_waste(struct palloc_heap *heap, unsigned max_waste)
+{
+	if (max_waste > 100) {
+		ERR("waste percentage outside of the allowed range");
+		errno = EINVAL;
+		return -1;
+	}
 
-		switch (hdr->type) {
-			case CHUNK_TYPE_RUN:
-				if (heap_reclaim_run(heap, &m, 1) != 0)
-					heap_run_into_free_chunk(heap, bucket,
-						&m);
-				break;
-			case CHUNK_TYPE_FREE:
-				heap_free_chunk_reuse(heap, bucket, &m);
-				break;
-			case CHUNK_TYPE_USED:
-				break;
-			default:
-				ASSERT(0);
-		}
+	util_atomic_store_explicit32(&heap->rt->adaptive.max_waste, max_waste,
+		memory_order_relaxed);
 
-		i = m.chunk_id + m.size_idx; /* hdr might have changed */
-	}
+	return 0;
 }
 
 /*
- * heap_populate_bucket -- (internal) creates volatile state of memory blocks
+ * heap_get_adaptive_nclasses -- returns the number of derived classes
  */
-static int
-heap_populate_bucket(struct palloc_heap *heap, struct bucket *bucket)
+unsigned
+heap_get_adaptive_nclasses(struct palloc_heap *heap)
 {
-	struct heap_rt *h = heap->rt;
-
-	/* at this point we are sure that there's no more memory in the heap */
-	if (h->zones_exhausted == h->nzones)
-		return ENOMEM;
-
-	uint32_t zone_id = h->zones_exhausted++;
-	struct zone *z = ZID_TO_ZONE(heap->layout, zone_id);
+	unsigned nclasses;
+	util_atomic_load_explicit32(&heap->rt->adaptive.nclasses, &nclasses,
+		memory_order_acquire);
 
-	/* ignore zone and chunk headers */
-	VALGRIND_ADD_TO_GLOBAL_TX_IGNORE(z, sizeof(z->header) +
-		sizeof(z->chunk_headers));
+	return nclasses;
+}
 
-	if (z->header.magic != ZONE_HEADER_MAGIC)
-		heap_zone_init(heap, zone_id, 0);
+/*
+ * heap_get_adaptive_class -- returns the information about a derived class
+ */
+int
+heap_get_adaptive_class(struct palloc_heap *heap, unsigned idx,
+	struct heap_adaptive_class *aclass)
+{
+	if (idx >= heap_get_adaptive_nclasses(heap)) {
+		ERR("derived class %u does not exist", idx);
+		errno = ENOENT;
+		return -1;
+	}
 
-	heap_reclaim_zone_garbage(heap, bucket, zone_id);
+	*aclass = heap->rt->adaptive.classes[idx];
 
-	/*
-	 * It doesn't matter that this function might not have found any
-	 * free blocks because there is still potential that subsequent calls
-	 * will find something in later zones.
-	 */
 	return 0;
 }
 
 /*
- * heap_recycle_unused -- recalculate scores in the recycler and turn any
- *	empty runs into free chunks
+ * heap_huge_stats_get -- (internal) gathers the statistics of free chunks
+ *	and returns the number of their contiguous extents
  *
- * If force is not set, this function might effectively be a noop if not enough
- * of space was freed.
+ * The free chunks of the processed zones are summarized by the container of
+ * the default bucket as they are inserted and removed, so this only takes
+ * the lock of the bucket for a moment. The zones which were never used are
+ * entirely free.
  */
-static int
-heap_recycle_unused(struct palloc_heap *heap, struct recycler *recycler,
-	struct bucket *defb, int force)
+static uint64_t
+heap_huge_stats_get(struct palloc_heap *heap, struct heap_huge_stats *hs)
 {
-	struct empty_runs r = recycler_recalc(recycler, force);
-	if (VEC_SIZE(&r) == 0)
-		return ENOMEM;
+	struct heap_rt *rt = heap->rt;
+	struct bucket *defb = rt->default_bucket;
 
-	struct bucket *nb = defb == NULL ? heap_bucket_acquire(heap,
-		DEFAULT_ALLOC_CLASS_ID, HEAP_ARENA_PER_THREAD) : NULL;
+	struct block_container_stats cs;
+	uint64_t nextents = 0;
+	uint64_t largest = 0;
 
-	ASSERT(defb != NULL || nb != NULL);
+	memset(hs, 0, sizeof(*hs));
 
-	struct memory_block *nm;
-	VEC_FOREACH_BY_PTR(nm, &r) {
-		heap_run_into_free_chunk(heap, defb ? defb : nb, nm);
+	util_mutex_lock(&defb->lock);
+
+	defb->c_ops->get_stats(defb->container, &cs);
+	hs->free_bytes = cs.nunits * CHUNKSIZE;
+	largest = (uint64_t)cs.largest * CHUNKSIZE;
+	nextents = cs.nblocks;
+
+	for (uint32_t zone_id = 0; zone_id < rt->nzones; ++zone_id) {
+		struct zone *z = ZID_TO_ZONE(heap->layout, zone_id);
+		if (VEC_GET(&rt->zones.vec, zone_id)->populated ||
+		    z->header.magic == ZONE_HEADER_MAGIC)
+			continue;
+
+		uint64_t size = (uint64_t)zone_calc_size_idx(zone_id,
+			rt->nzones, *heap->sizep) * CHUNKSIZE;
+		hs->free_bytes += size;
+		if (size > largest)
+			largest = size;
+		nextents++;
 	}
 
-	if (nb != NULL)
-		heap_bucket_release(heap, nb);
+	util_mutex_unlock(&defb->lock);
 
-	VEC_DELETE(&r);
+	hs->largest_free = largest;
+	hs->fragmentation = hs->free_bytes == 0 ? 0 :
+		100 - hs->largest_free * 100 / hs->free_bytes;
 
-	return 0;
+	return nextents;
 }
 
 /*
- * heap_reclaim_garbage -- (internal) creates volatile state of unused runs
+ * heap_runs_stats -- (internal) walks the chunk headers of the entire heap
+ *	and gathers the occupancy of the allocation class
+ *
+ * The walk doesn't stop any allocations, so the result is only accurate if
+ * the heap is not concurrently modified. It never steps outside of a zone,
+ * even if it reads a header which is being modified.
  */
-static int
-heap_reclaim_garbage(struct palloc_heap *heap, struct bucket *bucket)
+static void
+heap_runs_stats(struct palloc_heap *heap, uint8_t class_id,
+	struct heap_class_stats *cs)
 {
-	int ret = ENOMEM;
-	struct recycler *r;
-	for (size_t i = 0; i < MAX_ALLOCATION_CLASSES; ++i) {
-		if ((r = heap->rt->recyclers[i]) == NULL)
+	struct heap_rt *rt = heap->rt;
+
+	for (uint32_t zone_id = 0; zone_id < rt->nzones; ++zone_id) {
+		struct zone *z = ZID_TO_ZONE(heap->layout, zone_id);
+		if (z->header.magic != ZONE_HEADER_MAGIC)
 			continue;
 
-		if (heap_recycle_unused(heap, r, bucket, 1) == 0)
-			ret = 0;
+		uint32_t zone_size_idx = z->header.size_idx;
+		for (uint32_t i = 0; i < zone_size_idx; ) {
+			struct chunk_header *hdr = &z->chunk_headers[i];
+			uint32_t size_idx = hdr->size_idx != 0 ?
+				hdr->size_idx : 1;
+			if (size_idx > zone_size_idx - i)
+				break;
+
+			if (hdr->type == CHUNK_TYPE_USED &&
+			    class_id == DEFAULT_ALLOC_CLASS_ID) {
+				cs->live_bytes += (uint64_t)size_idx *
+					CHUNKSIZE;
+			} else if (hdr->type == CHUNK_TYPE_RUN &&
+			    class_id != DEFAULT_ALLOC_CLASS_ID) {
+				struct memory_block m = MEMORY_BLOCK_NONE;
+				m.zone_id = zone_id;
+				m.chunk_id = i;
+				m.size_idx = size_idx;
+
+				struct chunk_run *run =
+					heap_get_chunk_run(heap, &m);
+				struct alloc_class *c = alloc_class_by_run(
+					rt->alloc_classes, run->hdr.block_size,
+					hdr->flags, size_idx);
+
+				if (c != NULL && c->id == class_id) {
+					memblock_rebuild_state(heap, &m);
+					struct recycler_element e =
+						recycler_element_new(heap, &m);
+
+					cs->runs++;
+					cs->free_blocks += e.free_space;
+					cs->live_bytes += (uint64_t)
+						(c->rdsc.nallocs -
+						e.free_space) * c->unit_size;
+				}
+			}
+
+			i += size_idx;
+		}
 	}
-
-	return ret;
 }
 
 /*
- * heap_ensure_huge_bucket_filled --
- *	(internal) refills the default bucket if needed
+ * heap_get_class_stats -- returns the statistics of the allocation class
+ *
+ * The counters of allocations, frees and lock waits are only gathered
+ * while the transient statistics are enabled, the occupancy is always
+ * calculated from the current state of the heap.
  */
-static int
-heap_ensure_huge_bucket_filled(struct palloc_heap *heap, struct bucket *bucket)
+int
+heap_get_class_stats(struct palloc_heap *heap, uint8_t class_id,
+	struct heap_class_stats *stats)
 {
-	if (heap_reclaim_garbage(heap, bucket) == 0)
-		return 0;
+	struct heap_rt *rt = heap->rt;
 
-	if (heap_populate_bucket(heap, bucket) == 0)
-		return 0;
+	if (class_id >= MAX_ALLOCATION_CLASSES ||
+	    alloc_class_by_id(rt->alloc_classes, class_id) == NULL) {
+		ERR("allocation class %u does not exist", class_id);
+		errno = ENOENT;
+		return -1;
+	}
 
-	int extend;
-	if ((extend = heap_extend(heap, bucket, heap->growsize)) < 0)
-		return ENOMEM;
+	util_mutex_lock(&rt->tstats.lock);
 
-	if (extend == 1)
-		return 0;
+	struct heap_counters sum = rt->tstats.classes[class_id];
 
-	/*
-	 * Extending the pool does not automatically add the chunks into the
-	 * runtime state of the bucket - we need to traverse the new zone if
-	 * it was created.
-	 */
-	if (heap_populate_bucket(heap, bucket) == 0)
-		return 0;
+	struct thread_stats *ts;
+	VEC_FOREACH(ts, &rt->tstats.vec) {
+		for (int i = 0; i < MAX_HEAP_COUNTERS; ++i) {
+			uint64_t v;
+			util_atomic_load_explicit64(&ts->classes[class_id].v[i],
+				&v, memory_order_relaxed);
+			sum.v[i] += v;
+		}
+	}
 
-	return ENOMEM;
-}
+	util_mutex_unlock(&rt->tstats.lock);
 
-/*
- * heap_bucket_deref_active -- detaches active blocks from the bucket
- */
-static int
-heap_bucket_deref_active(struct palloc_heap *heap, struct bucket *b)
-{
-	/* get rid of the active block in the bucket */
-	struct memory_block_reserved **active = &b->active_memory_block;
+	memset(stats, 0, sizeof(*stats));
+	stats->allocations = sum.v[HEAP_COUNTER_ALLOCATIONS];
+	stats->frees = sum.v[HEAP_COUNTER_FREES];
+	stats->lock_waits = sum.v[HEAP_COUNTER_LOCK_WAITS];
+	stats->claims = sum.v[HEAP_COUNTER_CLAIMS];
 
-	if (b->is_active) {
-		b->c_ops->rm_all(b->container);
-		if (util_fetch_and_sub64(&(*active)->nresv, 1) == 1) {
-			VALGRIND_ANNOTATE_HAPPENS_AFTER(&(*active)->nresv);
-			heap_discard_run(heap, &(*active)->m);
-		} else {
-			VALGRIND_ANNOTATE_HAPPENS_BEFORE(&(*active)->nresv);
-			*active = NULL;
-		}
-		b->is_active = 0;
-	}
+	heap_runs_stats(heap, class_id, stats);
 
-	if (*active == NULL) {
-		*active = Zalloc(sizeof(struct memory_block_reserved));
-		if (*active == NULL)
-			return -1;
+	if (class_id == DEFAULT_ALLOC_CLASS_ID) {
+		struct heap_huge_stats hs;
+		stats->free_blocks = heap_huge_stats_get(heap, &hs);
 	}
 
 	return 0;
 }
 
 /*
- * heap_force_recycle -- detaches all memory from arenas, and forces global
- *	recycling of all memory blocks
+ * heap_get_arena_stats -- returns the statistics of the arena
+ *
+ * Frees are attributed to the arena of the thread that performed them, so
+ * the live bytes of an arena are only an estimate.
  */
-void
-heap_force_recycle(struct palloc_heap *heap)
+int
+heap_get_arena_stats(struct palloc_heap *heap, unsigned arena_id,
+	struct heap_arena_stats *stats)
 {
-	util_mutex_lock(&heap->rt->arenas.lock);
-	struct arena *arenap;
-	VEC_FOREACH(arenap, &heap->rt->arenas.vec) {
-		for (int i = 0; i < MAX_ALLOCATION_CLASSES; ++i) {
-			struct bucket *b = arenap->buckets[i];
-			if (b == NULL)
-				continue;
-			util_mutex_lock(&b->lock);
-			/*
-			 * There's no need to check if this fails, as that
-			 * will not prevent progress in this function.
-			 */
-			heap_bucket_deref_active(heap, b);
-			util_mutex_unlock(&b->lock);
-		}
+	struct heap_rt *rt = heap->rt;
+
+	util_mutex_lock(&rt->arenas.lock);
+	if (arena_id < 1 || arena_id > VEC_SIZE(&rt->arenas.vec)) {
+		util_mutex_unlock(&rt->arenas.lock);
+		ERR("arena %u does not exist", arena_id);
+		errno = ENOENT;
+		return -1;
 	}
-	util_mutex_unlock(&heap->rt->arenas.lock);
-	heap_reclaim_garbage(heap, NULL);
-}
+	struct arena *arena = VEC_ARR(&rt->arenas.vec)[arena_id - 1];
+	util_mutex_unlock(&rt->arenas.lock);
 
-/*
- * heap_reuse_from_recycler -- (internal) try reusing runs that are currently
- *	in the recycler
- */
-static int
-heap_reuse_from_recycler(struct palloc_heap *heap,
-	struct bucket *b, uint32_t units, int force)
-{
-	struct memory_block m = MEMORY_BLOCK_NONE;
-	m.size_idx = units;
+	struct heap_counters sum;
+	for (int i = 0; i < MAX_HEAP_COUNTERS; ++i)
+		util_atomic_load_explicit64(&arena->counters.v[i], &sum.v[i],
+			memory_order_acquire);
 
-	struct recycler *r = heap->rt->recyclers[b->aclass->id];
-	if (!force && recycler_get(r, &m) == 0)
-		return heap_run_reuse(heap, b, &m);
+	util_mutex_lock(&rt->tstats.lock);
 
-	heap_recycle_unused(heap, r, NULL, force);
+	struct thread_stats *ts;
+	VEC_FOREACH(ts, &rt->tstats.vec) {
+		if (ts->arena != arena)
+			continue;
 
-	if (recycler_get(r, &m) == 0)
-		return heap_run_reuse(heap, b, &m);
+		for (int i = 0; i < MAX_HEAP_COUNTERS; ++i) {
+			uint64_t v;
+			util_atomic_load_explicit64(&ts->arena_counters.v[i],
+				&v, memory_order_relaxed);
+			sum.v[i] += v;
+		}
+	}
 
-	return ENOMEM;
+	util_mutex_unlock(&rt->tstats.lock);
+
+	stats->allocations = sum.v[HEAP_COUNTER_ALLOCATIONS];
+	stats->frees = sum.v[HEAP_COUNTER_FREES];
+	stats->live_bytes = sum.v[HEAP_COUNTER_ALLOC_BYTES] >
+		sum.v[HEAP_COUNTER_FREE_BYTES] ?
+		sum.v[HEAP_COUNTER_ALLOC_BYTES] -
+		sum.v[HEAP_COUNTER_FREE_BYTES] : 0;
+	stats->lock_waits = sum.v[HEAP_COUNTER_LOCK_WAITS];
+	stats->claims = sum.v[HEAP_COUNTER_CLAIMS];
+
+	return 0;
 }
 
 /*
- * heap_discard_run -- puts the memory block back into the global heap.
+ * heap_get_huge_stats -- returns the statistics of free chunks
  */
 void
-heap_discard_run(struct palloc_heap *heap, struct memory_block *m)
+heap_get_huge_stats(struct palloc_heap *heap, struct heap_huge_stats *stats)
 {
-	if (heap_reclaim_run(heap, m, 0)) {
-		struct bucket *defb =
-			heap_bucket_acquire(heap,
-			DEFAULT_ALLOC_CLASS_ID, 0);
-
-		heap_run_into_free_chunk(heap, defb, m);
-
-		heap_bucket_release(heap, defb);
-	}
+	heap_huge_stats_get(heap, stats);
 }
 
 /*
- * heap_ensure_run_bucket_filled -- (internal) refills the bucket if needed
+ * heap_get_extend_watermark -- returns the size of the free extent below which
+ *	the heap is extended in the background
  */
-static int
-heap_ensure_run_bucket_filled(struct palloc_heap *heap, struct bucket *b,
-	uint32_t units)
+uint64_t
+heap_get_extend_watermark(struct palloc_heap *heap)
 {
-	ASSERTeq(b->aclass->type, CLASS_RUN);
-	int ret = 0;
+	uint64_t watermark;
+	util_atomic_load_explicit64(&heap->rt->extender.watermark, &watermark,
+		memory_order_relaxed);
 
-	if (heap_bucket_deref_active(heap, b) != 0)
-		return ENOMEM;
+	return watermark;
+}
 
-	if (heap_reuse_from_recycler(heap, b, units, 0) == 0)
-		goto out;
+/*
+ * heap_set_extend_watermark -- changes the size of the free extent below
+ *	which the heap is extended in the background, starts the worker if
+ *	needed
+ */
+int
+heap_set_extend_watermark(struct palloc_heap *heap, uint64_t watermark)
+{
+	struct heap_extender *e = &heap->rt->extender;
 
-	/* search in the next zone before attempting to create a new run */
-	struct bucket *defb = heap_bucket_acquire(heap,
-		DEFAULT_ALLOC_CLASS_ID,
-		HEAP_ARENA_PER_THREAD);
-	heap_populate_bucket(heap, defb);
-	heap_bucket_release(heap, defb);
+	if (watermark > MAX_CHUNK * CHUNKSIZE) {
+		ERR("watermark larger than the size of a zone");
+		errno = EINVAL;
+		return -1;
+	}
 
-	if (heap_reuse_from_recycler(heap, b, units, 0) == 0)
-		goto out;
+	int ret = 0;
 
-	struct memory_block m = MEMORY_BLOCK_NONE;
-	m.size_idx = b->aclass->rdsc.size_idx;
+	util_mutex_lock(&e->lock);
 
-	defb = heap_bucket_acquire(heap,
-		DEFAULT_ALLOC_CLASS_ID,
-		HEAP_ARENA_PER_THREAD);
-	/* cannot reuse an existing run, create a new one */
-	if (heap_get_bestfit_block(heap, defb, &m) == 0) {
-		ASSERTeq(m.block_off, 0);
-		if (heap_run_create(heap, b, &m) != 0) {
-			heap_bucket_release(heap, defb);
-			return ENOMEM;
+	if (watermark != 0 && !e->running && !e->stop) {
+		ret = os_thread_create(&e->thread, NULL,
+			heap_extender_worker, heap);
+		if (ret != 0) {
+			errno = ret;
+			ERR("!os_thread_create");
+			ret = -1;
+			goto out;
 		}
-
-		b->active_memory_block->m = m;
-		b->is_active = 1;
-		b->active_memory_block->bucket = b;
-		util_fetch_and_add64(&b->active_memory_block->nresv, 1);
-
-		heap_bucket_release(heap, defb);
-
-		goto out;
+		e->running = 1;
 	}
-	heap_bucket_release(heap, defb);
 
-	if (heap_reuse_from_recycler(heap, b, units, 0) == 0)
-		goto out;
+	util_atomic_store_explicit64(&e->watermark, watermark,
+		memory_order_relaxed);
+	e->failed = 0;
 
-	ret = ENOMEM;
 out:
+	util_mutex_unlock(&e->lock);
 
 	return ret;
 }
 
 /*
- * heap_memblock_on_free -- bookkeeping actions executed at every free of a
- *	block
+ * heap_get_extend_stats -- returns the statistics of the heap extensions
  */
 void
-heap_memblock_on_free(struct palloc_heap *heap, const struct memory_block *m)
+heap_get_extend_stats(struct palloc_heap *heap, struct heap_extend_stats *stats)
 {
-	if (m->type != MEMORY_BLOCK_RUN)
-		return;
-
-	struct chunk_header *hdr = heap_get_chunk_hdr(heap, m);
-	struct chunk_run *run = heap_get_chunk_run(heap, m);
-
-	ASSERTeq(hdr->type, CHUNK_TYPE_RUN);
+	struct heap_extend_stats *s = &heap->rt->extender.stats;
 
-	struct alloc_class *c = alloc_class_by_run(
-		heap->rt->alloc_classes,
-		run->hdr.block_size, hdr->flags, hdr->size_idx);
-
-	if (c == NULL)
-		return;
-
-	recycler_inc_unaccounted(heap->rt->recyclers[c->id], m);
+	util_atomic_load64(&s->async, &stats->async);
+	util_atomic_load64(&s->sync, &stats->sync);
+	util_atomic_load64(&s->failed, &stats->failed);
+	util_atomic_load64(&s->time_ns, &stats->time_ns);
+	util_atomic_load64(&s->max_ns, &stats->max_ns);
 }
 
 /*
- * heap_split_block -- (internal) splits unused part of the memory block
+ * heap_extender_stop -- stops the background extension of the heap, waits
+ *	for the extension in progress to finish
  */
-static void
-heap_split_block(struct palloc_heap *heap, struct bucket *b,
-		struct memory_block *m, uint32_t units)
+void
+heap_extender_stop(struct palloc_heap *heap)
 {
-	ASSERT(units <= UINT16_MAX);
-	ASSERT(units > 0);
+	struct heap_extender *e = &heap->rt->extender;
 
-	if (b->aclass->type == CLASS_RUN) {
-		ASSERT((uint64_t)m->block_off + (uint64_t)units <= UINT32_MAX);
-		struct memory_block r = {m->chunk_id, m->zone_id,
-			m->size_idx - units, (uint32_t)(m->block_off + units),
-			NULL, NULL, 0, 0, NULL};
-		memblock_rebuild_state(heap, &r);
-		if (bucket_insert_block(b, &r) != 0)
-			LOG(2,
-				"failed to allocate memory block runtime tracking info");
-	} else {
-		uint32_t new_chunk_id = m->chunk_id + units;
-		uint32_t new_size_idx = m->size_idx - units;
+	util_mutex_lock(&e->lock);
 
-		*m = memblock_huge_init(heap, m->chunk_id, m->zone_id, units);
+	int running = e->running;
+	e->stop = 1;
+	os_cond_signal(&e->cond);
 
-		struct memory_block n = memblock_huge_init(heap,
-			new_chunk_id, m->zone_id, new_size_idx);
+	util_mutex_unlock(&e->lock);
 
-		if (bucket_insert_block(b, &n) != 0)
-			LOG(2,
-				"failed to allocate memory block runtime tracking info");
-	}
+	if (running)
+		os_thread_join(&e->thread, NULL);
 
-	m->size_idx = units;
+	e->running = 0;
 }
 
 /*
- * heap_get_bestfit_block --
- *	extracts a memory block of equal size index
+ * heap_sample_alloc -- records the reserved allocation in the ring of
+ *	samples, if the current allocation of the thread is sampled
  */
-int
-heap_get_bestfit_block(struct palloc_heap *heap, struct bucket *b,
-	struct memory_block *m)
+void
+heap_sample_alloc(struct palloc_heap *heap, size_t size, uint64_t off,
+	uint64_t type_num, uint8_t class_id, uint16_t arena_id)
 {
-	uint32_t units = m->size_idx;
-
-	while (b->c_ops->get_rm_bestfit(b->container, m) != 0) {
-		if (b->aclass->type == CLASS_HUGE) {
-			if (heap_ensure_huge_bucket_filled(heap, b) != 0)
-				return ENOMEM;
-		} else {
-			if (heap_ensure_run_bucket_filled(heap, b, units) != 0)
-				return ENOMEM;
-		}
-	}
+	struct heap_sampler *s = &heap->rt->sampler;
 
-	ASSERT(m->size_idx >= units);
+	unsigned rate;
+	util_atomic_load_explicit32(&s->rate, &rate, memory_order_acquire);
+	if (rate == 0)
+		return;
 
-	if (units != m->size_idx)
-		heap_split_block(heap, b, m, units);
+	if (Sample_countdown != 0) {
+		Sample_countdown--;
+		return;
+	}
+	Sample_countdown = rate - 1;
 
-	m->m_ops->ensure_header_type(m, b->aclass->header_type);
-	m->header_type = b->aclass->header_type;
+	struct heap_sample sample;
+	sample.size = size;
+	sample.off = off;
+	sample.type_num = type_num;
+	sample.class_id = class_id;
+	if (arena_id == HEAP_ARENA_PER_THREAD) {
+		struct arena *a = heap_current_arena(heap);
+		arena_id = a != NULL ? (uint16_t)a->id : 0;
+	}
+	sample.arena_id = arena_id;
+
+	/* the innermost frame is this function */
+	void *frames[POBJ_ALLOC_SAMPLE_FRAMES + 1];
+	unsigned nframes = os_backtrace(frames, POBJ_ALLOC_SAMPLE_FRAMES + 1);
+	for (unsigned i = 0; i < POBJ_ALLOC_SAMPLE_FRAMES; ++i) {
+		sample.frames[i] = i + 1 < nframes ?
+			(uint64_t)(uintptr_t)frames[i + 1] : 0;
+	}
 
-	return 0;
+	/* the ring is allocated before the sampling is first enabled */
+	uint64_t seq = util_fetch_and_add64(&s->total, 1);
+	struct heap_sample *slot = &s->ring[seq % s->capacity];
+
+	uint64_t *src = &sample.seq;
+	uint64_t *dst = &slot->seq;
+	util_atomic_store_explicit64(dst, 0, memory_order_release);
+	for (size_t i = 1; i < sizeof(sample) / sizeof(uint64_t); ++i)
+		util_atomic_store_explicit64(&dst[i], src[i],
+			memory_order_release);
+	util_atomic_store_explicit64(dst, seq + 1, memory_order_release);
 }
 
 /*
- * heap_get_adjacent_free_block -- locates adjacent free memory block in heap
+ * heap_get_samples -- copies up to nsamples most recent samples, from the
+ *	oldest one, and returns their number
+ *
+ * The samples overwritten or being written while they are copied are skipped.
  */
-static int
-heap_get_adjacent_free_block(struct palloc_heap *heap,
-	const struct memory_block *in, struct memory_block *out, int prev)
+size_t
+heap_get_samples(struct palloc_heap *heap, struct pobj_alloc_sample *samples,
+	size_t nsamples)
 {
-	struct zone *z = ZID_TO_ZONE(heap->layout, in->zone_id);
-	struct chunk_header *hdr = &z->chunk_headers[in->chunk_id];
-	out->zone_id = in->zone_id;
-
-	if (prev) {
-		if (in->chunk_id == 0)
-			return ENOENT;
-
-		struct chunk_header *prev_hdr =
-			&z->chunk_headers[in->chunk_id - 1];
-		out->chunk_id = in->chunk_id - prev_hdr->size_idx;
+	struct heap_sampler *s = &heap->rt->sampler;
 
-		if (z->chunk_headers[out->chunk_id].type != CHUNK_TYPE_FREE)
-			return ENOENT;
+	struct heap_sample *ring;
+	util_atomic_load_explicit64(&s->ring, &ring, memory_order_acquire);
+	if (ring == NULL)
+		return 0;
 
-		out->size_idx = z->chunk_headers[out->chunk_id].size_idx;
-	} else { /* next */
-		if (in->chunk_id + hdr->size_idx == z->header.size_idx)
-			return ENOENT;
+	uint64_t total;
+	util_atomic_load_explicit64(&s->total, &total, memory_order_acquire);
 
-		out->chunk_id = in->chunk_id + hdr->size_idx;
+	uint64_t n = MIN(MIN(total, s->capacity), nsamples);
+	size_t copied = 0;
+	for (uint64_t seq = total - n; seq < total; ++seq) {
+		struct heap_sample sample;
+		uint64_t *src = &ring[seq % s->capacity].seq;
+		uint64_t *dst = &sample.seq;
 
-		if (z->chunk_headers[out->chunk_id].type != CHUNK_TYPE_FREE)
-			return ENOENT;
+		for (size_t i = 0; i < sizeof(sample) / sizeof(uint64_t); ++i)
+			util_atomic_load_explicit64(&src[i], &dst[i],
+				memory_order_acquire);
 
-		out->size_idx = z->chunk_headers[out->chunk_id].size_idx;
+		uint64_t after;
+		util_atomic_load_explicit64(src, &after, memory_order_acquire);
+		if (sample.seq != seq + 1 || after != sample.seq)
+			continue;
+
+		struct pobj_alloc_sample *out = &samples[copied++];
+		out->seq = seq;
+		out->size = sample.size;
+		out->off = sample.off;
+		out->type_num = sample.type_num;
+		out->class_id = (unsigned)sample.class_id;
+		out->arena_id = (unsigned)sample.arena_id;
+		for (unsigned i = 0; i < POBJ_ALLOC_SAMPLE_FRAMES; ++i)
+			out->frames[i] = (void *)(uintptr_t)sample.frames[i];
 	}
-	memblock_rebuild_state(heap, out);
 
-	return 0;
+	return copied;
 }
 
 /*
- * heap_coalesce -- (internal) merges adjacent memory blocks
+ * heap_get_sample_rate -- returns how many allocations of a thread are made
+ *	per recorded sample, 0 if the sampling is disabled
  */
-static struct memory_block
-heap_coalesce(struct palloc_heap *heap,
-	const struct memory_block *blocks[], int n)
+unsigned
+heap_get_sample_rate(struct palloc_heap *heap)
 {
-	struct memory_block ret = MEMORY_BLOCK_NONE;
-
-	const struct memory_block *b = NULL;
-	ret.size_idx = 0;
-	for (int i = 0; i < n; ++i) {
-		if (blocks[i] == NULL)
-			continue;
-		b = b ? b : blocks[i];
-		ret.size_idx += blocks[i] ? blocks[i]->size_idx : 0;
-	}
-
-	ASSERTne(b, NULL);
-
-	ret.chunk_id = b->chunk_id;
-	ret.zone_id = b->zone_id;
-	ret.block_off = b->block_off;
-	memblock_rebuild_state(heap, &ret);
+	unsigned rate;
+	util_atomic_load_explicit32(&heap->rt->sampler.rate, &rate,
+		memory_order_relaxed);
 
-	return ret;
+	return rate;
 }
 
 /*
- * heap_coalesce_huge -- finds neighbours of a huge block, removes them from the
- *	volatile state and returns the resulting block
+ * heap_set_sample_rate -- changes how many allocations of a thread are made
+ *	per recorded sample, 0 disables the sampling
  */
-struct memory_block
-heap_coalesce_huge(struct palloc_heap *heap, struct bucket *b,
-	const struct memory_block *m)
+int
+heap_set_sample_rate(struct palloc_heap *heap, unsigned rate)
 {
-	const struct memory_block *blocks[3] = {NULL, m, NULL};
+	struct heap_sampler *s = &heap->rt->sampler;
+	int ret = 0;
 
-	struct memory_block prev = MEMORY_BLOCK_NONE;
-	if (heap_get_adjacent_free_block(heap, m, &prev, 1) == 0 &&
-		b->c_ops->get_rm_exact(b->container, &prev) == 0) {
-		blocks[0] = &prev;
-	}
+	util_mutex_lock(&s->lock);
 
-	struct memory_block next = MEMORY_BLOCK_NONE;
-	if (heap_get_adjacent_free_block(heap, m, &next, 0) == 0 &&
-		b->c_ops->get_rm_exact(b->container, &next) == 0) {
-		blocks[2] = &next;
+	if (rate != 0 && s->ring == NULL) {
+		struct heap_sample *ring = Zalloc(sizeof(*ring) * s->capacity);
+		if (ring == NULL) {
+			ERR("!Zalloc");
+			ret = -1;
+			goto out;
+		}
+		util_atomic_store_explicit64(&s->ring, ring,
+			memory_order_release);
 	}
 
-	return heap_coalesce(heap, blocks, 3);
+	if (s->rate == 0 && rate != 0)
+		util_fetch_and_add32(&Heap_nsamplers, 1);
+	else if (s->rate != 0 && rate == 0)
+		util_fetch_and_sub32(&Heap_nsamplers, 1);
+
+	util_atomic_store_explicit32(&s->rate, rate, memory_order_release);
+
+out:
+	util_mutex_unlock(&s->lock);
+
+	return ret;
 }
 
 /*
- * heap_end -- returns first address after heap
+ * heap_get_sample_capacity -- returns the number of samples kept
  */
-void *
-heap_end(struct palloc_heap *h)
+uint64_t
+heap_get_sample_capacity(struct palloc_heap *heap)
 {
-	ASSERT(h->rt->nzones > 0);
-
-	struct zone *last_zone = ZID_TO_ZONE(h->layout, h->rt->nzones - 1);
-
-	return &last_zone->chunks[last_zone->header.size_idx];
+	return heap->rt->sampler.capacity;
 }
 
 /*
- * heap_arena_create -- create a new arena, push it to the vector
- * and return new arena id or -1 on failure
+ * heap_set_sample_capacity -- changes the number of samples kept, possible
+ *	only until the sampling is first enabled
  */
 int
-heap_arena_create(struct palloc_heap *heap)
+heap_set_sample_capacity(struct palloc_heap *heap, uint64_t capacity)
 {
-	struct heap_rt *h = heap->rt;
+	struct heap_sampler *s = &heap->rt->sampler;
+	int ret = 0;
 
-	struct arena *arena = heap_arena_new(heap, 0);
-	if (arena == NULL)
+	if (capacity == 0 || capacity > HEAP_SAMPLE_MAX_CAPACITY) {
+		ERR("sample capacity must be between 1 and %u",
+			HEAP_SAMPLE_MAX_CAPACITY);
+		errno = EINVAL;
 		return -1;
+	}
 
-	util_mutex_lock(&h->arenas.lock);
+	util_mutex_lock(&s->lock);
 
-	if (VEC_PUSH_BACK(&h->arenas.vec, arena))
-		goto err_push_back;
+	if (s->ring != NULL) {
+		ERR("sample capacity can't change once sampling was enabled");
+		errno = EBUSY;
+		ret = -1;
+	} else {
+		s->capacity = capacity;
+	}
 
-	int ret = (int)VEC_SIZE(&h->arenas.vec);
-	util_mutex_unlock(&h->arenas.lock);
+	util_mutex_unlock(&s->lock);
 
 	return ret;
-
-err_push_back:
-	util_mutex_unlock(&h->arenas.lock);
-	heap_arena_delete(arena);
-	return -1;
 }
 
 /*
- * heap_get_narenas_total -- returns the number of all arenas in the heap
+ * heap_get_sample_total -- returns the number of samples taken so far
  */
-unsigned
-heap_get_narenas_total(struct palloc_heap *heap)
+uint64_t
+heap_get_sample_total(struct palloc_heap *heap)
 {
-	struct heap_rt *h = heap->rt;
-
-	util_mutex_lock(&h->arenas.lock);
-	unsigned total = (unsigned)VEC_SIZE(&h->arenas.vec);
-	util_mutex_unlock(&h->arenas.lock);
+	uint64_t total;
+	util_atomic_load64(&heap->rt->sampler.total, &total);
 
 	return total;
 }
 
 /*
- * heap_get_narenas_max -- returns the max number of arenas
+ * heap_get_punch_hole_enabled -- returns whether the file blocks of idle free
+ *	chunks are automatically deallocated
  */
-unsigned
-heap_get_narenas_max(struct palloc_heap *heap)
+int
+heap_get_punch_hole_enabled(struct palloc_heap *heap)
 {
-	struct heap_rt *h = heap->rt;
-
-	util_mutex_lock(&h->arenas.lock);
-	unsigned max = (unsigned)VEC_CAPACITY(&h->arenas.vec);
-	util_mutex_unlock(&h->arenas.lock);
+	int enabled;
+	util_atomic_load_explicit32(&heap->rt->punch_hole.enabled, &enabled,
+		memory_order_relaxed);
 
-	return max;
+	return enabled;
 }
 
 /*
- * heap_set_narenas_max -- change the max number of arenas
+ * heap_set_punch_hole_enabled -- enables or disables the automatic
+ *	deallocation of the file blocks of idle free chunks
  */
 int
-heap_set_narenas_max(struct palloc_heap *heap, unsigned size)
+heap_set_punch_hole_enabled(struct palloc_heap *heap, int enabled)
 {
-	struct heap_rt *h = heap->rt;
-	int ret = -1;
-
-	util_mutex_lock(&h->arenas.lock);
-	unsigned capacity = (unsigned)VEC_CAPACITY(&h->arenas.vec);
-	if (size < capacity) {
-		LOG(2, "cannot decrease max number of arenas");
-		goto out;
-	} else if (size == capacity) {
-		ret = 0;
-		goto out;
+	if (enabled && !heap_punch_hole_supported(heap->set)) {
+		ERR("file blocks cannot be deallocated on Device DAX");
+		errno = ENOTSUP;
+		return -1;
 	}
 
-	ret = VEC_RESERVE(&h->arenas.vec, size);
+	util_atomic_store_explicit32(&heap->rt->punch_hole.enabled, enabled,
+		memory_order_relaxed);
 
-out:
-	util_mutex_unlock(&h->arenas.lock);
-	return ret;
+	return 0;
 }
 
 /*
- * heap_get_narenas_auto -- returns the number of all automatic arenas
+ * heap_get_punch_hole_interval -- returns the minimum time, in milliseconds,
+ *	between two automatic passes
  */
-unsigned
-heap_get_narenas_auto(struct palloc_heap *heap)
+uint64_t
+heap_get_punch_hole_interval(struct palloc_heap *heap)
 {
-	struct heap_rt *h = heap->rt;
-	struct arena *arena;
-	unsigned narenas = 0;
-
-	util_mutex_lock(&h->arenas.lock);
-
-	VEC_FOREACH(arena, &h->arenas.vec) {
-		if (arena->automatic)
-			narenas++;
-	}
-
-	util_mutex_unlock(&h->arenas.lock);
+	uint64_t interval;
+	util_atomic_load_explicit64(&heap->rt->punch_hole.interval, &interval,
+		memory_order_relaxed);
 
-	return narenas;
+	return interval;
 }
 
 /*
- * heap_get_arena_buckets -- returns a pointer to buckets from the arena
+ * heap_set_punch_hole_interval -- changes the minimum time, in milliseconds,
+ *	between two automatic passes
  */
-struct bucket **
-heap_get_arena_buckets(struct palloc_heap *heap, unsigned arena_id)
+void
+heap_set_punch_hole_interval(struct palloc_heap *heap, uint64_t interval)
 {
-	util_mutex_lock(&heap->rt->arenas.lock);
-	struct arena *a = heap_get_arena_by_id(heap, arena_id);
-	util_mutex_unlock(&heap->rt->arenas.lock);
-
-	return a->buckets;
+	util_atomic_store_explicit64(&heap->rt->punch_hole.interval, interval,
+		memory_order_relaxed);
 }
 
 /*
- * heap_get_arena_auto -- returns arena automatic value
+ * heap_get_punch_hole_min_size -- returns the minimum size of a free extent
+ *	for its file blocks to be deallocated
  */
-int
-heap_get_arena_auto(struct palloc_heap *heap, unsigned arena_id)
+uint64_t
+heap_get_punch_hole_min_size(struct palloc_heap *heap)
 {
-	util_mutex_lock(&heap->rt->arenas.lock);
-	struct arena *a = heap_get_arena_by_id(heap, arena_id);
-	util_mutex_unlock(&heap->rt->arenas.lock);
+	uint64_t min_size;
+	util_atomic_load_explicit64(&heap->rt->punch_hole.min_size, &min_size,
+		memory_order_relaxed);
 
-	return a->automatic;
+	return min_size;
 }
 
 /*
- * heap_set_arena_auto -- sets arena automatic value
+ * heap_set_punch_hole_min_size -- changes the minimum size of a free extent
+ *	for its file blocks to be deallocated
  */
-int
-heap_set_arena_auto(struct palloc_heap *heap, unsigned arena_id,
-		int automatic)
+void
+heap_set_punch_hole_min_size(struct palloc_heap *heap, uint64_t min_size)
 {
-	unsigned nautomatic = 0;
-	struct arena *a;
-	struct heap_rt *h = heap->rt;
-	int ret = 0;
-
-	util_mutex_lock(&h->arenas.lock);
-	VEC_FOREACH(a, &h->arenas.vec)
-		if (a->automatic)
-			nautomatic++;
-
-	a = VEC_ARR(&heap->rt->arenas.vec)[arena_id - 1];
-
-	if (!automatic && nautomatic <= 1 && a->automatic) {
-		ERR("at least one automatic arena must exist");
-		ret = -1;
-		goto out;
-	}
-	a->automatic = automatic;
+	util_atomic_store_explicit64(&heap->rt->punch_hole.min_size, min_size,
+		memory_order_relaxed);
+}
 
-out:
-	util_mutex_unlock(&h->arenas.lock);
-	return ret;
+/*
+ * heap_get_punch_hole_reclaimed -- returns the number of bytes returned to
+ *	the file system
+ */
+uint64_t
+heap_get_punch_hole_reclaimed(struct palloc_heap *heap)
+{
+	uint64_t reclaimed;
+	util_atomic_load_explicit64(&heap->rt->punch_hole.reclaimed,
+		&reclaimed, memory_order_relaxed);
 
+	return reclaimed;
 }
 
 /*
- * heap_set_arena_thread -- assign arena with given id to the current thread
+ * heap_punch_hole -- deallocates the file blocks backing the free extents
+ *	that weren't used since the previous pass
+ *
+ * The number of bytes returned to the file system by the pass is stored in
+ * reclaimed.
  */
-void
-heap_set_arena_thread(struct palloc_heap *heap, unsigned arena_id)
+int
+heap_punch_hole(struct palloc_heap *heap, uint64_t *reclaimed)
 {
-	os_mutex_lock(&heap->rt->arenas.lock);
-	heap_arena_thread_attach(heap, heap_get_arena_by_id(heap, arena_id));
-	os_mutex_unlock(&heap->rt->arenas.lock);
+	int ret = heap_punch_hole_pass(heap, 0, reclaimed);
+	if (ret != 0)
+		ERR("!unable to deallocate the file blocks of free chunks");
+
+	return ret;
 }
 
 /*
@@ -1305,8 +5074,7 @@ heap_create_alloc_class_buckets(struct palloc_heap *heap, struct alloc_class *c)
 	struct heap_rt *h = heap->rt;
 
 	if (c->type == CLASS_RUN) {
-		h->recyclers[c->id] = recycler_new(heap, c->rdsc.nallocs,
-			&heap->rt->arenas.nactive);
+		h->recyclers[c->id] = recycler_new(heap, c->rdsc.nallocs);
 		if (h->recyclers[c->id] == NULL)
 			goto error_recycler_new;
 	}
@@ -1316,8 +5084,8 @@ heap_create_alloc_class_buckets(struct palloc_heap *heap, struct alloc_class *c)
 	VEC_FOREACH_BY_POS(i, &h->arenas.vec) {
 		arena = VEC_ARR(&h->arenas.vec)[i];
 		if (arena->buckets[c->id] == NULL)
-			arena->buckets[c->id] = bucket_new(
-				container_new_seglists(heap), c);
+			arena->buckets[c->id] = heap_arena_bucket_new(heap,
+				arena, c);
 		if (arena->buckets[c->id] == NULL)
 			goto error_cache_bucket_new;
 	}
@@ -1397,10 +5165,19 @@ heap_extend(struct palloc_heap *heap, struct bucket *b, size_t size)
 	heap_zone_init(heap, zone_id, chunk_id);
 
 	if (heap->rt->nzones != nzones) {
+		if (heap_zones_grow(heap, nzones) != 0)
+			return -1;
+
 		heap->rt->nzones = nzones;
+		if (heap->rt->numa.enabled)
+			heap_numa_update(heap);
 		return 0;
 	}
 
+	/* the new part of the heap might be backed by a different node */
+	if (heap->rt->numa.enabled)
+		heap_numa_update(heap);
+
 	struct chunk_header *hdr = &z->chunk_headers[chunk_id];
 
 	struct memory_block m = MEMORY_BLOCK_NONE;
@@ -1446,8 +5223,9 @@ heap_zone_update_if_needed(struct palloc_heap *heap)
  */
 int
 heap_boot(struct palloc_heap *heap, void *heap_start, uint64_t heap_size,
-		uint64_t *sizep, void *base, struct pmem_ops *p_ops,
-		struct stats *stats, struct pool_set *set)
+		uint64_t *sizep, void *base, uint64_t run_id,
+		struct pmem_ops *p_ops, struct stats *stats,
+		struct pool_set *set)
 {
 	/*
 	 * The size can be 0 if interrupted during heap_init or this is the
@@ -1478,7 +5256,7 @@ heap_boot(struct palloc_heap *heap, void *heap_start, uint64_t heap_size,
 
 	unsigned narenas_default = heap_get_procs();
 
-	if (heap_arenas_init(&h->arenas) != 0) {
+	if (heap_arenas_init(&h->arenas, narenas_default) != 0) {
 		err = errno;
 		goto error_arenas_malloc;
 	}
@@ -1487,11 +5265,65 @@ heap_boot(struct palloc_heap *heap, void *heap_start, uint64_t heap_size,
 
 	h->zones_exhausted = 0;
 
+	h->numa.enabled = 0;
+	h->numa.nnodes = 0;
+	h->numa.fake_nodes = 0;
+	VEC_INIT(&h->numa.ranges);
+	memset(h->numa.stats, 0, sizeof(h->numa.stats));
+
+	h->adaptive.enabled = 0;
+	h->adaptive.sample_rate = ADAPTIVE_DEFAULT_SAMPLE_RATE;
+	h->adaptive.max_waste = ADAPTIVE_DEFAULT_MAX_WASTE;
+	h->adaptive.nsamples = 0;
+	memset(h->adaptive.bins, 0, sizeof(h->adaptive.bins));
+	h->adaptive.nclasses = 0;
+	util_mutex_init(&h->adaptive.lock);
+
+	h->punch_hole.enabled = Fallocate_punch_hole &&
+		heap_punch_hole_supported(set);
+	h->punch_hole.interval = PUNCH_HOLE_DEFAULT_INTERVAL;
+	h->punch_hole.min_size = PUNCH_HOLE_DEFAULT_MIN_SIZE;
+	h->punch_hole.last_pass = heap_punch_hole_now();
+	h->punch_hole.reclaimed = 0;
+	h->punch_hole.nzones = 0;
+	h->punch_hole.idle = NULL;
+	h->punch_hole.punched = NULL;
+
+	util_mutex_init(&h->extender.lock);
+	util_cond_init(&h->extender.cond);
+	h->extender.running = 0;
+	h->extender.stop = 0;
+	h->extender.requested = 0;
+	h->extender.failed = 0;
+	h->extender.watermark = 0;
+	memset(&h->extender.stats, 0, sizeof(h->extender.stats));
+
+	h->sampler.rate = 0;
+	h->sampler.capacity = HEAP_SAMPLE_DEFAULT_CAPACITY;
+	h->sampler.ring = NULL;
+	h->sampler.total = 0;
+	util_mutex_init(&h->sampler.lock);
+
+	memset(h->aligned_classes, 0, sizeof(h->aligned_classes));
+
+	h->shared_runs = 0;
+
 	h->nlocks = On_valgrind ? MAX_RUN_LOCKS_VG : MAX_RUN_LOCKS;
 	for (unsigned i = 0; i < h->nlocks; ++i)
 		util_mutex_init(&h->run_locks[i]);
 
 	os_tls_key_create(&h->arenas.thread, heap_thread_arena_destructor);
+	os_tls_key_create(&h->arenas.bound, NULL);
+
+	util_mutex_init(&h->tcaches.lock);
+	VEC_INIT(&h->tcaches.vec);
+	h->tcaches.size = 0;
+	os_tls_key_create(&h->tcaches.thread, heap_thread_cache_destructor);
+
+	util_mutex_init(&h->tstats.lock);
+	VEC_INIT(&h->tstats.vec);
+	memset(h->tstats.classes, 0, sizeof(h->tstats.classes));
+	os_tls_key_create(&h->tstats.thread, heap_thread_stats_destructor);
 
 	heap->p_ops = *p_ops;
 	heap->layout = heap_start;
@@ -1505,7 +5337,8 @@ heap_boot(struct palloc_heap *heap, void *heap_start, uint64_t heap_size,
 	VALGRIND_DO_CREATE_MEMPOOL(heap->layout, 0, 0);
 
 	for (unsigned i = 0; i < narenas_default; ++i) {
-		if (VEC_PUSH_BACK(&h->arenas.vec, heap_arena_new(heap, 1))) {
+		if (VEC_PUSH_BACK(&h->arenas.vec,
+		    heap_arena_new(heap, 1, i + 1))) {
 			err = errno;
 			goto error_vec_reserve;
 		}
@@ -1516,9 +5349,26 @@ heap_boot(struct palloc_heap *heap, void *heap_start, uint64_t heap_size,
 
 	heap_zone_update_if_needed(heap);
 
+	if (heap_zones_init(heap, run_id) != 0) {
+		err = ENOMEM;
+		goto error_zones_init;
+	}
+
 	return 0;
 
+error_zones_init:
+	for (size_t i = 0; i < VEC_SIZE(&h->arenas.vec); ++i)
+		heap_arena_delete(VEC_ARR(&h->arenas.vec)[i]);
 error_vec_reserve:
+	os_tls_key_delete(h->tstats.thread);
+	util_mutex_destroy(&h->tstats.lock);
+	util_mutex_destroy(&h->sampler.lock);
+	util_cond_destroy(&h->extender.cond);
+	util_mutex_destroy(&h->extender.lock);
+	util_mutex_destroy(&h->adaptive.lock);
+	os_tls_key_delete(h->tcaches.thread);
+	util_mutex_destroy(&h->tcaches.lock);
+	os_tls_key_delete(h->arenas.bound);
 	heap_arenas_fini(&h->arenas);
 error_arenas_malloc:
 	alloc_class_collection_delete(h->alloc_classes);
@@ -1595,8 +5445,32 @@ heap_cleanup(struct palloc_heap *heap)
 {
 	struct heap_rt *rt = heap->rt;
 
+	heap_extender_stop(heap);
+	util_cond_destroy(&rt->extender.cond);
+	util_mutex_destroy(&rt->extender.lock);
+
+	if (rt->sampler.rate != 0)
+		util_fetch_and_sub32(&Heap_nsamplers, 1);
+	Free(rt->sampler.ring);
+	util_mutex_destroy(&rt->sampler.lock);
+
+	struct thread_cache *tcache;
+	VEC_FOREACH(tcache, &rt->tcaches.vec)
+		heap_thread_cache_delete(tcache);
+	VEC_DELETE(&rt->tcaches.vec);
+	os_tls_key_delete(rt->tcaches.thread);
+	util_mutex_destroy(&rt->tcaches.lock);
+
+	struct thread_stats *ts;
+	VEC_FOREACH(ts, &rt->tstats.vec)
+		Free(ts);
+	VEC_DELETE(&rt->tstats.vec);
+	os_tls_key_delete(rt->tstats.thread);
+	util_mutex_destroy(&rt->tstats.lock);
+
 	alloc_class_collection_delete(rt->alloc_classes);
 
+	os_tls_key_delete(rt->arenas.bound);
 	os_tls_key_delete(rt->arenas.thread);
 	bucket_delete(rt->default_bucket);
 
@@ -1609,6 +5483,15 @@ heap_cleanup(struct palloc_heap *heap)
 
 	heap_arenas_fini(&rt->arenas);
 
+	util_mutex_destroy(&rt->adaptive.lock);
+
+	Free(rt->punch_hole.idle);
+	Free(rt->punch_hole.punched);
+
+	VEC_DELETE(&rt->numa.ranges);
+
+	VEC_DELETE(&rt->zones.vec);
+
 	for (int i = 0; i < MAX_ALLOCATION_CLASSES; ++i) {
 		if (heap->rt->recyclers[i] == NULL)
 			continue;
@@ -1891,3 +5774,101 @@ heap_vg_open(struct palloc_heap *heap, object_callback cb,
 	}
 }
 #endif
+
+/*
+ * CTL_READ_HANDLER(nthreads) -- returns the number of threads used to boot
+ *	the pool
+ */
+static int
+CTL_READ_HANDLER(nthreads)(void *ctx, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	unsigned *arg_out = arg;
+
+	util_atomic_load_explicit32(&Heap_boot_nthreads, arg_out,
+		memory_order_acquire);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(nthreads) -- sets the number of threads used to boot
+ *	the pool
+ */
+static int
+CTL_WRITE_HANDLER(nthreads)(void *ctx, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	long long arg_in = *(long long *)arg;
+
+	if (arg_in < 0 || arg_in > MAX_BOOT_THREADS) {
+		ERR("invalid number of boot threads %lld, "
+			"must be between 0 and %d", arg_in, MAX_BOOT_THREADS);
+		errno = EINVAL;
+		return -1;
+	}
+
+	util_atomic_store_explicit32(&Heap_boot_nthreads, (unsigned)arg_in,
+		memory_order_release);
+
+	return 0;
+}
+
+static const struct ctl_argument CTL_ARG(nthreads) = CTL_ARG_LONG_LONG;
+
+/*
+ * CTL_READ_HANDLER(zone_summary) -- returns whether the persistent zone
+ *	summaries are used
+ */
+static int
+CTL_READ_HANDLER(zone_summary)(void *ctx, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	int *arg_out = arg;
+
+	util_atomic_load_explicit32(&Heap_boot_zone_summary, arg_out,
+		memory_order_acquire);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(zone_summary) -- enables or disables the persistent zone
+ *	summaries
+ */
+static int
+CTL_WRITE_HANDLER(zone_summary)(void *ctx, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	int arg_in = *(int *)arg;
+
+	util_atomic_store_explicit32(&Heap_boot_zone_summary, arg_in != 0,
+		memory_order_release);
+
+	return 0;
+}
+
+static const struct ctl_argument CTL_ARG(zone_summary) = CTL_ARG_BOOLEAN;
+
+static const struct ctl_node CTL_NODE(boot)[] = {
+	CTL_LEAF_RW(nthreads),
+	CTL_LEAF_RW(zone_summary),
+
+	CTL_NODE_END
+};
+
+static const struct ctl_node CTL_NODE(heap)[] = {
+	CTL_CHILD(boot),
+
+	CTL_NODE_END
+};
+
+/*
+ * heap_global_ctl_register -- registers the global part of the "heap" ctl
+ *	module, which can be used before any pool is opened
+ */
+void
+heap_global_ctl_register(void)
+{
+	CTL_REGISTER_MODULE(NULL, heap);
+}
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2015-2019, Intel Corporation */
+/* Copyright 2015-2020, Intel Corporation */
 
 /*
  * heap.h -- internal definitions for heap
@@ -28,9 +28,11 @@ extern "C" {
 #define BIT_IS_CLR(a, i)	(!((a) & (1ULL << (i))))
 #define HEAP_ARENA_PER_THREAD (0)
 
+extern unsigned Heap_boot_nthreads;
+
 int heap_boot(struct palloc_heap *heap, void *heap_start, uint64_t heap_size,
 		uint64_t *sizep,
-		void *base, struct pmem_ops *p_ops,
+		void *base, uint64_t run_id, struct pmem_ops *p_ops,
 		struct stats *stats, struct pool_set *set);
 int heap_init(void *heap_start, uint64_t heap_size, uint64_t *sizep,
 	struct pmem_ops *p_ops);
@@ -39,6 +41,8 @@ int heap_check(void *heap_start, uint64_t heap_size);
 int heap_check_remote(void *heap_start, uint64_t heap_size,
 		struct remote_ops *ops);
 int heap_buckets_init(struct palloc_heap *heap);
+void heap_boot_zones(struct palloc_heap *heap, unsigned nthreads);
+void heap_global_ctl_register(void);
 int heap_create_alloc_class_buckets(struct palloc_heap *heap,
 	struct alloc_class *c);
 
@@ -47,6 +51,10 @@ int heap_extend(struct palloc_heap *heap, struct bucket *defb, size_t size);
 struct alloc_class *
 heap_get_best_class(struct palloc_heap *heap, size_t size);
 
+struct alloc_class *
+heap_get_aligned_class(struct palloc_heap *heap, size_t size,
+	size_t alignment);
+
 struct bucket *
 heap_bucket_acquire(struct palloc_heap *heap, uint8_t class_id,
 		uint16_t arena_id);
@@ -56,6 +64,20 @@ heap_bucket_release(struct palloc_heap *heap, struct bucket *b);
 
 int heap_get_bestfit_block(struct palloc_heap *heap, struct bucket *b,
 	struct memory_block *m);
+int heap_claim_block(struct palloc_heap *heap, struct alloc_class *c,
+	uint16_t arena_id, struct memory_block *m,
+	struct memory_block_reserved **mresv);
+int heap_get_shared_runs(struct palloc_heap *heap);
+void heap_set_shared_runs(struct palloc_heap *heap, int shared);
+
+int heap_thread_cache_get(struct palloc_heap *heap, struct alloc_class *c,
+	struct memory_block *m, struct memory_block_reserved **mresv);
+void heap_thread_cache_put(struct palloc_heap *heap, struct alloc_class *c,
+	const struct memory_block *m, struct memory_block_reserved *mresv);
+void heap_thread_cache_flush(struct palloc_heap *heap);
+void heap_thread_cache_flush_all(struct palloc_heap *heap);
+unsigned heap_get_thread_cache_size(struct palloc_heap *heap);
+int heap_set_thread_cache_size(struct palloc_heap *heap, unsigned size);
 struct memory_block
 heap_coalesce_huge(struct palloc_heap *heap, struct bucket *b,
 	const struct memory_block *m);
@@ -65,12 +87,23 @@ os_mutex_t *heap_get_run_lock(struct palloc_heap *heap,
 void
 heap_force_recycle(struct palloc_heap *heap);
 
-void
+int
 heap_discard_run(struct palloc_heap *heap, struct memory_block *m);
 
+int
+heap_get_sparse_run(struct palloc_heap *heap, unsigned max_fill_pct,
+	struct memory_block *m);
+
 void
 heap_memblock_on_free(struct palloc_heap *heap, const struct memory_block *m);
 
+void
+heap_zone_summary_on_free(struct palloc_heap *heap,
+	const struct memory_block *m);
+
+void
+heap_punch_hole_auto(struct palloc_heap *heap);
+
 int
 heap_free_chunk_reuse(struct palloc_heap *heap,
 	struct bucket *bucket, struct memory_block *m);
@@ -104,6 +137,150 @@ int heap_set_arena_auto(struct palloc_heap *heap, unsigned arena_id,
 
 void heap_set_arena_thread(struct palloc_heap *heap, unsigned arena_id);
 
+enum pobj_arena_mode heap_get_arena_mode(struct palloc_heap *heap);
+int heap_set_arena_mode(struct palloc_heap *heap, enum pobj_arena_mode mode);
+
+struct heap_numa_node_stats {
+	unsigned narenas;	/* number of arenas tied to the node */
+	size_t size;		/* size of the heap backed by the node */
+	uint64_t local;		/* chunks reserved from the node memory */
+	uint64_t remote;	/* chunks reserved from other nodes */
+};
+
+int heap_get_numa_enabled(struct palloc_heap *heap);
+
+int heap_set_numa_enabled(struct palloc_heap *heap, int enabled);
+
+unsigned heap_get_numa_fake_nodes(struct palloc_heap *heap);
+
+int heap_set_numa_fake_nodes(struct palloc_heap *heap, unsigned nnodes);
+
+unsigned heap_get_numa_nnodes(struct palloc_heap *heap);
+
+int heap_get_numa_node_stats(struct palloc_heap *heap, unsigned node,
+		struct heap_numa_node_stats *stats);
+
+unsigned heap_get_arena_node(struct palloc_heap *heap, unsigned arena_id);
+
+int heap_set_arena_node(struct palloc_heap *heap, unsigned arena_id,
+		unsigned node);
+
+unsigned heap_get_thread_numa_node(struct palloc_heap *heap);
+
+int heap_set_thread_numa_node(struct palloc_heap *heap, unsigned node);
+
+struct heap_class_stats {
+	uint64_t allocations;	/* number of allocations of the class */
+	uint64_t frees;		/* number of frees of the class */
+	uint64_t live_bytes;	/* bytes taken by the allocated blocks */
+	uint64_t runs;		/* number of runs of the class */
+	uint64_t free_blocks;	/* free units in runs, free chunks if huge */
+	uint64_t lock_waits;	/* contended acquisitions of bucket locks */
+	uint64_t claims;	/* blocks claimed without the bucket lock */
+};
+
+int heap_get_class_stats(struct palloc_heap *heap, uint8_t class_id,
+		struct heap_class_stats *stats);
+
+struct heap_arena_stats {
+	uint64_t allocations;	/* allocations made from the arena */
+	uint64_t frees;		/* frees made by threads using the arena */
+	uint64_t live_bytes;	/* allocated bytes less the freed ones */
+	uint64_t lock_waits;	/* contended acquisitions of bucket locks */
+	uint64_t claims;	/* blocks claimed without the bucket lock */
+};
+
+int heap_get_arena_stats(struct palloc_heap *heap, unsigned arena_id,
+		struct heap_arena_stats *stats);
+
+struct heap_huge_stats {
+	uint64_t free_bytes;	/* total size of the free chunks */
+	uint64_t largest_free;	/* size of the largest free extent */
+	uint64_t fragmentation;	/* free space outside of the largest extent */
+};
+
+void heap_get_huge_stats(struct palloc_heap *heap,
+		struct heap_huge_stats *stats);
+
+struct arena *heap_get_arena(struct palloc_heap *heap, uint16_t arena_id);
+
+void heap_stats_on_alloc(struct palloc_heap *heap, uint8_t class_id,
+		struct arena *arena, size_t size);
+
+struct heap_adaptive_class {
+	size_t size;		/* allocation size the class was derived for */
+	uint8_t class_id;	/* id of the derived class */
+	unsigned waste;		/* % of units wasted by the previous class */
+};
+
+int heap_get_adaptive_enabled(struct palloc_heap *heap);
+
+void heap_set_adaptive_enabled(struct palloc_heap *heap, int enabled);
+
+unsigned heap_get_adaptive_sample_rate(struct palloc_heap *heap);
+
+int heap_set_adaptive_sample_rate(struct palloc_heap *heap, unsigned rate);
+
+unsigned heap_get_adaptive_max_waste(struct palloc_heap *heap);
+
+int heap_set_adaptive_max_waste(struct palloc_heap *heap, unsigned max_waste);
+
+unsigned heap_get_adaptive_nclasses(struct palloc_heap *heap);
+
+int heap_get_adaptive_class(struct palloc_heap *heap, unsigned idx,
+		struct heap_adaptive_class *aclass);
+
+struct heap_extend_stats {
+	uint64_t async; /* extensions performed in the background */
+	uint64_t sync; /* extensions performed by allocations */
+	uint64_t failed;
+	uint64_t time_ns; /* total time of the successful extensions */
+	uint64_t max_ns; /* time of the longest successful extension */
+};
+
+uint64_t heap_get_extend_watermark(struct palloc_heap *heap);
+
+int heap_set_extend_watermark(struct palloc_heap *heap, uint64_t watermark);
+
+void heap_get_extend_stats(struct palloc_heap *heap,
+		struct heap_extend_stats *stats);
+
+void heap_extender_stop(struct palloc_heap *heap);
+
+extern unsigned Heap_nsamplers;
+
+void heap_sample_alloc(struct palloc_heap *heap, size_t size, uint64_t off,
+		uint64_t type_num, uint8_t class_id, uint16_t arena_id);
+
+size_t heap_get_samples(struct palloc_heap *heap,
+		struct pobj_alloc_sample *samples, size_t nsamples);
+
+unsigned heap_get_sample_rate(struct palloc_heap *heap);
+
+int heap_set_sample_rate(struct palloc_heap *heap, unsigned rate);
+
+uint64_t heap_get_sample_capacity(struct palloc_heap *heap);
+
+int heap_set_sample_capacity(struct palloc_heap *heap, uint64_t capacity);
+
+uint64_t heap_get_sample_total(struct palloc_heap *heap);
+
+int heap_get_punch_hole_enabled(struct palloc_heap *heap);
+
+int heap_set_punch_hole_enabled(struct palloc_heap *heap, int enabled);
+
+uint64_t heap_get_punch_hole_interval(struct palloc_heap *heap);
+
+void heap_set_punch_hole_interval(struct palloc_heap *heap, uint64_t interval);
+
+uint64_t heap_get_punch_hole_min_size(struct palloc_heap *heap);
+
+void heap_set_punch_hole_min_size(struct palloc_heap *heap, uint64_t min_size);
+
+uint64_t heap_get_punch_hole_reclaimed(struct palloc_heap *heap);
+
+int heap_punch_hole(struct palloc_heap *heap, uint64_t *reclaimed);
+
 void heap_vg_open(struct palloc_heap *heap, object_callback cb,
 		void *arg, int objects);
 
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2015-2018, Intel Corporation */
+/* Copyright 2015-2020, Intel Corporation */
 
 /*
  * heap_layout.h -- internal definitions for heap layout
@@ -28,6 +28,7 @@ extern "C" {
 #define ZONE_MIN_SIZE (sizeof(struct zone) + sizeof(struct chunk))
 #define ZONE_MAX_SIZE (sizeof(struct zone) + sizeof(struct chunk) * MAX_CHUNK)
 #define HEAP_MIN_SIZE (sizeof(struct heap_layout) + ZONE_MIN_SIZE)
+#define ZONE_SUMMARY_CLASS_WORDS 4 /* one bit per allocation class */
 
 /* Base bitmap values, relevant for both normal and flexible bitmaps */
 #define RUN_BITS_PER_VALUE 64U
@@ -88,6 +89,16 @@ enum chunk_type {
 	MAX_CHUNK_TYPE
 };
 
+enum zone_summary_flags {
+	ZONE_SUMMARY_VALID		=	0x0001,
+	ZONE_SUMMARY_FREE_CHUNKS	=	0x0002,
+};
+
+/* the format of the summary is stored in the upper bits of its flags */
+#define ZONE_SUMMARY_VERSION 1ULL
+#define ZONE_SUMMARY_VERSION_SHIFT 48
+#define ZONE_SUMMARY_VERSION_MASK (0xFFFFULL << ZONE_SUMMARY_VERSION_SHIFT)
+
 struct chunk {
 	uint8_t data[CHUNKSIZE];
 };
@@ -108,10 +119,24 @@ struct chunk_header {
 	uint32_t size_idx;
 };
 
+/*
+ * The summary describes where the free space of the zone is: whether there are
+ * any free chunks and which classes have partially-free runs. It's kept as
+ * a superset of the actual state, but it's only a hint and a stale summary
+ * affects nothing but the order in which the zones are processed.
+ *
+ * The summary is stamped with the run id of the pool instance that maintains
+ * it, and it's only trusted if it was maintained by the previous instance,
+ * which means that the summary is ignored after the pool was used by
+ * a library which doesn't maintain it.
+ */
 struct zone_header {
 	uint32_t magic;
 	uint32_t size_idx;
-	uint8_t reserved[56];
+	uint64_t summary_flags;
+	uint64_t summary_run_classes[ZONE_SUMMARY_CLASS_WORDS];
+	uint64_t summary_run_id;
+	uint8_t reserved[8];
 };
 
 struct zone {
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2015-2019, Intel Corporation */
+/* Copyright 2015-2020, Intel Corporation */
 
 /*
  * lane.c -- lane implementation
@@ -20,11 +20,14 @@
 #include "out.h"
 #include "util.h"
 #include "obj.h"
+#include "os.h"
 #include "os_thread.h"
 #include "valgrind_internal.h"
 #include "memops.h"
 #include "palloc.h"
+#include "heap.h"
 #include "tx.h"
+#include "sys_util.h"
 
 static os_tls_key_t Lane_info_key;
 
@@ -179,8 +182,12 @@ lane_undo_extend(void *base, uint64_t *redo, uint64_t gen_num)
 	struct tx_parameters *params = pop->tx_params;
 	size_t s = SIZEOF_ALIGNED_ULOG(params->cache_size);
 
-	return pmalloc_construct(base, redo, s, lane_ulog_constructor, &gen_num,
-		0, OBJ_INTERNAL_OBJECT_MASK, 0);
+	int ret = pmalloc_construct(base, redo, s, lane_ulog_constructor,
+		&gen_num, 0, OBJ_INTERNAL_OBJECT_MASK, 0);
+	if (ret == 0)
+		STATS_INC(pop->stats, transient, tx_log_extends, 1);
+
+	return ret;
 }
 
 /*
@@ -189,10 +196,27 @@ lane_undo_extend(void *base, uint64_t *redo, uint64_t gen_num)
 static int
 lane_redo_extend(void *base, uint64_t *redo, uint64_t gen_num)
 {
+	PMEMobjpool *pop = base;
 	size_t s = SIZEOF_ALIGNED_ULOG(LANE_REDO_EXTERNAL_SIZE);
 
-	return pmalloc_construct(base, redo, s, lane_ulog_constructor, &gen_num,
-		0, OBJ_INTERNAL_OBJECT_MASK, 0);
+	int ret = pmalloc_construct(base, redo, s, lane_ulog_constructor,
+		&gen_num, 0, OBJ_INTERNAL_OBJECT_MASK, 0);
+	if (ret == 0)
+		STATS_INC(pop->stats, transient, tx_log_extends, 1);
+
+	return ret;
+}
+
+/*
+ * lane_ulog_free -- frees a ulog extension
+ */
+static void
+lane_ulog_free(void *base, uint64_t *next)
+{
+	PMEMobjpool *pop = base;
+
+	pfree(pop, next);
+	STATS_INC(pop->stats, transient, tx_log_frees, 1);
 }
 
 /*
@@ -214,14 +238,14 @@ lane_init(PMEMobjpool *pop, struct lane *lane, struct lane_layout *layout)
 
 	lane->external = operation_new((struct ulog *)&layout->external,
 		LANE_REDO_EXTERNAL_SIZE,
-		lane_redo_extend, (ulog_free_fn)pfree, &pop->p_ops,
+		lane_redo_extend, lane_ulog_free, &pop->p_ops,
 		LOG_TYPE_REDO);
 	if (lane->external == NULL)
 		goto error_external_new;
 
 	lane->undo = operation_new((struct ulog *)&layout->undo,
 		LANE_UNDO_SIZE,
-		lane_undo_extend, (ulog_free_fn)pfree, &pop->p_ops,
+		lane_undo_extend, lane_ulog_free, &pop->p_ops,
 		LOG_TYPE_UNDO);
 	if (lane->undo == NULL)
 		goto error_undo_new;
@@ -285,6 +309,11 @@ lane_boot(PMEMobjpool *pop)
 		}
 	}
 
+	pop->lanes_desc.mode = POBJ_LANE_MODE_THREAD;
+	pop->lanes_desc.nwaiters = 0;
+	util_mutex_init(&pop->lanes_desc.wait_lock);
+	util_cond_init(&pop->lanes_desc.wait_cond);
+
 	return 0;
 
 error_lane_init:
@@ -336,9 +365,109 @@ lane_cleanup(PMEMobjpool *pop)
 	Free(pop->lanes_desc.lane_locks);
 	pop->lanes_desc.lane_locks = NULL;
 
+	util_cond_destroy(&pop->lanes_desc.wait_cond);
+	util_mutex_destroy(&pop->lanes_desc.wait_lock);
+
 	lane_info_cleanup(pop);
 }
 
+/*
+ * lane_recover_redo -- (internal) recovers the redo logs of a single lane
+ */
+static void
+lane_recover_redo(PMEMobjpool *pop, uint64_t idx)
+{
+	struct lane_layout *layout = lane_get_layout(pop, idx);
+
+	ulog_recover((struct ulog *)&layout->internal,
+		OBJ_OFF_IS_VALID_FROM_CTX, &pop->p_ops);
+	ulog_recover((struct ulog *)&layout->external,
+		OBJ_OFF_IS_VALID_FROM_CTX, &pop->p_ops);
+}
+
+/*
+ * lane_recover_undo -- (internal) recovers the undo log of a single lane
+ */
+static void
+lane_recover_undo(PMEMobjpool *pop, uint64_t idx)
+{
+	struct operation_context *ctx = pop->lanes_desc.lane[idx].undo;
+	operation_resume(ctx);
+	operation_process(ctx);
+	operation_finish(ctx, ULOG_INC_FIRST_GEN_NUM |
+			ULOG_FREE_AFTER_FIRST);
+}
+
+/*
+ * State shared by the threads that recover the lanes.
+ */
+struct lane_recovery {
+	PMEMobjpool *pop;
+	void (*recover)(PMEMobjpool *pop, uint64_t idx);
+	uint64_t next; /* index of the next lane to be claimed */
+};
+
+/*
+ * lane_recovery_worker -- (internal) recovers the claimed lanes
+ */
+static void *
+lane_recovery_worker(void *arg)
+{
+	struct lane_recovery *r = arg;
+
+	uint64_t idx;
+	while ((idx = util_fetch_and_add64(&r->next, 1)) < r->pop->nlanes)
+		r->recover(r->pop, idx);
+
+	return NULL;
+}
+
+/*
+ * lane_recover_all -- (internal) recovers all lanes using up to nthreads
+ *	threads
+ *
+ * The logs of different lanes are independent of each other: all of the
+ * persistent changes of a single operation are made under the locks of the
+ * modified objects, and those are held until the log is discarded. If some of
+ * the threads cannot be started, the work is done by the remaining ones.
+ */
+static void
+lane_recover_all(PMEMobjpool *pop,
+	void (*recover)(PMEMobjpool *pop, uint64_t idx), unsigned nthreads)
+{
+	struct lane_recovery r;
+	r.pop = pop;
+	r.recover = recover;
+	r.next = 0;
+
+	if (nthreads > pop->nlanes)
+		nthreads = (unsigned)pop->nlanes;
+
+	os_thread_t *threads = NULL;
+	unsigned nstarted = 0;
+	if (nthreads > 1) {
+		threads = Malloc(sizeof(*threads) * (nthreads - 1));
+		if (threads == NULL)
+			LOG(2, "!Malloc");
+	}
+
+	for (; threads != NULL && nstarted < nthreads - 1; ++nstarted) {
+		errno = os_thread_create(&threads[nstarted], NULL,
+			lane_recovery_worker, &r);
+		if (errno != 0) {
+			LOG(2, "!os_thread_create");
+			break;
+		}
+	}
+
+	lane_recovery_worker(&r);
+
+	for (unsigned i = 0; i < nstarted; ++i)
+		os_thread_join(&threads[i], NULL);
+
+	Free(threads);
+}
+
 /*
  * lane_recover_and_section_boot -- performs initialization and recovery of all
  * lanes
@@ -351,21 +480,16 @@ lane_recover_and_section_boot(PMEMobjpool *pop)
 		SIZEOF_ULOG(LANE_REDO_INTERNAL_SIZE) != LANE_TOTAL_SIZE);
 
 	int err = 0;
-	uint64_t i; /* lane index */
-	struct lane_layout *layout;
+
+	unsigned nthreads;
+	util_atomic_load_explicit32(&Heap_boot_nthreads, &nthreads,
+		memory_order_acquire);
 
 	/*
 	 * First we need to recover the internal/external redo logs so that the
 	 * allocator state is consistent before we boot it.
 	 */
-	for (i = 0; i < pop->nlanes; ++i) {
-		layout = lane_get_layout(pop, i);
-
-		ulog_recover((struct ulog *)&layout->internal,
-			OBJ_OFF_IS_VALID_FROM_CTX, &pop->p_ops);
-		ulog_recover((struct ulog *)&layout->external,
-			OBJ_OFF_IS_VALID_FROM_CTX, &pop->p_ops);
-	}
+	lane_recover_all(pop, lane_recover_redo, nthreads);
 
 	if ((err = pmalloc_boot(pop)) != 0)
 		return err;
@@ -374,13 +498,7 @@ lane_recover_and_section_boot(PMEMobjpool *pop)
 	 * Undo logs must be processed after the heap is initialized since
 	 * a undo recovery might require deallocation of the next ulogs.
 	 */
-	for (i = 0; i < pop->nlanes; ++i) {
-		struct operation_context *ctx = pop->lanes_desc.lane[i].undo;
-		operation_resume(ctx);
-		operation_process(ctx);
-		operation_finish(ctx, ULOG_INC_FIRST_GEN_NUM |
-				ULOG_FREE_AFTER_FIRST);
-	}
+	lane_recover_all(pop, lane_recover_undo, nthreads);
 
 	return 0;
 }
@@ -417,39 +535,128 @@ lane_check(PMEMobjpool *pop)
 	return 0;
 }
 
+/*
+ * lane_try_get -- (internal) tries to lock any of the lanes, starting with
+ *	the primary one, returns 0 on success
+ */
+static inline int
+lane_try_get(uint64_t *locks, struct lane_info *info, uint64_t nlocks)
+{
+	uint64_t primary = info->primary % nlocks;
+
+	for (uint64_t i = 0; i < nlocks; ++i) {
+		info->lane_idx = (primary + i) % nlocks;
+		if (likely(util_bool_compare_and_swap64(
+				&locks[info->lane_idx], 0, 1))) {
+			if (info->lane_idx == primary) {
+				info->primary_attempts =
+					LANE_PRIMARY_ATTEMPTS;
+			} else if (info->primary_attempts == 0) {
+				info->primary = info->lane_idx;
+				info->primary_attempts =
+					LANE_PRIMARY_ATTEMPTS;
+			}
+			return 0;
+		}
+
+		if (info->lane_idx == primary &&
+				info->primary_attempts > 0) {
+			info->primary_attempts--;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * lane_wait_now -- (internal) returns the current time in nanoseconds
+ */
+static uint64_t
+lane_wait_now(void)
+{
+	struct timespec ts;
+	os_clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * lane_wait -- (internal) sleeps until one of the lanes can be locked
+ *
+ * The waiter is registered before the lanes are checked again, so a thread
+ * unlocking a lane after that check either lets the check succeed or sees
+ * the waiter and wakes it up. The condition is signaled under the lock, which
+ * is held by the waiter from the check until it goes to sleep.
+ */
+static void
+lane_wait(PMEMobjpool *pop, struct lane_info *info)
+{
+	struct lane_descriptor *desc = &pop->lanes_desc;
+	uint64_t start = lane_wait_now();
+
+	util_mutex_lock(&desc->wait_lock);
+	util_fetch_and_add64(&desc->nwaiters, 1);
+
+	while (lane_try_get(desc->lane_locks, info,
+			desc->runtime_nlanes) != 0)
+		os_cond_wait(&desc->wait_cond, &desc->wait_lock);
+
+	util_fetch_and_sub64(&desc->nwaiters, 1);
+	util_mutex_unlock(&desc->wait_lock);
+
+	STATS_INC(pop->stats, transient, lane_waits, 1);
+	STATS_INC(pop->stats, transient, lane_wait_time,
+		lane_wait_now() - start);
+}
+
+/*
+ * lane_cpu_primary -- (internal) returns the lane preferred by the threads
+ *	running on the cpu
+ *
+ * Consecutive cpus are spread across the lane locks the same way as the
+ * primary lanes of consecutive threads, so that their locks don't share
+ * cache lines.
+ */
+static inline uint64_t
+lane_cpu_primary(unsigned cpu, uint64_t nlanes)
+{
+	uint64_t c = cpu % nlanes;
+	uint64_t groups = nlanes / LANE_JUMP;
+	if (nlanes % LANE_JUMP != 0)
+		return c;
+
+	return (c % groups) * LANE_JUMP + c / groups;
+}
+
 /*
  * get_lane -- (internal) get free lane index
  */
 static inline void
-get_lane(uint64_t *locks, struct lane_info *info, uint64_t nlocks)
-{
-	info->lane_idx = info->primary;
-	while (1) {
-		do {
-			info->lane_idx %= nlocks;
-			if (likely(util_bool_compare_and_swap64(
-					&locks[info->lane_idx], 0, 1))) {
-				if (info->lane_idx == info->primary) {
-					info->primary_attempts =
-						LANE_PRIMARY_ATTEMPTS;
-				} else if (info->primary_attempts == 0) {
-					info->primary = info->lane_idx;
-					info->primary_attempts =
-						LANE_PRIMARY_ATTEMPTS;
-				}
-				return;
-			}
+get_lane(PMEMobjpool *pop, struct lane_info *info)
+{
+	struct lane_descriptor *desc = &pop->lanes_desc;
 
-			if (info->lane_idx == info->primary &&
-					info->primary_attempts > 0) {
-				info->primary_attempts--;
-			}
+	unsigned mode;
+	util_atomic_load_explicit32(&desc->mode, &mode, memory_order_relaxed);
 
-			++info->lane_idx;
-		} while (info->lane_idx < nlocks);
+	int cpu;
+	if (mode == POBJ_LANE_MODE_CPU && (cpu = os_sched_getcpu()) >= 0)
+		info->primary = lane_cpu_primary((unsigned)cpu,
+			desc->runtime_nlanes);
 
+	if (likely(lane_try_get(desc->lane_locks, info,
+			desc->runtime_nlanes) == 0))
+		return;
+
+	/* the lanes are usually held briefly, so try again before sleeping */
+	for (int i = 0; i < LANE_YIELD_ATTEMPTS; ++i) {
 		sched_yield();
+		if (lane_try_get(desc->lane_locks, info,
+				desc->runtime_nlanes) == 0)
+			return;
 	}
+
+	lane_wait(pop, info);
 }
 
 /*
@@ -521,10 +728,9 @@ lane_hold(PMEMobjpool *pop, struct lane **lanep)
 			&pop->lanes_desc.next_lane_idx, LANE_JUMP);
 	} /* handles wraparound */
 
-	uint64_t *llocks = pop->lanes_desc.lane_locks;
 	/* grab next free lane from lanes available at runtime */
 	if (!lane->nest_count++) {
-		get_lane(llocks, lane, pop->lanes_desc.runtime_nlanes);
+		get_lane(pop, lane);
 	}
 
 	struct lane *l = &pop->lanes_desc.lane[lane->lane_idx];
@@ -536,6 +742,15 @@ lane_hold(PMEMobjpool *pop, struct lane **lanep)
 		operation_init(l->external);
 		operation_init(l->internal);
 		operation_init(l->undo);
+		operation_set_crc32c(l->external, pop->ulog_checksum_crc32c);
+		operation_set_crc32c(l->internal, pop->ulog_checksum_crc32c);
+		operation_set_crc32c(l->undo, pop->ulog_checksum_crc32c);
+
+		struct tx_parameters *params = pop->tx_params;
+		operation_set_retain(l->external, params->log_retain_max,
+			params->log_retain_decay);
+		operation_set_retain(l->undo, params->log_retain_max,
+			params->log_retain_decay);
 	}
 
 	if (lanep)
@@ -563,10 +778,164 @@ lane_release(PMEMobjpool *pop)
 	if (unlikely(lane->nest_count == 0)) {
 		FATAL("lane_release");
 	} else if (--(lane->nest_count) == 0) {
-		if (unlikely(!util_bool_compare_and_swap64(
-				&pop->lanes_desc.lane_locks[lane->lane_idx],
-				1, 0))) {
-			FATAL("util_bool_compare_and_swap64");
-		}
+		lane_unlock(pop, lane->lane_idx);
+	}
+}
+
+/*
+ * lane_detach -- releases the outermost hold of the calling thread on its
+ *	lane without unlocking the lane
+ *
+ * The lane stays locked until lane_unlock is called, possibly by a different
+ * thread. Fails if the lane is held by an outer operation of the thread.
+ */
+int
+lane_detach(PMEMobjpool *pop, uint64_t *lane_idx)
+{
+	if (unlikely(!pop->lanes_desc.runtime_nlanes))
+		return -1;
+
+	struct lane_info *lane = get_lane_info_record(pop);
+
+	ASSERTne(lane, NULL);
+	ASSERTne(lane->lane_idx, UINT64_MAX);
+
+	if (lane->nest_count != 1)
+		return -1;
+
+	lane->nest_count = 0;
+	*lane_idx = lane->lane_idx;
+
+	return 0;
+}
+
+/*
+ * lane_unlock -- makes the lane available to other threads
+ */
+void
+lane_unlock(PMEMobjpool *pop, uint64_t lane_idx)
+{
+	struct lane_descriptor *desc = &pop->lanes_desc;
+
+	if (unlikely(!util_bool_compare_and_swap64(
+			&desc->lane_locks[lane_idx], 1, 0))) {
+		FATAL("util_bool_compare_and_swap64");
+	}
+
+	uint64_t nwaiters;
+	util_atomic_load64(&desc->nwaiters, &nwaiters);
+	if (unlikely(nwaiters != 0)) {
+		util_mutex_lock(&desc->wait_lock);
+		os_cond_signal(&desc->wait_cond);
+		util_mutex_unlock(&desc->wait_lock);
+	}
+}
+
+/*
+ * lane_get_mode -- (internal) returns the way lanes are picked by threads
+ */
+static enum pobj_lane_mode
+lane_get_mode(PMEMobjpool *pop)
+{
+	unsigned mode;
+	util_atomic_load_explicit32(&pop->lanes_desc.mode, &mode,
+		memory_order_relaxed);
+
+	return (enum pobj_lane_mode)mode;
+}
+
+/*
+ * lane_set_mode -- (internal) changes the way lanes are picked by threads
+ */
+static int
+lane_set_mode(PMEMobjpool *pop, enum pobj_lane_mode mode)
+{
+	if (mode != POBJ_LANE_MODE_THREAD && mode != POBJ_LANE_MODE_CPU) {
+		ERR("invalid lane mode %d", mode);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (mode == POBJ_LANE_MODE_CPU && os_sched_getcpu() < 0) {
+		ERR("!cannot determine the current cpu");
+		return -1;
+	}
+
+	util_atomic_store_explicit32(&pop->lanes_desc.mode, (unsigned)mode,
+		memory_order_relaxed);
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(mode) -- reads the way lanes are picked by threads
+ */
+static int
+CTL_READ_HANDLER(mode)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	*(enum pobj_lane_mode *)arg = lane_get_mode(pop);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(mode) -- changes the way lanes are picked by threads
+ */
+static int
+CTL_WRITE_HANDLER(mode)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	return lane_set_mode(pop, *(enum pobj_lane_mode *)arg);
+}
+
+/*
+ * lane_mode_parser -- parses the lane mode
+ */
+static int
+lane_mode_parser(const void *arg, void *dest, size_t dest_size)
+{
+	const char *vstr = arg;
+	enum pobj_lane_mode *mode = dest;
+	ASSERTeq(dest_size, sizeof(enum pobj_lane_mode));
+
+	if (strcmp(vstr, "thread") == 0) {
+		*mode = POBJ_LANE_MODE_THREAD;
+	} else if (strcmp(vstr, "cpu") == 0) {
+		*mode = POBJ_LANE_MODE_CPU;
+	} else {
+		ERR("invalid lane mode");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static const struct ctl_argument CTL_ARG(mode) = {
+	.dest_size = sizeof(enum pobj_lane_mode),
+	.parsers = {
+		CTL_ARG_PARSER(sizeof(enum pobj_lane_mode),
+			lane_mode_parser),
+		CTL_ARG_PARSER_END
 	}
+};
+
+static const struct ctl_node CTL_NODE(lane)[] = {
+	CTL_LEAF_RW(mode),
+
+	CTL_NODE_END
+};
+
+/*
+ * lane_ctl_register -- registers ctl nodes for "lane" module
+ */
+void
+lane_ctl_register(PMEMobjpool *pop)
+{
+	CTL_REGISTER_MODULE(pop->ctl, lane);
 }
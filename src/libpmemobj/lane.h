@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2015-2019, Intel Corporation */
+/* Copyright 2015-2020, Intel Corporation */
 
 /*
  * lane.h -- internal definitions for lanes
@@ -11,6 +11,7 @@
 #include <stdint.h>
 #include "ulog.h"
 #include "libpmemobj.h"
+#include "os_thread.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -30,6 +31,8 @@ extern "C" {
  */
 #define LANE_PRIMARY_ATTEMPTS 128
 
+#define LANE_YIELD_ATTEMPTS 2
+
 #define RLANE_DEFAULT 0
 
 #define LANE_TOTAL_SIZE 3072 /* 3 * 1024 (sum of 3 old lane sections) */
@@ -97,6 +100,16 @@ struct lane_descriptor {
 	unsigned next_lane_idx;
 	uint64_t *lane_locks;
 	struct lane *lane;
+
+	unsigned mode; /* one of enum pobj_lane_mode */
+
+	/*
+	 * Threads which found all of the lanes busy sleep on the condition
+	 * until one of the lanes is released.
+	 */
+	uint64_t nwaiters;
+	os_mutex_t wait_lock;
+	os_cond_t wait_cond;
 };
 
 typedef int (*section_layout_op)(PMEMobjpool *pop, void *data, unsigned length);
@@ -138,9 +151,12 @@ void lane_cleanup(PMEMobjpool *pop);
 int lane_recover_and_section_boot(PMEMobjpool *pop);
 int lane_section_cleanup(PMEMobjpool *pop);
 int lane_check(PMEMobjpool *pop);
+void lane_ctl_register(PMEMobjpool *pop);
 
 unsigned lane_hold(PMEMobjpool *pop, struct lane **lane);
 void lane_release(PMEMobjpool *pop);
+int lane_detach(PMEMobjpool *pop, uint64_t *lane_idx);
+void lane_unlock(PMEMobjpool *pop, uint64_t lane_idx);
 
 #ifdef __cplusplus
 }
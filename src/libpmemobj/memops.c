@@ -53,6 +53,7 @@ struct operation_context {
 	size_t ulog_curr_offset; /* offset in the log for buffer stores */
 	size_t ulog_curr_capacity; /* capacity of the current log */
 	size_t ulog_curr_gen_num; /* transaction counter in the current log */
+	uint64_t ulog_csum_flags; /* checksum algorithm of the logs */
 	struct ulog *ulog_curr; /* current persistent log */
 	size_t total_logged; /* total amount of buffer stores in the logs */
 
@@ -62,6 +63,10 @@ struct operation_context {
 	int ulog_auto_reserve; /* allow or do not to auto ulog reservation */
 	int ulog_any_user_buffer; /* set if any user buffer is added */
 
+	size_t ulog_retain_max; /* max capacity of the retained next logs */
+	unsigned ulog_retain_decay; /* % by which the peak decays per op */
+	size_t ulog_retain_peak; /* learned usage of the next logs */
+
 	struct ulog_next next; /* vector of 'next' fields of persistent ulog */
 
 	enum operation_state state; /* operation sanity check */
@@ -251,7 +256,7 @@ void
 operation_free_logs(struct operation_context *ctx, uint64_t flags)
 {
 	int freed = ulog_free_next(ctx->ulog, ctx->p_ops, ctx->ulog_free,
-			operation_user_buffer_remove, flags);
+			operation_user_buffer_remove, 0, flags);
 	if (freed) {
 		ctx->ulog_capacity = ulog_capacity(ctx->ulog,
 			ctx->ulog_base_nbytes, ctx->p_ops);
@@ -402,6 +407,113 @@ operation_add_entry(struct operation_context *ctx, void *ptr, uint64_t value,
 		from_pool ? LOG_PERSISTENT : LOG_TRANSIENT);
 }
 
+/*
+ * operation_redo_log_left -- (internal) returns the number of bytes left in
+ *	the persistent log which contains the given offset of the shadow log
+ */
+static size_t
+operation_redo_log_left(struct operation_context *ctx, size_t offset)
+{
+	size_t end = ctx->ulog_base_nbytes;
+	if (offset < end)
+		return end - offset;
+
+	uint64_t next;
+	VEC_FOREACH(next, &ctx->next) {
+		end += ulog_by_offset(next, ctx->p_ops)->capacity;
+		if (offset < end)
+			return end - offset;
+	}
+
+	return 0;
+}
+
+/*
+ * operation_add_redo_buffer -- (internal) adds a buffer operation to the
+ *	shadow copy of the redo log
+ *
+ * The persistent redo log is written linearly from the shadow copy at
+ * processing time, and so the buffer is split into multiple entries in such
+ * a way that none of them spans two of the underlying logs. All buffers have
+ * to be added before any of the value entries.
+ */
+static int
+operation_add_redo_buffer(struct operation_context *ctx,
+	void *dest, void *src, size_t size, ulog_operation_type type)
+{
+	struct operation_log *oplog = &ctx->pshadow_ops;
+
+	while (size != 0) {
+		ASSERTeq(oplog->offset % CACHELINE_SIZE, 0);
+
+		size_t real_size = size + sizeof(struct ulog_entry_buf);
+
+		/* if there's no space left in the log, reserve some more */
+		size_t left = operation_redo_log_left(ctx, oplog->offset);
+		if (left == 0) {
+			if (operation_reserve(ctx, oplog->offset +
+			    ALIGN_UP(real_size, CACHELINE_SIZE)) != 0)
+				return -1;
+
+			left = operation_redo_log_left(ctx, oplog->offset);
+			ASSERTne(left, 0);
+		}
+
+		size_t curr_size = MIN(real_size, left);
+		size_t data_size = curr_size - sizeof(struct ulog_entry_buf);
+		size_t entry_size = ALIGN_UP(curr_size, CACHELINE_SIZE);
+
+		/* keep the spare cacheline for the zeroed next entry */
+		size_t needed = oplog->offset + entry_size + CACHELINE_SIZE;
+		if (needed > oplog->capacity) {
+			size_t ncapacity = ALIGN_UP(needed,
+				(size_t)ULOG_BASE_SIZE);
+			struct ulog *ulog = Realloc(oplog->ulog,
+				SIZEOF_ULOG(ncapacity));
+			if (ulog == NULL)
+				return -1;
+			oplog->capacity = ncapacity;
+			oplog->ulog = ulog;
+			oplog->ulog->capacity = oplog->capacity;
+
+			VECQ_CLEAR(&ctx->merge_entries);
+		}
+
+		struct ulog_entry_buf *e = ulog_entry_buf_create_shadow(
+			oplog->ulog, oplog->offset, dest, src, data_size,
+			type, &ctx->s_ops);
+		ASSERTeq(entry_size, ulog_entry_size(&e->base));
+
+		oplog->offset += entry_size;
+
+		dest = (char *)dest + data_size;
+		src = (char *)src + data_size;
+		size -= data_size;
+	}
+
+	return 0;
+}
+
+/*
+ * operation_set_undo_csum -- (internal) makes the persistent undo log use
+ *	the checksum algorithm of the operation
+ *
+ * This can only be done while there are no valid entries in the log.
+ */
+static void
+operation_set_undo_csum(struct operation_context *ctx)
+{
+	struct ulog *ulog = ctx->ulog;
+	if ((ulog->flags & ULOG_CHECKSUM_CRC32C) == ctx->ulog_csum_flags)
+		return;
+
+	VALGRIND_ADD_TO_TX(&ulog->flags, sizeof(ulog->flags));
+	ulog->flags = (ulog->flags & ~(uint64_t)ULOG_CHECKSUM_CRC32C) |
+		ctx->ulog_csum_flags;
+	pmemops_persist(ctx->p_ops, &ulog->flags, sizeof(ulog->flags));
+	VALGRIND_REMOVE_FROM_TX(&ulog->flags, sizeof(ulog->flags));
+}
+
 /*
  * operation_add_buffer -- adds a buffer operation to the log
  */
@@ -409,8 +521,15 @@ int
 operation_add_buffer(struct operation_context *ctx,
 	void *dest, void *src, size_t size, ulog_operation_type type)
 {
+	if (ctx->type == LOG_TYPE_REDO)
+		return operation_add_redo_buffer(ctx, dest, src, size, type);
+
 	size_t real_size = size + sizeof(struct ulog_entry_buf);
 
+	/* the first entry decides the checksum of the entire log */
+	if (ctx->total_logged == 0)
+		operation_set_undo_csum(ctx);
+
 	/* if there's no space left in the log, reserve some more */
 	if (ctx->ulog_curr_capacity == 0) {
 		ctx->ulog_curr_gen_num = ctx->ulog->gen_num;
@@ -450,6 +569,7 @@ operation_add_buffer(struct operation_context *ctx,
 	struct ulog_entry_buf *e = ulog_entry_buf_create(ctx->ulog_curr,
 		ctx->ulog_curr_offset,
 		ctx->ulog_curr_gen_num,
+		ctx->ulog_csum_flags,
 		dest, src, data_size,
 		type, ctx->p_ops);
 	ASSERT(entry_size == ulog_entry_size(&e->base));
@@ -600,6 +720,16 @@ operation_add_user_buffer(struct operation_context *ctx,
 	operation_set_any_user_buffer(ctx, 1);
 }
 
+/*
+ * operation_get_redo_nbytes -- returns the number of bytes occupied by the
+ *	entries in the shadow copy of the redo log
+ */
+size_t
+operation_get_redo_nbytes(struct operation_context *ctx)
+{
+	return ctx->pshadow_ops.offset;
+}
+
 /*
  * operation_set_auto_reserve -- set auto reserve value for context
  */
@@ -609,6 +739,30 @@ operation_set_auto_reserve(struct operation_context *ctx, int auto_reserve)
 	ctx->ulog_auto_reserve = auto_reserve;
 }
 
+/*
+ * operation_set_crc32c -- selects CRC32C or Fletcher64 as the checksum of
+ *	the logs of the following operations of the context
+ */
+void
+operation_set_crc32c(struct operation_context *ctx, int crc32c)
+{
+	ctx->ulog_csum_flags = crc32c ? ULOG_CHECKSUM_CRC32C : 0;
+	ctx->pshadow_ops.ulog->flags = ctx->ulog_csum_flags;
+}
+
+/*
+ * operation_set_retain -- sets the maximum capacity of the next logs that
+ *	are kept once the operation finishes, and the percentage by which their
+ *	learned usage decays with every operation
+ */
+void
+operation_set_retain(struct operation_context *ctx, size_t max,
+	unsigned decay)
+{
+	ctx->ulog_retain_max = max;
+	ctx->ulog_retain_decay = decay;
+}
+
 /*
  * operation_set_any_user_buffer -- set ulog_any_user_buffer value for context
  */
@@ -705,6 +859,9 @@ operation_init(struct operation_context *ctx)
 	ctx->ulog_curr_capacity = 0;
 	ctx->ulog_curr_gen_num = 0;
 	ctx->ulog_curr = NULL;
+
+	plog->ulog->flags = ctx->ulog_csum_flags;
+
 	ctx->total_logged = 0;
 	ctx->ulog_auto_reserve = 1;
 	ctx->ulog_any_user_buffer = 0;
@@ -781,6 +938,48 @@ operation_process(struct operation_context *ctx)
 		ulog_process(ctx->transient_ops.ulog, NULL, &ctx->t_ops);
 }
 
+/*
+ * operation_retain_capacity -- (internal) updates the learned usage of the
+ *	next logs and returns the capacity of the ones that should be kept
+ *
+ * The usage is the peak number of bytes logged over the capacity of the
+ * first log, which decays with every operation that needs less. The next
+ * logs are kept, in order, until they cover the usage, as long as their
+ * capacity doesn't exceed the maximum.
+ */
+static size_t
+operation_retain_capacity(struct operation_context *ctx)
+{
+	if (ctx->ulog_retain_max == 0 || ctx->ulog_any_user_buffer) {
+		ctx->ulog_retain_peak = 0;
+		return 0;
+	}
+
+	size_t logged = ctx->type == LOG_TYPE_UNDO ?
+		ctx->total_logged : ctx->pshadow_ops.offset;
+	size_t usage = logged > ctx->ulog_base_nbytes ?
+		logged - ctx->ulog_base_nbytes : 0;
+
+	size_t peak = ctx->ulog_retain_peak;
+	peak -= peak / 100 * ctx->ulog_retain_decay;
+	ctx->ulog_retain_peak = MAX(usage, peak);
+
+	size_t retain = 0;
+	uint64_t offset;
+	VEC_FOREACH(offset, &ctx->next) {
+		if (retain >= ctx->ulog_retain_peak)
+			break;
+
+		struct ulog *u = ulog_by_offset(offset, ctx->p_ops);
+		if (retain + u->capacity > ctx->ulog_retain_max)
+			break;
+
+		retain += u->capacity;
+	}
+
+	return retain;
+}
+
 /*
  * operation_finish -- finalizes the operation
  */
@@ -789,6 +988,8 @@ operation_finish(struct operation_context *ctx, unsigned flags)
 {
 	ASSERTne(ctx->state, OPERATION_IDLE);
 
+	size_t retain = operation_retain_capacity(ctx);
+
 	if (ctx->type == LOG_TYPE_UNDO && ctx->total_logged != 0)
 		ctx->state = OPERATION_CLEANUP;
 
@@ -805,13 +1006,13 @@ operation_finish(struct operation_context *ctx, unsigned flags)
 			ctx->total_logged, ctx->ulog_base_nbytes,
 			&ctx->next, ctx->ulog_free,
 			operation_user_buffer_remove,
-			ctx->p_ops, flags);
+			ctx->p_ops, retain, flags);
 		if (ret == 0)
 			goto out;
 	} else if (ctx->type == LOG_TYPE_REDO) {
 		int ret = ulog_free_next(ctx->ulog, ctx->p_ops,
 			ctx->ulog_free, operation_user_buffer_remove,
-			flags);
+			retain, flags);
 		if (ret == 0)
 			goto out;
 	}
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2016-2019, Intel Corporation */
+/* Copyright 2016-2020, Intel Corporation */
 
 /*
  * memops.h -- aggregated memory operations helper definitions
@@ -67,9 +67,13 @@ void operation_add_user_buffer(struct operation_context *ctx,
 		struct user_buffer_def *userbuf);
 void operation_set_auto_reserve(struct operation_context *ctx,
 		int auto_reserve);
+void operation_set_crc32c(struct operation_context *ctx, int crc32c);
+void operation_set_retain(struct operation_context *ctx, size_t max,
+	unsigned decay);
 void operation_set_any_user_buffer(struct operation_context *ctx,
 	int any_user_buffer);
 int operation_get_any_user_buffer(struct operation_context *ctx);
+size_t operation_get_redo_nbytes(struct operation_context *ctx);
 int operation_user_buffer_range_cmp(const void *lhs, const void *rhs);
 
 int operation_reserve(struct operation_context *ctx, size_t new_capacity);
@@ -4,6 +4,7 @@
 /*
  * obj.c -- transactional object store implementation
  */
+#include <endian.h>
 #include <inttypes.h>
 #include <limits.h>
 #include <wchar.h>
@@ -19,7 +20,9 @@
 #include "ctl_global.h"
 #include "ravl.h"
 
+#include "alloc_class.h"
 #include "heap_layout.h"
+#include "heap.h"
 #include "os.h"
 #include "os_thread.h"
 #include "pmemops.h"
@@ -164,6 +167,7 @@ obj_ctl_init_and_load(PMEMobjpool *pop)
 		pmalloc_ctl_register(pop);
 		stats_ctl_register(pop);
 		debug_ctl_register(pop);
+		lane_ctl_register(pop);
 	}
 
 	char *env_config = os_getenv(OBJ_CONFIG_ENV_VARIABLE);
@@ -276,6 +280,7 @@ obj_init(void)
 	 * subsequent call to this function for individual pools.
 	 */
 	ctl_global_register();
+	heap_global_ctl_register();
 
 	if (obj_ctl_init_and_load(NULL))
 		FATAL("error: %s", pmemobj_errormsg());
@@ -1182,6 +1187,14 @@ obj_runtime_init(PMEMobjpool *pop, int rdonly, int boot, unsigned nlanes)
 
 	pop->lanes_desc.runtime_nlanes = nlanes;
 
+	/*
+	 * Logs checksummed with CRC32C cannot be recovered by the versions of
+	 * the library which only know Fletcher64, so it has to be selected
+	 * explicitly, which is then recorded in the pool header.
+	 */
+	pop->ulog_checksum_crc32c = (le32toh(pop->hdr.features.incompat) &
+		POOL_FEAT_ULOG_CRC32C) != 0;
+
 	pop->tx_params = tx_params_new();
 	if (pop->tx_params == NULL)
 		goto err_tx_params;
@@ -1943,6 +1956,15 @@ pmemobj_close(PMEMobjpool *pop)
 
 	_pobj_cache_invalidate++;
 
+	if (pmalloc_free_batch_flush(pop) != 0)
+		LOG(2, "unable to publish deferred frees");
+
+	pmalloc_defrag_stop(pop);
+	pmalloc_extender_stop(pop);
+
+	/* lanes queued for the post-commit cleanup have to be released */
+	tx_post_commit_stop(pop);
+
 	if (critnib_remove(pools_ht, pop->uuid_lo) != pop) {
 		ERR("critnib_remove for pools_ht");
 	}
@@ -2163,6 +2185,71 @@ constructor_alloc(void *ctx, void *ptr, size_t usable_size, void *arg)
 	return ret;
 }
 
+/*
+ * constructor_alloc_bulk -- (internal) constructor for bulk allocations
+ *
+ * The zeroed memory doesn't have to be drained here, all of the objects are
+ * drained at once before their allocation is published.
+ */
+static int
+constructor_alloc_bulk(void *ctx, void *ptr, size_t usable_size, void *arg)
+{
+	PMEMobjpool *pop = ctx;
+	LOG(3, "pop %p ptr %p arg %p", pop, ptr, arg);
+	struct pmem_ops *p_ops = &pop->p_ops;
+
+	ASSERTne(ptr, NULL);
+	ASSERTne(arg, NULL);
+
+	struct constr_args *carg = arg;
+
+	if (carg->zero_init)
+		pmemops_memset(p_ops, ptr, 0, usable_size,
+			PMEMOBJ_F_MEM_NODRAIN);
+
+	int ret = 0;
+	if (carg->constructor)
+		ret = carg->constructor(pop, ptr, carg->arg);
+
+	return ret;
+}
+
+/*
+ * obj_alloc_class_id -- picks the allocation class requested by the flags,
+ *	either explicitly or through the requested alignment
+ */
+int
+obj_alloc_class_id(PMEMobjpool *pop, size_t size, uint64_t flags,
+	uint16_t *class_id)
+{
+	*class_id = CLASS_ID_FROM_FLAG(flags);
+
+	size_t alignment = ALIGNMENT_FROM_FLAG(flags);
+	if (alignment == 0)
+		return 0;
+
+	if (!util_is_pow2(alignment)) {
+		ERR("alignment %zu is not a power of two", alignment);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (*class_id != 0) {
+		ERR("alignment cannot be combined with an allocation class");
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct alloc_class *c = heap_get_aligned_class(&pop->heap, size,
+		alignment);
+	if (c == NULL)
+		return -1;
+
+	*class_id = c->id;
+
+	return 0;
+}
+
 /*
  * obj_alloc_construct -- (internal) allocates a new object with constructor
  */
@@ -2177,6 +2264,10 @@ obj_alloc_construct(PMEMobjpool *pop, PMEMoid *oidp, size_t size,
 		return -1;
 	}
 
+	uint16_t class_id;
+	if (obj_alloc_class_id(pop, size, flags, &class_id) != 0)
+		return -1;
+
 	struct constr_args carg;
 
 	carg.zero_init = flags & POBJ_FLAG_ZERO;
@@ -2192,8 +2283,7 @@ obj_alloc_construct(PMEMobjpool *pop, PMEMoid *oidp, size_t size,
 	int ret = palloc_operation(&pop->heap, 0,
 			oidp != NULL ? &oidp->off : NULL, size,
 			constructor_alloc, &carg, type_num, 0,
-			CLASS_ID_FROM_FLAG(flags), ARENA_ID_FROM_FLAG(flags),
-			ctx);
+			class_id, ARENA_ID_FROM_FLAG(flags), ctx);
 
 	pmalloc_operation_release(pop);
 
@@ -2266,6 +2356,130 @@ pmemobj_xalloc(PMEMobjpool *pop, PMEMoid *oidp, size_t size,
 	return ret;
 }
 
+/*
+ * obj_alloc_bulk -- (internal) allocates multiple objects of the same size
+ *	and publishes all of them with a single redo log
+ */
+static int
+obj_alloc_bulk(PMEMobjpool *pop, PMEMoid *oidv, size_t oidcnt, size_t size,
+	type_num_t type_num, uint64_t flags,
+	pmemobj_constr constructor, void *arg)
+{
+	if (size > PMEMOBJ_MAX_ALLOC_SIZE) {
+		ERR("requested size too large");
+		errno = ENOMEM;
+		return -1;
+	}
+
+	/* every object requires up to three redo log entries */
+	if (oidcnt > SIZE_MAX / sizeof(struct pobj_action) ||
+	    oidcnt > SIZE_MAX / (3 * sizeof(struct ulog_entry_val))) {
+		ERR("too many objects requested");
+		errno = ENOMEM;
+		return -1;
+	}
+
+	uint16_t class_id;
+	if (obj_alloc_class_id(pop, size, flags, &class_id) != 0)
+		return -1;
+
+	struct pobj_action *actv = Malloc(oidcnt * sizeof(*actv));
+	if (actv == NULL) {
+		ERR("!Malloc");
+		return -1;
+	}
+
+	struct constr_args carg;
+
+	carg.zero_init = flags & POBJ_FLAG_ZERO;
+	carg.constructor = constructor;
+	carg.arg = arg;
+
+	int ret = palloc_reserve_bulk(&pop->heap, size,
+			constructor_alloc_bulk, &carg, type_num, 0,
+			class_id, ARENA_ID_FROM_FLAG(flags), actv, oidcnt);
+	if (ret != 0)
+		goto out;
+
+	/*
+	 * Object identifiers that reside in the pool are set atomically with
+	 * the allocation itself.
+	 */
+	int in_pool = OBJ_PTR_FROM_POOL(pop, oidv);
+	size_t nentries = in_pool ? oidcnt * 3 : oidcnt;
+
+	struct operation_context *ctx = pmalloc_operation_hold(pop);
+
+	ret = operation_reserve(ctx, nentries * sizeof(struct ulog_entry_val));
+	if (ret != 0) {
+		pmalloc_operation_release(pop);
+		palloc_cancel(&pop->heap, actv, oidcnt);
+		goto out;
+	}
+
+	/* the actions get reordered once published */
+	for (size_t i = 0; i < oidcnt; ++i) {
+		if (in_pool) {
+			operation_add_entry(ctx, &oidv[i].pool_uuid_lo,
+				pop->uuid_lo, ULOG_OPERATION_SET);
+			operation_add_entry(ctx, &oidv[i].off,
+				actv[i].heap.offset, ULOG_OPERATION_SET);
+		} else {
+			oidv[i].pool_uuid_lo = pop->uuid_lo;
+			oidv[i].off = actv[i].heap.offset;
+		}
+	}
+
+	palloc_publish(&pop->heap, actv, oidcnt, ctx);
+
+	pmalloc_operation_release(pop);
+
+out:
+	Free(actv);
+	return ret;
+}
+
+/*
+ * pmemobj_xalloc_bulk -- allocates multiple objects of the same size at once
+ */
+int
+pmemobj_xalloc_bulk(PMEMobjpool *pop, PMEMoid *oidv, size_t oidcnt,
+	size_t size, uint64_t type_num, uint64_t flags,
+	pmemobj_constr constructor, void *arg)
+{
+	LOG(3, "pop %p oidv %p oidcnt %zu size %zu type_num %llx flags %llx "
+		"constructor %p arg %p",
+		pop, oidv, oidcnt, size, (unsigned long long)type_num,
+		(unsigned long long)flags,
+		constructor, arg);
+
+	/* log notice message if used inside a transaction */
+	_POBJ_DEBUG_NOTICE_IN_TX();
+
+	if (size == 0) {
+		ERR("allocation with size 0");
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (flags & ~POBJ_XALLOC_VALID_FLAGS) {
+		ERR("unknown flags 0x%" PRIx64,
+				flags & ~POBJ_XALLOC_VALID_FLAGS);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (oidcnt == 0)
+		return 0;
+
+	PMEMOBJ_API_START();
+	int ret = obj_alloc_bulk(pop, oidv, oidcnt, size, type_num,
+			flags, constructor, arg);
+
+	PMEMOBJ_API_END();
+	return ret;
+}
+
 /* arguments for constructor_realloc and constructor_zrealloc */
 struct carg_realloc {
 	void *ptr;
@@ -2606,7 +2820,16 @@ pmemobj_free(PMEMoid *oidp)
 	ASSERTne(pop, NULL);
 	ASSERT(OBJ_OID_IS_VALID(pop, *oidp));
 
-	obj_free(pop, oidp);
+	/*
+	 * A handle residing in the pool has to be cleared atomically with
+	 * the free, so only the frees through volatile handles are batched.
+	 */
+	if (!OBJ_PTR_FROM_POOL(pop, oidp) &&
+	    pmalloc_free_batch_enqueue(pop, oidp->off) == 0)
+		*oidp = OID_NULL;
+	else
+		obj_free(pop, oidp);
+
 	PMEMOBJ_API_END();
 }
 
@@ -3021,8 +3244,10 @@ pmemobj_xreserve(PMEMobjpool *pop, struct pobj_action *act,
 	carg.constructor = NULL;
 	carg.arg = NULL;
 
-	if (palloc_reserve(&pop->heap, size, constructor_alloc, &carg,
-		type_num, 0, CLASS_ID_FROM_FLAG(flags),
+	uint16_t class_id;
+	if (obj_alloc_class_id(pop, size, flags, &class_id) != 0 ||
+	    palloc_reserve(&pop->heap, size, constructor_alloc, &carg,
+		type_num, 0, class_id,
 		ARENA_ID_FROM_FLAG(flags), act) != 0) {
 		PMEMOBJ_API_END();
 		return oid;
@@ -3035,6 +3260,43 @@ pmemobj_xreserve(PMEMobjpool *pop, struct pobj_action *act,
 	return oid;
 }
 
+/*
+ * pmemobj_xreserve_bulk -- reserves multiple objects of the same size at once
+ */
+int
+pmemobj_xreserve_bulk(PMEMobjpool *pop, struct pobj_action *actv,
+	size_t actvcnt, size_t size, uint64_t type_num, uint64_t flags)
+{
+	LOG(3, "pop %p actv %p actvcnt %zu size %zu type_num %llx flags %llx",
+		pop, actv, actvcnt, size,
+		(unsigned long long)type_num, (unsigned long long)flags);
+
+	if (flags & ~POBJ_ACTION_XRESERVE_VALID_FLAGS) {
+		ERR("unknown flags 0x%" PRIx64,
+				flags & ~POBJ_ACTION_XRESERVE_VALID_FLAGS);
+		errno = EINVAL;
+		return -1;
+	}
+
+	PMEMOBJ_API_START();
+	struct constr_args carg;
+
+	carg.zero_init = flags & POBJ_FLAG_ZERO;
+	carg.constructor = NULL;
+	carg.arg = NULL;
+
+	uint16_t class_id;
+	int ret = obj_alloc_class_id(pop, size, flags, &class_id);
+	if (ret == 0)
+		ret = palloc_reserve_bulk(&pop->heap, size,
+			constructor_alloc_bulk, &carg, type_num, 0,
+			class_id, ARENA_ID_FROM_FLAG(flags),
+			actv, actvcnt);
+
+	PMEMOBJ_API_END();
+	return ret;
+}
+
 /*
  * pmemobj_set_value -- creates an action to set a value
  */
@@ -95,7 +95,7 @@ typedef uint64_t type_num_t;
 #define CONVERSION_FLAG_OLD_SET_CACHE ((1ULL) << 0)
 
 /* PMEM_OBJ_POOL_HEAD_SIZE Without the unused and unused2 arrays */
-#define PMEM_OBJ_POOL_HEAD_SIZE 2196
+#define PMEM_OBJ_POOL_HEAD_SIZE 2332
 #define PMEM_OBJ_POOL_UNUSED2_SIZE (PMEM_PAGESIZE \
 					- OBJ_DSC_P_UNUSED\
 					- PMEM_OBJ_POOL_HEAD_SIZE)
@@ -171,8 +171,11 @@ struct pmemobjpool {
 
 	int vg_boot;
 	int tx_debug_skip_expensive_checks;
+	int ulog_checksum_crc32c; /* checksum new ulogs with CRC32C */
 
 	struct tx_parameters *tx_params;
+	struct pmalloc_defrag *defrag;
+	struct pmalloc_free_batch *free_batch;
 
 	/*
 	 * Locks are dynamically allocated on FreeBSD. Keep track so
@@ -208,6 +211,9 @@ struct pmemobjpool {
 #define ARENA_ID_FROM_FLAG(flag)\
 ((uint16_t)((flag) >> 32))
 
+#define ALIGNMENT_FROM_FLAG(flag)\
+((size_t)(((flag) & POBJ_XALLOC_ALIGN_MASK) >> 8))
+
 /*
  * pmemobj_get_uuid_lo -- (internal) evaluates XOR sum of least significant
  * 8 bytes with most significant 8 bytes.
@@ -249,6 +255,8 @@ void obj_init(void);
 void obj_fini(void);
 int obj_read_remote(void *ctx, uintptr_t base, void *dest, void *addr,
 		size_t length);
+int obj_alloc_class_id(PMEMobjpool *pop, size_t size, uint64_t flags,
+		uint16_t *class_id);
 
 /*
  * (debug helper macro) logs notice message if used inside a transaction
@@ -47,8 +47,9 @@ struct pobj_action_internal {
 	/* type of operation (alloc/free vs set) */
 	enum pobj_action_type type;
 
-	/* not used */
-	uint32_t padding;
+	/* allocation class of a reservation, used for statistics */
+	uint8_t class_id;
+	uint8_t padding[3];
 
 	/*
 	 * Action-specific lock that needs to be taken for the duration of
@@ -65,6 +66,9 @@ struct pobj_action_internal {
 			enum memblock_state new_state;
 			struct memory_block m;
 			struct memory_block_reserved *mresv;
+
+			/* NULL if reserved from the arena of the thread */
+			struct arena *arena;
 		};
 
 		/* valid only when type == POBJ_ACTION_TYPE_MEM */
@@ -155,33 +159,13 @@ alloc_prep_block(struct palloc_heap *heap, const struct memory_block *m,
 }
 
 /*
- * palloc_reservation_create -- creates a volatile reservation of a
- *	memory block.
- *
- * The first step in the allocation of a new block is reserving it in
- * the transient heap - which is represented by the bucket abstraction.
- *
- * To provide optimal scaling for multi-threaded applications and reduce
- * fragmentation the appropriate bucket is chosen depending on the
- * current thread context and to which allocation class the requested
- * size falls into.
- *
- * Once the bucket is selected, just enough memory is reserved for the
- * requested size. The underlying block allocation algorithm
- * (best-fit, next-fit, ...) varies depending on the bucket container.
+ * palloc_reservation_class -- (internal) picks the allocation class of the
+ *	reservation and calculates the number of its units the block needs
  */
-static int
-palloc_reservation_create(struct palloc_heap *heap, size_t size,
-	palloc_constr constructor, void *arg,
-	uint64_t extra_field, uint16_t object_flags,
-	uint16_t class_id, uint16_t arena_id,
-	struct pobj_action_internal *out)
+static struct alloc_class *
+palloc_reservation_class(struct palloc_heap *heap, size_t size,
+	uint16_t class_id, uint32_t *size_idx)
 {
-	int err = 0;
-
-	struct memory_block *new_block = &out->m;
-	out->type = POBJ_ACTION_TYPE_HEAP;
-
 	ASSERT(class_id < UINT8_MAX);
 	struct alloc_class *c = class_id == 0 ?
 		heap_get_best_class(heap, size) :
@@ -191,7 +175,7 @@ palloc_reservation_create(struct palloc_heap *heap, size_t size,
 	if (c == NULL) {
 		ERR("no allocation class for size %lu bytes", size);
 		errno = EINVAL;
-		return -1;
+		return NULL;
 	}
 
 	/*
@@ -202,22 +186,34 @@ palloc_reservation_create(struct palloc_heap *heap, size_t size,
 	 * For example, to allocate 500 bytes from a bucket that
 	 * provides 256 byte blocks two memory 'units' are required.
 	 */
-	ssize_t size_idx = alloc_class_calc_size_idx(c, size);
-	if (size_idx < 0) {
+	ssize_t idx = alloc_class_calc_size_idx(c, size);
+	if (idx < 0) {
 		ERR("allocation class not suitable for size %lu bytes",
 			size);
 		errno = EINVAL;
-		return -1;
+		return NULL;
 	}
-	ASSERT(size_idx <= UINT32_MAX);
-	*new_block = MEMORY_BLOCK_NONE;
-	new_block->size_idx = (uint32_t)size_idx;
+	ASSERT(idx <= UINT32_MAX);
+	*size_idx = (uint32_t)idx;
 
-	struct bucket *b = heap_bucket_acquire(heap, c->id, arena_id);
+	return c;
+}
 
-	err = heap_get_bestfit_block(heap, b, new_block);
-	if (err != 0)
-		goto out;
+/*
+ * palloc_reservation_prep -- (internal) prepares the reserved memory block
+ *	and fills in the rest of the action
+ *
+ * The bucket the block was taken from must be locked, or NULL if the block
+ * comes from the thread cache or was claimed without locking the bucket. If
+ * the constructor fails, the block is given back and ECANCELED is returned.
+ */
+static int
+palloc_reservation_prep(struct palloc_heap *heap, struct bucket *b,
+	struct alloc_class *c, palloc_constr constructor, void *arg,
+	uint64_t extra_field, uint16_t object_flags, uint16_t arena_id,
+	struct pobj_action_internal *out)
+{
+	struct memory_block *new_block = &out->m;
 
 	if (alloc_prep_block(heap, new_block, constructor, arg,
 		extra_field, object_flags, out) != 0) {
@@ -225,11 +221,12 @@ palloc_reservation_create(struct palloc_heap *heap, size_t size,
 		 * Constructor returned non-zero value which means
 		 * the memory block reservation has to be rolled back.
 		 */
-		if (new_block->type == MEMORY_BLOCK_HUGE) {
+		if (b == NULL) {
+			heap_thread_cache_put(heap, c, new_block, out->mresv);
+		} else if (new_block->type == MEMORY_BLOCK_HUGE) {
 			bucket_insert_block(b, new_block);
 		}
-		err = ECANCELED;
-		goto out;
+		return ECANCELED;
 	}
 
 	/*
@@ -237,18 +234,91 @@ palloc_reservation_create(struct palloc_heap *heap, size_t size,
 	 * runtime state.
 	 * The memory block cannot be put back into the global state unless
 	 * there are no active reservations.
+	 * Blocks from the thread cache and the claimed ones are already
+	 * accounted for.
 	 */
-	if ((out->mresv = b->active_memory_block) != NULL)
+	if (b != NULL && (out->mresv = b->active_memory_block) != NULL)
 		util_fetch_and_add64(&out->mresv->nresv, 1);
 
 	out->lock = new_block->m_ops->get_lock(new_block);
 	out->new_state = MEMBLOCK_ALLOCATED;
+	out->class_id = c->id;
+	out->arena = heap_get_arena(heap, arena_id);
+
+	return 0;
+}
+
+/*
+ * palloc_reservation_create -- creates a volatile reservation of a
+ *	memory block.
+ *
+ * The first step in the allocation of a new block is reserving it in
+ * the transient heap - which is represented by the bucket abstraction.
+ *
+ * To provide optimal scaling for multi-threaded applications and reduce
+ * fragmentation the appropriate bucket is chosen depending on the
+ * current thread context and to which allocation class the requested
+ * size falls into.
+ *
+ * Once the bucket is selected, just enough memory is reserved for the
+ * requested size. The underlying block allocation algorithm
+ * (best-fit, next-fit, ...) varies depending on the bucket container.
+ */
+static int
+palloc_reservation_create(struct palloc_heap *heap, size_t size,
+	palloc_constr constructor, void *arg,
+	uint64_t extra_field, uint16_t object_flags,
+	uint16_t class_id, uint16_t arena_id,
+	struct pobj_action_internal *out)
+{
+	int err = 0;
+
+	struct memory_block *new_block = &out->m;
+	out->type = POBJ_ACTION_TYPE_HEAP;
+
+	uint32_t size_idx;
+	struct alloc_class *c = palloc_reservation_class(heap, size, class_id,
+		&size_idx);
+	if (c == NULL)
+		return -1;
+
+	*new_block = MEMORY_BLOCK_NONE;
+	new_block->size_idx = size_idx;
+
+	/*
+	 * Small allocations from the thread's own arena are first attempted
+	 * from the thread cache, which already holds reserved blocks and
+	 * doesn't require the bucket lock. Then, if the runs are shared, the
+	 * block is claimed from the active run without locking the bucket.
+	 */
+	struct bucket *b = NULL;
+	if ((arena_id != HEAP_ARENA_PER_THREAD ||
+	    heap_thread_cache_get(heap, c, new_block, &out->mresv) != 0) &&
+	    heap_claim_block(heap, c, arena_id, new_block, &out->mresv) != 0) {
+		b = heap_bucket_acquire(heap, c->id, arena_id);
+
+		err = heap_get_bestfit_block(heap, b, new_block);
+		if (err != 0)
+			goto out;
+	}
+
+	err = palloc_reservation_prep(heap, b, c, constructor, arg,
+		extra_field, object_flags, arena_id, out);
 
 out:
-	heap_bucket_release(heap, b);
+	if (b != NULL)
+		heap_bucket_release(heap, b);
 
-	if (err == 0)
+	if (err == 0) {
+		unsigned nsamplers;
+		util_atomic_load_explicit32(&Heap_nsamplers, &nsamplers,
+			memory_order_relaxed);
+		if (unlikely(nsamplers != 0)) {
+			heap_sample_alloc(heap, size, out->offset, extra_field,
+				c->id, arena_id);
+		}
 		return 0;
+	}
 
 	errno = err;
 	return -1;
@@ -275,6 +345,9 @@ palloc_heap_action_exec(struct palloc_heap *heap,
 	 * value - either modification of few bits in a bitmap or
 	 * changing a chunk type from free to used or vice versa.
 	 */
+	if (act->new_state == MEMBLOCK_FREE)
+		heap_zone_summary_on_free(heap, &act->m);
+
 	act->m.m_ops->prep_hdr(&act->m, act->new_state, ctx);
 }
 
@@ -300,6 +373,9 @@ palloc_restore_free_chunk_state(struct palloc_heap *heap,
 			}
 		}
 		heap_bucket_release(heap, b);
+
+		/* no lock can be held here, the pass takes the bucket lock */
+		heap_punch_hole_auto(heap);
 	}
 }
 
@@ -395,6 +471,8 @@ palloc_heap_action_on_process(struct palloc_heap *heap,
 			STATS_INC(heap->stats, transient, heap_run_allocated,
 				act->m.m_ops->get_real_size(&act->m));
 		}
+		heap_stats_on_alloc(heap, act->class_id, act->arena,
+			act->m.m_ops->get_real_size(&act->m));
 	} else if (act->new_state == MEMBLOCK_FREE) {
 		if (On_memcheck) {
 			void *ptr = act->m.m_ops->get_user_data(&act->m);
@@ -497,7 +575,9 @@ static const struct {
 };
 
 /*
- * palloc_action_compare -- compares two actions based on lock address
+ * palloc_action_compare -- compares two actions based on lock address and,
+ *	for the same lock, on the offset so that updates of the same bitmap
+ *	values end up next to each other and get merged in the redo log
  */
 static int
 palloc_action_compare(const void *lhs, const void *rhs)
@@ -512,6 +592,11 @@ palloc_action_compare(const void *lhs, const void *rhs)
 	if (vlhs > vrhs)
 		return 1;
 
+	if (mlhs->offset < mrhs->offset)
+		return -1;
+	if (mlhs->offset > mrhs->offset)
+		return 1;
+
 	return 0;
 }
 
@@ -599,6 +684,72 @@ palloc_reserve(struct palloc_heap *heap, size_t size,
 		(struct pobj_action_internal *)act);
 }
 
+/*
+ * palloc_reserve_bulk -- creates reservations of multiple blocks of the same
+ *	size, taking the bucket lock only once
+ *
+ * Either all of the reservations are created, or none of them.
+ */
+int
+palloc_reserve_bulk(struct palloc_heap *heap, size_t size,
+	palloc_constr constructor, void *arg,
+	uint64_t extra_field, uint16_t object_flags,
+	uint16_t class_id, uint16_t arena_id,
+	struct pobj_action *actv, size_t actvcnt)
+{
+	COMPILE_ERROR_ON(sizeof(struct pobj_action) !=
+		sizeof(struct pobj_action_internal));
+
+	uint32_t size_idx;
+	struct alloc_class *c = palloc_reservation_class(heap, size, class_id,
+		&size_idx);
+	if (c == NULL)
+		return -1;
+
+	struct pobj_action_internal *acts =
+		(struct pobj_action_internal *)actv;
+	struct bucket *b = heap_bucket_acquire(heap, c->id, arena_id);
+
+	int err = 0;
+	size_t n;
+	for (n = 0; n < actvcnt; ++n) {
+		struct pobj_action_internal *out = &acts[n];
+		out->type = POBJ_ACTION_TYPE_HEAP;
+		out->m = MEMORY_BLOCK_NONE;
+		out->m.size_idx = size_idx;
+
+		err = heap_get_bestfit_block(heap, b, &out->m);
+		if (err != 0)
+			break;
+
+		err = palloc_reservation_prep(heap, b, c, constructor, arg,
+			extra_field, object_flags, arena_id, out);
+		if (err != 0)
+			break;
+	}
+
+	heap_bucket_release(heap, b);
+
+	if (err == 0) {
+		unsigned nsamplers;
+		util_atomic_load_explicit32(&Heap_nsamplers, &nsamplers,
+			memory_order_relaxed);
+		if (unlikely(nsamplers != 0)) {
+			for (n = 0; n < actvcnt; ++n)
+				heap_sample_alloc(heap, size, acts[n].offset,
+					extra_field, c->id, arena_id);
+		}
+
+		return 0;
+	}
+
+	/* the cancellation might need to lock the bucket again */
+	palloc_cancel(heap, actv, n);
+
+	errno = err;
+	return -1;
+}
+
 /*
  * palloc_defer_free -- creates an internal deferred free action
  */
@@ -838,12 +989,13 @@ pobj_actions_add(struct pobj_actions *actv)
 }
 
 /*
- * palloc_defrag -- forces recycling of all available memory, and reallocates
- *	provided objects so that they have the lowest possible address.
+ * palloc_defrag_objects -- (internal) reallocates provided objects, which
+ *	reside in runs with occupancy not exceeding max_fill_pct percent
  */
-int
-palloc_defrag(struct palloc_heap *heap, uint64_t **objv, size_t objcnt,
-	struct operation_context *ctx, struct pobj_defrag_result *result)
+static int
+palloc_defrag_objects(struct palloc_heap *heap, uint64_t **objv,
+	size_t objcnt, struct operation_context *ctx,
+	struct pobj_defrag_result *result, unsigned max_fill_pct)
 {
 	int ret = -1;
 	/*
@@ -893,8 +1045,6 @@ palloc_defrag(struct palloc_heap *heap, uint64_t **objv, size_t objcnt,
 	if (current_object_sequence > longest_object_sequence)
 		longest_object_sequence = current_object_sequence;
 
-	heap_force_recycle(heap);
-
 	/*
 	 * The number of actions at which the action vector will be processed.
 	 */
@@ -1025,12 +1175,7 @@ palloc_defrag(struct palloc_heap *heap, uint64_t **objv, size_t objcnt,
 		unsigned original_fillpct = m.m_ops->fill_pct(&m);
 		os_mutex_unlock(mlock);
 
-		/*
-		 * Empirically, 50% fill rate is the sweetspot for moving
-		 * objects between runs. Other values tend to produce worse
-		 * results.
-		 */
-		if (original_fillpct > 50)
+		if (original_fillpct > max_fill_pct)
 			continue;
 
 		size_t user_size = m.m_ops->get_user_size(&m);
@@ -1148,6 +1293,39 @@ err_ravl:
 	return ret;
 }
 
+/*
+ * palloc_defrag -- forces recycling of all available memory, and reallocates
+ *	provided objects so that they have the lowest possible address.
+ */
+int
+palloc_defrag(struct palloc_heap *heap, uint64_t **objv, size_t objcnt,
+	struct operation_context *ctx, struct pobj_defrag_result *result)
+{
+	heap_force_recycle(heap);
+
+	/*
+	 * Empirically, 50% fill rate is the sweetspot for moving
+	 * objects between runs. Other values tend to produce worse
+	 * results.
+	 */
+	return palloc_defrag_objects(heap, objv, objcnt, ctx, result, 50);
+}
+
+/*
+ * palloc_defrag_relocate -- reallocates provided objects regardless of the
+ *	occupancy of their runs
+ *
+ * Unlike palloc_defrag(), this doesn't detach the runs from the arenas, the
+ * caller is expected to have already picked the objects worth moving.
+ */
+int
+palloc_defrag_relocate(struct palloc_heap *heap, uint64_t **objv,
+	size_t objcnt, struct operation_context *ctx,
+	struct pobj_defrag_result *result)
+{
+	return palloc_defrag_objects(heap, objv, objcnt, ctx, result, 100);
+}
+
 /*
  * palloc_usable_size -- returns the number of bytes in the memory block
  */
@@ -1242,11 +1420,11 @@ palloc_next(struct palloc_heap *heap, uint64_t off)
 int
 palloc_boot(struct palloc_heap *heap, void *heap_start,
 		uint64_t heap_size, uint64_t *sizep,
-		void *base, struct pmem_ops *p_ops, struct stats *stats,
-		struct pool_set *set)
+		void *base, uint64_t run_id, struct pmem_ops *p_ops,
+		struct stats *stats, struct pool_set *set)
 {
 	return heap_boot(heap, heap_start, heap_size, sizep,
-		base, p_ops, stats, set);
+		base, run_id, p_ops, stats, set);
 }
 
 /*
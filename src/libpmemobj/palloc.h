@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2015-2019, Intel Corporation */
+/* Copyright 2015-2020, Intel Corporation */
 
 /*
  * palloc.h -- internal definitions for persistent allocator
@@ -56,6 +56,13 @@ palloc_reserve(struct palloc_heap *heap, size_t size,
 	uint16_t class_id, uint16_t arena_id,
 	struct pobj_action *act);
 
+int
+palloc_reserve_bulk(struct palloc_heap *heap, size_t size,
+	palloc_constr constructor, void *arg,
+	uint64_t extra_field, uint16_t object_flags,
+	uint16_t class_id, uint16_t arena_id,
+	struct pobj_action *actv, size_t actvcnt);
+
 void
 palloc_defer_free(struct palloc_heap *heap, uint64_t off,
 	struct pobj_action *act);
@@ -82,7 +89,7 @@ uint16_t palloc_flags(struct palloc_heap *heap, uint64_t off);
 
 int palloc_boot(struct palloc_heap *heap, void *heap_start,
 		uint64_t heap_size, uint64_t *sizep,
-		void *base, struct pmem_ops *p_ops,
+		void *base, uint64_t run_id, struct pmem_ops *p_ops,
 		struct stats *stats, struct pool_set *set);
 
 int palloc_buckets_init(struct palloc_heap *heap);
@@ -98,6 +105,9 @@ size_t palloc_heap(void *heap_start);
 
 int palloc_defrag(struct palloc_heap *heap, uint64_t **objv, size_t objcnt,
 	struct operation_context *ctx, struct pobj_defrag_result *result);
+int palloc_defrag_relocate(struct palloc_heap *heap, uint64_t **objv,
+	size_t objcnt, struct operation_context *ctx,
+	struct pobj_defrag_result *result);
 
 /* foreach callback, terminates iteration if return value is non-zero */
 typedef int (*object_callback)(const struct memory_block *m, void *arg);
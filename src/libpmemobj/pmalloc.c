@@ -19,9 +19,12 @@
 #include "out.h"
 #include "palloc.h"
 #include "pmalloc.h"
+#include "recycler.h"
 #include "alloc_class.h"
 #include "set.h"
 #include "mmap.h"
+#include "sys_util.h"
+#include "tx.h"
 
 enum pmalloc_operation_type {
 	OPERATION_INTERNAL, /* used only for single, one-off operations */
@@ -42,6 +45,15 @@ static struct operation_context *
 pmalloc_operation_hold_type(PMEMobjpool *pop, enum pmalloc_operation_type type,
 	int start)
 {
+	/*
+	 * The objects modified or allocated by asynchronously committed
+	 * transactions have to be durable before anything which may depend on
+	 * them is made persistent. The internal operations are excluded, as
+	 * they're used by the post-commit workers themselves.
+	 */
+	if (type == OPERATION_EXTERNAL)
+		tx_post_commit_wait(pop);
+
 	struct lane *lane;
 	lane_hold(pop, &lane);
 	struct operation_context *ctx = type == OPERATION_INTERNAL ?
@@ -171,608 +183,2838 @@ pfree(PMEMobjpool *pop, uint64_t *off)
 }
 
 /*
- * pmalloc_boot -- global runtime init routine of allocator section
+ * Background defragmentation service. Every step takes sparsely occupied runs
+ * out of the recyclers, relocates their objects, using the references found
+ * by the application, and gives the runs back to the heap. The runs that were
+ * emptied this way end up as free chunks.
  */
-int
-pmalloc_boot(PMEMobjpool *pop)
+struct pmalloc_defrag {
+	os_mutex_t lock; /* protects the parameters and the state of workers */
+	os_cond_t cond; /* signaled when workers are stopped */
+	os_cond_t stopped; /* signaled when a worker returns */
+
+	unsigned nworkers; /* number of running workers */
+	int stop;
+
+	struct pobj_defrag_callbacks callbacks;
+	unsigned batch; /* objects after which no more runs are picked */
+	unsigned fill_pct; /* max occupancy of a run picked for relocation */
+	unsigned interval; /* ms between steps of a worker with nothing to do */
+
+	os_mutex_t step_lock; /* serializes the steps */
+
+	uint64_t relocated; /* total number of relocated objects */
+	uint64_t reclaimed; /* total number of runs turned into free chunks */
+};
+
+#define PMALLOC_DEFRAG_DEFAULT_BATCH 128
+#define PMALLOC_DEFRAG_DEFAULT_FILL_PCT 50
+#define PMALLOC_DEFRAG_DEFAULT_INTERVAL 1000 /* ms */
+
+/* max number of references to a single object that can be relocated */
+#define PMALLOC_DEFRAG_MAX_REFS 64
+
+/*
+ * pmalloc_defrag_new -- (internal) creates a new defragmentation service
+ */
+static struct pmalloc_defrag *
+pmalloc_defrag_new(void)
 {
-	int ret = palloc_boot(&pop->heap, (char *)pop + pop->heap_offset,
-			pop->set->poolsize - pop->heap_offset, &pop->heap_size,
-			pop, &pop->p_ops,
-			pop->stats, pop->set);
-	if (ret)
-		return ret;
+	struct pmalloc_defrag *d = Zalloc(sizeof(*d));
+	if (d == NULL)
+		return NULL;
 
-#if VG_MEMCHECK_ENABLED
-	if (On_memcheck)
-		palloc_heap_vg_open(&pop->heap, pop->vg_boot);
-#endif
+	util_mutex_init(&d->lock);
+	util_cond_init(&d->cond);
+	util_cond_init(&d->stopped);
+	util_mutex_init(&d->step_lock);
 
-	ret = palloc_buckets_init(&pop->heap);
-	if (ret)
-		palloc_heap_cleanup(&pop->heap);
+	d->batch = PMALLOC_DEFRAG_DEFAULT_BATCH;
+	d->fill_pct = PMALLOC_DEFRAG_DEFAULT_FILL_PCT;
+	d->interval = PMALLOC_DEFRAG_DEFAULT_INTERVAL;
 
-	return ret;
+	return d;
 }
 
 /*
- * pmalloc_cleanup -- global cleanup routine of allocator section
+ * pmalloc_defrag_delete -- (internal) deletes the defragmentation service
  */
-int
-pmalloc_cleanup(PMEMobjpool *pop)
+static void
+pmalloc_defrag_delete(struct pmalloc_defrag *d)
 {
-	palloc_heap_cleanup(&pop->heap);
+	ASSERTeq(d->nworkers, 0);
 
-	return 0;
+	util_mutex_destroy(&d->step_lock);
+	util_cond_destroy(&d->stopped);
+	util_cond_destroy(&d->cond);
+	util_mutex_destroy(&d->lock);
+	Free(d);
 }
 
+VEC(pmalloc_defrag_runs, struct memory_block);
+
 /*
- * CTL_WRITE_HANDLER(desc) -- creates a new allocation class
+ * State of a single defragmentation step.
+ */
+struct pmalloc_defrag_batch {
+	PMEMobjpool *pop;
+	struct pobj_defrag_callbacks callbacks;
+
+	struct pmalloc_defrag_runs runs;
+	VEC(, uint64_t *) objv; /* offsets of the references */
+
+	int err;
+};
+
+/*
+ * pmalloc_defrag_collect -- (internal) finds the references to the object
+ *	and adds them to the batch
  */
 static int
-CTL_WRITE_HANDLER(desc)(void *ctx,
-	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+pmalloc_defrag_collect(const struct memory_block *m, void *arg)
 {
-	PMEMobjpool *pop = ctx;
-	uint8_t id;
-	struct alloc_class_collection *ac = heap_alloc_classes(&pop->heap);
-	struct pobj_alloc_class_desc *p = arg;
-
-	if (p->unit_size <= 0 || p->unit_size > PMEMOBJ_MAX_ALLOC_SIZE ||
-		p->units_per_block <= 0) {
-		errno = EINVAL;
-		return -1;
+	struct pmalloc_defrag_batch *b = arg;
+	PMEMobjpool *pop = b->pop;
+
+	/* the application doesn't know about the internal objects */
+	if (m->m_ops->get_flags(m) & OBJ_INTERNAL_OBJECT_MASK)
+		return 0;
+
+	PMEMoid oid;
+	oid.pool_uuid_lo = pop->uuid_lo;
+	oid.off = HEAP_PTR_TO_OFF(&pop->heap, m->m_ops->get_user_data(m));
+
+	PMEMoid *refs[PMALLOC_DEFRAG_MAX_REFS];
+	int nrefs = b->callbacks.refs(pop, oid, refs, PMALLOC_DEFRAG_MAX_REFS,
+		b->callbacks.arg);
+	if (nrefs <= 0 || nrefs > PMALLOC_DEFRAG_MAX_REFS)
+		return 0;
+
+	for (int i = 0; i < nrefs; ++i) {
+		if (refs[i]->pool_uuid_lo != oid.pool_uuid_lo ||
+		    refs[i]->off != oid.off) {
+			LOG(2, "invalid reference to object at offset %"
+				PRIu64, oid.off);
+			return 0;
+		}
 	}
 
-	if (p->alignment != 0 && p->unit_size % p->alignment != 0) {
-		ERR("unit size must be evenly divisible by alignment");
-		errno = EINVAL;
-		return -1;
+	for (int i = 0; i < nrefs; ++i) {
+		if (VEC_PUSH_BACK(&b->objv, &refs[i]->off) != 0) {
+			b->err = errno;
+			return 1;
+		}
 	}
 
-	if (p->alignment > (MEGABYTE * 2)) {
-		ERR("alignment cannot be larger than 2 megabytes");
+	return 0;
+}
+
+/*
+ * pmalloc_defrag_step -- (internal) performs a single batch of the
+ *	defragmentation
+ *
+ * Returns 0 on success, the result is set to the number of objects found
+ * in the picked runs and the number of those that were relocated.
+ */
+static int
+pmalloc_defrag_step(PMEMobjpool *pop, struct pobj_defrag_result *result)
+{
+	struct pmalloc_defrag *d = pop->defrag;
+
+	result->total = 0;
+	result->relocated = 0;
+
+	struct pmalloc_defrag_batch b;
+	b.pop = pop;
+	b.err = 0;
+	VEC_INIT(&b.runs);
+	VEC_INIT(&b.objv);
+
+	util_mutex_lock(&d->lock);
+	b.callbacks = d->callbacks;
+	unsigned batch = d->batch;
+	unsigned fill_pct = d->fill_pct;
+	util_mutex_unlock(&d->lock);
+
+	if (b.callbacks.refs == NULL) {
+		ERR("defragmentation callbacks are not set");
 		errno = EINVAL;
 		return -1;
 	}
 
-	enum header_type lib_htype = MAX_HEADER_TYPES;
-	switch (p->header_type) {
-		case POBJ_HEADER_LEGACY:
-			lib_htype = HEADER_LEGACY;
-			break;
-		case POBJ_HEADER_COMPACT:
-			lib_htype = HEADER_COMPACT;
-			break;
-		case POBJ_HEADER_NONE:
-			lib_htype = HEADER_NONE;
-			break;
-		case MAX_POBJ_HEADER_TYPES:
-		default:
-			ERR("invalid header type");
-			errno = EINVAL;
-			return -1;
-	}
+	int ret = 0;
 
-	if (PMDK_SLIST_EMPTY(indexes)) {
-		if (alloc_class_find_first_free_slot(ac, &id) != 0) {
-			ERR("no available free allocation class identifier");
-			errno = EINVAL;
-			return -1;
-		}
-	} else {
-		struct ctl_index *idx = PMDK_SLIST_FIRST(indexes);
-		ASSERTeq(strcmp(idx->name, "class_id"), 0);
+	util_mutex_lock(&d->step_lock);
 
-		if (idx->value < 0 || idx->value >= MAX_ALLOCATION_CLASSES) {
-			ERR("class id outside of the allowed range");
-			errno = ERANGE;
-			return -1;
+	/*
+	 * The runs are picked before the application is asked to stop
+	 * accessing the objects, this doesn't require any cooperation because
+	 * runs taken out of the recyclers cannot be allocated from.
+	 */
+	struct memory_block m = MEMORY_BLOCK_NONE;
+	size_t nunits = 0; /* upper bound of the number of objects */
+	while (nunits < batch &&
+	    heap_get_sparse_run(&pop->heap, fill_pct, &m) == 0) {
+		if (VEC_PUSH_BACK(&b.runs, m) != 0) {
+			heap_discard_run(&pop->heap, &m);
+			break;
 		}
 
-		id = (uint8_t)idx->value;
+		struct run_bitmap bitmap;
+		m.m_ops->get_bitmap(&m, &bitmap);
+		struct recycler_element e =
+			recycler_element_new(&pop->heap, &m);
+		nunits += bitmap.nbits - e.free_space;
 
-		if (alloc_class_reserve(ac, id) != 0) {
-			ERR("attempted to overwrite an allocation class");
-			errno = EEXIST;
-			return -1;
-		}
+		m = MEMORY_BLOCK_NONE;
 	}
 
-	size_t runsize_bytes =
-		CHUNK_ALIGN_UP((p->units_per_block * p->unit_size) +
-		RUN_BASE_METADATA_SIZE);
+	if (VEC_SIZE(&b.runs) == 0)
+		goto out;
 
-	/* aligning the buffer might require up-to to 'alignment' bytes */
-	if (p->alignment != 0)
-		runsize_bytes += p->alignment;
+	if (b.callbacks.lock)
+		b.callbacks.lock(pop, b.callbacks.arg);
 
-	uint32_t size_idx = (uint32_t)(runsize_bytes / CHUNKSIZE);
-	if (size_idx > UINT16_MAX)
-		size_idx = UINT16_MAX;
+	struct memory_block *run;
+	VEC_FOREACH_BY_PTR(run, &b.runs) {
+		if (run->m_ops->iterate_used(run, pmalloc_defrag_collect,
+		    &b) != 0)
+			break;
+	}
 
-	struct alloc_class *c = alloc_class_new(id,
-		heap_alloc_classes(&pop->heap), CLASS_RUN,
-		lib_htype, p->unit_size, p->alignment, size_idx);
-	if (c == NULL) {
-		errno = EINVAL;
-		return -1;
+	if (b.err == 0 && VEC_SIZE(&b.objv) != 0) {
+		struct operation_context *ctx = pmalloc_operation_hold(pop);
+
+		if (palloc_defrag_relocate(&pop->heap, VEC_ARR(&b.objv),
+		    VEC_SIZE(&b.objv), ctx, result) != 0)
+			b.err = errno;
+
+		pmalloc_operation_release(pop);
 	}
 
-	if (heap_create_alloc_class_buckets(&pop->heap, c) != 0) {
-		alloc_class_delete(ac, c);
-		return -1;
+	if (b.callbacks.unlock)
+		b.callbacks.unlock(pop, b.callbacks.arg);
+
+	uint64_t reclaimed = 0;
+	VEC_FOREACH_BY_PTR(run, &b.runs) {
+		reclaimed += (uint64_t)heap_discard_run(&pop->heap, run);
 	}
 
-	p->class_id = c->id;
-	p->units_per_block = c->rdsc.nallocs;
+	util_fetch_and_add64(&d->relocated, result->relocated);
+	util_fetch_and_add64(&d->reclaimed, reclaimed);
 
-	return 0;
+	if (b.err != 0) {
+		errno = b.err;
+		ret = -1;
+	}
+
+out:
+	util_mutex_unlock(&d->step_lock);
+
+	VEC_DELETE(&b.objv);
+	VEC_DELETE(&b.runs);
+
+	return ret;
 }
 
 /*
- * pmalloc_header_type_parser -- parses the alloc header type argument
+ * pmalloc_defrag_worker -- (internal) performs the defragmentation until the
+ *	workers are stopped, waits for the interval whenever a step doesn't
+ *	relocate anything
  */
-static int
-pmalloc_header_type_parser(const void *arg, void *dest, size_t dest_size)
+static void
+pmalloc_defrag_worker(PMEMobjpool *pop)
 {
-	const char *vstr = arg;
-	enum pobj_header_type *htype = dest;
-	ASSERTeq(dest_size, sizeof(enum pobj_header_type));
+	struct pmalloc_defrag *d = pop->defrag;
 
-	if (strcmp(vstr, "none") == 0) {
-		*htype = POBJ_HEADER_NONE;
-	} else if (strcmp(vstr, "compact") == 0) {
-		*htype = POBJ_HEADER_COMPACT;
-	} else if (strcmp(vstr, "legacy") == 0) {
-		*htype = POBJ_HEADER_LEGACY;
-	} else {
-		ERR("invalid header type");
-		errno = EINVAL;
-		return -1;
+	util_mutex_lock(&d->lock);
+	d->nworkers++;
+
+	while (!d->stop) {
+		struct pobj_defrag_result result = {0, 0};
+
+		if (d->callbacks.refs != NULL) {
+			util_mutex_unlock(&d->lock);
+			(void) pmalloc_defrag_step(pop, &result);
+			util_mutex_lock(&d->lock);
+		}
+
+		if (d->stop || result.relocated != 0)
+			continue;
+
+		struct timespec deadline;
+		os_clock_gettime(CLOCK_REALTIME, &deadline);
+		uint64_t nsec = (uint64_t)deadline.tv_nsec +
+			(uint64_t)d->interval * 1000000;
+		deadline.tv_sec += (time_t)(nsec / 1000000000);
+		deadline.tv_nsec = (long)(nsec % 1000000000);
+
+		(void) os_cond_timedwait(&d->cond, &d->lock, &deadline);
 	}
 
-	return 0;
+	d->nworkers--;
+	os_cond_broadcast(&d->stopped);
+
+	util_mutex_unlock(&d->lock);
 }
 
 /*
- * CTL_READ_HANDLER(desc) -- reads the information about allocation class
+ * pmalloc_defrag_stop -- stops all defragmentation workers, returns once all
+ *	of them have finished their current step
  */
-static int
-CTL_READ_HANDLER(desc)(void *ctx,
-	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+void
+pmalloc_defrag_stop(PMEMobjpool *pop)
 {
-	PMEMobjpool *pop = ctx;
-	uint8_t id;
+	struct pmalloc_defrag *d = pop->defrag;
 
-	struct ctl_index *idx = PMDK_SLIST_FIRST(indexes);
-	ASSERTeq(strcmp(idx->name, "class_id"), 0);
+	util_mutex_lock(&d->lock);
 
-	if (idx->value < 0 || idx->value >= MAX_ALLOCATION_CLASSES) {
-		ERR("class id outside of the allowed range");
-		errno = ERANGE;
-		return -1;
-	}
+	d->stop = 1;
+	os_cond_broadcast(&d->cond);
 
-	id = (uint8_t)idx->value;
+	while (d->nworkers != 0)
+		os_cond_wait(&d->stopped, &d->lock);
 
-	struct alloc_class *c = alloc_class_by_id(
-		heap_alloc_classes(&pop->heap), id);
+	d->stop = 0;
 
-	if (c == NULL) {
-		ERR("class with the given id does not exist");
-		errno = ENOENT;
-		return -1;
-	}
+	util_mutex_unlock(&d->lock);
+}
 
-	enum pobj_header_type user_htype = MAX_POBJ_HEADER_TYPES;
-	switch (c->header_type) {
-		case HEADER_LEGACY:
-			user_htype = POBJ_HEADER_LEGACY;
-			break;
-		case HEADER_COMPACT:
-			user_htype = POBJ_HEADER_COMPACT;
-			break;
-		case HEADER_NONE:
-			user_htype = POBJ_HEADER_NONE;
-			break;
-		default:
-			ASSERT(0); /* unreachable */
-			break;
-	}
+/*
+ * pmalloc_extender_stop -- stops the background extension of the heap
+ */
+void
+pmalloc_extender_stop(PMEMobjpool *pop)
+{
+	heap_extender_stop(&pop->heap);
+}
 
-	struct pobj_alloc_class_desc *p = arg;
-	p->units_per_block = c->type == CLASS_HUGE ? 0 : c->rdsc.nallocs;
-	p->header_type = user_htype;
-	p->unit_size = c->unit_size;
-	p->class_id = c->id;
-	p->alignment = c->flags & CHUNK_FLAG_ALIGNED ? c->rdsc.alignment : 0;
+/*
+ * Deferred free batching. When enabled, objects freed through handles that
+ * don't reside in the pool are not freed right away, but queued as deferred
+ * free actions of the calling thread. The entire queue is published at once,
+ * with a single redo log and with every run lock taken only once, when it
+ * reaches its capacity, when its oldest entry gets older than the interval or
+ * when a flush is requested. Frees that weren't published before a crash are
+ * lost, which leaves the objects allocated but the heap consistent.
+ */
+VEC(pmalloc_free_actv, struct pobj_action);
 
-	return 0;
-}
+struct pmalloc_free_queue {
+	struct pmalloc_free_batch *fb;
 
-static const struct ctl_argument CTL_ARG(desc) = {
-	.dest_size = sizeof(struct pobj_alloc_class_desc),
-	.parsers = {
-		CTL_ARG_PARSER_STRUCT(struct pobj_alloc_class_desc,
-			unit_size, ctl_arg_integer),
-		CTL_ARG_PARSER_STRUCT(struct pobj_alloc_class_desc,
-			alignment, ctl_arg_integer),
-		CTL_ARG_PARSER_STRUCT(struct pobj_alloc_class_desc,
-			units_per_block, ctl_arg_integer),
-		CTL_ARG_PARSER_STRUCT(struct pobj_alloc_class_desc,
-			header_type, pmalloc_header_type_parser),
-		CTL_ARG_PARSER_END
-	}
+	/* protects the queue against flushes done by other threads */
+	os_mutex_t lock;
+	struct pmalloc_free_actv actv;
+	uint64_t oldest; /* time, in ms, at which the first free was queued */
 };
 
-static const struct ctl_node CTL_NODE(class_id)[] = {
-	CTL_LEAF_RW(desc),
+struct pmalloc_free_batch {
+	PMEMobjpool *pop;
 
-	CTL_NODE_END
-};
+	/* protects the vector of queues and the orphaned frees */
+	os_mutex_t lock;
+	VEC(, struct pmalloc_free_queue *) queues;
 
-static const struct ctl_node CTL_NODE(new)[] = {
-	CTL_LEAF_WO(desc),
+	/* frees queued by the threads that already exited */
+	struct pmalloc_free_actv orphans;
 
-	CTL_NODE_END
-};
+	/* stores a pointer to the queue of the current thread */
+	os_tls_key_t thread;
 
-static const struct ctl_node CTL_NODE(alloc_class)[] = {
-	CTL_INDEXED(class_id),
-	CTL_INDEXED(new),
+	int enabled;
+	unsigned capacity; /* max number of frees queued by a thread */
+	unsigned interval; /* max time, in ms, a free can be queued, 0 - none */
 
-	CTL_NODE_END
+	uint64_t nbatches; /* number of published batches */
+	uint64_t nfreed; /* number of objects freed in batches */
 };
 
+#define PMALLOC_FREE_BATCH_DEFAULT_CAPACITY 64
+#define PMALLOC_FREE_BATCH_DEFAULT_INTERVAL 100 /* ms */
+
 /*
- * CTL_RUNNABLE_HANDLER(extend) -- extends the pool by the given size
+ * pmalloc_free_batch_now -- (internal) returns the current time in
+ *	milliseconds
  */
-static int
-CTL_RUNNABLE_HANDLER(extend)(void *ctx,
-	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+static uint64_t
+pmalloc_free_batch_now(void)
 {
-	PMEMobjpool *pop = ctx;
+	struct timespec ts;
+	os_clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	ssize_t arg_in = *(ssize_t *)arg;
-	if (arg_in < (ssize_t)PMEMOBJ_MIN_PART) {
-		ERR("incorrect size for extend, must be larger than %" PRIu64,
-			PMEMOBJ_MIN_PART);
-		return -1;
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/*
+ * pmalloc_free_actv_append -- (internal) appends all of the actions from src
+ *	to dst, either all or none of them
+ */
+static int
+pmalloc_free_actv_append(struct pmalloc_free_actv *dst,
+	struct pmalloc_free_actv *src)
+{
+	size_t n = VEC_SIZE(dst) + VEC_SIZE(src);
+	if (VEC_CAPACITY(dst) < n && VEC_RESERVE(dst, n) != 0)
+		return -1;
+
+	struct pobj_action *act;
+	VEC_FOREACH_BY_PTR(act, src) {
+		/* the capacity was reserved above, this cannot fail */
+		int ret = VEC_PUSH_BACK(dst, *act);
+		ASSERTeq(ret, 0);
+	}
+
+	return 0;
+}
+
+/*
+ * pmalloc_free_queue_delete -- (internal) deletes an empty queue
+ */
+static void
+pmalloc_free_queue_delete(struct pmalloc_free_queue *q)
+{
+	ASSERTeq(VEC_SIZE(&q->actv), 0);
+
+	VEC_DELETE(&q->actv);
+	util_mutex_destroy(&q->lock);
+	Free(q);
+}
+
+/*
+ * pmalloc_free_queue_destructor -- (internal) hands over the frees queued by
+ *	an exiting thread to the next flush
+ *
+ * The queue cannot be published here because the lane of the thread might
+ * have been already released.
+ */
+static void
+pmalloc_free_queue_destructor(void *arg)
+{
+	struct pmalloc_free_queue *q = arg;
+	struct pmalloc_free_batch *fb = q->fb;
+
+	util_mutex_lock(&fb->lock);
+
+	struct pmalloc_free_queue **qp;
+	VEC_FOREACH_BY_PTR(qp, &fb->queues) {
+		if (*qp == q) {
+			VEC_ERASE_BY_PTR(&fb->queues, qp);
+			break;
+		}
+	}
+
+	util_mutex_lock(&q->lock);
+
+	/* the objects stay allocated, the heap remains consistent */
+	if (pmalloc_free_actv_append(&fb->orphans, &q->actv) != 0)
+		ERR("!lost %zu deferred frees of an exiting thread",
+			VEC_SIZE(&q->actv));
+	VEC_CLEAR(&q->actv);
+
+	util_mutex_unlock(&q->lock);
+	util_mutex_unlock(&fb->lock);
+
+	pmalloc_free_queue_delete(q);
+}
+
+/*
+ * pmalloc_free_queue -- (internal) returns the queue of the current thread,
+ *	creating it if needed
+ */
+static struct pmalloc_free_queue *
+pmalloc_free_queue(struct pmalloc_free_batch *fb)
+{
+	struct pmalloc_free_queue *q = os_tls_get(fb->thread);
+	if (q != NULL)
+		return q;
+
+	q = Zalloc(sizeof(*q));
+	if (q == NULL) {
+		ERR("!free batch queue malloc error");
+		return NULL;
+	}
+	q->fb = fb;
+	util_mutex_init(&q->lock);
+	VEC_INIT(&q->actv);
+
+	util_mutex_lock(&fb->lock);
+	int ret = VEC_PUSH_BACK(&fb->queues, q);
+	util_mutex_unlock(&fb->lock);
+
+	if (ret != 0) {
+		pmalloc_free_queue_delete(q);
+		return NULL;
+	}
+
+	os_tls_set(fb->thread, q);
+
+	return q;
+}
+
+/*
+ * pmalloc_free_batch_publish -- (internal) frees all objects from the vector
+ *	of deferred free actions in a single operation
+ */
+static int
+pmalloc_free_batch_publish(struct pmalloc_free_batch *fb,
+	struct pmalloc_free_actv *actv)
+{
+	size_t n = VEC_SIZE(actv);
+	if (n == 0)
+		return 0;
+
+	PMEMobjpool *pop = fb->pop;
+	struct operation_context *ctx = pmalloc_operation_hold(pop);
+
+	if (operation_reserve(ctx, n * sizeof(struct ulog_entry_val)) != 0) {
+		operation_cancel(ctx);
+		pmalloc_operation_release(pop);
+		return -1;
+	}
+
+	palloc_publish(&pop->heap, VEC_ARR(actv), n, ctx);
+
+	pmalloc_operation_release(pop);
+
+	VEC_CLEAR(actv);
+
+	util_fetch_and_add64(&fb->nbatches, 1);
+	util_fetch_and_add64(&fb->nfreed, n);
+
+	return 0;
+}
+
+/*
+ * pmalloc_free_queue_flush -- (internal) publishes the frees taken out of
+ *	the queue and the ones left behind by the exited threads
+ *
+ * Must be called without the lock of the queue held, the lock of the batching
+ * state is always taken before the one of a queue. The frees that couldn't be
+ * published are put back into the queue until the next attempt.
+ */
+static int
+pmalloc_free_queue_flush(struct pmalloc_free_batch *fb,
+	struct pmalloc_free_queue *q, struct pmalloc_free_actv *batch)
+{
+	util_mutex_lock(&fb->lock);
+	/* the orphans that don't fit are left for the next flush */
+	if (pmalloc_free_actv_append(batch, &fb->orphans) == 0)
+		VEC_CLEAR(&fb->orphans);
+	util_mutex_unlock(&fb->lock);
+
+	int ret = pmalloc_free_batch_publish(fb, batch);
+
+	util_mutex_lock(&q->lock);
+	if (VEC_SIZE(&q->actv) == 0) {
+		/* the buffer of the batch is reused by the queue */
+		struct pmalloc_free_actv tmp = q->actv;
+		q->actv = *batch;
+		*batch = tmp;
+	} else if (pmalloc_free_actv_append(&q->actv, batch) != 0) {
+		ERR("!lost %zu deferred frees", VEC_SIZE(batch));
+	}
+	util_mutex_unlock(&q->lock);
+
+	VEC_DELETE(batch);
+
+	return ret;
+}
+
+/*
+ * pmalloc_free_batch_enqueue -- queues a free of the object if the batching
+ *	is enabled, publishing the queue of the calling thread once it's full
+ *	or old enough
+ *
+ * Returns non-zero if the object has to be freed by the caller.
+ */
+int
+pmalloc_free_batch_enqueue(PMEMobjpool *pop, uint64_t off)
+{
+	struct pmalloc_free_batch *fb = pop->free_batch;
+
+	int enabled;
+	util_atomic_load_explicit32(&fb->enabled, &enabled,
+		memory_order_relaxed);
+	if (!enabled)
+		return -1;
+
+	struct pmalloc_free_queue *q = pmalloc_free_queue(fb);
+	if (q == NULL)
+		return -1;
+
+	struct pobj_action act;
+	palloc_defer_free(&pop->heap, off, &act);
+
+	util_mutex_lock(&q->lock);
+
+	if (VEC_PUSH_BACK(&q->actv, act) != 0) {
+		util_mutex_unlock(&q->lock);
+		return -1;
+	}
+
+	unsigned capacity;
+	unsigned interval;
+	util_atomic_load_explicit32(&fb->capacity, &capacity,
+		memory_order_relaxed);
+	util_atomic_load_explicit32(&fb->interval, &interval,
+		memory_order_relaxed);
+
+	uint64_t now = pmalloc_free_batch_now();
+	if (VEC_SIZE(&q->actv) == 1)
+		q->oldest = now;
+
+	if (VEC_SIZE(&q->actv) < capacity &&
+	    (interval == 0 || now - q->oldest < interval)) {
+		util_mutex_unlock(&q->lock);
+		return 0;
+	}
+
+	/* the queue is published without its lock, see the lock order */
+	struct pmalloc_free_actv batch = q->actv;
+	VEC_INIT(&q->actv);
+
+	util_mutex_unlock(&q->lock);
+
+	if (pmalloc_free_queue_flush(fb, q, &batch) != 0)
+		LOG(2, "unable to publish deferred frees");
+
+	return 0;
+}
+
+/*
+ * pmalloc_free_batch_flush -- publishes the deferred frees of all threads
+ */
+int
+pmalloc_free_batch_flush(PMEMobjpool *pop)
+{
+	struct pmalloc_free_batch *fb = pop->free_batch;
+	int ret = 0;
+
+	util_mutex_lock(&fb->lock);
+
+	struct pmalloc_free_queue **qp;
+	VEC_FOREACH_BY_PTR(qp, &fb->queues) {
+		util_mutex_lock(&(*qp)->lock);
+		if (pmalloc_free_batch_publish(fb, &(*qp)->actv) != 0)
+			ret = -1;
+		util_mutex_unlock(&(*qp)->lock);
+	}
+
+	if (pmalloc_free_batch_publish(fb, &fb->orphans) != 0)
+		ret = -1;
+
+	util_mutex_unlock(&fb->lock);
+
+	return ret;
+}
+
+/*
+ * pmalloc_free_batch_new -- (internal) creates a new, disabled, free batching
+ *	state of the pool
+ */
+static struct pmalloc_free_batch *
+pmalloc_free_batch_new(PMEMobjpool *pop)
+{
+	struct pmalloc_free_batch *fb = Zalloc(sizeof(*fb));
+	if (fb == NULL)
+		return NULL;
+
+	int ret = os_tls_key_create(&fb->thread,
+		pmalloc_free_queue_destructor);
+	if (ret != 0) {
+		errno = ret;
+		ERR("!os_tls_key_create");
+		Free(fb);
+		return NULL;
+	}
+
+	fb->pop = pop;
+	util_mutex_init(&fb->lock);
+	VEC_INIT(&fb->queues);
+	VEC_INIT(&fb->orphans);
+
+	fb->capacity = PMALLOC_FREE_BATCH_DEFAULT_CAPACITY;
+	fb->interval = PMALLOC_FREE_BATCH_DEFAULT_INTERVAL;
+
+	return fb;
+}
+
+/*
+ * pmalloc_free_batch_delete -- (internal) deletes the free batching state,
+ *	any frees that are still queued are dropped
+ */
+static void
+pmalloc_free_batch_delete(struct pmalloc_free_batch *fb)
+{
+	os_tls_key_delete(fb->thread);
+
+	struct pmalloc_free_queue **qp;
+	VEC_FOREACH_BY_PTR(qp, &fb->queues) {
+		VEC_CLEAR(&(*qp)->actv);
+		pmalloc_free_queue_delete(*qp);
+	}
+	VEC_DELETE(&fb->queues);
+	VEC_DELETE(&fb->orphans);
+
+	util_mutex_destroy(&fb->lock);
+	Free(fb);
+}
+
+/*
+ * pmalloc_boot -- global runtime init routine of allocator section
+ */
+int
+pmalloc_boot(PMEMobjpool *pop)
+{
+	int ret = palloc_boot(&pop->heap, (char *)pop + pop->heap_offset,
+			pop->set->poolsize - pop->heap_offset, &pop->heap_size,
+			pop, pop->run_id, &pop->p_ops,
+			pop->stats, pop->set);
+	if (ret)
+		return ret;
+
+#if VG_MEMCHECK_ENABLED
+	if (On_memcheck)
+		palloc_heap_vg_open(&pop->heap, pop->vg_boot);
+#endif
+
+	ret = palloc_buckets_init(&pop->heap);
+	if (ret) {
+		palloc_heap_cleanup(&pop->heap);
+		return ret;
+	}
+
+	pop->defrag = pmalloc_defrag_new();
+	if (pop->defrag == NULL) {
+		palloc_heap_cleanup(&pop->heap);
+		return ENOMEM;
+	}
+
+	pop->free_batch = pmalloc_free_batch_new(pop);
+	if (pop->free_batch == NULL) {
+		pmalloc_defrag_delete(pop->defrag);
+		palloc_heap_cleanup(&pop->heap);
+		return ENOMEM;
+	}
+
+	unsigned nthreads;
+	util_atomic_load_explicit32(&Heap_boot_nthreads, &nthreads,
+		memory_order_acquire);
+	heap_boot_zones(&pop->heap, nthreads);
+
+	return 0;
+}
+
+/*
+ * pmalloc_cleanup -- global cleanup routine of allocator section
+ */
+int
+pmalloc_cleanup(PMEMobjpool *pop)
+{
+	pmalloc_free_batch_delete(pop->free_batch);
+	pmalloc_defrag_delete(pop->defrag);
+	palloc_heap_cleanup(&pop->heap);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(desc) -- creates a new allocation class
+ */
+static int
+CTL_WRITE_HANDLER(desc)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	uint8_t id;
+	struct alloc_class_collection *ac = heap_alloc_classes(&pop->heap);
+	struct pobj_alloc_class_desc *p = arg;
+
+	if (p->unit_size <= 0 || p->unit_size > PMEMOBJ_MAX_ALLOC_SIZE ||
+		p->units_per_block <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (p->alignment != 0 && p->unit_size % p->alignment != 0) {
+		ERR("unit size must be evenly divisible by alignment");
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (p->alignment > (MEGABYTE * 2)) {
+		ERR("alignment cannot be larger than 2 megabytes");
+		errno = EINVAL;
+		return -1;
+	}
+
+	enum header_type lib_htype = MAX_HEADER_TYPES;
+	switch (p->header_type) {
+		case POBJ_HEADER_LEGACY:
+			lib_htype = HEADER_LEGACY;
+			break;
+		case POBJ_HEADER_COMPACT:
+			lib_htype = HEADER_COMPACT;
+			break;
+		case POBJ_HEADER_NONE:
+			lib_htype = HEADER_NONE;
+			break;
+		case MAX_POBJ_HEADER_TYPES:
+		default:
+			ERR("invalid header type");
+			errno = EINVAL;
+			return -1;
+	}
+
+	if (PMDK_SLIST_EMPTY(indexes)) {
+		if (alloc_class_find_first_free_slot(ac, &id) != 0) {
+			ERR("no available free allocation class identifier");
+			errno = EINVAL;
+			return -1;
+		}
+	} else {
+		struct ctl_index *idx = PMDK_SLIST_FIRST(indexes);
+		ASSERTeq(strcmp(idx->name, "class_id"), 0);
+
+		if (idx->value < 0 || idx->value >= MAX_ALLOCATION_CLASSES) {
+			ERR("class id outside of the allowed range");
+			errno = ERANGE;
+			return -1;
+		}
+
+		id = (uint8_t)idx->value;
+
+		if (alloc_class_reserve(ac, id) != 0) {
+			ERR("attempted to overwrite an allocation class");
+			errno = EEXIST;
+			return -1;
+		}
+	}
+
+	size_t runsize_bytes =
+		CHUNK_ALIGN_UP((p->units_per_block * p->unit_size) +
+		RUN_BASE_METADATA_SIZE);
+
+	/* aligning the buffer might require up-to to 'alignment' bytes */
+	if (p->alignment != 0)
+		runsize_bytes += p->alignment;
+
+	uint32_t size_idx = (uint32_t)(runsize_bytes / CHUNKSIZE);
+	if (size_idx > UINT16_MAX)
+		size_idx = UINT16_MAX;
+
+	struct alloc_class *c = alloc_class_new(id,
+		heap_alloc_classes(&pop->heap), CLASS_RUN,
+		lib_htype, p->unit_size, p->alignment, size_idx);
+	if (c == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (heap_create_alloc_class_buckets(&pop->heap, c) != 0) {
+		alloc_class_delete(ac, c);
+		return -1;
+	}
+
+	p->class_id = c->id;
+	p->units_per_block = c->rdsc.nallocs;
+
+	return 0;
+}
+
+/*
+ * pmalloc_header_type_parser -- parses the alloc header type argument
+ */
+static int
+pmalloc_header_type_parser(const void *arg, void *dest, size_t dest_size)
+{
+	const char *vstr = arg;
+	enum pobj_header_type *htype = dest;
+	ASSERTeq(dest_size, sizeof(enum pobj_header_type));
+
+	if (strcmp(vstr, "none") == 0) {
+		*htype = POBJ_HEADER_NONE;
+	} else if (strcmp(vstr, "compact") == 0) {
+		*htype = POBJ_HEADER_COMPACT;
+	} else if (strcmp(vstr, "legacy") == 0) {
+		*htype = POBJ_HEADER_LEGACY;
+	} else {
+		ERR("invalid header type");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(desc) -- reads the information about allocation class
+ */
+static int
+CTL_READ_HANDLER(desc)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	uint8_t id;
+
+	struct ctl_index *idx = PMDK_SLIST_FIRST(indexes);
+	ASSERTeq(strcmp(idx->name, "class_id"), 0);
+
+	if (idx->value < 0 || idx->value >= MAX_ALLOCATION_CLASSES) {
+		ERR("class id outside of the allowed range");
+		errno = ERANGE;
+		return -1;
+	}
+
+	id = (uint8_t)idx->value;
+
+	struct alloc_class *c = alloc_class_by_id(
+		heap_alloc_classes(&pop->heap), id);
+
+	if (c == NULL) {
+		ERR("class with the given id does not exist");
+		errno = ENOENT;
+		return -1;
+	}
+
+	enum pobj_header_type user_htype = MAX_POBJ_HEADER_TYPES;
+	switch (c->header_type) {
+		case HEADER_LEGACY:
+			user_htype = POBJ_HEADER_LEGACY;
+			break;
+		case HEADER_COMPACT:
+			user_htype = POBJ_HEADER_COMPACT;
+			break;
+		case HEADER_NONE:
+			user_htype = POBJ_HEADER_NONE;
+			break;
+		default:
+			ASSERT(0); /* unreachable */
+			break;
+	}
+
+	struct pobj_alloc_class_desc *p = arg;
+	p->units_per_block = c->type == CLASS_HUGE ? 0 : c->rdsc.nallocs;
+	p->header_type = user_htype;
+	p->unit_size = c->unit_size;
+	p->class_id = c->id;
+	p->alignment = c->flags & CHUNK_FLAG_ALIGNED ? c->rdsc.alignment : 0;
+
+	return 0;
+}
+
+static const struct ctl_argument CTL_ARG(desc) = {
+	.dest_size = sizeof(struct pobj_alloc_class_desc),
+	.parsers = {
+		CTL_ARG_PARSER_STRUCT(struct pobj_alloc_class_desc,
+			unit_size, ctl_arg_integer),
+		CTL_ARG_PARSER_STRUCT(struct pobj_alloc_class_desc,
+			alignment, ctl_arg_integer),
+		CTL_ARG_PARSER_STRUCT(struct pobj_alloc_class_desc,
+			units_per_block, ctl_arg_integer),
+		CTL_ARG_PARSER_STRUCT(struct pobj_alloc_class_desc,
+			header_type, pmalloc_header_type_parser),
+		CTL_ARG_PARSER_END
+	}
+};
+
+static const struct ctl_node CTL_NODE(class_id)[] = {
+	CTL_LEAF_RW(desc),
+
+	CTL_NODE_END
+};
+
+static const struct ctl_node CTL_NODE(new)[] = {
+	CTL_LEAF_WO(desc),
+
+	CTL_NODE_END
+};
+
+/*
+ * CTL_READ_HANDLER(enabled, adaptive) -- returns whether allocation classes
+ *	are derived from the sampled allocation sizes
+ */
+static int
+CTL_READ_HANDLER(enabled, adaptive)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	int *arg_out = arg;
+
+	*arg_out = heap_get_adaptive_enabled(&pop->heap);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(enabled, adaptive) -- enables or disables the derivation
+ *	of allocation classes
+ */
+static int
+CTL_WRITE_HANDLER(enabled, adaptive)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	int arg_in = *(int *)arg;
+
+	heap_set_adaptive_enabled(&pop->heap, arg_in);
+
+	return 0;
+}
+
+static const struct ctl_argument CTL_ARG(enabled) = CTL_ARG_BOOLEAN;
+
+/*
+ * CTL_READ_HANDLER(sample_rate) -- reads how many allocations of a thread
+ *	make up a single sample
+ */
+static int
+CTL_READ_HANDLER(sample_rate)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	ssize_t *arg_out = arg;
+
+	*arg_out = (ssize_t)heap_get_adaptive_sample_rate(&pop->heap);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(sample_rate) -- changes how many allocations of a thread
+ *	make up a single sample
+ */
+static int
+CTL_WRITE_HANDLER(sample_rate)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	ssize_t arg_in = *(ssize_t *)arg;
+
+	if (arg_in <= 0 || arg_in > UINT32_MAX) {
+		ERR("incorrect sample rate %zd", arg_in);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return heap_set_adaptive_sample_rate(&pop->heap, (unsigned)arg_in);
+}
+
+static const struct ctl_argument CTL_ARG(sample_rate) = CTL_ARG_LONG_LONG;
+
+/*
+ * CTL_READ_HANDLER(max_waste) -- reads the percentage of a unit above which
+ *	a better fitting class is derived
+ */
+static int
+CTL_READ_HANDLER(max_waste)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	ssize_t *arg_out = arg;
+
+	*arg_out = (ssize_t)heap_get_adaptive_max_waste(&pop->heap);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(max_waste) -- changes the percentage of a unit above which
+ *	a better fitting class is derived
+ */
+static int
+CTL_WRITE_HANDLER(max_waste)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	ssize_t arg_in = *(ssize_t *)arg;
+
+	if (arg_in < 0 || arg_in > 100) {
+		ERR("incorrect waste percentage %zd", arg_in);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return heap_set_adaptive_max_waste(&pop->heap, (unsigned)arg_in);
+}
+
+static const struct ctl_argument CTL_ARG(max_waste) = CTL_ARG_LONG_LONG;
+
+/*
+ * CTL_READ_HANDLER(nclasses) -- reads the number of derived classes
+ */
+static int
+CTL_READ_HANDLER(nclasses)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	unsigned *arg_out = arg;
+
+	*arg_out = heap_get_adaptive_nclasses(&pop->heap);
+
+	return 0;
+}
+
+/*
+ * ctl_derived_class -- (internal) reads the indexed derived class
+ */
+static int
+ctl_derived_class(PMEMobjpool *pop, struct ctl_indexes *indexes,
+	struct heap_adaptive_class *aclass)
+{
+	struct ctl_index *idx = PMDK_SLIST_FIRST(indexes);
+	ASSERTeq(strcmp(idx->name, "derived_id"), 0);
+
+	if (idx->value < 0 || idx->value > UINT32_MAX) {
+		ERR("derived class index outside of the allowed range");
+		errno = ERANGE;
+		return -1;
+	}
+
+	return heap_get_adaptive_class(&pop->heap, (unsigned)idx->value,
+		aclass);
+}
+
+/*
+ * CTL_READ_HANDLER(class_id, derived) -- reads the id of the derived class
+ */
+static int
+CTL_READ_HANDLER(class_id, derived)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	struct heap_adaptive_class aclass;
+	if (ctl_derived_class(ctx, indexes, &aclass) != 0)
+		return -1;
+
+	unsigned *arg_out = arg;
+	*arg_out = aclass.class_id;
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(size, derived) -- reads the allocation size the class was
+ *	derived for
+ */
+static int
+CTL_READ_HANDLER(size, derived)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	struct heap_adaptive_class aclass;
+	if (ctl_derived_class(ctx, indexes, &aclass) != 0)
+		return -1;
+
+	size_t *arg_out = arg;
+	*arg_out = aclass.size;
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(waste, derived) -- reads the unit percentage that was
+ *	wasted by the class previously assigned to the size
+ */
+static int
+CTL_READ_HANDLER(waste, derived)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	struct heap_adaptive_class aclass;
+	if (ctl_derived_class(ctx, indexes, &aclass) != 0)
+		return -1;
+
+	unsigned *arg_out = arg;
+	*arg_out = aclass.waste;
+
+	return 0;
+}
+
+static const struct ctl_node CTL_NODE(derived_id)[] = {
+	CTL_LEAF_RO(class_id, derived),
+	CTL_LEAF_RO(size, derived),
+	CTL_LEAF_RO(waste, derived),
+
+	CTL_NODE_END
+};
+
+static const struct ctl_node CTL_NODE(derived)[] = {
+	CTL_INDEXED(derived_id),
+
+	CTL_NODE_END
+};
+
+static const struct ctl_node CTL_NODE(adaptive)[] = {
+	CTL_LEAF_RW(enabled, adaptive),
+	CTL_LEAF_RW(sample_rate),
+	CTL_LEAF_RW(max_waste),
+	CTL_LEAF_RO(nclasses),
+	CTL_CHILD(derived),
+
+	CTL_NODE_END
+};
+
+static const struct ctl_node CTL_NODE(alloc_class)[] = {
+	CTL_INDEXED(class_id),
+	CTL_INDEXED(new),
+	CTL_CHILD(adaptive),
+
+	CTL_NODE_END
+};
+
+/*
+ * CTL_RUNNABLE_HANDLER(extend) -- extends the pool by the given size
+ */
+static int
+CTL_RUNNABLE_HANDLER(extend)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	ssize_t arg_in = *(ssize_t *)arg;
+	if (arg_in < (ssize_t)PMEMOBJ_MIN_PART) {
+		ERR("incorrect size for extend, must be larger than %" PRIu64,
+			PMEMOBJ_MIN_PART);
+		return -1;
+	}
+
+	struct palloc_heap *heap = &pop->heap;
+	struct bucket *defb = heap_bucket_acquire(heap,
+		DEFAULT_ALLOC_CLASS_ID,
+		HEAP_ARENA_PER_THREAD);
+
+	int ret = heap_extend(heap, defb, (size_t)arg_in) < 0 ? -1 : 0;
+
+	heap_bucket_release(heap, defb);
+
+	return ret;
+}
+
+/*
+ * CTL_READ_HANDLER(granularity) -- reads the current heap grow size
+ */
+static int
+CTL_READ_HANDLER(granularity)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	ssize_t *arg_out = arg;
+
+	*arg_out = (ssize_t)pop->heap.growsize;
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(granularity) -- changes the heap grow size
+ */
+static int
+CTL_WRITE_HANDLER(granularity)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	ssize_t arg_in = *(int *)arg;
+	if (arg_in != 0 && arg_in < (ssize_t)PMEMOBJ_MIN_PART) {
+		ERR("incorrect grow size, must be 0 or larger than %" PRIu64,
+			PMEMOBJ_MIN_PART);
+		return -1;
+	}
+
+	pop->heap.growsize = (size_t)arg_in;
+
+	return 0;
+}
+
+static const struct ctl_argument CTL_ARG(granularity) = CTL_ARG_LONG_LONG;
+
+/*
+ * CTL_READ_HANDLER(watermark) -- reads the size of the free extent below which
+ *	the heap is extended in the background
+ */
+static int
+CTL_READ_HANDLER(watermark)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	*(ssize_t *)arg = (ssize_t)heap_get_extend_watermark(&pop->heap);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(watermark) -- changes the size of the free extent below
+ *	which the heap is extended in the background
+ */
+static int
+CTL_WRITE_HANDLER(watermark)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	ssize_t arg_in = *(ssize_t *)arg;
+	if (arg_in < 0) {
+		ERR("incorrect heap extension watermark %zd", arg_in);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return heap_set_extend_watermark(&pop->heap, (uint64_t)arg_in);
+}
+
+static const struct ctl_argument CTL_ARG(watermark) = CTL_ARG_LONG_LONG;
+
+/*
+ * CTL_READ_HANDLER(async) -- reads the number of heap extensions performed
+ *	in the background
+ */
+static int
+CTL_READ_HANDLER(async)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	struct heap_extend_stats stats;
+	heap_get_extend_stats(&pop->heap, &stats);
+	*(uint64_t *)arg = stats.async;
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(sync) -- reads the number of heap extensions performed
+ *	by allocations
+ */
+static int
+CTL_READ_HANDLER(sync)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	struct heap_extend_stats stats;
+	heap_get_extend_stats(&pop->heap, &stats);
+	*(uint64_t *)arg = stats.sync;
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(failed) -- reads the number of failed heap extensions
+ */
+static int
+CTL_READ_HANDLER(failed)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	struct heap_extend_stats stats;
+	heap_get_extend_stats(&pop->heap, &stats);
+	*(uint64_t *)arg = stats.failed;
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(time_ns) -- reads the total time of the heap extensions
+ */
+static int
+CTL_READ_HANDLER(time_ns)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	struct heap_extend_stats stats;
+	heap_get_extend_stats(&pop->heap, &stats);
+	*(uint64_t *)arg = stats.time_ns;
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(max_ns) -- reads the time of the longest heap extension
+ */
+static int
+CTL_READ_HANDLER(max_ns)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	struct heap_extend_stats stats;
+	heap_get_extend_stats(&pop->heap, &stats);
+	*(uint64_t *)arg = stats.max_ns;
+
+	return 0;
+}
+
+static const struct ctl_node CTL_NODE(extensions)[] = {
+	CTL_LEAF_RO(async),
+	CTL_LEAF_RO(sync),
+	CTL_LEAF_RO(failed),
+	CTL_LEAF_RO(time_ns),
+	CTL_LEAF_RO(max_ns),
+
+	CTL_NODE_END
+};
+
+/*
+ * CTL_READ_HANDLER(total) -- reads a number of the arenas
+ */
+static int
+CTL_READ_HANDLER(total)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	unsigned *narenas = arg;
+
+	*narenas = heap_get_narenas_total(&pop->heap);
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(max) -- reads a max number of the arenas
+ */
+static int
+CTL_READ_HANDLER(max)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	unsigned *max = arg;
+
+	*max = heap_get_narenas_max(&pop->heap);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(max) -- write a max number of the arenas
+ */
+static int
+CTL_WRITE_HANDLER(max)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	unsigned size = *(unsigned *)arg;
+
+	int ret = heap_set_narenas_max(&pop->heap, size);
+	if (ret) {
+		LOG(1, "cannot change max arena number");
+		return -1;
+	}
+
+	return 0;
+}
+
+static const struct ctl_argument CTL_ARG(max) = CTL_ARG_LONG_LONG;
+
+/*
+ * CTL_READ_HANDLER(automatic) -- reads a number of the automatic arenas
+ */
+static int
+CTL_READ_HANDLER(automatic, narenas)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	unsigned *narenas = arg;
+
+	*narenas = heap_get_narenas_auto(&pop->heap);
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(arena_id) -- reads the id of the arena
+ * assigned to the calling thread
+ */
+static int
+CTL_READ_HANDLER(arena_id)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	unsigned *arena_id = arg;
+
+	*arena_id = heap_get_thread_arena_id(&pop->heap);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(arena_id) -- assigns the arena to the calling thread
+ */
+static int
+CTL_WRITE_HANDLER(arena_id)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	unsigned arena_id = *(unsigned *)arg;
+
+	unsigned narenas = heap_get_narenas_total(&pop->heap);
+
+	/*
+	 * check if index is not bigger than number of arenas
+	 * or if it is not equal zero
+	 */
+	if (arena_id < 1 || arena_id > narenas) {
+		LOG(1, "arena id outside of the allowed range: <1,%u>",
+			narenas);
+		errno = ERANGE;
+		return -1;
+	}
+
+	heap_set_arena_thread(&pop->heap, arena_id);
+
+	return 0;
+}
+
+static const struct ctl_argument CTL_ARG(arena_id) = CTL_ARG_LONG_LONG;
+
+/*
+ * CTL_WRITE_HANDLER(automatic) -- updates automatic status of the arena
+ */
+static int
+CTL_WRITE_HANDLER(automatic)(void *ctx, enum ctl_query_source source,
+		void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	int arg_in = *(int *)arg;
+	unsigned arena_id;
+
+	struct ctl_index *idx = PMDK_SLIST_FIRST(indexes);
+	ASSERTeq(strcmp(idx->name, "arena_id"), 0);
+	arena_id = (unsigned)idx->value;
+
+	unsigned narenas = heap_get_narenas_total(&pop->heap);
+
+	/*
+	 * check if index is not bigger than number of arenas
+	 * or if it is not equal zero
+	 */
+	if (arena_id < 1 || arena_id > narenas) {
+		LOG(1, "arena id outside of the allowed range: <1,%u>",
+			narenas);
+		errno = ERANGE;
+		return -1;
+	}
+
+	if (arg_in != 0 && arg_in != 1) {
+		LOG(1, "incorrect arena state, must be 0 or 1");
+		return -1;
+	}
+
+	return heap_set_arena_auto(&pop->heap, arena_id, arg_in);
+}
+
+/*
+ * CTL_READ_HANDLER(automatic) -- reads automatic status of the arena
+ */
+static int
+CTL_READ_HANDLER(automatic)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	int *arg_out = arg;
+	unsigned arena_id;
+
+	struct ctl_index *idx = PMDK_SLIST_FIRST(indexes);
+	ASSERTeq(strcmp(idx->name, "arena_id"), 0);
+	arena_id = (unsigned)idx->value;
+
+	unsigned narenas = heap_get_narenas_total(&pop->heap);
+
+	/*
+	 * check if index is not bigger than number of arenas
+	 * or if it is not equal zero
+	 */
+	if (arena_id < 1 || arena_id > narenas) {
+		LOG(1, "arena id outside of the allowed range: <1,%u>",
+			narenas);
+		errno = ERANGE;
+		return -1;
+	}
+
+	*arg_out = heap_get_arena_auto(&pop->heap, arena_id);
+
+	return 0;
+}
+
+static struct ctl_argument CTL_ARG(automatic) = CTL_ARG_BOOLEAN;
+
+static const struct ctl_node CTL_NODE(size)[] = {
+	CTL_LEAF_RW(granularity),
+	CTL_LEAF_RUNNABLE(extend),
+	CTL_LEAF_RW(watermark),
+	CTL_CHILD(extensions),
+
+	CTL_NODE_END
+};
+
+/*
+ * CTL_READ_HANDLER(size) -- reads usable size of specified arena
+ */
+static int
+CTL_READ_HANDLER(size)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	unsigned arena_id;
+	unsigned narenas;
+	size_t *arena_size = arg;
+
+	struct ctl_index *idx = PMDK_SLIST_FIRST(indexes);
+	ASSERTeq(strcmp(idx->name, "arena_id"), 0);
+
+	/* take index of arena */
+	arena_id = (unsigned)idx->value;
+	/* take number of arenas */
+	narenas = heap_get_narenas_total(&pop->heap);
+
+	/*
+	 * check if index is not bigger than number of arenas
+	 * or if it is not equal zero
+	 */
+	if (arena_id < 1 || arena_id > narenas) {
+		LOG(1, "arena id outside of the allowed range: <1,%u>",
+			narenas);
+		errno = ERANGE;
+		return -1;
+	}
+
+	/* take buckets for arena */
+	struct bucket **buckets;
+	buckets = heap_get_arena_buckets(&pop->heap, arena_id);
+
+	/* calculate number of reservation for arena using buckets */
+	unsigned size = 0;
+	for (int i = 0; i < MAX_ALLOCATION_CLASSES; ++i) {
+		if (buckets[i] != NULL && buckets[i]->is_active)
+			size += buckets[i]->active_memory_block->m.size_idx;
+	}
+
+	*arena_size = size * CHUNKSIZE;
+
+	return 0;
+}
+
+/*
+ * CTL_RUNNABLE_HANDLER(create) -- create new arena in the heap
+ */
+static int
+CTL_RUNNABLE_HANDLER(create)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	unsigned *arena_id = arg;
+	struct palloc_heap *heap = &pop->heap;
+
+	int ret = heap_arena_create(heap);
+	if (ret < 0)
+		return -1;
+
+	*arena_id = (unsigned)ret;
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(numa_node, arena) -- reads the NUMA node of the arena
+ */
+static int
+CTL_READ_HANDLER(numa_node, arena)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	ssize_t *arg_out = arg;
+	unsigned arena_id;
+
+	struct ctl_index *idx = PMDK_SLIST_FIRST(indexes);
+	ASSERTeq(strcmp(idx->name, "arena_id"), 0);
+	arena_id = (unsigned)idx->value;
+
+	unsigned narenas = heap_get_narenas_total(&pop->heap);
+
+	if (arena_id < 1 || arena_id > narenas) {
+		LOG(1, "arena id outside of the allowed range: <1,%u>",
+			narenas);
+		errno = ERANGE;
+		return -1;
+	}
+
+	*arg_out = (ssize_t)heap_get_arena_node(&pop->heap, arena_id);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(numa_node, arena) -- changes the NUMA node of the arena
+ */
+static int
+CTL_WRITE_HANDLER(numa_node, arena)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	ssize_t arg_in = *(ssize_t *)arg;
+	unsigned arena_id;
+
+	struct ctl_index *idx = PMDK_SLIST_FIRST(indexes);
+	ASSERTeq(strcmp(idx->name, "arena_id"), 0);
+	arena_id = (unsigned)idx->value;
+
+	unsigned narenas = heap_get_narenas_total(&pop->heap);
+
+	if (arena_id < 1 || arena_id > narenas) {
+		LOG(1, "arena id outside of the allowed range: <1,%u>",
+			narenas);
+		errno = ERANGE;
+		return -1;
+	}
+
+	if (arg_in < 0 || arg_in > UINT32_MAX) {
+		ERR("incorrect NUMA node %zd", arg_in);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return heap_set_arena_node(&pop->heap, arena_id, (unsigned)arg_in);
+}
+
+static const struct ctl_argument CTL_ARG(numa_node) = CTL_ARG_LONG_LONG;
+
+static const struct ctl_node CTL_NODE(arena_id)[] = {
+	CTL_LEAF_RO(size),
+	CTL_LEAF_RW(automatic),
+	CTL_LEAF_RW(numa_node, arena),
+
+	CTL_NODE_END
+};
+
+/*
+ * CTL_READ_HANDLER(mode) -- reads the way arenas are picked for allocations
+ */
+static int
+CTL_READ_HANDLER(mode)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	*(enum pobj_arena_mode *)arg = heap_get_arena_mode(&pop->heap);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(mode) -- changes the way arenas are picked for
+ *	allocations
+ */
+static int
+CTL_WRITE_HANDLER(mode)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	return heap_set_arena_mode(&pop->heap, *(enum pobj_arena_mode *)arg);
+}
+
+/*
+ * arena_mode_parser -- parses the arena mode
+ */
+static int
+arena_mode_parser(const void *arg, void *dest, size_t dest_size)
+{
+	const char *vstr = arg;
+	enum pobj_arena_mode *mode = dest;
+	ASSERTeq(dest_size, sizeof(enum pobj_arena_mode));
+
+	if (strcmp(vstr, "thread") == 0) {
+		*mode = POBJ_ARENA_MODE_THREAD;
+	} else if (strcmp(vstr, "cpu") == 0) {
+		*mode = POBJ_ARENA_MODE_CPU;
+	} else {
+		ERR("invalid arena mode");
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static const struct ctl_argument CTL_ARG(mode) = {
+	.dest_size = sizeof(enum pobj_arena_mode),
+	.parsers = {
+		CTL_ARG_PARSER(sizeof(enum pobj_arena_mode),
+			arena_mode_parser),
+		CTL_ARG_PARSER_END
+	}
+};
+
+static const struct ctl_node CTL_NODE(arena)[] = {
+	CTL_INDEXED(arena_id),
+	CTL_LEAF_RUNNABLE(create),
+	CTL_LEAF_RW(mode),
+
+	CTL_NODE_END
+};
+
+static const struct ctl_node CTL_NODE(narenas)[] = {
+	CTL_LEAF_RO(automatic, narenas),
+	CTL_LEAF_RO(total),
+	CTL_LEAF_RW(max),
+
+	CTL_NODE_END
+};
+
+/*
+ * CTL_READ_HANDLER(numa_node, thread) -- reads the NUMA node of the arena
+ *	assigned to the current thread
+ */
+static int
+CTL_READ_HANDLER(numa_node, thread)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	ssize_t *arg_out = arg;
+
+	*arg_out = (ssize_t)heap_get_thread_numa_node(&pop->heap);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(numa_node, thread) -- assigns an arena of the given NUMA
+ *	node to the current thread
+ */
+static int
+CTL_WRITE_HANDLER(numa_node, thread)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	ssize_t arg_in = *(ssize_t *)arg;
+
+	if (arg_in < 0 || arg_in > UINT32_MAX) {
+		ERR("incorrect NUMA node %zd", arg_in);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return heap_set_thread_numa_node(&pop->heap, (unsigned)arg_in);
+}
+
+static const struct ctl_node CTL_NODE(thread)[] = {
+	CTL_LEAF_RW(arena_id),
+	CTL_LEAF_RW(numa_node, thread),
+
+	CTL_NODE_END
+};
+
+/*
+ * CTL_READ_HANDLER(capacity) -- reads the number of blocks cached per
+ *	allocation class by each thread
+ */
+static int
+CTL_READ_HANDLER(capacity)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	ssize_t *arg_out = arg;
+
+	*arg_out = (ssize_t)heap_get_thread_cache_size(&pop->heap);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(capacity) -- changes the number of blocks cached per
+ *	allocation class by each thread
+ */
+static int
+CTL_WRITE_HANDLER(capacity)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	ssize_t arg_in = *(ssize_t *)arg;
+	if (arg_in < 0 || arg_in > UINT32_MAX) {
+		ERR("incorrect thread cache capacity %zd", arg_in);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return heap_set_thread_cache_size(&pop->heap, (unsigned)arg_in);
+}
+
+static const struct ctl_argument CTL_ARG(capacity) = CTL_ARG_LONG_LONG;
+
+/*
+ * CTL_RUNNABLE_HANDLER(flush) -- releases all blocks cached by the calling
+ *	thread
+ */
+static int
+CTL_RUNNABLE_HANDLER(flush)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	heap_thread_cache_flush(&pop->heap);
+
+	return 0;
+}
+
+static const struct ctl_node CTL_NODE(thread_cache)[] = {
+	CTL_LEAF_RW(capacity),
+	CTL_LEAF_RUNNABLE(flush),
+
+	CTL_NODE_END
+};
+
+/*
+ * CTL_READ_HANDLER(enabled) -- returns whether the NUMA aware placement is
+ *	enabled
+ */
+static int
+CTL_READ_HANDLER(enabled)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	int *arg_out = arg;
+
+	*arg_out = heap_get_numa_enabled(&pop->heap);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(enabled) -- enables or disables the NUMA aware placement
+ */
+static int
+CTL_WRITE_HANDLER(enabled)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	int arg_in = *(int *)arg;
+
+	return heap_set_numa_enabled(&pop->heap, arg_in);
+}
+
+/*
+ * CTL_READ_HANDLER(fake_nodes) -- reads the number of faked NUMA nodes
+ */
+static int
+CTL_READ_HANDLER(fake_nodes)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	ssize_t *arg_out = arg;
+
+	*arg_out = (ssize_t)heap_get_numa_fake_nodes(&pop->heap);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(fake_nodes) -- fakes the NUMA topology of the heap
+ */
+static int
+CTL_WRITE_HANDLER(fake_nodes)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	ssize_t arg_in = *(ssize_t *)arg;
+
+	if (arg_in < 0 || arg_in > UINT32_MAX) {
+		ERR("incorrect number of NUMA nodes %zd", arg_in);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return heap_set_numa_fake_nodes(&pop->heap, (unsigned)arg_in);
+}
+
+static const struct ctl_argument CTL_ARG(fake_nodes) = CTL_ARG_LONG_LONG;
+
+/*
+ * CTL_READ_HANDLER(nnodes) -- reads the number of NUMA nodes backing the heap
+ */
+static int
+CTL_READ_HANDLER(nnodes)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	unsigned *arg_out = arg;
+
+	*arg_out = heap_get_numa_nnodes(&pop->heap);
+
+	return 0;
+}
+
+/*
+ * ctl_numa_node_stats -- (internal) reads statistics of the indexed NUMA node
+ */
+static int
+ctl_numa_node_stats(PMEMobjpool *pop, struct ctl_indexes *indexes,
+	struct heap_numa_node_stats *stats)
+{
+	struct ctl_index *idx = PMDK_SLIST_FIRST(indexes);
+	ASSERTeq(strcmp(idx->name, "node_id"), 0);
+
+	if (idx->value < 0 || idx->value > UINT32_MAX) {
+		LOG(1, "NUMA node id %ld outside of the allowed range",
+			idx->value);
+		errno = ERANGE;
+		return -1;
+	}
+
+	return heap_get_numa_node_stats(&pop->heap, (unsigned)idx->value,
+		stats);
+}
+
+/*
+ * CTL_READ_HANDLER(narenas, node) -- reads the number of arenas tied to the
+ *	NUMA node
+ */
+static int
+CTL_READ_HANDLER(narenas, node)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	struct heap_numa_node_stats stats;
+	if (ctl_numa_node_stats(ctx, indexes, &stats) != 0)
+		return -1;
+
+	*(unsigned *)arg = stats.narenas;
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(size, node) -- reads the size of the heap backed by the
+ *	NUMA node
+ */
+static int
+CTL_READ_HANDLER(size, node)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	struct heap_numa_node_stats stats;
+	if (ctl_numa_node_stats(ctx, indexes, &stats) != 0)
+		return -1;
+
+	*(size_t *)arg = stats.size;
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(local, node) -- reads the number of chunks reserved from
+ *	the memory of the NUMA node by arenas tied to it
+ */
+static int
+CTL_READ_HANDLER(local, node)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	struct heap_numa_node_stats stats;
+	if (ctl_numa_node_stats(ctx, indexes, &stats) != 0)
+		return -1;
+
+	*(uint64_t *)arg = stats.local;
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(remote, node) -- reads the number of chunks reserved from
+ *	the memory of other nodes by arenas tied to the NUMA node
+ */
+static int
+CTL_READ_HANDLER(remote, node)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	struct heap_numa_node_stats stats;
+	if (ctl_numa_node_stats(ctx, indexes, &stats) != 0)
+		return -1;
+
+	*(uint64_t *)arg = stats.remote;
+
+	return 0;
+}
+
+static const struct ctl_node CTL_NODE(node_id)[] = {
+	CTL_LEAF_RO(narenas, node),
+	CTL_LEAF_RO(size, node),
+	CTL_LEAF_RO(local, node),
+	CTL_LEAF_RO(remote, node),
+
+	CTL_NODE_END
+};
+
+static const struct ctl_node CTL_NODE(node)[] = {
+	CTL_INDEXED(node_id),
+
+	CTL_NODE_END
+};
+
+static const struct ctl_node CTL_NODE(numa)[] = {
+	CTL_LEAF_RW(enabled),
+	CTL_LEAF_RW(fake_nodes),
+	CTL_LEAF_RO(nnodes),
+	CTL_CHILD(node),
+
+	CTL_NODE_END
+};
+
+/*
+ * CTL_READ_HANDLER(callbacks) -- reads the callbacks used by the
+ *	defragmentation to find the references to objects
+ */
+static int
+CTL_READ_HANDLER(callbacks)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	struct pmalloc_defrag *d = pop->defrag;
+
+	util_mutex_lock(&d->lock);
+	*(struct pobj_defrag_callbacks *)arg = d->callbacks;
+	util_mutex_unlock(&d->lock);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(callbacks) -- sets the callbacks used by the
+ *	defragmentation to find the references to objects
+ */
+static int
+CTL_WRITE_HANDLER(callbacks)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	struct pmalloc_defrag *d = pop->defrag;
+
+	if (source != CTL_QUERY_PROGRAMMATIC) {
+		ERR("defragmentation callbacks cannot be set from "
+			"the configuration");
+		errno = EINVAL;
+		return -1;
 	}
 
-	struct palloc_heap *heap = &pop->heap;
-	struct bucket *defb = heap_bucket_acquire(heap,
-		DEFAULT_ALLOC_CLASS_ID,
-		HEAP_ARENA_PER_THREAD);
+	/* the current step might still be using the old callbacks */
+	util_mutex_lock(&d->step_lock);
+	util_mutex_lock(&d->lock);
+	d->callbacks = *(struct pobj_defrag_callbacks *)arg;
+	util_mutex_unlock(&d->lock);
+	util_mutex_unlock(&d->step_lock);
 
-	int ret = heap_extend(heap, defb, (size_t)arg_in) < 0 ? -1 : 0;
+	return 0;
+}
+
+static const struct ctl_argument CTL_ARG(callbacks) = {
+	.dest_size = sizeof(struct pobj_defrag_callbacks),
+	.parsers = {
+		CTL_ARG_PARSER_END
+	}
+};
+
+/*
+ * CTL_READ_HANDLER(batch) -- reads the number of objects after which
+ *	a defragmentation step stops picking runs
+ */
+static int
+CTL_READ_HANDLER(batch)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	struct pmalloc_defrag *d = pop->defrag;
+
+	util_mutex_lock(&d->lock);
+	*(ssize_t *)arg = (ssize_t)d->batch;
+	util_mutex_unlock(&d->lock);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(batch) -- sets the number of objects after which
+ *	a defragmentation step stops picking runs
+ */
+static int
+CTL_WRITE_HANDLER(batch)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	struct pmalloc_defrag *d = pop->defrag;
+
+	ssize_t arg_in = *(ssize_t *)arg;
+	if (arg_in <= 0 || arg_in > UINT32_MAX) {
+		ERR("incorrect defragmentation batch size %zd", arg_in);
+		errno = EINVAL;
+		return -1;
+	}
+
+	util_mutex_lock(&d->lock);
+	d->batch = (unsigned)arg_in;
+	util_mutex_unlock(&d->lock);
+
+	return 0;
+}
+
+static const struct ctl_argument CTL_ARG(batch) = CTL_ARG_LONG_LONG;
+
+/*
+ * CTL_READ_HANDLER(fill_pct) -- reads the max occupancy of runs picked by
+ *	the defragmentation
+ */
+static int
+CTL_READ_HANDLER(fill_pct)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	struct pmalloc_defrag *d = pop->defrag;
+
+	util_mutex_lock(&d->lock);
+	*(ssize_t *)arg = (ssize_t)d->fill_pct;
+	util_mutex_unlock(&d->lock);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(fill_pct) -- sets the max occupancy of runs picked by
+ *	the defragmentation
+ */
+static int
+CTL_WRITE_HANDLER(fill_pct)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	struct pmalloc_defrag *d = pop->defrag;
+
+	ssize_t arg_in = *(ssize_t *)arg;
+	if (arg_in < 0 || arg_in > 100) {
+		ERR("incorrect defragmentation fill percentage %zd", arg_in);
+		errno = EINVAL;
+		return -1;
+	}
+
+	util_mutex_lock(&d->lock);
+	d->fill_pct = (unsigned)arg_in;
+	util_mutex_unlock(&d->lock);
+
+	return 0;
+}
+
+static const struct ctl_argument CTL_ARG(fill_pct) = CTL_ARG_LONG_LONG;
+
+/*
+ * CTL_READ_HANDLER(interval) -- reads the time, in milliseconds, a worker
+ *	waits after a step that relocated nothing
+ */
+static int
+CTL_READ_HANDLER(interval)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	struct pmalloc_defrag *d = pop->defrag;
+
+	util_mutex_lock(&d->lock);
+	*(ssize_t *)arg = (ssize_t)d->interval;
+	util_mutex_unlock(&d->lock);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(interval) -- sets the time, in milliseconds, a worker
+ *	waits after a step that relocated nothing
+ */
+static int
+CTL_WRITE_HANDLER(interval)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	struct pmalloc_defrag *d = pop->defrag;
+
+	ssize_t arg_in = *(ssize_t *)arg;
+	if (arg_in < 0 || arg_in > UINT32_MAX) {
+		ERR("incorrect defragmentation interval %zd", arg_in);
+		errno = EINVAL;
+		return -1;
+	}
+
+	util_mutex_lock(&d->lock);
+	d->interval = (unsigned)arg_in;
+	util_mutex_unlock(&d->lock);
+
+	return 0;
+}
+
+static const struct ctl_argument CTL_ARG(interval) = CTL_ARG_LONG_LONG;
+
+/*
+ * CTL_RUNNABLE_HANDLER(step) -- performs a single batch of the
+ *	defragmentation
+ */
+static int
+CTL_RUNNABLE_HANDLER(step)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	struct pobj_defrag_result result;
+	int ret = pmalloc_defrag_step(pop, &result);
+
+	if (arg != NULL)
+		*(struct pobj_defrag_result *)arg = result;
+
+	return ret;
+}
+
+/*
+ * CTL_READ_HANDLER(worker) -- performs the defragmentation until the
+ *	workers are stopped
+ */
+static int
+CTL_READ_HANDLER(worker)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	pmalloc_defrag_worker(pop);
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(stop) -- stops all defragmentation workers
+ */
+static int
+CTL_READ_HANDLER(stop)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	pmalloc_defrag_stop(pop);
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(relocated) -- reads the total number of objects relocated
+ *	by the defragmentation
+ */
+static int
+CTL_READ_HANDLER(relocated)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	util_atomic_load64(&pop->defrag->relocated, (uint64_t *)arg);
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(reclaimed) -- reads the total number of runs turned into
+ *	free chunks by the defragmentation
+ */
+static int
+CTL_READ_HANDLER(reclaimed)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	util_atomic_load64(&pop->defrag->reclaimed, (uint64_t *)arg);
+
+	return 0;
+}
+
+static const struct ctl_node CTL_NODE(defrag)[] = {
+	CTL_LEAF_RW(callbacks),
+	CTL_LEAF_RW(batch),
+	CTL_LEAF_RW(fill_pct),
+	CTL_LEAF_RW(interval),
+	CTL_LEAF_RUNNABLE(step),
+	CTL_LEAF_RO(worker),
+	CTL_LEAF_RO(stop),
+	CTL_LEAF_RO(relocated),
+	CTL_LEAF_RO(reclaimed),
+
+	CTL_NODE_END
+};
+
+/*
+ * CTL_READ_HANDLER(enabled, punch_hole) -- returns whether the file blocks of
+ *	idle free chunks are automatically deallocated
+ */
+static int
+CTL_READ_HANDLER(enabled, punch_hole)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	int *arg_out = arg;
+	*arg_out = heap_get_punch_hole_enabled(&pop->heap);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(enabled, punch_hole) -- enables or disables the automatic
+ *	deallocation of the file blocks of idle free chunks
+ */
+static int
+CTL_WRITE_HANDLER(enabled, punch_hole)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	int arg_in = *(int *)arg;
+
+	return heap_set_punch_hole_enabled(&pop->heap, arg_in);
+}
+
+/*
+ * CTL_READ_HANDLER(interval, punch_hole) -- returns the minimum time, in
+ *	milliseconds, between two automatic passes
+ */
+static int
+CTL_READ_HANDLER(interval, punch_hole)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	ssize_t *arg_out = arg;
+	*arg_out = (ssize_t)heap_get_punch_hole_interval(&pop->heap);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(interval, punch_hole) -- changes the minimum time, in
+ *	milliseconds, between two automatic passes
+ */
+static int
+CTL_WRITE_HANDLER(interval, punch_hole)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	ssize_t arg_in = *(ssize_t *)arg;
+	if (arg_in < 0) {
+		ERR("incorrect punch hole interval %zd", arg_in);
+		errno = EINVAL;
+		return -1;
+	}
+
+	heap_set_punch_hole_interval(&pop->heap, (uint64_t)arg_in);
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(min_size) -- returns the minimum size of a free extent
+ *	for its file blocks to be deallocated
+ */
+static int
+CTL_READ_HANDLER(min_size)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	ssize_t *arg_out = arg;
+	*arg_out = (ssize_t)heap_get_punch_hole_min_size(&pop->heap);
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(min_size) -- changes the minimum size of a free extent
+ *	for its file blocks to be deallocated
+ */
+static int
+CTL_WRITE_HANDLER(min_size)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	ssize_t arg_in = *(ssize_t *)arg;
+	if (arg_in < 0) {
+		ERR("incorrect punch hole minimum size %zd", arg_in);
+		errno = EINVAL;
+		return -1;
+	}
 
-	heap_bucket_release(heap, defb);
+	heap_set_punch_hole_min_size(&pop->heap, (uint64_t)arg_in);
 
-	return ret;
+	return 0;
 }
 
+static const struct ctl_argument CTL_ARG(min_size) = CTL_ARG_LONG_LONG;
+
 /*
- * CTL_READ_HANDLER(granularity) -- reads the current heap grow size
+ * CTL_RUNNABLE_HANDLER(run) -- deallocates the file blocks of the free chunks
+ *	which weren't used since the previous pass
  */
 static int
-CTL_READ_HANDLER(granularity)(void *ctx,
+CTL_RUNNABLE_HANDLER(run)(void *ctx,
 	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
 {
 	PMEMobjpool *pop = ctx;
 
-	ssize_t *arg_out = arg;
+	uint64_t reclaimed;
+	int ret = heap_punch_hole(&pop->heap, &reclaimed);
 
-	*arg_out = (ssize_t)pop->heap.growsize;
+	if (arg != NULL)
+		*(uint64_t *)arg = reclaimed;
 
-	return 0;
+	return ret;
 }
 
 /*
- * CTL_WRITE_HANDLER(granularity) -- changes the heap grow size
+ * CTL_READ_HANDLER(reclaimed, punch_hole) -- reads the total number of bytes
+ *	returned to the file system
  */
 static int
-CTL_WRITE_HANDLER(granularity)(void *ctx,
+CTL_READ_HANDLER(reclaimed, punch_hole)(void *ctx,
 	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
 {
 	PMEMobjpool *pop = ctx;
 
-	ssize_t arg_in = *(int *)arg;
-	if (arg_in != 0 && arg_in < (ssize_t)PMEMOBJ_MIN_PART) {
-		ERR("incorrect grow size, must be 0 or larger than %" PRIu64,
-			PMEMOBJ_MIN_PART);
-		return -1;
-	}
-
-	pop->heap.growsize = (size_t)arg_in;
+	*(uint64_t *)arg = heap_get_punch_hole_reclaimed(&pop->heap);
 
 	return 0;
 }
 
-static const struct ctl_argument CTL_ARG(granularity) = CTL_ARG_LONG_LONG;
+static const struct ctl_node CTL_NODE(punch_hole)[] = {
+	CTL_LEAF_RW(enabled, punch_hole),
+	CTL_LEAF_RW(interval, punch_hole),
+	CTL_LEAF_RW(min_size),
+	CTL_LEAF_RUNNABLE(run),
+	CTL_LEAF_RO(reclaimed, punch_hole),
+
+	CTL_NODE_END
+};
 
 /*
- * CTL_READ_HANDLER(total) -- reads a number of the arenas
+ * CTL_READ_HANDLER(enabled, free_batch) -- returns whether the frees are
+ *	batched
  */
 static int
-CTL_READ_HANDLER(total)(void *ctx,
+CTL_READ_HANDLER(enabled, free_batch)(void *ctx,
 	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
 {
 	PMEMobjpool *pop = ctx;
-	unsigned *narenas = arg;
 
-	*narenas = heap_get_narenas_total(&pop->heap);
+	util_atomic_load_explicit32(&pop->free_batch->enabled, (int *)arg,
+		memory_order_relaxed);
 
 	return 0;
 }
 
 /*
- * CTL_READ_HANDLER(max) -- reads a max number of the arenas
+ * CTL_WRITE_HANDLER(enabled, free_batch) -- enables or disables the batching
+ *	of frees, disabling it publishes all of the queued frees
  */
 static int
-CTL_READ_HANDLER(max)(void *ctx,
+CTL_WRITE_HANDLER(enabled, free_batch)(void *ctx,
 	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
 {
 	PMEMobjpool *pop = ctx;
-	unsigned *max = arg;
 
-	*max = heap_get_narenas_max(&pop->heap);
+	int arg_in = *(int *)arg;
+
+	util_atomic_store_explicit32(&pop->free_batch->enabled, arg_in,
+		memory_order_relaxed);
+
+	if (!arg_in)
+		return pmalloc_free_batch_flush(pop);
 
 	return 0;
 }
 
 /*
- * CTL_WRITE_HANDLER(max) -- write a max number of the arenas
+ * CTL_READ_HANDLER(capacity, free_batch) -- reads the max number of frees
+ *	queued by a thread
  */
 static int
-CTL_WRITE_HANDLER(max)(void *ctx,
+CTL_READ_HANDLER(capacity, free_batch)(void *ctx,
 	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
 {
 	PMEMobjpool *pop = ctx;
-	unsigned size = *(unsigned *)arg;
 
-	int ret = heap_set_narenas_max(&pop->heap, size);
-	if (ret) {
-		LOG(1, "cannot change max arena number");
-		return -1;
-	}
+	unsigned capacity;
+	util_atomic_load_explicit32(&pop->free_batch->capacity, &capacity,
+		memory_order_relaxed);
+	*(ssize_t *)arg = (ssize_t)capacity;
 
 	return 0;
 }
 
-static const struct ctl_argument CTL_ARG(max) = CTL_ARG_LONG_LONG;
-
 /*
- * CTL_READ_HANDLER(automatic) -- reads a number of the automatic arenas
+ * CTL_WRITE_HANDLER(capacity, free_batch) -- changes the max number of frees
+ *	queued by a thread
  */
 static int
-CTL_READ_HANDLER(automatic, narenas)(void *ctx,
+CTL_WRITE_HANDLER(capacity, free_batch)(void *ctx,
 	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
 {
 	PMEMobjpool *pop = ctx;
-	unsigned *narenas = arg;
 
-	*narenas = heap_get_narenas_auto(&pop->heap);
+	ssize_t arg_in = *(ssize_t *)arg;
+	if (arg_in <= 0 || arg_in > UINT32_MAX) {
+		ERR("incorrect free batch capacity %zd", arg_in);
+		errno = EINVAL;
+		return -1;
+	}
+
+	util_atomic_store_explicit32(&pop->free_batch->capacity,
+		(unsigned)arg_in, memory_order_relaxed);
 
 	return 0;
 }
 
 /*
- * CTL_READ_HANDLER(arena_id) -- reads the id of the arena
- * assigned to the calling thread
+ * CTL_READ_HANDLER(interval, free_batch) -- reads the max time, in
+ *	milliseconds, a free can stay queued
  */
 static int
-CTL_READ_HANDLER(arena_id)(void *ctx,
+CTL_READ_HANDLER(interval, free_batch)(void *ctx,
 	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
 {
 	PMEMobjpool *pop = ctx;
-	unsigned *arena_id = arg;
 
-	*arena_id = heap_get_thread_arena_id(&pop->heap);
+	unsigned interval;
+	util_atomic_load_explicit32(&pop->free_batch->interval, &interval,
+		memory_order_relaxed);
+	*(ssize_t *)arg = (ssize_t)interval;
 
 	return 0;
 }
 
 /*
- * CTL_WRITE_HANDLER(arena_id) -- assigns the arena to the calling thread
+ * CTL_WRITE_HANDLER(interval, free_batch) -- changes the max time, in
+ *	milliseconds, a free can stay queued
  */
 static int
-CTL_WRITE_HANDLER(arena_id)(void *ctx,
+CTL_WRITE_HANDLER(interval, free_batch)(void *ctx,
 	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
 {
 	PMEMobjpool *pop = ctx;
-	unsigned arena_id = *(unsigned *)arg;
-
-	unsigned narenas = heap_get_narenas_total(&pop->heap);
 
-	/*
-	 * check if index is not bigger than number of arenas
-	 * or if it is not equal zero
-	 */
-	if (arena_id < 1 || arena_id > narenas) {
-		LOG(1, "arena id outside of the allowed range: <1,%u>",
-			narenas);
-		errno = ERANGE;
+	ssize_t arg_in = *(ssize_t *)arg;
+	if (arg_in < 0 || arg_in > UINT32_MAX) {
+		ERR("incorrect free batch interval %zd", arg_in);
+		errno = EINVAL;
 		return -1;
 	}
 
-	heap_set_arena_thread(&pop->heap, arena_id);
+	util_atomic_store_explicit32(&pop->free_batch->interval,
+		(unsigned)arg_in, memory_order_relaxed);
 
 	return 0;
 }
 
-static const struct ctl_argument CTL_ARG(arena_id) = CTL_ARG_LONG_LONG;
-
 /*
- * CTL_WRITE_HANDLER(automatic) -- updates automatic status of the arena
+ * CTL_RUNNABLE_HANDLER(flush, free_batch) -- publishes the frees queued by
+ *	all threads
  */
 static int
-CTL_WRITE_HANDLER(automatic)(void *ctx, enum ctl_query_source source,
-		void *arg, struct ctl_indexes *indexes)
+CTL_RUNNABLE_HANDLER(flush, free_batch)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
 {
 	PMEMobjpool *pop = ctx;
-	int arg_in = *(int *)arg;
-	unsigned arena_id;
-
-	struct ctl_index *idx = PMDK_SLIST_FIRST(indexes);
-	ASSERTeq(strcmp(idx->name, "arena_id"), 0);
-	arena_id = (unsigned)idx->value;
 
-	unsigned narenas = heap_get_narenas_total(&pop->heap);
+	return pmalloc_free_batch_flush(pop);
+}
 
-	/*
-	 * check if index is not bigger than number of arenas
-	 * or if it is not equal zero
-	 */
-	if (arena_id < 1 || arena_id > narenas) {
-		LOG(1, "arena id outside of the allowed range: <1,%u>",
-			narenas);
-		errno = ERANGE;
-		return -1;
-	}
+/*
+ * CTL_READ_HANDLER(batches) -- reads the number of published batches of frees
+ */
+static int
+CTL_READ_HANDLER(batches)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
 
-	if (arg_in != 0 && arg_in != 1) {
-		LOG(1, "incorrect arena state, must be 0 or 1");
-		return -1;
-	}
+	util_atomic_load64(&pop->free_batch->nbatches, (uint64_t *)arg);
 
-	return heap_set_arena_auto(&pop->heap, arena_id, arg_in);
+	return 0;
 }
 
 /*
- * CTL_READ_HANDLER(automatic) -- reads automatic status of the arena
+ * CTL_READ_HANDLER(freed) -- reads the number of objects freed in batches
  */
 static int
-CTL_READ_HANDLER(automatic)(void *ctx,
+CTL_READ_HANDLER(freed)(void *ctx,
 	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
 {
 	PMEMobjpool *pop = ctx;
-	int *arg_out = arg;
-	unsigned arena_id;
 
-	struct ctl_index *idx = PMDK_SLIST_FIRST(indexes);
-	ASSERTeq(strcmp(idx->name, "arena_id"), 0);
-	arena_id = (unsigned)idx->value;
+	util_atomic_load64(&pop->free_batch->nfreed, (uint64_t *)arg);
 
-	unsigned narenas = heap_get_narenas_total(&pop->heap);
+	return 0;
+}
 
-	/*
-	 * check if index is not bigger than number of arenas
-	 * or if it is not equal zero
-	 */
-	if (arena_id < 1 || arena_id > narenas) {
-		LOG(1, "arena id outside of the allowed range: <1,%u>",
-			narenas);
-		errno = ERANGE;
-		return -1;
-	}
+static const struct ctl_node CTL_NODE(free_batch)[] = {
+	CTL_LEAF_RW(enabled, free_batch),
+	CTL_LEAF_RW(capacity, free_batch),
+	CTL_LEAF_RW(interval, free_batch),
+	CTL_LEAF_RUNNABLE(flush, free_batch),
+	CTL_LEAF_RO(batches),
+	CTL_LEAF_RO(freed),
 
-	*arg_out = heap_get_arena_auto(&pop->heap, arena_id);
+	CTL_NODE_END
+};
+
+/*
+ * CTL_READ_HANDLER(rate) -- reads how many allocations of a thread are made
+ *	per recorded sample
+ */
+static int
+CTL_READ_HANDLER(rate)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	ssize_t *arg_out = arg;
+
+	*arg_out = (ssize_t)heap_get_sample_rate(&pop->heap);
 
 	return 0;
 }
 
-static struct ctl_argument CTL_ARG(automatic) = CTL_ARG_BOOLEAN;
+/*
+ * CTL_WRITE_HANDLER(rate) -- changes how many allocations of a thread are
+ *	made per recorded sample, 0 disables the sampling
+ */
+static int
+CTL_WRITE_HANDLER(rate)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	ssize_t arg_in = *(ssize_t *)arg;
 
-static const struct ctl_node CTL_NODE(size)[] = {
-	CTL_LEAF_RW(granularity),
-	CTL_LEAF_RUNNABLE(extend),
+	if (arg_in < 0 || arg_in > UINT32_MAX) {
+		ERR("incorrect allocation sample rate %zd", arg_in);
+		errno = EINVAL;
+		return -1;
+	}
 
-	CTL_NODE_END
-};
+	return heap_set_sample_rate(&pop->heap, (unsigned)arg_in);
+}
+
+static const struct ctl_argument CTL_ARG(rate) = CTL_ARG_LONG_LONG;
 
 /*
- * CTL_READ_HANDLER(size) -- reads usable size of specified arena
+ * CTL_READ_HANDLER(capacity, sample) -- reads the number of samples kept
  */
 static int
-CTL_READ_HANDLER(size)(void *ctx,
+CTL_READ_HANDLER(capacity, sample)(void *ctx,
 	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
 {
 	PMEMobjpool *pop = ctx;
-	unsigned arena_id;
-	unsigned narenas;
-	size_t *arena_size = arg;
+	ssize_t *arg_out = arg;
 
-	struct ctl_index *idx = PMDK_SLIST_FIRST(indexes);
-	ASSERTeq(strcmp(idx->name, "arena_id"), 0);
+	*arg_out = (ssize_t)heap_get_sample_capacity(&pop->heap);
 
-	/* take index of arena */
-	arena_id = (unsigned)idx->value;
-	/* take number of arenas */
-	narenas = heap_get_narenas_total(&pop->heap);
+	return 0;
+}
 
-	/*
-	 * check if index is not bigger than number of arenas
-	 * or if it is not equal zero
-	 */
-	if (arena_id < 1 || arena_id > narenas) {
-		LOG(1, "arena id outside of the allowed range: <1,%u>",
-			narenas);
-		errno = ERANGE;
+/*
+ * CTL_WRITE_HANDLER(capacity, sample) -- changes the number of samples kept
+ */
+static int
+CTL_WRITE_HANDLER(capacity, sample)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	ssize_t arg_in = *(ssize_t *)arg;
+
+	if (arg_in <= 0) {
+		ERR("incorrect allocation sample capacity %zd", arg_in);
+		errno = EINVAL;
 		return -1;
 	}
 
-	/* take buckets for arena */
-	struct bucket **buckets;
-	buckets = heap_get_arena_buckets(&pop->heap, arena_id);
+	return heap_set_sample_capacity(&pop->heap, (uint64_t)arg_in);
+}
 
-	/* calculate number of reservation for arena using buckets */
-	unsigned size = 0;
-	for (int i = 0; i < MAX_ALLOCATION_CLASSES; ++i) {
-		if (buckets[i] != NULL && buckets[i]->is_active)
-			size += buckets[i]->active_memory_block->m.size_idx;
-	}
+/*
+ * CTL_READ_HANDLER(total, sample) -- reads the number of samples taken
+ */
+static int
+CTL_READ_HANDLER(total, sample)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
 
-	*arena_size = size * CHUNKSIZE;
+	*(uint64_t *)arg = heap_get_sample_total(&pop->heap);
 
 	return 0;
 }
 
 /*
- * CTL_RUNNABLE_HANDLER(create) -- create new arena in the heap
+ * CTL_RUNNABLE_HANDLER(dump) -- copies the most recent samples into the
+ *	provided buffer
  */
 static int
-CTL_RUNNABLE_HANDLER(create)(void *ctx,
+CTL_RUNNABLE_HANDLER(dump)(void *ctx,
 	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
 {
 	PMEMobjpool *pop = ctx;
-	unsigned *arena_id = arg;
-	struct palloc_heap *heap = &pop->heap;
+	struct pobj_alloc_samples *samples = arg;
 
-	int ret = heap_arena_create(heap);
-	if (ret < 0)
+	if (samples == NULL ||
+	    (samples->samples == NULL && samples->nsamples != 0)) {
+		ERR("invalid allocation samples buffer");
+		errno = EINVAL;
 		return -1;
+	}
 
-	*arena_id = (unsigned)ret;
+	samples->nsamples = heap_get_samples(&pop->heap, samples->samples,
+		samples->nsamples);
 
 	return 0;
 }
 
-static const struct ctl_node CTL_NODE(arena_id)[] = {
-	CTL_LEAF_RO(size),
-	CTL_LEAF_RW(automatic),
+static const struct ctl_node CTL_NODE(sample)[] = {
+	CTL_LEAF_RW(rate),
+	CTL_LEAF_RW(capacity, sample),
+	CTL_LEAF_RO(total, sample),
+	CTL_LEAF_RUNNABLE(dump),
 
 	CTL_NODE_END
 };
 
-static const struct ctl_node CTL_NODE(arena)[] = {
-	CTL_INDEXED(arena_id),
-	CTL_LEAF_RUNNABLE(create),
+/*
+ * CTL_READ_HANDLER(enabled, shared_runs) -- returns whether the blocks of
+ *	the active runs can be claimed without locking their bucket
+ */
+static int
+CTL_READ_HANDLER(enabled, shared_runs)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
 
-	CTL_NODE_END
-};
+	*(int *)arg = heap_get_shared_runs(&pop->heap);
 
-static const struct ctl_node CTL_NODE(narenas)[] = {
-	CTL_LEAF_RO(automatic, narenas),
-	CTL_LEAF_RO(total),
-	CTL_LEAF_RW(max),
+	return 0;
+}
 
-	CTL_NODE_END
-};
+/*
+ * CTL_WRITE_HANDLER(enabled, shared_runs) -- enables or disables claiming
+ *	the blocks of the active runs without locking their bucket
+ */
+static int
+CTL_WRITE_HANDLER(enabled, shared_runs)(void *ctx,
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
 
-static const struct ctl_node CTL_NODE(thread)[] = {
-	CTL_LEAF_RW(arena_id),
+	heap_set_shared_runs(&pop->heap, *(int *)arg);
+
+	return 0;
+}
+
+static const struct ctl_node CTL_NODE(shared_runs)[] = {
+	CTL_LEAF_RW(enabled, shared_runs),
 
 	CTL_NODE_END
 };
@@ -783,6 +3025,13 @@ static const struct ctl_node CTL_NODE(heap)[] = {
 	CTL_CHILD(size),
 	CTL_CHILD(thread),
 	CTL_CHILD(narenas),
+	CTL_CHILD(thread_cache),
+	CTL_CHILD(numa),
+	CTL_CHILD(defrag),
+	CTL_CHILD(punch_hole),
+	CTL_CHILD(free_batch),
+	CTL_CHILD(sample),
+	CTL_CHILD(shared_runs),
 
 	CTL_NODE_END
 };
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2015-2018, Intel Corporation */
+/* Copyright 2015-2020, Intel Corporation */
 
 /*
  * pmalloc.h -- internal definitions for persistent malloc
@@ -40,6 +40,12 @@ void pmalloc_operation_release(PMEMobjpool *pop);
 
 void pmalloc_ctl_register(PMEMobjpool *pop);
 
+void pmalloc_defrag_stop(PMEMobjpool *pop);
+void pmalloc_extender_stop(PMEMobjpool *pop);
+
+int pmalloc_free_batch_enqueue(PMEMobjpool *pop, uint64_t off);
+int pmalloc_free_batch_flush(PMEMobjpool *pop);
+
 int pmalloc_cleanup(PMEMobjpool *pop);
 int pmalloc_boot(PMEMobjpool *pop);
 
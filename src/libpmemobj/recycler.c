@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2016-2019, Intel Corporation */
+/* Copyright 2016-2020, Intel Corporation */
 
 /*
  * recycler.c -- implementation of run recycler
@@ -11,90 +11,192 @@
 #include "out.h"
 #include "util.h"
 #include "sys_util.h"
-#include "ravl.h"
+#include "critnib.h"
 #include "valgrind_internal.h"
 
-#define THRESHOLD_MUL 4
+/*
+ * Runs are kept on lists by the size of their largest free block, rounded down
+ * to a power of two, so that a run for a request is found by looking at the
+ * heads of a few lists. The first list holds the runs without free blocks
+ * and the last one the runs which became entirely free.
+ *
+ * The frees are counted on the elements of the runs without the recycler lock
+ * and folded into the free space of the runs, moving them between the lists,
+ * by recycler_recalc(). Both the frees and the insertion of a run into the
+ * recycler happen with the run lock held, so every free is accounted exactly
+ * once - either in the bitmap the element was calculated from or by
+ * recycler_on_free(). The forced recalculation only refreshes the values from
+ * the bitmaps.
+ *
+ * The free space is exact, but the largest free block is only a lower bound,
+ * the freed blocks are not merged with their free neighbours until the run
+ * is recalculated from its bitmap.
+ */
+#define RECYCLER_LIST_FULL 0
+#define RECYCLER_LIST_EMPTY 33
+#define RECYCLER_NLISTS 34
 
 /*
- * recycler_element_cmp -- compares two recycler elements
+ * Max number of runs inspected on the list that might contain runs too small
+ * for the request.
  */
-static int
-recycler_element_cmp(const void *lhs, const void *rhs)
+#define RECYCLER_MAX_SCAN 16
+
+/*
+ * Max number of runs inspected when looking for a sparsely occupied run.
+ */
+#define SPARSE_MAX_SCAN 64
+
+/*
+ * The blocks freed in a run since the last fold, the number of units in the
+ * low half and the size of the largest freed block in the high half.
+ */
+#define RECYCLER_FREED(units, max_block)\
+	((uint64_t)(max_block) << 32 | (units))
+#define RECYCLER_FREED_UNITS(freed) ((uint32_t)(freed))
+#define RECYCLER_FREED_MAX_BLOCK(freed) ((uint32_t)((freed) >> 32))
+
+struct recycler_run {
+	struct recycler_element e;
+	uint64_t freed; /* not yet folded frees, see recycler_on_free() */
+
+	struct recycler_run *prev;
+	struct recycler_run *next;
+	unsigned list;
+};
+
+struct recycler {
+	struct recycler_run *lists[RECYCLER_NLISTS];
+	struct critnib *runs; /* the runs by the position of their chunk */
+
+	struct palloc_heap *heap;
+	size_t nallocs;
+
+	int unfolded; /* set when any of the runs has frees to fold */
+
+	os_mutex_t lock;
+};
+
+/*
+ * recycler_run_key -- (internal) returns the key of the run in the recycler
+ */
+static inline uint64_t
+recycler_run_key(uint32_t zone_id, uint32_t chunk_id)
 {
-	const struct recycler_element *l = lhs;
-	const struct recycler_element *r = rhs;
+	return ((uint64_t)zone_id << 32) | chunk_id;
+}
 
-	int64_t diff = (int64_t)l->max_free_block - (int64_t)r->max_free_block;
-	if (diff != 0)
-		return diff > 0 ? 1 : -1;
+/*
+ * recycler_list_id -- (internal) returns the list on which the run with the
+ *	given free space belongs
+ */
+static unsigned
+recycler_list_id(struct recycler *r, const struct recycler_element *e)
+{
+	if (e->free_space >= r->nallocs)
+		return RECYCLER_LIST_EMPTY;
 
-	diff = (int64_t)l->free_space - (int64_t)r->free_space;
-	if (diff != 0)
-		return diff > 0 ? 1 : -1;
+	if (e->max_free_block == 0)
+		return RECYCLER_LIST_FULL;
 
-	diff = (int64_t)l->zone_id - (int64_t)r->zone_id;
-	if (diff != 0)
-		return diff > 0 ? 1 : -1;
+	return (unsigned)util_mssb_index(e->max_free_block) + 1;
+}
 
-	diff = (int64_t)l->chunk_id - (int64_t)r->chunk_id;
-	if (diff != 0)
-		return diff > 0 ? 1 : -1;
+/*
+ * recycler_link -- (internal) puts the run at the head of its list
+ */
+static void
+recycler_link(struct recycler *r, struct recycler_run *run)
+{
+	run->list = recycler_list_id(r, &run->e);
+	run->prev = NULL;
+	run->next = r->lists[run->list];
+	if (run->next != NULL)
+		run->next->prev = run;
+	r->lists[run->list] = run;
+}
 
-	return 0;
+/*
+ * recycler_unlink -- (internal) removes the run from its list
+ */
+static void
+recycler_unlink(struct recycler *r, struct recycler_run *run)
+{
+	if (run->prev != NULL)
+		run->prev->next = run->next;
+	else
+		r->lists[run->list] = run->next;
+
+	if (run->next != NULL)
+		run->next->prev = run->prev;
 }
 
-struct recycler {
-	struct ravl *runs;
-	struct palloc_heap *heap;
+/*
+ * recycler_take -- (internal) removes the run from the recycler and returns
+ *	its memory block
+ *
+ * The element of the run has to be freed with recycler_run_delete() once the
+ * recycler lock is released.
+ */
+static void
+recycler_take(struct recycler *r, struct recycler_run *run,
+	struct memory_block *m)
+{
+	recycler_unlink(r, run);
+	critnib_remove(r->runs, recycler_run_key(run->e.zone_id,
+		run->e.chunk_id));
 
-	/*
-	 * How many unaccounted units there *might* be inside of the memory
-	 * blocks stored in the recycler.
-	 * The value is not meant to be accurate, but rather a rough measure on
-	 * how often should the memory block scores be recalculated.
-	 *
-	 * Per-chunk unaccounted units are shared for all zones, which might
-	 * lead to some unnecessary recalculations.
-	 */
-	size_t unaccounted_units[MAX_CHUNK];
-	size_t unaccounted_total;
-	size_t nallocs;
-	size_t *peak_arenas;
+	m->chunk_id = run->e.chunk_id;
+	m->zone_id = run->e.zone_id;
 
-	VEC(, struct recycler_element) recalc;
+	struct chunk_header *hdr = heap_get_chunk_hdr(r->heap, m);
+	m->size_idx = hdr->size_idx;
 
-	os_mutex_t lock;
-};
+	memblock_rebuild_state(r->heap, m);
+}
+
+/*
+ * recycler_run_delete -- (internal) frees the element of a run taken out of
+ *	the recycler
+ *
+ * recycler_on_free() looks the elements up with only the lock of the run held,
+ * so the element is freed after that lock is released by all the threads which
+ * might have found it before it was taken.
+ */
+static void
+recycler_run_delete(struct recycler *r, struct recycler_run *run)
+{
+	os_mutex_t *lock = heap_get_run_lock(r->heap, run->e.chunk_id);
+	util_mutex_lock(lock);
+	util_mutex_unlock(lock);
+
+	Free(run);
+}
 
 /*
  * recycler_new -- creates new recycler instance
  */
 struct recycler *
-recycler_new(struct palloc_heap *heap, size_t nallocs, size_t *peak_arenas)
+recycler_new(struct palloc_heap *heap, size_t nallocs)
 {
 	struct recycler *r = Malloc(sizeof(struct recycler));
 	if (r == NULL)
 		goto error_alloc_recycler;
 
-	r->runs = ravl_new_sized(recycler_element_cmp,
-		sizeof(struct recycler_element));
+	r->runs = critnib_new();
 	if (r->runs == NULL)
-		goto error_alloc_tree;
+		goto error_alloc_runs;
 
+	memset(r->lists, 0, sizeof(r->lists));
 	r->heap = heap;
 	r->nallocs = nallocs;
-	r->peak_arenas = peak_arenas;
-	r->unaccounted_total = 0;
-	memset(&r->unaccounted_units, 0, sizeof(r->unaccounted_units));
-
-	VEC_INIT(&r->recalc);
+	r->unfolded = 0;
 
 	util_mutex_init(&r->lock);
 
 	return r;
 
-error_alloc_tree:
+error_alloc_runs:
 	Free(r);
 error_alloc_recycler:
 	return NULL;
@@ -106,10 +208,17 @@ error_alloc_recycler:
 void
 recycler_delete(struct recycler *r)
 {
-	VEC_DELETE(&r->recalc);
+	for (unsigned i = 0; i < RECYCLER_NLISTS; ++i) {
+		struct recycler_run *run = r->lists[i];
+		while (run != NULL) {
+			struct recycler_run *next = run->next;
+			Free(run);
+			run = next;
+		}
+	}
 
 	util_mutex_destroy(&r->lock);
-	ravl_delete(r->runs);
+	critnib_delete(r->runs);
 	Free(r);
 }
 
@@ -146,158 +255,341 @@ recycler_element_new(struct palloc_heap *heap, const struct memory_block *m)
 
 /*
  * recycler_put -- inserts new run into the recycler
+ *
+ * Must be called with the lock of the run taken, the element has to be
+ * calculated under the same lock.
  */
 int
 recycler_put(struct recycler *r, const struct memory_block *m,
 	struct recycler_element element)
 {
-	int ret = 0;
+	struct recycler_run *run = Malloc(sizeof(*run));
+	if (run == NULL)
+		return -1;
+
+	run->e = element;
+	run->freed = 0;
 
 	util_mutex_lock(&r->lock);
 
-	ret = ravl_emplace_copy(r->runs, &element);
+	int ret = critnib_insert(r->runs,
+		recycler_run_key(element.zone_id, element.chunk_id), run);
+	if (ret != 0) {
+		Free(run);
+		errno = ret;
+		ret = -1;
+		goto out;
+	}
+
+	recycler_link(r, run);
 
+out:
 	util_mutex_unlock(&r->lock);
 
 	return ret;
 }
 
+/*
+ * recycler_element_cmp -- (internal) orders the runs from the most occupied
+ *	one, ties are broken by the position of the runs
+ */
+static int
+recycler_element_cmp(const struct recycler_element *lhs,
+	const struct recycler_element *rhs)
+{
+	if (lhs->max_free_block != rhs->max_free_block)
+		return lhs->max_free_block < rhs->max_free_block ? -1 : 1;
+
+	if (lhs->free_space != rhs->free_space)
+		return lhs->free_space < rhs->free_space ? -1 : 1;
+
+	uint64_t lkey = recycler_run_key(lhs->zone_id, lhs->chunk_id);
+	uint64_t rkey = recycler_run_key(rhs->zone_id, rhs->chunk_id);
+	if (lkey != rkey)
+		return lkey < rkey ? -1 : 1;
+
+	return 0;
+}
+
+/*
+ * recycler_best_fit -- (internal) returns the most occupied run, out of the
+ *	first few on the list, which fits the request
+ */
+static struct recycler_run *
+recycler_best_fit(struct recycler_run *run, uint32_t units)
+{
+	struct recycler_run *best = NULL;
+
+	for (int i = 0; run != NULL && i < RECYCLER_MAX_SCAN;
+	    run = run->next, ++i) {
+		if (run->e.max_free_block < units)
+			continue;
+
+		if (best == NULL || recycler_element_cmp(&run->e, &best->e) < 0)
+			best = run;
+	}
+
+	return best;
+}
+
 /*
  * recycler_get -- retrieves a chunk from the recycler
+ *
+ * Only the list of the request size class might contain runs which are too
+ * small, the runs on the following lists always fit, so the search is
+ * bounded by the number of lists.
  */
 int
 recycler_get(struct recycler *r, struct memory_block *m)
 {
 	int ret = 0;
+	uint32_t units = m->size_idx;
 
 	util_mutex_lock(&r->lock);
 
-	struct recycler_element e = { .max_free_block = m->size_idx, 0, 0, 0};
-	struct ravl_node *n = ravl_find(r->runs, &e,
-		RAVL_PREDICATE_GREATER_EQUAL);
-	if (n == NULL) {
-		ret = ENOMEM;
-		goto out;
-	}
+	struct recycler_element e = { .max_free_block = units, 0, 0, 0};
+	unsigned list = recycler_list_id(r, &e);
 
-	struct recycler_element *ne = ravl_data(n);
-	m->chunk_id = ne->chunk_id;
-	m->zone_id = ne->zone_id;
+	struct recycler_run *run = NULL;
+	for (; run == NULL && list < RECYCLER_LIST_EMPTY; ++list)
+		run = recycler_best_fit(r->lists[list], units);
 
-	ravl_remove(r->runs, n);
+	if (run == NULL && units <= r->nallocs)
+		run = r->lists[RECYCLER_LIST_EMPTY];
 
-	struct chunk_header *hdr = heap_get_chunk_hdr(r->heap, m);
-	m->size_idx = hdr->size_idx;
+	if (run == NULL) {
+		ret = ENOMEM;
+		goto out;
+	}
 
-	memblock_rebuild_state(r->heap, m);
+	recycler_take(r, run, m);
 
 out:
 	util_mutex_unlock(&r->lock);
 
+	if (run != NULL)
+		recycler_run_delete(r, run);
+
 	return ret;
 }
 
 /*
- * recycler_recalc -- recalculates the scores of runs in the recycler to match
- *	the updated persistent state
+ * recycler_get_sparse -- retrieves a run whose occupancy doesn't exceed
+ *	max_fill_pct percent from the recycler
+ *
+ * The search begins at the list of the runs with the largest free blocks,
+ * where the sparsely occupied runs are most likely to be found, and is bounded
+ * to keep the recycler lock hold time low.
  */
-struct empty_runs
-recycler_recalc(struct recycler *r, int force)
+int
+recycler_get_sparse(struct recycler *r, unsigned max_fill_pct,
+	struct memory_block *m)
 {
-	struct empty_runs runs;
-	VEC_INIT(&runs);
+	int ret = ENOMEM;
+	struct recycler_run *run = NULL;
 
-	uint64_t units = r->unaccounted_total;
+	uint64_t min_free_space = r->nallocs -
+		r->nallocs * MIN(max_fill_pct, 100) / 100;
 
-	size_t peak_arenas;
-	util_atomic_load64(r->peak_arenas, &peak_arenas);
+	util_mutex_lock(&r->lock);
 
-	uint64_t recalc_threshold =
-		THRESHOLD_MUL * peak_arenas * r->nallocs;
+	int scanned = 0;
+	for (unsigned list = RECYCLER_NLISTS; list != 0 &&
+	    scanned < SPARSE_MAX_SCAN; --list) {
+		run = r->lists[list - 1];
+		for (; run != NULL && scanned < SPARSE_MAX_SCAN;
+		    run = run->next, ++scanned) {
+			if (run->e.free_space >= min_free_space) {
+				recycler_take(r, run, m);
+				ret = 0;
+				goto out;
+			}
+		}
+	}
 
-	if (!force && units < recalc_threshold)
-		return runs;
+out:
+	util_mutex_unlock(&r->lock);
 
-	if (util_mutex_trylock(&r->lock) != 0)
-		return runs;
+	if (ret == 0)
+		recycler_run_delete(r, run);
 
-	/* If the search is forced, recalculate everything */
-	uint64_t search_limit = force ? UINT64_MAX : units;
+	return ret;
+}
 
-	uint64_t found_units = 0;
-	struct memory_block nm = MEMORY_BLOCK_NONE;
-	struct ravl_node *n;
-	struct recycler_element next = {0, 0, 0, 0};
-	enum ravl_predicate p = RAVL_PREDICATE_GREATER_EQUAL;
-	do {
-		if ((n = ravl_find(r->runs, &next, p)) == NULL)
-			break;
+/*
+ * Position of a run in the recycler.
+ */
+struct recycler_pos {
+	uint32_t chunk_id;
+	uint32_t zone_id;
+};
 
-		p = RAVL_PREDICATE_GREATER;
+/*
+ * recycler_recalc_all -- (internal) recalculates the free space of all runs
+ *	in the recycler from their bitmaps
+ *
+ * The run lock has to be taken before the recycler one, like on free, so the
+ * runs are only looked up in the recycler once their locks are held, to skip
+ * the ones which were taken out of the recycler in the meantime.
+ */
+static void
+recycler_recalc_all(struct recycler *r)
+{
+	VEC(, struct recycler_pos) positions;
+	VEC_INIT(&positions);
 
-		struct recycler_element *ne = ravl_data(n);
-		next = *ne;
+	util_mutex_lock(&r->lock);
 
-		uint64_t chunk_units = r->unaccounted_units[ne->chunk_id];
-		if (!force && chunk_units == 0)
+	for (unsigned i = 0; i < RECYCLER_NLISTS; ++i) {
+		if (i == RECYCLER_LIST_EMPTY)
 			continue;
 
-		uint32_t existing_free_space = ne->free_space;
+		struct recycler_run *run;
+		for (run = r->lists[i]; run != NULL; run = run->next) {
+			struct recycler_pos pos = {
+				run->e.chunk_id, run->e.zone_id
+			};
+			if (VEC_PUSH_BACK(&positions, pos) != 0)
+				break;
+		}
+	}
 
-		nm.chunk_id = ne->chunk_id;
-		nm.zone_id = ne->zone_id;
-		memblock_rebuild_state(r->heap, &nm);
+	util_mutex_unlock(&r->lock);
 
-		struct recycler_element e = recycler_element_new(r->heap, &nm);
+	struct recycler_pos *pos;
+	VEC_FOREACH_BY_PTR(pos, &positions) {
+		os_mutex_t *lock = heap_get_run_lock(r->heap, pos->chunk_id);
+		util_mutex_lock(lock);
+		util_mutex_lock(&r->lock);
+
+		struct recycler_run *run = critnib_get(r->runs,
+			recycler_run_key(pos->zone_id, pos->chunk_id));
+		if (run != NULL) {
+			struct memory_block m = MEMORY_BLOCK_NONE;
+			m.chunk_id = pos->chunk_id;
+			m.zone_id = pos->zone_id;
+			memblock_rebuild_state(r->heap, &m);
+
+			uint32_t free_space = 0;
+			uint32_t max_free_block = 0;
+			m.m_ops->calc_free(&m, &free_space, &max_free_block);
+
+			recycler_unlink(r, run);
+			run->e.free_space = free_space;
+			run->e.max_free_block = max_free_block;
+			util_atomic_store_explicit64(&run->freed, 0,
+				memory_order_relaxed);
+			recycler_link(r, run);
+		}
 
-		ASSERT(e.free_space >= existing_free_space);
-		uint64_t free_space_diff = e.free_space - existing_free_space;
-		found_units += free_space_diff;
+		util_mutex_unlock(&r->lock);
+		util_mutex_unlock(lock);
+	}
 
-		if (free_space_diff == 0)
-			continue;
+	VEC_DELETE(&positions);
+}
 
-		/*
-		 * Decrease the per chunk_id counter by the number of nallocs
-		 * found, increased by the blocks potentially freed in the
-		 * active memory block. Cap the sub value to prevent overflow.
-		 */
-		util_fetch_and_sub64(&r->unaccounted_units[nm.chunk_id],
-			MIN(chunk_units, free_space_diff + r->nallocs));
-
-		ravl_remove(r->runs, n);
-
-		if (e.free_space == r->nallocs) {
-			memblock_rebuild_state(r->heap, &nm);
-			if (VEC_PUSH_BACK(&runs, nm) != 0)
-				ASSERT(0); /* XXX: fix after refactoring */
-		} else {
-			VEC_PUSH_BACK(&r->recalc, e);
+/*
+ * recycler_fold -- (internal) folds the frees counted since the last fold
+ *	into the free space of the runs
+ *
+ * The runs only move to the lists of larger free blocks, which are visited
+ * later, with the frees of the already folded runs cleared.
+ */
+static void
+recycler_fold(struct recycler *r)
+{
+	for (unsigned i = 0; i < RECYCLER_LIST_EMPTY; ++i) {
+		struct recycler_run *next;
+		for (struct recycler_run *run = r->lists[i]; run != NULL;
+		    run = next) {
+			next = run->next;
+
+			uint64_t freed = util_fetch_and_and64(&run->freed, 0);
+			if (freed == 0)
+				continue;
+
+			struct recycler_element *e = &run->e;
+			recycler_unlink(r, run);
+			e->free_space += RECYCLER_FREED_UNITS(freed);
+			e->max_free_block = MAX(e->max_free_block,
+				RECYCLER_FREED_MAX_BLOCK(freed));
+			recycler_link(r, run);
 		}
-	} while (found_units < search_limit);
-
-	struct recycler_element *e;
-	VEC_FOREACH_BY_PTR(e, &r->recalc) {
-		ravl_emplace_copy(r->runs, e);
 	}
+}
 
-	VEC_CLEAR(&r->recalc);
+/*
+ * recycler_recalc -- takes the runs which became empty out of the recycler,
+ *	if forced, first recalculates the free space of all runs
+ */
+struct empty_runs
+recycler_recalc(struct recycler *r, int force)
+{
+	struct empty_runs runs;
+	VEC_INIT(&runs);
+
+	if (force)
+		recycler_recalc_all(r);
+
+	struct recycler_run *taken = NULL;
+
+	util_mutex_lock(&r->lock);
+
+	/* the flag is cleared first, not to miss the frees counted meanwhile */
+	if (util_fetch_and_and32(&r->unfolded, 0))
+		recycler_fold(r);
+
+	struct recycler_run *run;
+	while ((run = r->lists[RECYCLER_LIST_EMPTY]) != NULL) {
+		struct memory_block m = MEMORY_BLOCK_NONE;
+		if (VEC_PUSH_BACK(&runs, m) != 0)
+			break;
+
+		recycler_take(r, run, &VEC_BACK(&runs));
+		run->next = taken;
+		taken = run;
+	}
 
 	util_mutex_unlock(&r->lock);
 
-	util_fetch_and_sub64(&r->unaccounted_total, units);
+	while ((run = taken) != NULL) {
+		taken = run->next;
+		recycler_run_delete(r, run);
+	}
 
 	return runs;
 }
 
 /*
- * recycler_inc_unaccounted -- increases the number of unaccounted units in the
+ * recycler_on_free -- accounts a block freed in a run, if the run is in the
  *	recycler
+ *
+ * Must be called with the lock of the run taken, which serializes the frees
+ * of the run, so only the fold can change the counter concurrently. Neither
+ * the lookup nor the update of the counter take the recycler lock.
  */
 void
-recycler_inc_unaccounted(struct recycler *r, const struct memory_block *m)
+recycler_on_free(struct recycler *r, const struct memory_block *m)
 {
-	util_fetch_and_add64(&r->unaccounted_total, m->size_idx);
-	util_fetch_and_add64(&r->unaccounted_units[m->chunk_id],
-		m->size_idx);
+	struct recycler_run *run = critnib_get(r->runs,
+		recycler_run_key(m->zone_id, m->chunk_id));
+	if (run == NULL)
+		return;
+
+	uint64_t freed;
+	uint64_t nfreed;
+	do {
+		util_atomic_load64(&run->freed, &freed);
+		nfreed = RECYCLER_FREED(
+			RECYCLER_FREED_UNITS(freed) + m->size_idx,
+			MAX(RECYCLER_FREED_MAX_BLOCK(freed), m->size_idx));
+	} while (!util_bool_compare_and_swap64(&run->freed, freed, nfreed));
+
+	int unfolded;
+	util_atomic_load_explicit32(&r->unfolded, &unfolded,
+		memory_order_acquire);
+	if (!unfolded)
+		util_atomic_store_explicit32(&r->unfolded, 1,
+			memory_order_release);
 }
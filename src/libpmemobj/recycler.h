@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2016-2019, Intel Corporation */
+/* Copyright 2016-2020, Intel Corporation */
 
 /*
  * recycler.h -- internal definitions of run recycler
@@ -29,8 +29,7 @@ struct recycler_element {
 	uint32_t zone_id;
 };
 
-struct recycler *recycler_new(struct palloc_heap *layout,
-	size_t nallocs, size_t *peak_arenas);
+struct recycler *recycler_new(struct palloc_heap *layout, size_t nallocs);
 void recycler_delete(struct recycler *r);
 struct recycler_element recycler_element_new(struct palloc_heap *heap,
 	const struct memory_block *m);
@@ -40,10 +39,12 @@ int recycler_put(struct recycler *r, const struct memory_block *m,
 
 int recycler_get(struct recycler *r, struct memory_block *m);
 
+int recycler_get_sparse(struct recycler *r, unsigned max_fill_pct,
+	struct memory_block *m);
+
 struct empty_runs recycler_recalc(struct recycler *r, int force);
 
-void recycler_inc_unaccounted(struct recycler *r,
-	const struct memory_block *m);
+void recycler_on_free(struct recycler *r, const struct memory_block *m);
 
 #ifdef __cplusplus
 }
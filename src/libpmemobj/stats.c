@@ -1,22 +1,173 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2017-2019, Intel Corporation */
+/* Copyright 2017-2020, Intel Corporation */
 
 /*
  * stats.c -- implementation of statistics
  */
 
 #include "obj.h"
+#include "alloc_class.h"
+#include "heap.h"
 #include "stats.h"
 
 STATS_CTL_HANDLER(persistent, curr_allocated, heap_curr_allocated);
 
 STATS_CTL_HANDLER(transient, run_allocated, heap_run_allocated);
 STATS_CTL_HANDLER(transient, run_active, heap_run_active);
+STATS_CTL_HANDLER(transient, zones_populated, heap_zones_populated);
+
+STATS_CTL_HANDLER(transient, range_lines, tx_range_lines);
+STATS_CTL_HANDLER(transient, flushed_lines, tx_flushed_lines);
+STATS_CTL_HANDLER(transient, lazy_pages, tx_lazy_pages);
+STATS_CTL_HANDLER(transient, log_extends, tx_log_extends);
+STATS_CTL_HANDLER(transient, log_frees, tx_log_frees);
+
+STATS_CTL_HANDLER(transient, waits, lane_waits);
+STATS_CTL_HANDLER(transient, wait_time, lane_wait_time);
+
+/*
+ * stats_class_read -- (internal) reads the statistics of the indexed
+ *	allocation class
+ */
+static int
+stats_class_read(PMEMobjpool *pop, struct ctl_indexes *indexes,
+	struct heap_class_stats *s)
+{
+	struct ctl_index *idx = PMDK_SLIST_FIRST(indexes);
+	ASSERTeq(strcmp(idx->name, "class_id"), 0);
+
+	if (idx->value < 0 || idx->value >= MAX_ALLOCATION_CLASSES) {
+		ERR("class id outside of the allowed range");
+		errno = ERANGE;
+		return -1;
+	}
+
+	return heap_get_class_stats(&pop->heap, (uint8_t)idx->value, s);
+}
+
+#define STATS_CLASS_CTL_HANDLER(name)\
+static int CTL_READ_HANDLER(name, class)(void *ctx,\
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)\
+{\
+	struct heap_class_stats s;\
+	if (stats_class_read(ctx, indexes, &s) != 0)\
+		return -1;\
+	uint64_t *argv = arg;\
+	*argv = s.name;\
+	return 0;\
+}
+
+STATS_CLASS_CTL_HANDLER(allocations);
+STATS_CLASS_CTL_HANDLER(frees);
+STATS_CLASS_CTL_HANDLER(live_bytes);
+STATS_CLASS_CTL_HANDLER(runs);
+STATS_CLASS_CTL_HANDLER(free_blocks);
+STATS_CLASS_CTL_HANDLER(lock_waits);
+STATS_CLASS_CTL_HANDLER(claims);
+
+static const struct ctl_node CTL_NODE(class_id)[] = {
+	CTL_LEAF_RO(allocations, class),
+	CTL_LEAF_RO(frees, class),
+	CTL_LEAF_RO(live_bytes, class),
+	CTL_LEAF_RO(runs, class),
+	CTL_LEAF_RO(free_blocks, class),
+	CTL_LEAF_RO(lock_waits, class),
+	CTL_LEAF_RO(claims, class),
+
+	CTL_NODE_END
+};
+
+static const struct ctl_node CTL_NODE(class)[] = {
+	CTL_INDEXED(class_id),
+
+	CTL_NODE_END
+};
+
+/*
+ * stats_arena_read -- (internal) reads the statistics of the indexed arena
+ */
+static int
+stats_arena_read(PMEMobjpool *pop, struct ctl_indexes *indexes,
+	struct heap_arena_stats *s)
+{
+	struct ctl_index *idx = PMDK_SLIST_FIRST(indexes);
+	ASSERTeq(strcmp(idx->name, "arena_id"), 0);
+
+	if (idx->value < 1 || idx->value > UINT32_MAX) {
+		ERR("arena id outside of the allowed range");
+		errno = ERANGE;
+		return -1;
+	}
+
+	return heap_get_arena_stats(&pop->heap, (unsigned)idx->value, s);
+}
+
+#define STATS_ARENA_CTL_HANDLER(name)\
+static int CTL_READ_HANDLER(name, arena)(void *ctx,\
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)\
+{\
+	struct heap_arena_stats s;\
+	if (stats_arena_read(ctx, indexes, &s) != 0)\
+		return -1;\
+	uint64_t *argv = arg;\
+	*argv = s.name;\
+	return 0;\
+}
+
+STATS_ARENA_CTL_HANDLER(allocations);
+STATS_ARENA_CTL_HANDLER(frees);
+STATS_ARENA_CTL_HANDLER(live_bytes);
+STATS_ARENA_CTL_HANDLER(lock_waits);
+STATS_ARENA_CTL_HANDLER(claims);
+
+static const struct ctl_node CTL_NODE(arena_id)[] = {
+	CTL_LEAF_RO(allocations, arena),
+	CTL_LEAF_RO(frees, arena),
+	CTL_LEAF_RO(live_bytes, arena),
+	CTL_LEAF_RO(lock_waits, arena),
+	CTL_LEAF_RO(claims, arena),
+
+	CTL_NODE_END
+};
+
+static const struct ctl_node CTL_NODE(arena)[] = {
+	CTL_INDEXED(arena_id),
+
+	CTL_NODE_END
+};
+
+#define STATS_HUGE_CTL_HANDLER(name)\
+static int CTL_READ_HANDLER(name, huge)(void *ctx,\
+	enum ctl_query_source source, void *arg, struct ctl_indexes *indexes)\
+{\
+	PMEMobjpool *pop = ctx;\
+	struct heap_huge_stats s;\
+	heap_get_huge_stats(&pop->heap, &s);\
+	uint64_t *argv = arg;\
+	*argv = s.name;\
+	return 0;\
+}
+
+STATS_HUGE_CTL_HANDLER(free_bytes);
+STATS_HUGE_CTL_HANDLER(largest_free);
+STATS_HUGE_CTL_HANDLER(fragmentation);
+
+static const struct ctl_node CTL_NODE(huge)[] = {
+	CTL_LEAF_RO(free_bytes, huge),
+	CTL_LEAF_RO(largest_free, huge),
+	CTL_LEAF_RO(fragmentation, huge),
+
+	CTL_NODE_END
+};
 
 static const struct ctl_node CTL_NODE(heap)[] = {
 	STATS_CTL_LEAF(persistent, curr_allocated),
 	STATS_CTL_LEAF(transient, run_allocated),
 	STATS_CTL_LEAF(transient, run_active),
+	STATS_CTL_LEAF(transient, zones_populated),
+	CTL_CHILD(class),
+	CTL_CHILD(arena),
+	CTL_CHILD(huge),
 
 	CTL_NODE_END
 };
@@ -96,8 +247,27 @@ static const struct ctl_argument CTL_ARG(enabled) = {
 	}
 };
 
+static const struct ctl_node CTL_NODE(tx)[] = {
+	STATS_CTL_LEAF(transient, range_lines),
+	STATS_CTL_LEAF(transient, flushed_lines),
+	STATS_CTL_LEAF(transient, lazy_pages),
+	STATS_CTL_LEAF(transient, log_extends),
+	STATS_CTL_LEAF(transient, log_frees),
+
+	CTL_NODE_END
+};
+
+static const struct ctl_node CTL_NODE(lane)[] = {
+	STATS_CTL_LEAF(transient, waits),
+	STATS_CTL_LEAF(transient, wait_time),
+
+	CTL_NODE_END
+};
+
 static const struct ctl_node CTL_NODE(stats)[] = {
 	CTL_CHILD(heap),
+	CTL_CHILD(tx),
+	CTL_CHILD(lane),
 	CTL_LEAF_RW(enabled),
 
 	CTL_NODE_END
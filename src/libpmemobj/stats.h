@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2017-2019, Intel Corporation */
+/* Copyright 2017-2020, Intel Corporation */
 
 /*
  * stats.h -- definitions of statistics
@@ -18,6 +18,14 @@ extern "C" {
 struct stats_transient {
 	uint64_t heap_run_allocated;
 	uint64_t heap_run_active;
+	uint64_t heap_zones_populated;
+	uint64_t tx_range_lines;
+	uint64_t tx_flushed_lines;
+	uint64_t tx_lazy_pages;
+	uint64_t tx_log_extends;
+	uint64_t tx_log_frees;
+	uint64_t lane_waits;
+	uint64_t lane_wait_time;
 };
 
 struct stats_persistent {
@@ -30,19 +38,27 @@ struct stats {
 	struct stats_persistent *persistent;
 };
 
+#define STATS_ENABLED(stats, type) STATS_ENABLED_##type(stats)
+
+#define STATS_ENABLED_transient(stats)\
+((stats)->enabled == POBJ_STATS_ENABLED_TRANSIENT ||\
+(stats)->enabled == POBJ_STATS_ENABLED_BOTH)
+
+#define STATS_ENABLED_persistent(stats)\
+((stats)->enabled == POBJ_STATS_ENABLED_PERSISTENT ||\
+(stats)->enabled == POBJ_STATS_ENABLED_BOTH)
+
 #define STATS_INC(stats, type, name, value) do {\
 	STATS_INC_##type(stats, name, value);\
 } while (0)
 
 #define STATS_INC_transient(stats, name, value) do {\
-	if ((stats)->enabled == POBJ_STATS_ENABLED_TRANSIENT ||\
-	(stats)->enabled == POBJ_STATS_ENABLED_BOTH)\
+	if (STATS_ENABLED_transient(stats))\
 		util_fetch_and_add64((&(stats)->transient->name), (value));\
 } while (0)
 
 #define STATS_INC_persistent(stats, name, value) do {\
-	if ((stats)->enabled == POBJ_STATS_ENABLED_PERSISTENT ||\
-	(stats)->enabled == POBJ_STATS_ENABLED_BOTH)\
+	if (STATS_ENABLED_persistent(stats))\
 		util_fetch_and_add64((&(stats)->persistent->name), (value));\
 } while (0)
 
@@ -51,14 +67,12 @@ struct stats {
 } while (0)
 
 #define STATS_SUB_transient(stats, name, value) do {\
-	if ((stats)->enabled == POBJ_STATS_ENABLED_TRANSIENT ||\
-	(stats)->enabled == POBJ_STATS_ENABLED_BOTH)\
+	if (STATS_ENABLED_transient(stats))\
 		util_fetch_and_sub64((&(stats)->transient->name), (value));\
 } while (0)
 
 #define STATS_SUB_persistent(stats, name, value) do {\
-	if ((stats)->enabled == POBJ_STATS_ENABLED_PERSISTENT ||\
-	(stats)->enabled == POBJ_STATS_ENABLED_BOTH)\
+	if (STATS_ENABLED_persistent(stats))\
 		util_fetch_and_sub64((&(stats)->persistent->name), (value));\
 } while (0)
 
@@ -67,15 +81,13 @@ struct stats {
 } while (0)
 
 #define STATS_SET_transient(stats, name, value) do {\
-	if ((stats)->enabled == POBJ_STATS_ENABLED_TRANSIENT ||\
-	(stats)->enabled == POBJ_STATS_ENABLED_BOTH)\
+	if (STATS_ENABLED_transient(stats))\
 		util_atomic_store_explicit64((&(stats)->transient->name),\
 		(value), memory_order_release);\
 } while (0)
 
 #define STATS_SET_persistent(stats, name, value) do {\
-	if ((stats)->enabled == POBJ_STATS_ENABLED_PERSISTENT ||\
-	(stats)->enabled == POBJ_STATS_ENABLED_BOTH)\
+	if (STATS_ENABLED_persistent(stats))\
 		util_atomic_store_explicit64((&(stats)->persistent->name),\
 		(value), memory_order_release);\
 } while (0)
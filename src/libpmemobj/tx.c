@@ -7,6 +7,9 @@
 
 #include <inttypes.h>
 #include <wchar.h>
+#ifndef _WIN32
+#include <signal.h>
+#endif
 
 #include "queue.h"
 #include "ravl.h"
@@ -14,8 +17,13 @@
 #include "out.h"
 #include "pmalloc.h"
 #include "tx.h"
+#include "os.h"
 #include "valgrind_internal.h"
 #include "memops.h"
+#include "mmap.h"
+#include "set.h"
+#include "sys_util.h"
+#include "vecq.h"
 
 struct tx_data {
 	PMDK_SLIST_ENTRY(tx_data) tx_entry;
@@ -23,6 +31,13 @@ struct tx_data {
 	enum pobj_tx_failure_behavior failure_behavior;
 };
 
+struct tx_durable_cb {
+	pmemobj_tx_durable_cb cb;
+	void *arg;
+};
+
+VEC(tx_durable_cbs, struct tx_durable_cb);
+
 struct tx {
 	PMEMobjpool *pop;
 	enum pobj_tx_stage stage;
@@ -33,6 +48,11 @@ struct tx {
 
 	struct ravl *ranges;
 
+	struct ravl *shadows; /* shadow copies of ranges, created on demand */
+	size_t shadows_nbytes; /* redo log space needed by the shadows */
+
+	struct ravl *lazy; /* write-protected pages, snapshotted on demand */
+
 	VEC(, struct pobj_action) actions;
 	VEC(, struct user_buffer_def) redo_userbufs;
 	size_t redo_userbufs_capacity;
@@ -40,6 +60,12 @@ struct tx {
 	pmemobj_tx_callback stage_callback;
 	void *stage_callback_arg;
 
+	/* called once the outermost transaction is durable */
+	struct tx_durable_cbs durable_cbs;
+
+	/* counted as a possible member of a group commit */
+	int group_running;
+
 	int first_snapshot;
 
 	void *user_data;
@@ -101,6 +127,196 @@ tx_range_def_cmp(const void *lhs, const void *rhs)
 	return 0;
 }
 
+/*
+ * Volatile copy of a persistent memory range, modified instead of the range
+ * itself and written back through the redo log at commit.
+ */
+struct tx_shadow {
+	uint64_t offset;
+	uint64_t size;
+	void *data;
+};
+
+/*
+ * tx_shadow_cmp -- compares two shadow copies
+ */
+static int
+tx_shadow_cmp(const void *lhs, const void *rhs)
+{
+	const struct tx_shadow *l = lhs;
+	const struct tx_shadow *r = rhs;
+
+	if (l->offset > r->offset)
+		return 1;
+	else if (l->offset < r->offset)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * The state of an asynchronously committed transaction, handed over to
+ * a post-commit worker together with its lane. The worker flushes the ranges,
+ * drains them and processes the redo log, which invalidates the undo log of
+ * the lane. Until then, the ranges can still be rolled back by the recovery,
+ * so other transactions have to wait before snapshotting any of them.
+ */
+struct tx_async_commit {
+	uint64_t ticket; /* order in which the commits become durable */
+	struct ravl *ranges;
+	VEC(, struct pobj_action) actions;
+	struct tx_durable_cbs durable_cbs;
+};
+
+/*
+ * A lane, locked by a committed transaction, that waits for the post-commit
+ * cleanup, or for the whole commit if the transaction was committed
+ * asynchronously.
+ */
+struct tx_post_commit_entry {
+	uint64_t lane_idx;
+	struct tx_async_commit *async; /* NULL for synchronous commits */
+};
+
+/*
+ * Queue of lanes, locked by committed transactions, that wait for the
+ * post-commit cleanup to be performed by one of the worker threads.
+ */
+struct tx_post_commit {
+	os_mutex_t lock;
+	os_cond_t cond; /* signaled when a lane is queued or workers stop */
+	os_cond_t stopped; /* signaled when a worker returns */
+
+	VECQ(, struct tx_post_commit_entry) lanes;
+	unsigned depth; /* maximum number of queued lanes */
+	unsigned nworkers; /* number of running workers */
+	int stop;
+
+	/* asynchronous commits which are not durable yet, in ticket order */
+	VECQ(, struct tx_async_commit *) pending;
+	os_cond_t durable_cond; /* signaled when an async commit is durable */
+	uint64_t tickets; /* ticket of the last asynchronous commit */
+	uint64_t durable; /* ticket of the last durable asynchronous commit */
+
+	uint64_t queued; /* commits that deferred the cleanup to workers */
+	uint64_t overflows; /* commits done inline because the queue was full */
+	uint64_t async_commits; /* commits completed by the workers */
+};
+
+/*
+ * tx_post_commit_new -- (internal) creates a new post-commit queue
+ */
+static struct tx_post_commit *
+tx_post_commit_new(void)
+{
+	struct tx_post_commit *pc = Malloc(sizeof(*pc));
+	if (pc == NULL)
+		return NULL;
+
+	util_mutex_init(&pc->lock);
+	util_cond_init(&pc->cond);
+	util_cond_init(&pc->stopped);
+	VECQ_INIT(&pc->lanes);
+	pc->depth = 0;
+	pc->nworkers = 0;
+	pc->stop = 0;
+	VECQ_INIT(&pc->pending);
+	util_cond_init(&pc->durable_cond);
+	pc->tickets = 0;
+	pc->durable = 0;
+	pc->queued = 0;
+	pc->overflows = 0;
+	pc->async_commits = 0;
+
+	return pc;
+}
+
+/*
+ * tx_post_commit_delete -- (internal) deletes the post-commit queue
+ */
+static void
+tx_post_commit_delete(struct tx_post_commit *pc)
+{
+	ASSERTeq(pc->nworkers, 0);
+	ASSERTeq(VECQ_SIZE(&pc->lanes), 0);
+	ASSERTeq(VECQ_SIZE(&pc->pending), 0);
+
+	VECQ_DELETE(&pc->pending);
+	util_cond_destroy(&pc->durable_cond);
+	VECQ_DELETE(&pc->lanes);
+	util_cond_destroy(&pc->stopped);
+	util_cond_destroy(&pc->cond);
+	util_mutex_destroy(&pc->lock);
+	Free(pc);
+}
+
+/*
+ * Concurrently committing transactions are gathered in groups, during a
+ * configurable time window, by the first committer of the group. The window
+ * ends early once no other transaction that could still join is running.
+ * The leader then flushes the modified ranges of all members and issues
+ * a single drain on their behalf. The redo log of each member, and the
+ * fences it needs, are still processed by the member itself.
+ */
+#define TX_GROUP_COMMIT_WINDOW_MAX 1000000 /* 1 second */
+
+struct tx_group_commit {
+	os_mutex_t lock;
+	os_cond_t cond; /* signaled when a group becomes durable */
+	os_cond_t gather; /* used by the leader to wait for members */
+
+	uint64_t window_us; /* 0 if group commit is disabled */
+
+	VEC(, struct tx *) members; /* members of the open group */
+	uint64_t running; /* transactions which may still join the group */
+	int open; /* whether a leader gathers members */
+	uint64_t gen; /* generation of the last opened group */
+	uint64_t durable_gen; /* generation of the last durable group */
+
+	uint64_t ngroups;
+	uint64_t ncommits;
+};
+
+/*
+ * tx_group_commit_new -- (internal) creates a new group commit instance
+ */
+static struct tx_group_commit *
+tx_group_commit_new(void)
+{
+	struct tx_group_commit *gc = Malloc(sizeof(*gc));
+	if (gc == NULL)
+		return NULL;
+
+	util_mutex_init(&gc->lock);
+	util_cond_init(&gc->cond);
+	util_cond_init(&gc->gather);
+	gc->window_us = 0;
+	VEC_INIT(&gc->members);
+	gc->running = 0;
+	gc->open = 0;
+	gc->gen = 0;
+	gc->durable_gen = 0;
+	gc->ngroups = 0;
+	gc->ncommits = 0;
+
+	return gc;
+}
+
+/*
+ * tx_group_commit_delete -- (internal) deletes the group commit instance
+ */
+static void
+tx_group_commit_delete(struct tx_group_commit *gc)
+{
+	ASSERTeq(gc->open, 0);
+
+	VEC_DELETE(&gc->members);
+	util_cond_destroy(&gc->gather);
+	util_cond_destroy(&gc->cond);
+	util_mutex_destroy(&gc->lock);
+	Free(gc);
+}
+
 /*
  * tx_params_new -- creates a new transactional parameters instance and fills it
  *	with default values.
@@ -113,8 +329,24 @@ tx_params_new(void)
 		return NULL;
 
 	tx_params->cache_size = TX_DEFAULT_RANGE_CACHE_SIZE;
+	tx_params->log_retain_max = 0;
+	tx_params->log_retain_decay = TX_DEFAULT_LOG_RETAIN_DECAY;
+
+	tx_params->post_commit = tx_post_commit_new();
+	if (tx_params->post_commit == NULL)
+		goto error_post_commit;
+
+	tx_params->group_commit = tx_group_commit_new();
+	if (tx_params->group_commit == NULL)
+		goto error_group_commit;
 
 	return tx_params;
+
+error_group_commit:
+	tx_post_commit_delete(tx_params->post_commit);
+error_post_commit:
+	Free(tx_params);
+	return NULL;
 }
 
 /*
@@ -123,6 +355,8 @@ tx_params_new(void)
 void
 tx_params_delete(struct tx_parameters *tx_params)
 {
+	tx_group_commit_delete(tx_params->group_commit);
+	tx_post_commit_delete(tx_params->post_commit);
 	Free(tx_params);
 }
 
@@ -176,6 +410,9 @@ tx_action_reserve(struct tx *tx, size_t n)
 	size_t entries_size = (VEC_SIZE(&tx->actions) + n) *
 		sizeof(struct ulog_entry_val);
 
+	/* the shadow copies are stored in the same log as the actions */
+	entries_size += tx->shadows_nbytes;
+
 	/* take the provided user buffers into account when reserving */
 	entries_size -= MIN(tx->redo_userbufs_capacity, entries_size);
 
@@ -331,106 +568,764 @@ tx_restore_range(PMEMobjpool *pop, struct tx *tx, struct ulog_entry_buf *range)
 		/* all PMEM locks have the same size */
 		void *lock_end = (char *)lock_begin + _POBJ_CL_SIZE;
 
-		tx_remove_range(&tx_ranges, lock_begin, lock_end);
-	}
+		tx_remove_range(&tx_ranges, lock_begin, lock_end);
+	}
+
+	ASSERT(!PMDK_SLIST_EMPTY(&tx_ranges));
+
+	void *dst_ptr = OBJ_OFF_TO_PTR(pop, range_offset);
+
+	while (!PMDK_SLIST_EMPTY(&tx_ranges)) {
+		txr = PMDK_SLIST_FIRST(&tx_ranges);
+		PMDK_SLIST_REMOVE_HEAD(&tx_ranges, tx_range);
+		/* restore partial range data from snapshot */
+		ASSERT((char *)txr->begin >= (char *)dst_ptr);
+		uint8_t *src = &range->data[
+				(char *)txr->begin - (char *)dst_ptr];
+		ASSERT((char *)txr->end >= (char *)txr->begin);
+		size_t size = (size_t)((char *)txr->end - (char *)txr->begin);
+		pmemops_memcpy(&pop->p_ops, txr->begin, src, size, 0);
+		Free(txr);
+	}
+}
+
+/*
+ * tx_undo_entry_apply -- applies modifications of a single ulog entry
+ */
+static int
+tx_undo_entry_apply(struct ulog_entry_base *e, void *arg,
+	const struct pmem_ops *p_ops)
+{
+	struct ulog_entry_buf *eb;
+
+	switch (ulog_entry_type(e)) {
+		case ULOG_OPERATION_BUF_CPY:
+			eb = (struct ulog_entry_buf *)e;
+
+			tx_restore_range(p_ops->base, get_tx(), eb);
+		break;
+		case ULOG_OPERATION_AND:
+		case ULOG_OPERATION_OR:
+		case ULOG_OPERATION_SET:
+		case ULOG_OPERATION_BUF_SET:
+		default:
+			ASSERT(0);
+	}
+
+	return 0;
+}
+
+/*
+ * tx_abort_set -- (internal) abort all set operations
+ */
+static void
+tx_abort_set(PMEMobjpool *pop, struct lane *lane)
+{
+	LOG(7, NULL);
+
+	ulog_foreach_entry((struct ulog *)&lane->layout->undo,
+		tx_undo_entry_apply, NULL, &pop->p_ops);
+	operation_finish(lane->undo, ULOG_INC_FIRST_GEN_NUM);
+}
+
+/*
+ * The cache lines of the ranges flushed at commit. The ranges of a transaction
+ * are visited in the order of their offsets and don't overlap, so the lines
+ * shared by consecutive ranges, or covered by ranges adjacent to each other,
+ * are merged into a single span which is flushed once.
+ */
+struct tx_flush_lines {
+	PMEMobjpool *pop;
+	uint64_t start; /* offset of the first line of the pending span */
+	uint64_t end; /* offset past the last line of the pending span */
+	uint64_t range_lines; /* lines of the ranges, counted separately */
+	uint64_t flushed_lines; /* lines actually flushed */
+};
+
+/*
+ * tx_flush_lines_init -- (internal) prepares an empty set of lines
+ */
+static void
+tx_flush_lines_init(struct tx_flush_lines *lines, PMEMobjpool *pop)
+{
+	lines->pop = pop;
+	lines->start = 0;
+	lines->end = 0;
+	lines->range_lines = 0;
+	lines->flushed_lines = 0;
+}
+
+/*
+ * tx_flush_lines_drain -- (internal) flushes the pending span of lines
+ */
+static void
+tx_flush_lines_drain(struct tx_flush_lines *lines)
+{
+	if (lines->start == lines->end)
+		return;
+
+	PMEMobjpool *pop = lines->pop;
+	pmemops_xflush(&pop->p_ops, OBJ_OFF_TO_PTR(pop, lines->start),
+		lines->end - lines->start, PMEMOBJ_F_RELAXED);
+
+	lines->flushed_lines += (lines->end - lines->start) / CACHELINE_SIZE;
+	lines->start = lines->end = 0;
+}
+
+/*
+ * tx_flush_lines_add -- (internal) adds the lines of a range to the set,
+ *	flushing the pending span if the range doesn't continue it
+ */
+static void
+tx_flush_lines_add(struct tx_flush_lines *lines,
+	const struct tx_range_def *range)
+{
+	PMEMobjpool *pop = lines->pop;
+
+	uint64_t start = ALIGN_DOWN(range->offset, CACHELINE_SIZE);
+	uint64_t end = ALIGN_UP(range->offset + range->size, CACHELINE_SIZE);
+	lines->range_lines += (end - start) / CACHELINE_SIZE;
+
+	/*
+	 * The replicas are updated with the exact bytes of the flushed
+	 * ranges, which cannot be extended to whole lines.
+	 */
+	if (pop->replica != NULL) {
+		pmemops_xflush(&pop->p_ops,
+			OBJ_OFF_TO_PTR(pop, range->offset),
+			range->size, PMEMOBJ_F_RELAXED);
+		lines->flushed_lines += (end - start) / CACHELINE_SIZE;
+		return;
+	}
+
+	if (lines->start != lines->end && start <= lines->end) {
+		ASSERT(start >= lines->start);
+		if (end > lines->end)
+			lines->end = end;
+		return;
+	}
+
+	tx_flush_lines_drain(lines);
+
+	lines->start = start;
+	lines->end = end;
+}
+
+/*
+ * tx_flush_lines_finish -- (internal) flushes the remaining lines and
+ *	accounts for them in the statistics
+ */
+static void
+tx_flush_lines_finish(struct tx_flush_lines *lines)
+{
+	tx_flush_lines_drain(lines);
+
+	struct stats *stats = lines->pop->stats;
+	STATS_INC(stats, transient, tx_range_lines, lines->range_lines);
+	STATS_INC(stats, transient, tx_flushed_lines, lines->flushed_lines);
+}
+
+/*
+ * tx_flush_range -- (internal) flush one range
+ */
+static void
+tx_flush_range(void *data, void *ctx)
+{
+	struct tx_flush_lines *lines = ctx;
+	PMEMobjpool *pop = lines->pop;
+	struct tx_range_def *range = data;
+	if (!(range->flags & POBJ_FLAG_NO_FLUSH))
+		tx_flush_lines_add(lines, range);
+	VALGRIND_REMOVE_FROM_TX(OBJ_OFF_TO_PTR(pop, range->offset),
+		range->size);
+}
+
+/*
+ * tx_flush_range_group -- (internal) flush one range of a transaction
+ *	committed by another thread
+ *
+ * Unlike tx_flush_range, it doesn't touch the valgrind transaction state,
+ * which belongs to the thread of the transaction.
+ */
+static void
+tx_flush_range_group(void *data, void *ctx)
+{
+	struct tx_flush_lines *lines = ctx;
+	struct tx_range_def *range = data;
+	if (!(range->flags & POBJ_FLAG_NO_FLUSH))
+		tx_flush_lines_add(lines, range);
+}
+
+/*
+ * tx_flush_ranges_group -- (internal) flush the ranges of a transaction
+ *	committed by another thread
+ */
+static void
+tx_flush_ranges_group(PMEMobjpool *pop, struct ravl *ranges)
+{
+	struct tx_flush_lines lines;
+	tx_flush_lines_init(&lines, pop);
+
+	ravl_foreach(ranges, tx_flush_range_group, &lines);
+
+	tx_flush_lines_finish(&lines);
+}
+
+/*
+ * tx_clean_range -- (internal) clean one range
+ */
+static void
+tx_clean_range(void *data, void *ctx)
+{
+	PMEMobjpool *pop = ctx;
+	struct tx_range_def *range = data;
+	VALGRIND_REMOVE_FROM_TX(OBJ_OFF_TO_PTR(pop, range->offset),
+		range->size);
+	VALGRIND_SET_CLEAN(OBJ_OFF_TO_PTR(pop, range->offset), range->size);
+}
+
+/*
+ * tx_untrack_range -- (internal) drops one range from the valgrind tx, the
+ *	range is flushed later on by a post-commit worker
+ */
+static void
+tx_untrack_range(void *data, void *ctx)
+{
+	PMEMobjpool *pop = ctx;
+	struct tx_range_def *range = data;
+	VALGRIND_REMOVE_FROM_TX(OBJ_OFF_TO_PTR(pop, range->offset),
+		range->size);
+}
+
+/*
+ * tx_pre_commit -- (internal) do pre-commit operations
+ */
+static void
+tx_pre_commit(struct tx *tx)
+{
+	LOG(5, NULL);
+
+	struct tx_flush_lines lines;
+	tx_flush_lines_init(&lines, tx->pop);
+
+	/* Flush all regions and destroy the whole tree. */
+	ravl_delete_cb(tx->ranges, tx_flush_range, &lines);
+	tx->ranges = NULL;
+
+	tx_flush_lines_finish(&lines);
+}
+
+/*
+ * tx_group_commit_enter -- (internal) counts the new outermost transaction as
+ *	a possible member of the groups, if group commit is enabled
+ */
+static void
+tx_group_commit_enter(struct tx *tx)
+{
+	struct tx_group_commit *gc = tx->pop->tx_params->group_commit;
+
+	uint64_t window_us;
+	util_atomic_load64(&gc->window_us, &window_us);
+
+	tx->group_running = window_us != 0;
+	if (tx->group_running)
+		util_fetch_and_add64(&gc->running, 1);
+}
+
+/*
+ * tx_group_commit_leave -- (internal) stops counting the transaction as
+ *	a possible member, the leader of the open group is notified so that it
+ *	doesn't wait for it
+ *
+ * Must be called with the group commit lock held.
+ */
+static void
+tx_group_commit_leave(struct tx_group_commit *gc, struct tx *tx)
+{
+	if (!tx->group_running)
+		return;
+
+	tx->group_running = 0;
+	util_fetch_and_sub64(&gc->running, 1);
+
+	if (gc->open)
+		os_cond_signal(&gc->gather);
+}
+
+/*
+ * tx_group_commit_lead -- (internal) gathers the members of a new group for
+ *	the duration of the window, or until there are no other running
+ *	transactions, makes the modifications of all of them durable and wakes
+ *	them up
+ *
+ * Called and returns with the group commit lock held.
+ */
+static void
+tx_group_commit_lead(struct tx_group_commit *gc, struct tx *tx,
+	uint64_t window_us)
+{
+	PMEMobjpool *pop = tx->pop;
+	uint64_t gen = ++gc->gen;
+	gc->open = 1;
+
+	if (VEC_PUSH_BACK(&gc->members, tx) != 0) {
+		/* flush the ranges on behalf of the leader anyway */
+		tx_flush_ranges_group(pop, tx->ranges);
+	}
+
+	struct timespec deadline;
+	os_clock_gettime(CLOCK_REALTIME, &deadline);
+	uint64_t nsec = (uint64_t)deadline.tv_nsec + window_us * 1000;
+	deadline.tv_sec += (time_t)(nsec / 1000000000);
+	deadline.tv_nsec = (long)(nsec % 1000000000);
+
+	for (;;) {
+		uint64_t running;
+		util_atomic_load64(&gc->running, &running);
+		if (running == 0)
+			break;
+
+		if (os_cond_timedwait(&gc->gather, &gc->lock,
+				&deadline) == ETIMEDOUT)
+			break;
+	}
+
+	/* close the group, the next committer will lead a new one */
+	gc->open = 0;
+	VEC(, struct tx *) members;
+	VEC_INIT(&members);
+	VEC_MOVE(&members, &gc->members);
+
+	util_mutex_unlock(&gc->lock);
+
+	struct tx *member;
+	VEC_FOREACH(member, &members)
+		tx_flush_ranges_group(pop, member->ranges);
+
+	pmemops_drain(&pop->p_ops);
+
+	util_mutex_lock(&gc->lock);
+
+	/* groups become durable in order in which they were opened */
+	while (gc->durable_gen != gen - 1)
+		os_cond_wait(&gc->cond, &gc->lock);
+
+	gc->durable_gen = gen;
+	gc->ngroups++;
+	gc->ncommits += VEC_SIZE(&members);
+	os_cond_broadcast(&gc->cond);
+
+	VEC_DELETE(&members);
+}
+
+/*
+ * tx_group_commit -- (internal) makes the modifications of the transaction
+ *	durable together with other concurrently committing transactions
+ *
+ * Returns 0 once the modified ranges of the transaction are flushed and
+ * drained, or -1 if group commit is disabled or failed, in which case the
+ * caller has to flush the ranges on its own.
+ */
+static int
+tx_group_commit(struct tx *tx)
+{
+	struct tx_group_commit *gc = tx->pop->tx_params->group_commit;
+
+	uint64_t window_us;
+	util_atomic_load64(&gc->window_us, &window_us);
+	if (window_us == 0)
+		return -1;
+
+	util_mutex_lock(&gc->lock);
+
+	tx_group_commit_leave(gc, tx);
+
+	if (gc->open) {
+		if (VEC_PUSH_BACK(&gc->members, tx) != 0) {
+			util_mutex_unlock(&gc->lock);
+			return -1;
+		}
+
+		uint64_t gen = gc->gen;
+		while (gc->durable_gen < gen)
+			os_cond_wait(&gc->cond, &gc->lock);
+	} else {
+		tx_group_commit_lead(gc, tx, window_us);
+	}
+
+	util_mutex_unlock(&gc->lock);
+
+	/* the ranges are already durable, drop them from the valgrind tx */
+	ravl_delete_cb(tx->ranges, tx_clean_range, tx->pop);
+	tx->ranges = NULL;
+
+	return 0;
+}
+
+/*
+ * tx_shadow_free -- (internal) frees the data of one shadow copy
+ */
+static void
+tx_shadow_free(void *data, void *arg)
+{
+	struct tx_shadow *shadow = data;
+
+	Free(shadow->data);
+}
+
+/*
+ * tx_shadows_delete -- (internal) discards all shadow copies of the
+ *	transaction
+ */
+static void
+tx_shadows_delete(struct tx *tx)
+{
+	if (tx->shadows == NULL)
+		return;
+
+	ravl_delete_cb(tx->shadows, tx_shadow_free, NULL);
+	tx->shadows = NULL;
+	tx->shadows_nbytes = 0;
+}
+
+struct tx_shadows_log_args {
+	struct tx *tx;
+	int ret;
+};
+
+/*
+ * tx_shadow_log -- (internal) adds one shadow copy to the redo log
+ */
+static void
+tx_shadow_log(void *data, void *arg)
+{
+	struct tx_shadow *shadow = data;
+	struct tx_shadows_log_args *args = arg;
+
+	if (args->ret != 0)
+		return;
+
+	struct tx *tx = args->tx;
+	args->ret = operation_add_buffer(tx->lane->external,
+		OBJ_OFF_TO_PTR(tx->pop, shadow->offset), shadow->data,
+		shadow->size, ULOG_OPERATION_BUF_CPY);
+}
+
+/*
+ * tx_shadows_log -- (internal) stores the shadow copies in the redo log of
+ *	the committing transaction and reserves the space for its actions
+ *
+ * The shadows are applied together with the actions, once the redo log is
+ * processed, which makes them a part of the transaction commit.
+ */
+static int
+tx_shadows_log(struct tx *tx)
+{
+	if (tx->shadows == NULL)
+		return 0;
+
+	struct tx_shadows_log_args args = {tx, 0};
+	ravl_foreach(tx->shadows, tx_shadow_log, &args);
+	if (args.ret != 0)
+		return -1;
+
+	struct operation_context *ctx = tx->lane->external;
+	size_t nbytes = operation_get_redo_nbytes(ctx) +
+		VEC_SIZE(&tx->actions) * sizeof(struct ulog_entry_val);
+
+	return operation_reserve(ctx, nbytes);
+}
+
+static int pmemobj_tx_add_common(struct tx *tx, struct tx_range_def *args);
+
+/*
+ * The whole pages of the ranges added with POBJ_XADD_LAZY_SNAPSHOT are made
+ * read-only instead of being snapshotted. The first write to such a page
+ * raises SIGSEGV, whose handler snapshots the page just like if it was added
+ * to the transaction at that point, makes it writable again and lets the
+ * write go through. The remaining pages are made writable again once the
+ * transaction commits or aborts.
+ *
+ * The handler only claims the write faults on the pages of the transaction
+ * of the faulting thread. All other faults, including the accesses to the
+ * ranges protected by RANGE_RO and RANGE_NONE in debug builds (which never
+ * cover the heap), are passed on to the previously installed handler.
+ */
+#ifndef _WIN32
+
+static os_once_t Tx_lazy_once = OS_ONCE_INIT;
+static int Tx_lazy_installed;
+static struct sigaction Tx_lazy_prev;
+
+/*
+ * tx_lazy_forward -- (internal) passes the signal on to the previous handler
+ */
+static void
+tx_lazy_forward(int sig, siginfo_t *info, void *uctx)
+{
+	if (Tx_lazy_prev.sa_flags & SA_SIGINFO) {
+		Tx_lazy_prev.sa_sigaction(sig, info, uctx);
+	} else if (Tx_lazy_prev.sa_handler == SIG_DFL ||
+	    Tx_lazy_prev.sa_handler == SIG_IGN) {
+		/* the faulting instruction will raise the signal again */
+		struct sigaction sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = SIG_DFL;
+		sigemptyset(&sa.sa_mask);
+		sigaction(sig, &sa, NULL);
+	} else {
+		Tx_lazy_prev.sa_handler(sig);
+	}
+}
+
+/*
+ * tx_lazy_snapshot -- (internal) snapshots the write-protected page which
+ *	contains the address and makes it writable
+ *
+ * Returns -1 if the page is not a write-protected page of the transaction.
+ */
+static int
+tx_lazy_snapshot(struct tx *tx, void *addr)
+{
+	PMEMobjpool *pop = tx->pop;
+	if (!OBJ_PTR_FROM_POOL(pop, addr))
+		return -1;
+
+	uint64_t offset = ALIGN_DOWN((uint64_t)((char *)addr - (char *)pop),
+		Pagesize);
+
+	struct tx_range_def search = {offset, 0, 0};
+	struct ravl_node *n = ravl_find(tx->lazy, &search,
+		RAVL_PREDICATE_LESS_EQUAL);
+	if (n == NULL)
+		return -1;
+
+	struct tx_range_def *f = ravl_data(n);
+	if (offset >= f->offset + f->size)
+		return -1;
+
+	struct tx_range_def page = {offset, Pagesize, f->flags};
+
+	/*
+	 * If the snapshot cannot be created, the transaction is aborted,
+	 * which makes all of the protected pages writable again. That's why
+	 * the page is still kept among them until it's snapshotted.
+	 */
+	page.flags &= ~POBJ_XADD_NO_ABORT;
+	if (pmemobj_tx_add_common(tx, &page) != 0)
+		return 0;
+
+	/* split the protected pages around the snapshotted one */
+	n = ravl_find(tx->lazy, &search, RAVL_PREDICATE_LESS_EQUAL);
+	f = ravl_data(n);
+
+	struct tx_range_def right = *f;
+	right.offset = offset + Pagesize;
+	right.size = f->offset + f->size - right.offset;
+	if (right.size != 0 && ravl_emplace_copy(tx->lazy, &right) != 0)
+		FATAL("out of memory for the protected pages");
+
+	/* look the node up again, the tree was modified */
+	n = ravl_find(tx->lazy, &search, RAVL_PREDICATE_LESS_EQUAL);
+	f = ravl_data(n);
+	f->size = offset - f->offset;
+	if (f->size == 0)
+		ravl_remove(tx->lazy, n);
 
-	ASSERT(!PMDK_SLIST_EMPTY(&tx_ranges));
+	if (util_range_rw(OBJ_OFF_TO_PTR(pop, offset), Pagesize) != 0)
+		FATAL("cannot make the snapshotted page writable");
 
-	void *dst_ptr = OBJ_OFF_TO_PTR(pop, range_offset);
+	STATS_INC(pop->stats, transient, tx_lazy_pages, 1);
 
-	while (!PMDK_SLIST_EMPTY(&tx_ranges)) {
-		txr = PMDK_SLIST_FIRST(&tx_ranges);
-		PMDK_SLIST_REMOVE_HEAD(&tx_ranges, tx_range);
-		/* restore partial range data from snapshot */
-		ASSERT((char *)txr->begin >= (char *)dst_ptr);
-		uint8_t *src = &range->data[
-				(char *)txr->begin - (char *)dst_ptr];
-		ASSERT((char *)txr->end >= (char *)txr->begin);
-		size_t size = (size_t)((char *)txr->end - (char *)txr->begin);
-		pmemops_memcpy(&pop->p_ops, txr->begin, src, size, 0);
-		Free(txr);
-	}
+	return 0;
 }
 
 /*
- * tx_undo_entry_apply -- applies modifications of a single ulog entry
+ * tx_lazy_fault -- (internal) SIGSEGV handler which snapshots the pages
+ *	written to for the first time
  */
-static int
-tx_undo_entry_apply(struct ulog_entry_base *e, void *arg,
-	const struct pmem_ops *p_ops)
+static void
+tx_lazy_fault(int sig, siginfo_t *info, void *uctx)
 {
-	struct ulog_entry_buf *eb;
-
-	switch (ulog_entry_type(e)) {
-		case ULOG_OPERATION_BUF_CPY:
-			eb = (struct ulog_entry_buf *)e;
+	int oerrno = errno;
 
-			tx_restore_range(p_ops->base, get_tx(), eb);
-		break;
-		case ULOG_OPERATION_AND:
-		case ULOG_OPERATION_OR:
-		case ULOG_OPERATION_SET:
-		case ULOG_OPERATION_BUF_SET:
-		default:
-			ASSERT(0);
+	struct tx *tx = get_tx();
+	if (info->si_code == SEGV_ACCERR && tx->stage == TX_STAGE_WORK &&
+	    tx->lazy != NULL && tx_lazy_snapshot(tx, info->si_addr) == 0) {
+		errno = oerrno;
+		return;
 	}
 
-	return 0;
+	errno = oerrno;
+	tx_lazy_forward(sig, info, uctx);
 }
 
 /*
- * tx_abort_set -- (internal) abort all set operations
+ * tx_lazy_install -- (internal) installs the SIGSEGV handler
+ *
+ * SA_NODEFER keeps the signal unblocked when the handler leaves through
+ * the longjmp of an aborted transaction.
  */
 static void
-tx_abort_set(PMEMobjpool *pop, struct lane *lane)
+tx_lazy_install(void)
 {
-	LOG(7, NULL);
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = tx_lazy_fault;
+	sa.sa_flags = SA_SIGINFO | SA_NODEFER | SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+
+	if (sigaction(SIGSEGV, &sa, &Tx_lazy_prev) != 0) {
+		ERR("!sigaction");
+		return;
+	}
 
-	ulog_foreach_entry((struct ulog *)&lane->layout->undo,
-		tx_undo_entry_apply, NULL, &pop->p_ops);
-	operation_finish(lane->undo, ULOG_INC_FIRST_GEN_NUM);
+	Tx_lazy_installed = 1;
 }
 
+#endif
+
 /*
- * tx_flush_range -- (internal) flush one range
+ * tx_lazy_supported -- (internal) checks whether the ranges of the pool can
+ *	be snapshotted lazily
+ *
+ * Device DAX can only be protected with the granularity of its alignment,
+ * and Valgrind needs to know about the snapshots before the stores.
  */
-static void
-tx_flush_range(void *data, void *ctx)
+static int
+tx_lazy_supported(PMEMobjpool *pop)
 {
-	PMEMobjpool *pop = ctx;
-	struct tx_range_def *range = data;
-	if (!(range->flags & POBJ_FLAG_NO_FLUSH)) {
-		pmemops_xflush(&pop->p_ops, OBJ_OFF_TO_PTR(pop, range->offset),
-				range->size, PMEMOBJ_F_RELAXED);
+#ifdef _WIN32
+	return 0;
+#else
+	if (pop->is_dev_dax || On_valgrind)
+		return 0;
+
+	os_once(&Tx_lazy_once, tx_lazy_install);
+
+	return Tx_lazy_installed;
+#endif
+}
+
+/*
+ * tx_lazy_protect -- (internal) write-protects the pages and keeps track of
+ *	them
+ */
+static int
+tx_lazy_protect(struct tx *tx, const struct tx_range_def *pages)
+{
+	if (tx->lazy == NULL) {
+		tx->lazy = ravl_new_sized(tx_range_def_cmp,
+			sizeof(struct tx_range_def));
+		if (tx->lazy == NULL)
+			return -1;
 	}
-	VALGRIND_REMOVE_FROM_TX(OBJ_OFF_TO_PTR(pop, range->offset),
-		range->size);
+
+	/* only track the pages which aren't protected already */
+	uint64_t offset = pages->offset;
+	uint64_t end = pages->offset + pages->size;
+	while (offset < end) {
+		struct tx_range_def search = {offset, 0, 0};
+		struct ravl_node *n = ravl_find(tx->lazy, &search,
+			RAVL_PREDICATE_LESS_EQUAL);
+		struct tx_range_def *f = n ? ravl_data(n) : NULL;
+		if (f != NULL && offset < f->offset + f->size) {
+			offset = f->offset + f->size;
+			continue;
+		}
+
+		n = ravl_find(tx->lazy, &search, RAVL_PREDICATE_GREATER);
+		f = n ? ravl_data(n) : NULL;
+
+		struct tx_range_def gap = *pages;
+		gap.offset = offset;
+		gap.size = (f != NULL && f->offset < end ? f->offset : end) -
+			offset;
+		if (ravl_emplace_copy(tx->lazy, &gap) != 0)
+			return -1;
+
+		offset += gap.size;
+	}
+
+	return util_range_ro(OBJ_OFF_TO_PTR(tx->pop, pages->offset),
+		pages->size);
 }
 
 /*
- * tx_clean_range -- (internal) clean one range
+ * tx_lazy_add -- (internal) adds a range whose whole pages are snapshotted
+ *	when they are first written to
+ *
+ * The partial pages at both ends of the range are snapshotted right away,
+ * just like the entire range if it cannot be protected.
+ */
+static int
+tx_lazy_add(struct tx *tx, struct tx_range_def *args)
+{
+	struct tx_range_def r = *args;
+	r.flags &= ~POBJ_XADD_LAZY_SNAPSHOT;
+
+	ASSERT(IS_PAGE_ALIGNED((uintptr_t)tx->pop));
+	uint64_t start = ALIGN_UP(r.offset, Pagesize);
+	uint64_t end = ALIGN_DOWN(r.offset + r.size, Pagesize);
+
+	if (start >= end || (r.flags & POBJ_XADD_NO_SNAPSHOT) ||
+	    !tx_lazy_supported(tx->pop))
+		return pmemobj_tx_add_common(tx, &r);
+
+	int ret;
+	struct tx_range_def part = r;
+
+	part.size = start - r.offset;
+	if (part.size != 0 && (ret = pmemobj_tx_add_common(tx, &part)) != 0)
+		return ret;
+
+	part.offset = end;
+	part.size = r.offset + r.size - end;
+	if (part.size != 0 && (ret = pmemobj_tx_add_common(tx, &part)) != 0)
+		return ret;
+
+	part.offset = start;
+	part.size = end - start;
+
+	/* the pages might have been snapshotted in whole already */
+	struct ravl_node *n = ravl_find(tx->ranges, &part,
+		RAVL_PREDICATE_LESS_EQUAL);
+	struct tx_range_def *f = n ? ravl_data(n) : NULL;
+	if (f != NULL && f->offset + f->size >= end)
+		return 0;
+
+	if (tx_lazy_protect(tx, &part) != 0)
+		return pmemobj_tx_add_common(tx, &part);
+
+	return 0;
+}
+
+/*
+ * tx_lazy_unprotect -- (internal) makes the pages writable again
  */
 static void
-tx_clean_range(void *data, void *ctx)
+tx_lazy_unprotect(void *data, void *arg)
 {
-	PMEMobjpool *pop = ctx;
-	struct tx_range_def *range = data;
-	VALGRIND_REMOVE_FROM_TX(OBJ_OFF_TO_PTR(pop, range->offset),
-		range->size);
-	VALGRIND_SET_CLEAN(OBJ_OFF_TO_PTR(pop, range->offset), range->size);
+	PMEMobjpool *pop = arg;
+	struct tx_range_def *pages = data;
+
+	if (util_range_rw(OBJ_OFF_TO_PTR(pop, pages->offset),
+	    pages->size) != 0)
+		FATAL("cannot make the protected pages writable");
 }
 
 /*
- * tx_pre_commit -- (internal) do pre-commit operations
+ * tx_lazy_release -- (internal) makes the pages which were not written to
+ *	writable again
  */
 static void
-tx_pre_commit(struct tx *tx)
+tx_lazy_release(struct tx *tx)
 {
-	LOG(5, NULL);
+	if (tx->lazy == NULL)
+		return;
 
-	/* Flush all regions and destroy the whole tree. */
-	ravl_delete_cb(tx->ranges, tx_flush_range, tx->pop);
-	tx->ranges = NULL;
+	ravl_delete_cb(tx->lazy, tx_lazy_unprotect, tx->pop);
+	tx->lazy = NULL;
 }
 
 /*
@@ -443,12 +1338,16 @@ tx_abort(PMEMobjpool *pop, struct lane *lane)
 
 	struct tx *tx = get_tx();
 
+	tx_lazy_release(tx);
+
 	tx_abort_set(pop, lane);
 
 	ravl_delete_cb(tx->ranges, tx_clean_range, pop);
 	palloc_cancel(&pop->heap,
 		VEC_ARR(&tx->actions), VEC_SIZE(&tx->actions));
 	tx->ranges = NULL;
+
+	tx_shadows_delete(tx);
 }
 
 /*
@@ -580,13 +1479,16 @@ tx_alloc_common(struct tx *tx, size_t size, type_num_t type_num,
 
 	PMEMobjpool *pop = tx->pop;
 
+	uint16_t class_id;
+	if (obj_alloc_class_id(pop, size, args.flags, &class_id) != 0)
+		return obj_tx_fail_null(errno, args.flags);
+
 	struct pobj_action *action = tx_action_add(tx);
 	if (action == NULL)
 		return obj_tx_fail_null(ENOMEM, args.flags);
 
 	if (palloc_reserve(&pop->heap, size, constructor, &args, type_num, 0,
-		CLASS_ID_FROM_FLAG(args.flags),
-		ARENA_ID_FROM_FLAG(args.flags), action) != 0)
+		class_id, ARENA_ID_FROM_FLAG(args.flags), action) != 0)
 		goto err_oom;
 
 	/* allocate object to undo log */
@@ -742,15 +1644,21 @@ pmemobj_tx_begin(PMEMobjpool *pop, jmp_buf env, ...)
 
 		VEC_INIT(&tx->actions);
 		VEC_INIT(&tx->redo_userbufs);
+		VEC_INIT(&tx->durable_cbs);
 		tx->redo_userbufs_capacity = 0;
 		PMDK_SLIST_INIT(&tx->tx_entries);
 		PMDK_SLIST_INIT(&tx->tx_locks);
 
 		tx->ranges = ravl_new_sized(tx_range_def_cmp,
 			sizeof(struct tx_range_def));
+		tx->shadows = NULL;
+		tx->shadows_nbytes = 0;
+		tx->lazy = NULL;
 
 		tx->pop = pop;
 
+		tx_group_commit_enter(tx);
+
 		tx->first_snapshot = 1;
 
 		tx->user_data = NULL;
@@ -935,51 +1843,407 @@ obj_tx_abort(int errnum, int user)
 	/* ONABORT */
 	obj_tx_callback(tx);
 
-	if (!util_is_zeroed(txd->env, sizeof(jmp_buf)))
-		longjmp(txd->env, errnum);
+	if (!util_is_zeroed(txd->env, sizeof(jmp_buf)))
+		longjmp(txd->env, errnum);
+}
+
+/*
+ * pmemobj_tx_abort -- aborts current transaction
+ *
+ * Note: this function should not be called from inside of pmemobj.
+ */
+void
+pmemobj_tx_abort(int errnum)
+{
+	PMEMOBJ_API_START();
+	obj_tx_abort(errnum, 1);
+	PMEMOBJ_API_END();
+}
+
+/*
+ * pmemobj_tx_errno -- returns last transaction error code
+ */
+int
+pmemobj_tx_errno(void)
+{
+	LOG(3, NULL);
+
+	return get_tx()->last_errnum;
+}
+
+/*
+ * tx_durable_callbacks -- (internal) notifies the application that the
+ *	transaction is durable
+ */
+static void
+tx_durable_callbacks(PMEMobjpool *pop, struct tx_durable_cbs *cbs)
+{
+	struct tx_durable_cb *dcb;
+	VEC_FOREACH_BY_PTR(dcb, cbs)
+		dcb->cb(pop, dcb->arg);
+
+	VEC_CLEAR(cbs);
+}
+
+/*
+ * tx_post_commit_enqueue -- (internal) hands the lane of the committed
+ *	transaction over to the post-commit workers
+ *
+ * Returns 0 if the lane was queued, in which case it is no longer held by the
+ * calling thread and will be unlocked by the worker once the cleanup is done.
+ * If 'ac' is set, the worker also makes the transaction durable before the
+ * cleanup, and calls its durability callbacks afterwards.
+ *
+ * The buffers appended by the application to the undo log can be freed or
+ * reused by it as soon as the transaction ends, so the cleanup of such logs
+ * is always done by the calling thread.
+ */
+static int
+tx_post_commit_enqueue(struct tx *tx, struct tx_async_commit *ac)
+{
+	struct tx_post_commit *pc = tx->pop->tx_params->post_commit;
+
+	unsigned nworkers;
+	util_atomic_load_explicit32(&pc->nworkers, &nworkers,
+		memory_order_acquire);
+	if (nworkers == 0)
+		return -1;
+
+	if (operation_get_any_user_buffer(tx->lane->undo))
+		return -1;
+
+	int ret = -1;
+
+	util_mutex_lock(&pc->lock);
+
+	if (pc->stop || pc->nworkers == 0)
+		goto out;
+
+	if (VECQ_SIZE(&pc->lanes) >= pc->depth) {
+		pc->overflows++;
+		goto out;
+	}
+
+	/* make sure the inserts below cannot fail once the lane is detached */
+	if (VECQ_CAPACITY(&pc->lanes) == VECQ_SIZE(&pc->lanes) &&
+	    VECQ_GROW(&pc->lanes) != 0)
+		goto out;
+
+	if (ac != NULL &&
+	    VECQ_CAPACITY(&pc->pending) == VECQ_SIZE(&pc->pending) &&
+	    VECQ_GROW(&pc->pending) != 0)
+		goto out;
+
+	uint64_t lane_idx;
+	if (lane_detach(tx->pop, &lane_idx) != 0)
+		goto out;
+
+	struct tx_post_commit_entry e;
+	e.lane_idx = lane_idx;
+	e.async = ac;
+
+	if (ac != NULL) {
+		ac->ticket = pc->tickets + 1;
+		(void) VECQ_INSERT(&pc->pending, ac);
+		util_atomic_store_explicit64(&pc->tickets, ac->ticket,
+			memory_order_release);
+	}
+
+	(void) VECQ_INSERT(&pc->lanes, e);
+	pc->queued++;
+	os_cond_signal(&pc->cond);
+
+	ret = 0;
+
+out:
+	util_mutex_unlock(&pc->lock);
+
+	return ret;
+}
+
+/*
+ * tx_post_commit_wait_ticket -- (internal) waits until the asynchronous
+ *	commits up to the given ticket are durable
+ */
+static void
+tx_post_commit_wait_ticket(struct tx_post_commit *pc, uint64_t ticket)
+{
+	uint64_t durable;
+	util_atomic_load_explicit64(&pc->durable, &durable,
+		memory_order_acquire);
+	if (durable >= ticket)
+		return;
+
+	util_mutex_lock(&pc->lock);
+
+	while (pc->durable < ticket)
+		os_cond_wait(&pc->durable_cond, &pc->lock);
+
+	util_mutex_unlock(&pc->lock);
+}
+
+/*
+ * tx_post_commit_wait -- waits until all transactions committed
+ *	asynchronously so far are durable
+ *
+ * Called before anything that may depend on the data of such transactions is
+ * made persistent, so that it can't outlive the transactions in case of
+ * a failure.
+ */
+void
+tx_post_commit_wait(PMEMobjpool *pop)
+{
+	struct tx_post_commit *pc = pop->tx_params->post_commit;
+
+	uint64_t tickets;
+	util_atomic_load_explicit64(&pc->tickets, &tickets,
+		memory_order_acquire);
+
+	tx_post_commit_wait_ticket(pc, tickets);
+}
+
+/*
+ * tx_post_commit_wait_range -- (internal) waits until all asynchronously
+ *	committed transactions which modified any part of the range are
+ *	durable
+ *
+ * Until then, the recovery could roll the range back to its old content, and
+ * so its snapshot must not be taken.
+ */
+static void
+tx_post_commit_wait_range(PMEMobjpool *pop, uint64_t offset, uint64_t size)
+{
+	struct tx_post_commit *pc = pop->tx_params->post_commit;
+
+	uint64_t tickets;
+	uint64_t durable;
+	util_atomic_load_explicit64(&pc->tickets, &tickets,
+		memory_order_acquire);
+	util_atomic_load_explicit64(&pc->durable, &durable,
+		memory_order_acquire);
+	if (durable >= tickets || size == 0)
+		return;
+
+	/* the last range which begins before the end of the given one */
+	struct tx_range_def search = {offset + size, 0, 0};
+	uint64_t ticket = 0;
+
+	util_mutex_lock(&pc->lock);
+
+	struct tx_async_commit *ac;
+	VECQ_FOREACH(ac, &pc->pending) {
+		struct ravl_node *n = ravl_find(ac->ranges, &search,
+			RAVL_PREDICATE_LESS);
+		if (n == NULL)
+			continue;
+
+		struct tx_range_def *r = ravl_data(n);
+		if (r->offset + r->size > offset)
+			ticket = ac->ticket;
+	}
+
+	while (pc->durable < ticket)
+		os_cond_wait(&pc->durable_cond, &pc->lock);
+
+	util_mutex_unlock(&pc->lock);
+}
+
+/*
+ * tx_post_commit_lane -- (internal) makes the asynchronously committed
+ *	transaction durable, if any, performs the post-commit cleanup of
+ *	the lane and makes it available to other threads
+ *
+ * The flushes are issued by the worker itself, because the drain doesn't
+ * wait for the ones issued by other threads. Both are done concurrently with
+ * other workers, only the redo logs are processed in the order of tickets.
+ */
+static void
+tx_post_commit_lane(PMEMobjpool *pop, struct tx_post_commit_entry *e)
+{
+	struct lane *lane = &pop->lanes_desc.lane[e->lane_idx];
+	struct tx_async_commit *ac = e->async;
+
+	if (ac != NULL) {
+		tx_flush_ranges_group(pop, ac->ranges);
+
+		pmemops_drain(&pop->p_ops);
+
+		tx_post_commit_wait_ticket(pop->tx_params->post_commit,
+			ac->ticket - 1);
+
+		palloc_publish(&pop->heap, VEC_ARR(&ac->actions),
+			VEC_SIZE(&ac->actions), lane->external);
+	}
+
+	operation_finish(lane->undo, 0);
+
+	lane_unlock(pop, e->lane_idx);
+}
+
+/*
+ * tx_async_commit_delete -- (internal) deletes the state of the durable
+ *	asynchronous commit
+ */
+static void
+tx_async_commit_delete(struct tx_async_commit *ac)
+{
+	ravl_delete(ac->ranges);
+	VEC_DELETE(&ac->actions);
+	VEC_DELETE(&ac->durable_cbs);
+	Free(ac);
+}
+
+/*
+ * tx_post_commit_worker -- (internal) processes the queued lanes until the
+ *	workers are stopped and the queue is empty
+ */
+static void
+tx_post_commit_worker(PMEMobjpool *pop)
+{
+	struct tx_post_commit *pc = pop->tx_params->post_commit;
+
+	util_mutex_lock(&pc->lock);
+
+	util_atomic_store_explicit32(&pc->nworkers, pc->nworkers + 1,
+		memory_order_release);
+
+	for (;;) {
+		while (VECQ_SIZE(&pc->lanes) == 0 && !pc->stop)
+			os_cond_wait(&pc->cond, &pc->lock);
+
+		if (VECQ_SIZE(&pc->lanes) == 0)
+			break;
+
+		struct tx_post_commit_entry e = VECQ_DEQUEUE(&pc->lanes);
+
+		util_mutex_unlock(&pc->lock);
+		tx_post_commit_lane(pop, &e);
+		util_mutex_lock(&pc->lock);
+
+		struct tx_async_commit *ac = e.async;
+		if (ac == NULL)
+			continue;
+
+		ASSERTeq(VECQ_FRONT(&pc->pending), ac);
+		(void) VECQ_DEQUEUE(&pc->pending);
+
+		util_atomic_store_explicit64(&pc->durable, ac->ticket,
+			memory_order_release);
+		os_cond_broadcast(&pc->durable_cond);
+
+		pc->async_commits++;
+
+		util_mutex_unlock(&pc->lock);
+		tx_durable_callbacks(pop, &ac->durable_cbs);
+		tx_async_commit_delete(ac);
+		util_mutex_lock(&pc->lock);
+	}
+
+	util_atomic_store_explicit32(&pc->nworkers, pc->nworkers - 1,
+		memory_order_release);
+	os_cond_broadcast(&pc->stopped);
+
+	util_mutex_unlock(&pc->lock);
 }
 
 /*
- * pmemobj_tx_abort -- aborts current transaction
- *
- * Note: this function should not be called from inside of pmemobj.
+ * tx_post_commit_stop -- stops all post-commit workers, returns once all of
+ *	them have finished processing the queue
  */
 void
-pmemobj_tx_abort(int errnum)
+tx_post_commit_stop(PMEMobjpool *pop)
 {
-	PMEMOBJ_API_START();
-	obj_tx_abort(errnum, 1);
-	PMEMOBJ_API_END();
-}
+	struct tx_post_commit *pc = pop->tx_params->post_commit;
 
-/*
- * pmemobj_tx_errno -- returns last transaction error code
- */
-int
-pmemobj_tx_errno(void)
-{
-	LOG(3, NULL);
+	util_mutex_lock(&pc->lock);
 
-	return get_tx()->last_errnum;
+	pc->stop = 1;
+	os_cond_broadcast(&pc->cond);
+
+	while (pc->nworkers != 0)
+		os_cond_wait(&pc->stopped, &pc->lock);
+
+	pc->stop = 0;
+
+	util_mutex_unlock(&pc->lock);
 }
 
+/*
+ * tx_post_commit -- (internal) performs the post-commit cleanup of the lane
+ *	and releases it, the work is deferred to the post-commit workers if any
+ *	are running
+ */
 static void
 tx_post_commit(struct tx *tx)
 {
-	operation_finish(tx->lane->undo, 0);
+	if (tx_post_commit_enqueue(tx, NULL) != 0) {
+		operation_finish(tx->lane->undo, 0);
+		lane_release(tx->pop);
+	}
+
+	tx->lane = NULL;
 }
 
 /*
- * pmemobj_tx_commit -- commits current transaction
+ * tx_async_commit -- (internal) hands the rest of the commit of the
+ *	transaction, along with its lane, over to the post-commit workers
+ *
+ * Returns 0 if the transaction was handed over, or -1 if it has to be
+ * committed by the calling thread. This is the case if there are no workers
+ * or their queue is full, and for the transactions with shadow copies or
+ * user buffers in the redo log, which have to be processed before the
+ * transaction ends.
  */
-void
-pmemobj_tx_commit(void)
+static int
+tx_async_commit(struct tx *tx)
 {
-	LOG(3, NULL);
+	if (tx->shadows != NULL || VEC_SIZE(&tx->redo_userbufs) != 0)
+		return -1;
 
-	PMEMOBJ_API_START();
-	struct tx *tx = get_tx();
+	struct tx_async_commit *ac = Malloc(sizeof(*ac));
+	if (ac == NULL)
+		return -1;
+
+	/* the worker flushes the ranges outside of the valgrind tx */
+	ravl_foreach(tx->ranges, tx_untrack_range, tx->pop);
+
+	ac->ranges = tx->ranges;
+	VEC_INIT(&ac->actions);
+	VEC_MOVE(&ac->actions, &tx->actions);
+	VEC_INIT(&ac->durable_cbs);
+	VEC_MOVE(&ac->durable_cbs, &tx->durable_cbs);
+
+	if (tx_post_commit_enqueue(tx, ac) != 0) {
+		VEC_MOVE(&tx->actions, &ac->actions);
+		VEC_MOVE(&tx->durable_cbs, &ac->durable_cbs);
+		Free(ac);
+		return -1;
+	}
+
+	tx->ranges = NULL;
+	tx->lane = NULL;
+
+	/* the transaction won't join any group */
+	if (tx->group_running) {
+		struct tx_group_commit *gc = tx->pop->tx_params->group_commit;
+
+		util_mutex_lock(&gc->lock);
+		tx_group_commit_leave(gc, tx);
+		util_mutex_unlock(&gc->lock);
+	}
+
+	return 0;
+}
 
+/*
+ * obj_tx_commit -- (internal) commits current transaction, the final drain
+ *	of the outermost transaction, the processing of its redo log and its
+ *	durability callbacks are left to a post-commit worker if 'async' is set
+ *	and it's possible
+ */
+static void
+obj_tx_commit(struct tx *tx, int async)
+{
 	ASSERT_IN_TX(tx);
 	ASSERT_TX_STAGE_WORK(tx);
 
@@ -995,10 +2259,7 @@ pmemobj_tx_commit(void)
 
 		PMEMobjpool *pop = tx->pop;
 
-		/* pre-commit phase */
-		tx_pre_commit(tx);
-
-		pmemops_drain(&pop->p_ops);
+		tx_lazy_release(tx);
 
 		operation_start(tx->lane->external);
 
@@ -1006,20 +2267,89 @@ pmemobj_tx_commit(void)
 		VEC_FOREACH_BY_PTR(userbuf, &tx->redo_userbufs)
 			operation_add_user_buffer(tx->lane->external, userbuf);
 
-		palloc_publish(&pop->heap, VEC_ARR(&tx->actions),
-			VEC_SIZE(&tx->actions), tx->lane->external);
+		/*
+		 * The shadows are logged before the snapshotted ranges are
+		 * flushed, so that the transaction can still be aborted if
+		 * there's not enough space for them in the redo log.
+		 */
+		if (tx_shadows_log(tx) != 0) {
+			ERR("out of memory for the shadow copies");
+			operation_finish(tx->lane->external, 0);
+			obj_tx_abort(ENOMEM, 0);
+			return;
+		}
+
+		if (!async || tx_async_commit(tx) != 0) {
+			/* pre-commit phase */
+			if (tx_group_commit(tx) != 0) {
+				tx_pre_commit(tx);
+
+				pmemops_drain(&pop->p_ops);
+			}
 
-		tx_post_commit(tx);
+			/*
+			 * The transaction may depend on the data of the
+			 * asynchronously committed ones, so it can't become
+			 * durable before them.
+			 */
+			tx_post_commit_wait(pop);
 
-		lane_release(pop);
+			palloc_publish(&pop->heap, VEC_ARR(&tx->actions),
+				VEC_SIZE(&tx->actions), tx->lane->external);
 
-		tx->lane = NULL;
+			tx_shadows_delete(tx);
+
+			tx_post_commit(tx);
+
+			tx_durable_callbacks(pop, &tx->durable_cbs);
+		}
 	}
 
 	tx->stage = TX_STAGE_ONCOMMIT;
 
 	/* ONCOMMIT */
 	obj_tx_callback(tx);
+}
+
+/*
+ * pmemobj_tx_commit -- commits current transaction
+ */
+void
+pmemobj_tx_commit(void)
+{
+	LOG(3, NULL);
+
+	PMEMOBJ_API_START();
+	obj_tx_commit(get_tx(), 0);
+	PMEMOBJ_API_END();
+}
+
+/*
+ * pmemobj_tx_commit_async -- commits current transaction without waiting
+ *	for it to become durable
+ */
+void
+pmemobj_tx_commit_async(pmemobj_tx_durable_cb cb, void *arg)
+{
+	LOG(3, NULL);
+
+	PMEMOBJ_API_START();
+	struct tx *tx = get_tx();
+
+	ASSERT_IN_TX(tx);
+	ASSERT_TX_STAGE_WORK(tx);
+
+	if (cb != NULL) {
+		struct tx_durable_cb dcb = {cb, arg};
+		if (VEC_PUSH_BACK(&tx->durable_cbs, dcb) != 0) {
+			ERR("out of memory for the durability callback");
+			obj_tx_abort(ENOMEM, 0);
+			PMEMOBJ_API_END();
+			return;
+		}
+	}
+
+	obj_tx_commit(tx, 1);
 	PMEMOBJ_API_END();
 }
 
@@ -1056,11 +2386,22 @@ pmemobj_tx_end(void)
 	if (PMDK_SLIST_EMPTY(&tx->tx_entries)) {
 		ASSERTeq(tx->lane, NULL);
 
+		/* aborted, or committed without joining a group */
+		if (tx->group_running) {
+			struct tx_group_commit *gc =
+				tx->pop->tx_params->group_commit;
+
+			util_mutex_lock(&gc->lock);
+			tx_group_commit_leave(gc, tx);
+			util_mutex_unlock(&gc->lock);
+		}
+
 		release_and_free_tx_locks(tx);
 		tx->pop = NULL;
 		tx->stage = TX_STAGE_NONE;
 		VEC_DELETE(&tx->actions);
 		VEC_DELETE(&tx->redo_userbufs);
+		VEC_DELETE(&tx->durable_cbs);
 
 		if (tx->stage_callback) {
 			pmemobj_tx_callback cb = tx->stage_callback;
@@ -1226,6 +2567,11 @@ pmemobj_tx_add_common(struct tx *tx, struct tx_range_def *args)
 		return obj_tx_fail_err(EINVAL, args->flags);
 	}
 
+	tx_post_commit_wait_range(tx->pop, args->offset, args->size);
+
+	if (args->flags & POBJ_XADD_LAZY_SNAPSHOT)
+		return tx_lazy_add(tx, args);
+
 	int ret = 0;
 
 	/*
@@ -1485,53 +2831,280 @@ pmemobj_tx_add_range(PMEMoid oid, uint64_t hoff, size_t size)
 		.flags = flags,
 	};
 
-	ret = pmemobj_tx_add_common(tx, &args);
+	ret = pmemobj_tx_add_common(tx, &args);
+
+	PMEMOBJ_API_END();
+	return ret;
+}
+
+/*
+ * pmemobj_tx_xadd_range -- adds persistent memory range into the transaction
+ */
+int
+pmemobj_tx_xadd_range(PMEMoid oid, uint64_t hoff, size_t size, uint64_t flags)
+{
+	LOG(3, NULL);
+
+	PMEMOBJ_API_START();
+	struct tx *tx = get_tx();
+
+	ASSERT_IN_TX(tx);
+	ASSERT_TX_STAGE_WORK(tx);
+
+	int ret;
+
+	flags |= tx_abort_on_failure_flag(tx);
+
+	if (flags & ~POBJ_XADD_VALID_FLAGS) {
+		ERR("unknown flags 0x%" PRIx64, flags
+			& ~POBJ_XADD_VALID_FLAGS);
+		ret = obj_tx_fail_err(EINVAL, flags);
+		PMEMOBJ_API_END();
+		return ret;
+	}
+
+	if (oid.pool_uuid_lo != tx->pop->uuid_lo) {
+		ERR("invalid pool uuid");
+		ret = obj_tx_fail_err(EINVAL, flags);
+		PMEMOBJ_API_END();
+		return ret;
+	}
+	ASSERT(OBJ_OID_IS_VALID(tx->pop, oid));
+
+	struct tx_range_def args = {
+		.offset = oid.off + hoff,
+		.size = size,
+		.flags = flags,
+	};
+
+	ret = pmemobj_tx_add_common(tx, &args);
+
+	PMEMOBJ_API_END();
+	return ret;
+}
+
+/*
+ * tx_shadow_find -- (internal) looks for the shadow copy which contains the
+ *	range
+ *
+ * Returns -1 if the range is only partially covered by shadow copies,
+ * otherwise 0 with the containing shadow copy, or NULL if there is none,
+ * stored in the shadow argument.
+ */
+static int
+tx_shadow_find(struct tx *tx, uint64_t offset, uint64_t size,
+	struct tx_shadow **shadow)
+{
+	*shadow = NULL;
+
+	if (tx->shadows == NULL)
+		return 0;
+
+	struct tx_shadow search = {offset, size, NULL};
+	struct ravl_node *n = ravl_find(tx->shadows, &search,
+		RAVL_PREDICATE_LESS_EQUAL);
+	if (n != NULL) {
+		struct tx_shadow *f = ravl_data(n);
+		if (offset + size <= f->offset + f->size) {
+			*shadow = f;
+			return 0;
+		}
+
+		if (offset < f->offset + f->size)
+			return -1;
+	}
+
+	n = ravl_find(tx->shadows, &search, RAVL_PREDICATE_GREATER);
+	if (n != NULL) {
+		struct tx_shadow *f = ravl_data(n);
+		if (f->offset < offset + size)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * tx_shadow_range_common -- (internal) common code for creating a shadow
+ *	copy of a persistent memory range
+ */
+static void *
+tx_shadow_range_common(struct tx *tx, uint64_t offset, size_t size,
+	uint64_t flags)
+{
+	LOG(15, NULL);
+
+	if (size == 0 || size > PMEMOBJ_MAX_ALLOC_SIZE) {
+		ERR("invalid shadow size %zu", size);
+		goto err_inval;
+	}
+
+	if (offset < tx->pop->heap_offset ||
+		(offset + size) >
+		(tx->pop->heap_offset + tx->pop->heap_size)) {
+		ERR("object outside of heap");
+		goto err_inval;
+	}
+
+	struct tx_shadow *f;
+	if (tx_shadow_find(tx, offset, size, &f) != 0) {
+		ERR("range partially overlaps an existing shadow");
+		goto err_inval;
+	}
+
+	if (f != NULL)
+		return (char *)f->data + (offset - f->offset);
+
+	if (tx->shadows == NULL) {
+		tx->shadows = ravl_new_sized(tx_shadow_cmp,
+			sizeof(struct tx_shadow));
+		if (tx->shadows == NULL)
+			goto err_nomem;
+	}
+
+	struct tx_shadow shadow = {offset, size, Malloc(size)};
+	if (shadow.data == NULL) {
+		ERR("!Malloc");
+		goto err_nomem;
+	}
+
+	memcpy(shadow.data, OBJ_OFF_TO_PTR(tx->pop, offset), size);
+
+	if (ravl_emplace_copy(tx->shadows, &shadow) != 0) {
+		Free(shadow.data);
+		goto err_nomem;
+	}
+
+	/*
+	 * Reserve the redo log space for the shadow right away, so that
+	 * the commit itself is unlikely to run out of it.
+	 */
+	size_t nbytes = ALIGN_UP(size + sizeof(struct ulog_entry_buf),
+		CACHELINE_SIZE);
+	tx->shadows_nbytes += nbytes;
+
+	if (tx_action_reserve(tx, 0) != 0) {
+		tx->shadows_nbytes -= nbytes;
+
+		struct ravl_node *n = ravl_find(tx->shadows, &shadow,
+			RAVL_PREDICATE_EQUAL);
+		ASSERTne(n, NULL);
+		ravl_remove(tx->shadows, n);
+		Free(shadow.data);
+
+		goto err_nomem;
+	}
+
+	return shadow.data;
+
+err_inval:
+	obj_tx_fail_err(EINVAL, flags);
+	return NULL;
+
+err_nomem:
+	ERR("out of memory");
+	obj_tx_fail_err(ENOMEM, flags);
+	return NULL;
+}
+
+/*
+ * pmemobj_tx_shadow_range -- creates a shadow copy of a persistent memory
+ *	range, which is written back to the pool at commit
+ */
+void *
+pmemobj_tx_shadow_range(PMEMoid oid, uint64_t hoff, size_t size)
+{
+	LOG(3, NULL);
+
+	PMEMOBJ_API_START();
+	struct tx *tx = get_tx();
+
+	ASSERT_IN_TX(tx);
+	ASSERT_TX_STAGE_WORK(tx);
+
+	void *ret;
+
+	uint64_t flags = tx_abort_on_failure_flag(tx);
+
+	if (oid.pool_uuid_lo != tx->pop->uuid_lo) {
+		ERR("invalid pool uuid");
+		obj_tx_fail_err(EINVAL, flags);
+		PMEMOBJ_API_END();
+		return NULL;
+	}
+	ASSERT(OBJ_OID_IS_VALID(tx->pop, oid));
+
+	ret = tx_shadow_range_common(tx, oid.off + hoff, size, flags);
+
+	PMEMOBJ_API_END();
+	return ret;
+}
+
+/*
+ * pmemobj_tx_shadow_range_direct -- creates a shadow copy of a persistent
+ *	memory range, which is written back to the pool at commit
+ */
+void *
+pmemobj_tx_shadow_range_direct(const void *ptr, size_t size)
+{
+	LOG(3, NULL);
+
+	PMEMOBJ_API_START();
+	struct tx *tx = get_tx();
+
+	ASSERT_IN_TX(tx);
+	ASSERT_TX_STAGE_WORK(tx);
+
+	void *ret;
+
+	uint64_t flags = tx_abort_on_failure_flag(tx);
+
+	if (!OBJ_PTR_FROM_POOL(tx->pop, ptr)) {
+		ERR("object outside of pool");
+		obj_tx_fail_err(EINVAL, flags);
+		PMEMOBJ_API_END();
+		return NULL;
+	}
+
+	ret = tx_shadow_range_common(tx,
+		(uint64_t)((char *)ptr - (char *)tx->pop), size, flags);
 
 	PMEMOBJ_API_END();
 	return ret;
 }
 
 /*
- * pmemobj_tx_xadd_range -- adds persistent memory range into the transaction
+ * pmemobj_tx_read_direct -- returns the address at which the current contents
+ *	of a persistent memory range can be read, which is the shadow copy of
+ *	the range if it has one
  */
-int
-pmemobj_tx_xadd_range(PMEMoid oid, uint64_t hoff, size_t size, uint64_t flags)
+const void *
+pmemobj_tx_read_direct(const void *ptr, size_t size)
 {
 	LOG(3, NULL);
 
-	PMEMOBJ_API_START();
 	struct tx *tx = get_tx();
 
-	ASSERT_IN_TX(tx);
-	ASSERT_TX_STAGE_WORK(tx);
+	/* outside of a transaction there are no shadow copies */
+	if (tx->stage != TX_STAGE_WORK || tx->shadows == NULL)
+		return ptr;
 
-	int ret;
+	if (!OBJ_PTR_FROM_POOL(tx->pop, ptr))
+		return ptr;
 
-	flags |= tx_abort_on_failure_flag(tx);
+	PMEMOBJ_API_START();
 
-	if (flags & ~POBJ_XADD_VALID_FLAGS) {
-		ERR("unknown flags 0x%" PRIx64, flags
-			& ~POBJ_XADD_VALID_FLAGS);
-		ret = obj_tx_fail_err(EINVAL, flags);
-		PMEMOBJ_API_END();
-		return ret;
-	}
+	const void *ret = ptr;
+	uint64_t offset = (uint64_t)((char *)ptr - (char *)tx->pop);
 
-	if (oid.pool_uuid_lo != tx->pop->uuid_lo) {
-		ERR("invalid pool uuid");
-		ret = obj_tx_fail_err(EINVAL, flags);
-		PMEMOBJ_API_END();
-		return ret;
+	struct tx_shadow *f;
+	if (tx_shadow_find(tx, offset, size, &f) != 0) {
+		ERR("range partially overlaps an existing shadow");
+		obj_tx_fail_err(EINVAL, tx_abort_on_failure_flag(tx));
+		ret = NULL;
+	} else if (f != NULL) {
+		ret = (char *)f->data + (offset - f->offset);
 	}
-	ASSERT(OBJ_OID_IS_VALID(tx->pop, oid));
-
-	struct tx_range_def args = {
-		.offset = oid.off + hoff,
-		.size = size,
-		.flags = flags,
-	};
-
-	ret = pmemobj_tx_add_common(tx, &args);
 
 	PMEMOBJ_API_END();
 	return ret;
@@ -2313,6 +3886,15 @@ static int
 CTL_READ_HANDLER(queue_depth)(void *ctx, enum ctl_query_source source,
 	void *arg, struct ctl_indexes *indexes)
 {
+	PMEMobjpool *pop = ctx;
+	struct tx_post_commit *pc = pop->tx_params->post_commit;
+
+	int *arg_out = arg;
+
+	util_mutex_lock(&pc->lock);
+	*arg_out = (int)pc->depth;
+	util_mutex_unlock(&pc->lock);
+
 	return 0;
 }
 
@@ -2323,6 +3905,25 @@ static int
 CTL_WRITE_HANDLER(queue_depth)(void *ctx, enum ctl_query_source source,
 	void *arg, struct ctl_indexes *indexes)
 {
+	PMEMobjpool *pop = ctx;
+	struct tx_post_commit *pc = pop->tx_params->post_commit;
+
+	int arg_in = *(int *)arg;
+
+	/* at least one lane has to remain available for the workers */
+	unsigned nlanes = pop->lanes_desc.runtime_nlanes;
+	if (arg_in < 0 || (unsigned)arg_in >= nlanes) {
+		ERR("invalid post commit queue depth %d, "
+			"must be lower than the number of lanes (%u)",
+			arg_in, nlanes);
+		errno = EINVAL;
+		return -1;
+	}
+
+	util_mutex_lock(&pc->lock);
+	pc->depth = (unsigned)arg_in;
+	util_mutex_unlock(&pc->lock);
+
 	return 0;
 }
 
@@ -2335,6 +3936,10 @@ static int
 CTL_READ_HANDLER(worker)(void *ctx, enum ctl_query_source source,
 	void *arg, struct ctl_indexes *indexes)
 {
+	PMEMobjpool *pop = ctx;
+
+	tx_post_commit_worker(pop);
+
 	return 0;
 }
 
@@ -2345,6 +3950,90 @@ static int
 CTL_READ_HANDLER(stop)(void *ctx, enum ctl_query_source source,
 	void *arg, struct ctl_indexes *indexes)
 {
+	PMEMobjpool *pop = ctx;
+
+	tx_post_commit_stop(pop);
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(pending) -- returns the number of lanes waiting in the
+ *	post commit queue
+ */
+static int
+CTL_READ_HANDLER(pending)(void *ctx, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	struct tx_post_commit *pc = pop->tx_params->post_commit;
+
+	size_t *arg_out = arg;
+
+	util_mutex_lock(&pc->lock);
+	*arg_out = VECQ_SIZE(&pc->lanes);
+	util_mutex_unlock(&pc->lock);
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(queued) -- returns the number of commits that deferred
+ *	the cleanup to the post commit workers
+ */
+static int
+CTL_READ_HANDLER(queued)(void *ctx, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	struct tx_post_commit *pc = pop->tx_params->post_commit;
+
+	uint64_t *arg_out = arg;
+
+	util_mutex_lock(&pc->lock);
+	*arg_out = pc->queued;
+	util_mutex_unlock(&pc->lock);
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(overflows) -- returns the number of commits that performed
+ *	the cleanup inline because the post commit queue was full
+ */
+static int
+CTL_READ_HANDLER(overflows)(void *ctx, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	struct tx_post_commit *pc = pop->tx_params->post_commit;
+
+	uint64_t *arg_out = arg;
+
+	util_mutex_lock(&pc->lock);
+	*arg_out = pc->overflows;
+	util_mutex_unlock(&pc->lock);
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(async_commits) -- returns the number of asynchronous
+ *	commits completed by the post commit workers
+ */
+static int
+CTL_READ_HANDLER(async_commits)(void *ctx, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	struct tx_post_commit *pc = pop->tx_params->post_commit;
+
+	uint64_t *arg_out = arg;
+
+	util_mutex_lock(&pc->lock);
+	*arg_out = pc->async_commits;
+	util_mutex_unlock(&pc->lock);
+
 	return 0;
 }
 
@@ -2352,6 +4041,247 @@ static const struct ctl_node CTL_NODE(post_commit)[] = {
 	CTL_LEAF_RW(queue_depth),
 	CTL_LEAF_RO(worker),
 	CTL_LEAF_RO(stop),
+	CTL_LEAF_RO(pending),
+	CTL_LEAF_RO(queued),
+	CTL_LEAF_RO(overflows),
+	CTL_LEAF_RO(async_commits),
+
+	CTL_NODE_END
+};
+
+/*
+ * CTL_READ_HANDLER(window) -- returns the group commit window
+ */
+static int
+CTL_READ_HANDLER(window)(void *ctx, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	struct tx_group_commit *gc = pop->tx_params->group_commit;
+
+	long long *arg_out = arg;
+
+	uint64_t window_us;
+	util_atomic_load64(&gc->window_us, &window_us);
+	*arg_out = (long long)window_us;
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(window) -- sets the group commit window, 0 disables
+ *	group commit
+ */
+static int
+CTL_WRITE_HANDLER(window)(void *ctx, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	struct tx_group_commit *gc = pop->tx_params->group_commit;
+
+	long long arg_in = *(long long *)arg;
+
+	if (arg_in < 0 || arg_in > TX_GROUP_COMMIT_WINDOW_MAX) {
+		ERR("invalid group commit window %lld, "
+			"must be between 0 and %d microseconds",
+			arg_in, TX_GROUP_COMMIT_WINDOW_MAX);
+		errno = EINVAL;
+		return -1;
+	}
+
+	util_atomic_store_explicit64(&gc->window_us, (uint64_t)arg_in,
+		memory_order_release);
+
+	return 0;
+}
+
+static const struct ctl_argument CTL_ARG(window) = CTL_ARG_LONG_LONG;
+
+/*
+ * CTL_READ_HANDLER(groups) -- returns the number of committed groups
+ */
+static int
+CTL_READ_HANDLER(groups)(void *ctx, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	struct tx_group_commit *gc = pop->tx_params->group_commit;
+
+	uint64_t *arg_out = arg;
+
+	util_mutex_lock(&gc->lock);
+	*arg_out = gc->ngroups;
+	util_mutex_unlock(&gc->lock);
+
+	return 0;
+}
+
+/*
+ * CTL_READ_HANDLER(commits) -- returns the number of transactions committed
+ *	as members of a group
+ */
+static int
+CTL_READ_HANDLER(commits)(void *ctx, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+	struct tx_group_commit *gc = pop->tx_params->group_commit;
+
+	uint64_t *arg_out = arg;
+
+	util_mutex_lock(&gc->lock);
+	*arg_out = gc->ncommits;
+	util_mutex_unlock(&gc->lock);
+
+	return 0;
+}
+
+static const struct ctl_node CTL_NODE(group_commit)[] = {
+	CTL_LEAF_RW(window),
+	CTL_LEAF_RO(groups),
+	CTL_LEAF_RO(commits),
+
+	CTL_NODE_END
+};
+
+/*
+ * CTL_READ_HANDLER(crc32c) -- returns whether the logs are checksummed
+ *	with CRC32C
+ */
+static int
+CTL_READ_HANDLER(crc32c)(void *ctx, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	int *arg_out = arg;
+
+	*arg_out = pop->ulog_checksum_crc32c;
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(crc32c) -- selects the checksum algorithm of the logs
+ *
+ * Before the first log is checksummed with CRC32C, the pool is marked with
+ * the POOL_FEAT_ULOG_CRC32C incompat feature, so that the versions of the
+ * library that cannot recover such logs refuse to open it. The feature stays
+ * enabled when CRC32C is turned off again.
+ */
+static int
+CTL_WRITE_HANDLER(crc32c)(void *ctx, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	int arg_in = *(int *)arg;
+
+	if (arg_in && util_pool_feature_enable(pop->set,
+	    (features_t)FEAT_INCOMPAT(ULOG_CRC32C)) != 0)
+		return -1;
+
+	pop->ulog_checksum_crc32c = arg_in;
+
+	return 0;
+}
+
+static const struct ctl_argument CTL_ARG(crc32c) = CTL_ARG_BOOLEAN;
+
+static const struct ctl_node CTL_NODE(checksum)[] = {
+	CTL_LEAF_RW(crc32c),
+
+	CTL_NODE_END
+};
+
+/*
+ * CTL_READ_HANDLER(retain_max) -- returns the maximum capacity of the next
+ *	logs retained by a lane log
+ */
+static int
+CTL_READ_HANDLER(retain_max)(void *ctx, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	long long *arg_out = arg;
+
+	*arg_out = (long long)pop->tx_params->log_retain_max;
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(retain_max) -- sets the maximum capacity of the next
+ *	logs retained by a lane log, 0 frees them after every operation
+ */
+static int
+CTL_WRITE_HANDLER(retain_max)(void *ctx, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	long long arg_in = *(long long *)arg;
+
+	if (arg_in < 0 || arg_in > (long long)PMEMOBJ_MAX_ALLOC_SIZE) {
+		errno = EINVAL;
+		ERR("invalid retained log capacity, "
+			"must be between 0 and max alloc size");
+		return -1;
+	}
+
+	pop->tx_params->log_retain_max = (size_t)arg_in;
+
+	return 0;
+}
+
+static const struct ctl_argument CTL_ARG(retain_max) = CTL_ARG_LONG_LONG;
+
+/*
+ * CTL_READ_HANDLER(retain_decay) -- returns the percentage by which the
+ *	learned usage of the next logs decays with every operation
+ */
+static int
+CTL_READ_HANDLER(retain_decay)(void *ctx, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	int *arg_out = arg;
+
+	*arg_out = (int)pop->tx_params->log_retain_decay;
+
+	return 0;
+}
+
+/*
+ * CTL_WRITE_HANDLER(retain_decay) -- sets the percentage by which the
+ *	learned usage of the next logs decays with every operation
+ */
+static int
+CTL_WRITE_HANDLER(retain_decay)(void *ctx, enum ctl_query_source source,
+	void *arg, struct ctl_indexes *indexes)
+{
+	PMEMobjpool *pop = ctx;
+
+	int arg_in = *(int *)arg;
+
+	if (arg_in < 0 || arg_in > 100) {
+		errno = EINVAL;
+		ERR("invalid log retain decay, must be between 0 and 100");
+		return -1;
+	}
+
+	pop->tx_params->log_retain_decay = (unsigned)arg_in;
+
+	return 0;
+}
+
+static const struct ctl_argument CTL_ARG(retain_decay) = CTL_ARG_INT;
+
+static const struct ctl_node CTL_NODE(log)[] = {
+	CTL_LEAF_RW(retain_max),
+	CTL_LEAF_RW(retain_decay),
 
 	CTL_NODE_END
 };
@@ -2360,6 +4290,9 @@ static const struct ctl_node CTL_NODE(tx)[] = {
 	CTL_CHILD(debug),
 	CTL_CHILD(cache),
 	CTL_CHILD(post_commit),
+	CTL_CHILD(group_commit),
+	CTL_CHILD(checksum),
+	CTL_CHILD(log),
 
 	CTL_NODE_END
 };
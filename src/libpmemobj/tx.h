@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2016-2019, Intel Corporation */
+/* Copyright 2016-2020, Intel Corporation */
 
 /*
  * tx.h -- internal definitions for transactions
@@ -17,6 +17,7 @@ extern "C" {
 #endif
 
 #define TX_DEFAULT_RANGE_CACHE_SIZE (1 << 15)
+#define TX_DEFAULT_LOG_RETAIN_DECAY 10
 #define TX_DEFAULT_RANGE_CACHE_THRESHOLD (1 << 12)
 
 #define TX_RANGE_MASK (8ULL - 1)
@@ -32,8 +33,15 @@ extern "C" {
 #define TX_INTENT_LOG_BUFFER_OVERHEAD sizeof(struct ulog)
 #define TX_INTENT_LOG_ENTRY_OVERHEAD sizeof(struct ulog_entry_val)
 
+struct tx_post_commit;
+struct tx_group_commit;
+
 struct tx_parameters {
 	size_t cache_size;
+	size_t log_retain_max; /* per lane log, 0 if logs aren't retained */
+	unsigned log_retain_decay; /* percentage */
+	struct tx_post_commit *post_commit;
+	struct tx_group_commit *group_commit;
 };
 
 /*
@@ -47,6 +55,9 @@ void tx_ctl_register(PMEMobjpool *pop);
 struct tx_parameters *tx_params_new(void);
 void tx_params_delete(struct tx_parameters *tx_params);
 
+void tx_post_commit_stop(PMEMobjpool *pop);
+void tx_post_commit_wait(PMEMobjpool *pop);
+
 #ifdef __cplusplus
 }
 #endif
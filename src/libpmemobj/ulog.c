@@ -95,11 +95,25 @@ ulog_entry_size(const struct ulog_entry_base *entry)
 }
 
 /*
- * ulog_entry_valid -- (internal) checks if a ulog entry is valid
+ * ulog_checksum_seq -- (internal) continues the checksum of a ulog entry with
+ *	the algorithm selected by the ulog flags
+ */
+static inline uint64_t
+ulog_checksum_seq(uint64_t flags, const void *addr, size_t len, uint64_t csum)
+{
+	return (flags & ULOG_CHECKSUM_CRC32C) ?
+		util_crc32c_seq(addr, len, csum) :
+		util_checksum_seq(addr, len, csum);
+}
+
+/*
+ * ulog_entry_csum_valid -- (internal) checks if a ulog entry is valid for
+ *	the given generation number and ulog flags
  * Returns 1 if the range is valid, otherwise 0 is returned.
  */
 static int
-ulog_entry_valid(struct ulog *ulog, const struct ulog_entry_base *entry)
+ulog_entry_csum_valid(uint64_t gen_num, uint64_t flags,
+	const struct ulog_entry_base *entry)
 {
 	if (entry->offset == 0)
 		return 0;
@@ -113,10 +127,12 @@ ulog_entry_valid(struct ulog *ulog, const struct ulog_entry_base *entry)
 			size = ulog_entry_size(entry);
 			b = (struct ulog_entry_buf *)entry;
 
-			uint64_t csum = util_checksum_compute(b, size,
+			uint64_t csum = (flags & ULOG_CHECKSUM_CRC32C) ?
+				util_crc32c_compute(b, size, &b->checksum) :
+				util_checksum_compute(b, size,
 					&b->checksum, 0);
-			csum = util_checksum_seq(&ulog->gen_num,
-					sizeof(ulog->gen_num), csum);
+			csum = ulog_checksum_seq(flags, &gen_num,
+					sizeof(gen_num), csum);
 
 			if (b->checksum != csum)
 				return 0;
@@ -128,6 +144,16 @@ ulog_entry_valid(struct ulog *ulog, const struct ulog_entry_base *entry)
 	return 1;
 }
 
+/*
+ * ulog_entry_valid -- (internal) checks if a ulog entry is valid
+ * Returns 1 if the range is valid, otherwise 0 is returned.
+ */
+static int
+ulog_entry_valid(struct ulog *ulog, const struct ulog_entry_base *entry)
+{
+	return ulog_entry_csum_valid(ulog->gen_num, ulog->flags, entry);
+}
+
 /*
  * ulog_construct -- initializes the ulog structure
  */
@@ -273,8 +299,19 @@ ulog_reserve(struct ulog *ulog,
 static int
 ulog_checksum(struct ulog *ulog, size_t ulog_base_bytes, int insert)
 {
-	return util_checksum(ulog, SIZEOF_ULOG(ulog_base_bytes),
-		&ulog->checksum, insert, 0);
+	if (!(ulog->flags & ULOG_CHECKSUM_CRC32C))
+		return util_checksum(ulog, SIZEOF_ULOG(ulog_base_bytes),
+			&ulog->checksum, insert, 0);
+
+	uint64_t csum = htole64(util_crc32c_compute(ulog,
+		SIZEOF_ULOG(ulog_base_bytes), &ulog->checksum));
+
+	if (insert) {
+		ulog->checksum = csum;
+		return 1;
+	}
+
+	return ulog->checksum == csum;
 }
 
 /*
@@ -418,7 +455,7 @@ ulog_clobber_entry(const struct ulog_entry_base *e,
  */
 struct ulog_entry_buf *
 ulog_entry_buf_create(struct ulog *ulog, size_t offset, uint64_t gen_num,
-		uint64_t *dest, const void *src, uint64_t size,
+		uint64_t flags, uint64_t *dest, const void *src, uint64_t size,
 		ulog_operation_type type, const struct pmem_ops *p_ops)
 {
 	struct ulog_entry_buf *e =
@@ -482,14 +519,15 @@ ulog_entry_buf_create(struct ulog *ulog, size_t offset, uint64_t gen_num,
 		VALGRIND_REMOVE_FROM_TX(dest, CACHELINE_SIZE);
 	}
 
-	b->checksum = util_checksum_seq(b, CACHELINE_SIZE, 0);
+	b->checksum = ulog_checksum_seq(flags, b, CACHELINE_SIZE, 0);
 	if (rcopy != 0)
-		b->checksum = util_checksum_seq(srcof, rcopy, b->checksum);
+		b->checksum = ulog_checksum_seq(flags, srcof, rcopy,
+			b->checksum);
 	if (lcopy != 0)
-		b->checksum = util_checksum_seq(last_cacheline,
+		b->checksum = ulog_checksum_seq(flags, last_cacheline,
 			CACHELINE_SIZE, b->checksum);
 
-	b->checksum = util_checksum_seq(&gen_num, sizeof(gen_num),
+	b->checksum = ulog_checksum_seq(flags, &gen_num, sizeof(gen_num),
 			b->checksum);
 
 	ASSERT(IS_CACHELINE_ALIGNED(e));
@@ -513,6 +551,48 @@ ulog_entry_buf_create(struct ulog *ulog, size_t offset, uint64_t gen_num,
 	}
 #endif
 
+	ASSERT(ulog_entry_csum_valid(gen_num, flags, &e->base));
+
+	return e;
+}
+
+/*
+ * ulog_entry_buf_create_shadow -- creates a buffer entry in the shadow copy
+ *	of a ulog, which resides in regular memory and is later written to
+ *	the persistent ulog with ulog_store
+ *
+ * The entry must be located at a cacheline offset in the ulog data, and there
+ * must be room for the header of the next entry after it, which is zeroed so
+ * that leftovers of a previous log are not applied.
+ */
+struct ulog_entry_buf *
+ulog_entry_buf_create_shadow(struct ulog *ulog, size_t offset,
+	uint64_t *dest, const void *src, uint64_t size,
+	ulog_operation_type type, const struct pmem_ops *p_ops)
+{
+	ASSERTeq(offset % CACHELINE_SIZE, 0);
+
+	struct ulog_entry_buf *e =
+		(struct ulog_entry_buf *)(ulog->data + offset);
+	size_t entry_size = ALIGN_UP(sizeof(*e) + size, CACHELINE_SIZE);
+
+	e->base.offset = (uint64_t)(dest) - (uint64_t)p_ops->base;
+	e->base.offset |= ULOG_OPERATION(type);
+	e->size = size;
+	e->checksum = 0;
+
+	memcpy(e->data, src, size);
+	memset(e->data + size, 0, entry_size - sizeof(*e) - size);
+
+	/* the same checksum as the one of ulog_entry_buf_create */
+	uint64_t csum = ulog_checksum_seq(ulog->flags, e, entry_size, 0);
+	e->checksum = ulog_checksum_seq(ulog->flags, &ulog->gen_num,
+		sizeof(ulog->gen_num), csum);
+
+	struct ulog_entry_base *next =
+		(struct ulog_entry_base *)(ulog->data + offset + entry_size);
+	next->offset = 0;
+
 	ASSERT(ulog_entry_valid(ulog, &e->base));
 
 	return e;
@@ -614,13 +694,14 @@ ulog_inc_gen_num(struct ulog *ulog, const struct pmem_ops *p_ops)
 }
 
 /*
- * ulog_free_by_ptr_next -- free all ulogs starting from the indicated one.
+ * ulog_free_by_ptr_next -- free all ulogs starting from the indicated one,
+ * except for the first ones that fit in 'retain' bytes of capacity.
  * Function returns 1 if any ulog have been freed or unpinned, 0 otherwise.
  */
 int
 ulog_free_next(struct ulog *u, const struct pmem_ops *p_ops,
 		ulog_free_fn ulog_free, ulog_rm_user_buffer_fn user_buff_remove,
-		uint64_t flags)
+		size_t retain, uint64_t flags)
 {
 	int ret = 0;
 
@@ -661,6 +742,16 @@ ulog_free_next(struct ulog *u, const struct pmem_ops *p_ops,
 		last_internal = ulog_by_offset(last_internal->next, p_ops);
 	}
 
+	/* keep the logs which fit in the retained capacity */
+	while (u->next != 0) {
+		struct ulog *next = ulog_by_offset(u->next, p_ops);
+		if (next->capacity > retain)
+			break;
+
+		retain -= next->capacity;
+		u = next;
+	}
+
 	while (u->next != 0) {
 		if (VEC_PUSH_BACK(&ulogs_internal_except_first,
 			&u->next) != 0) {
@@ -710,7 +801,7 @@ ulog_clobber_data(struct ulog *ulog_first,
 	size_t nbytes, size_t ulog_base_nbytes,
 	struct ulog_next *next, ulog_free_fn ulog_free,
 	ulog_rm_user_buffer_fn user_buff_remove,
-	const struct pmem_ops *p_ops, unsigned flags)
+	const struct pmem_ops *p_ops, size_t retain, unsigned flags)
 {
 	ASSERTne(ulog_first, NULL);
 
@@ -729,7 +820,8 @@ ulog_clobber_data(struct ulog *ulog_first,
 		/*
 		 * We want to keep gen_nums consistent between ulogs.
 		 * If the transaction will commit successfully we'll reuse the
-		 * second buffer (third and next ones will be freed anyway).
+		 * second buffer (third and next ones will be freed, unless
+		 * they are retained, see below).
 		 * If the application will crash we'll free 2nd ulog on
 		 * recovery, which means we'll never read gen_num of the
 		 * second ulog in case of an ungraceful shutdown.
@@ -773,7 +865,26 @@ ulog_clobber_data(struct ulog *ulog_first,
 	if (u == NULL)
 		return 0;
 
-	return ulog_free_next(u, p_ops, ulog_free, user_buff_remove, flags);
+	/*
+	 * The second ulog is always kept, only the ones after it can be
+	 * retained.
+	 */
+	if (flags & ULOG_FREE_AFTER_FIRST)
+		retain = 0;
+	else if (u == ulog_second)
+		retain = retain > u->capacity ? retain - u->capacity : 0;
+
+	int ret = ulog_free_next(u, p_ops, ulog_free, user_buff_remove,
+		retain, flags);
+
+	/* the retained ulogs are reused just like the second one */
+	if (u == ulog_second) {
+		for (struct ulog *r = ulog_next(u, p_ops); r != NULL;
+		    r = ulog_next(r, p_ops))
+			ulog_inc_gen_num(r, NULL);
+	}
+
+	return ret;
 }
 
 /*
@@ -63,6 +63,12 @@ struct ulog_entry_buf {
  */
 #define ULOG_USER_OWNED (1U << 0)
 
+/*
+ * The checksums of the ulog and of its entries are CRC32C instead of
+ * Fletcher64. Only the flag of the first ulog of a chain matters.
+ */
+#define ULOG_CHECKSUM_CRC32C (1U << 1)
+
 /* use this for allocations of aligned ulog extensions */
 #define SIZEOF_ALIGNED_ULOG(base_capacity)\
 ALIGN_UP(SIZEOF_ULOG(base_capacity + (2 * CACHELINE_SIZE)), CACHELINE_SIZE)
@@ -121,14 +127,14 @@ void ulog_store(struct ulog *dest,
 
 int ulog_free_next(struct ulog *u, const struct pmem_ops *p_ops,
 		ulog_free_fn ulog_free, ulog_rm_user_buffer_fn user_buff_remove,
-		uint64_t flags);
+		size_t retain, uint64_t flags);
 void ulog_clobber(struct ulog *dest, struct ulog_next *next,
 	const struct pmem_ops *p_ops);
 int ulog_clobber_data(struct ulog *dest,
 	size_t nbytes, size_t ulog_base_nbytes,
 	struct ulog_next *next, ulog_free_fn ulog_free,
 	ulog_rm_user_buffer_fn user_buff_remove,
-	const struct pmem_ops *p_ops, unsigned flags);
+	const struct pmem_ops *p_ops, size_t retain, unsigned flags);
 void ulog_clobber_entry(const struct ulog_entry_base *e,
 	const struct pmem_ops *p_ops);
 
@@ -150,7 +156,11 @@ struct ulog_entry_val *ulog_entry_val_create(struct ulog *ulog,
 
 struct ulog_entry_buf *
 ulog_entry_buf_create(struct ulog *ulog, size_t offset,
-	uint64_t gen_num, uint64_t *dest, const void *src, uint64_t size,
+	uint64_t gen_num, uint64_t flags, uint64_t *dest, const void *src,
+	uint64_t size, ulog_operation_type type, const struct pmem_ops *p_ops);
+struct ulog_entry_buf *
+ulog_entry_buf_create_shadow(struct ulog *ulog, size_t offset,
+	uint64_t *dest, const void *src, uint64_t size,
 	ulog_operation_type type, const struct pmem_ops *p_ops);
 
 void ulog_entry_apply(const struct ulog_entry_base *e, int persist,
@@ -26,6 +26,7 @@ static const features_t f_singlehdr = FEAT_INCOMPAT(SINGLEHDR);
 static const features_t f_cksum_2k = FEAT_INCOMPAT(CKSUM_2K);
 static const features_t f_sds = FEAT_INCOMPAT(SDS);
 static const features_t f_chkbb = FEAT_COMPAT(CHECK_BAD_BLOCKS);
+static const features_t f_ulog_crc32c = FEAT_INCOMPAT(ULOG_CRC32C);
 
 #define FEAT_INVALID \
 	{UINT32_MAX, UINT32_MAX, UINT32_MAX};
@@ -566,6 +567,53 @@ query_badblocks_checking(const char *path)
 	return query_feature(path, f_chkbb);
 }
 
+/*
+ * enable_ulog_crc32c -- (internal) enable POOL_FEAT_ULOG_CRC32C
+ */
+static int
+enable_ulog_crc32c(const char *path)
+{
+	struct pool_set *set = poolset_open(path, RW);
+	if (!set)
+		return -1;
+
+	int ret = 0;
+	if (!require_feature_is(set, f_ulog_crc32c, DISABLED))
+		goto exit;
+
+	/* the logs checksummed with CRC32C are used only by obj pools */
+	if (pool_hdr_get_type(get_hdr(set, 0, 0)) != POOL_TYPE_OBJ) {
+		ret = unsupported_feature(f_ulog_crc32c);
+		goto exit;
+	}
+
+	feature_set(set, f_ulog_crc32c, ENABLED);
+exit:
+	poolset_close(set);
+	return ret;
+}
+
+/*
+ * disable_ulog_crc32c -- (internal) disable POOL_FEAT_ULOG_CRC32C
+ *
+ * The logs of the pool might still be checksummed with CRC32C, and there is
+ * no way to tell it without opening the pool.
+ */
+static int
+disable_ulog_crc32c(const char *path)
+{
+	return unsupported_feature(f_ulog_crc32c);
+}
+
+/*
+ * query_ulog_crc32c -- (internal) query POOL_FEAT_ULOG_CRC32C
+ */
+static int
+query_ulog_crc32c(const char *path)
+{
+	return query_feature(path, f_ulog_crc32c);
+}
+
 struct feature_funcs {
 	int (*enable)(const char *);
 	int (*disable)(const char *);
@@ -593,6 +641,11 @@ static struct feature_funcs features[] = {
 			.disable = disable_badblocks_checking,
 			.query = query_badblocks_checking
 		},
+		{
+			.enable = enable_ulog_crc32c,
+			.disable = disable_ulog_crc32c,
+			.query = query_ulog_crc32c
+		},
 };
 
 #define FEATURE_FUNCS_MAX ARRAY_SIZE(features)
@@ -684,6 +737,7 @@ pmempool_feature_queryU(const char *path, enum pmempool_feature feature,
 	CHECK_INCOMPAT_MAPPING(SINGLEHDR, PMEMPOOL_FEAT_SINGLEHDR);
 	CHECK_INCOMPAT_MAPPING(CKSUM_2K, PMEMPOOL_FEAT_CKSUM_2K);
 	CHECK_INCOMPAT_MAPPING(SDS, PMEMPOOL_FEAT_SHUTDOWN_STATE);
+	CHECK_INCOMPAT_MAPPING(ULOG_CRC32C, PMEMPOOL_FEAT_ULOG_CRC32C);
 
 #undef CHECK_INCOMPAT_MAPPING
 #endif
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2014-2018, Intel Corporation */
+/* Copyright 2014-2020, Intel Corporation */
 
 /*
  * checksum.c -- unit test for library internal checksum routine
@@ -12,6 +12,9 @@
 #include "util.h"
 #include <inttypes.h>
 
+/* large enough for all block sizes of the hardware CRC32C */
+#define CRC32C_BUF_SIZE (128 * 1024 + 13)
+
 /*
  * fletcher64 -- compute a Fletcher64 checksum
  *
@@ -36,6 +39,71 @@ fletcher64(void *addr, size_t len)
 	return htole64((uint64_t)hi32 << 32 | lo32);
 }
 
+/*
+ * crc32c -- compute a CRC32C checksum bit by bit
+ *
+ * Gold standard implementation used to compare to the
+ * util_crc32c_seq() being unit tested.
+ */
+static uint32_t
+crc32c(const void *addr, size_t len)
+{
+	const unsigned char *p = addr;
+	uint32_t crc = UINT32_MAX;
+
+	while (len--) {
+		crc ^= *p++;
+		for (int k = 0; k < 8; k++)
+			crc = crc & 1 ? (crc >> 1) ^ 0x82F63B78U : crc >> 1;
+	}
+
+	return ~crc;
+}
+
+/*
+ * test_crc32c -- verifies the CRC32C of buffers of various sizes, alignments
+ *	and split points against the gold standard
+ */
+static void
+test_crc32c(void)
+{
+	UT_ASSERTeq(util_crc32c_seq("123456789", 9, 0), 0xE3069283);
+
+	unsigned char *buf = MALLOC(CRC32C_BUF_SIZE);
+	for (size_t i = 0; i < CRC32C_BUF_SIZE; i++)
+		buf[i] = (unsigned char)(i * 31 + (i >> 8));
+
+	size_t sizes[] = {0, 1, 7, 8, 100, 767, 768, 4096, 24575, 24576,
+		CRC32C_BUF_SIZE - 7};
+
+	for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+		for (size_t off = 0; off < 8; off++) {
+			size_t len = sizes[i];
+			uint32_t gold = crc32c(buf + off, len);
+
+			UT_ASSERTeq(util_crc32c_seq(buf + off, len, 0), gold);
+
+			/* the checksum continued after any split point */
+			size_t split = len / 3 + off;
+			if (split > len)
+				split = len;
+			uint64_t csum = util_crc32c_seq(buf + off, split, 0);
+			csum = util_crc32c_seq(buf + off + split, len - split,
+				csum);
+			UT_ASSERTeq(csum, gold);
+		}
+	}
+
+	/* the location of the checksum is treated as zeros */
+	uint64_t *csump = (uint64_t *)(buf + 4096);
+	*csump = 0;
+	uint32_t gold = crc32c(buf, CRC32C_BUF_SIZE);
+	*csump = 0x123;
+	UT_ASSERTeq(util_crc32c_compute(buf, CRC32C_BUF_SIZE, csump), gold);
+
+	FREE(buf);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -44,6 +112,9 @@ main(int argc, char *argv[])
 	if (argc < 2)
 		UT_FATAL("usage: %s files...", argv[0]);
 
+	util_init();
+	test_crc32c();
+
 	for (int arg = 1; arg < argc; arg++) {
 		int fd = OPEN(argv[arg], O_RDONLY);
 
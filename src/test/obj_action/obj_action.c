@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2017-2019, Intel Corporation */
+/* Copyright 2017-2020, Intel Corporation */
 
 /*
  * obj_action.c -- test the action API
@@ -161,6 +161,118 @@ test_many(PMEMobjpool *pop, size_t n)
 	FREE(act);
 }
 
+#define BULK_TYPE_NUM 2
+#define BULK_SIZE 100
+
+/*
+ * count_bulk -- counts the objects allocated by the bulk tests
+ */
+static size_t
+count_bulk(PMEMobjpool *pop)
+{
+	size_t n = 0;
+	PMEMoid oid;
+	POBJ_FOREACH(pop, oid) {
+		if (pmemobj_type_num(oid) == BULK_TYPE_NUM)
+			n++;
+	}
+
+	return n;
+}
+
+/*
+ * bulk_constr -- constructor which fails on the given object
+ */
+static int
+bulk_constr(PMEMobjpool *pop, void *ptr, void *arg)
+{
+	int *countdown = arg;
+
+	return --(*countdown) == 0;
+}
+
+static void
+test_bulk(PMEMobjpool *pop, size_t n)
+{
+	struct pobj_action *act = (struct pobj_action *)
+		MALLOC(sizeof(struct pobj_action) * n);
+
+	/* reservations can be canceled and published like any others */
+	int ret = pmemobj_xreserve_bulk(pop, act, n, BULK_SIZE,
+		BULK_TYPE_NUM, POBJ_XALLOC_ZERO);
+	UT_ASSERTeq(ret, 0);
+	pmemobj_cancel(pop, act, n);
+	UT_ASSERTeq(count_bulk(pop), 0);
+
+	ret = pmemobj_xreserve_bulk(pop, act, n, BULK_SIZE, BULK_TYPE_NUM,
+		POBJ_XALLOC_ZERO);
+	UT_ASSERTeq(ret, 0);
+	for (size_t i = 0; i < n; ++i) {
+		char *data = (char *)pop + act[i].heap.offset;
+		for (size_t j = 0; j < BULK_SIZE; ++j)
+			UT_ASSERTeq(data[j], 0);
+	}
+	UT_ASSERTeq(pmemobj_publish(pop, act, n), 0);
+	UT_ASSERTeq(count_bulk(pop), n);
+
+	ret = pmemobj_xreserve_bulk(pop, act, 1, BULK_SIZE, BULK_TYPE_NUM,
+		POBJ_XALLOC_NO_FLUSH);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	/* the identifiers can reside in volatile memory... */
+	PMEMoid *oidv = (PMEMoid *)MALLOC(sizeof(PMEMoid) * n);
+	ret = pmemobj_xalloc_bulk(pop, oidv, n, BULK_SIZE, BULK_TYPE_NUM,
+		0, NULL, NULL);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(count_bulk(pop), 2 * n);
+	for (size_t i = 0; i < n; ++i) {
+		UT_ASSERTeq(pmemobj_type_num(oidv[i]), BULK_TYPE_NUM);
+		UT_ASSERT(pmemobj_alloc_usable_size(oidv[i]) >= BULK_SIZE);
+		pmemobj_free(&oidv[i]);
+	}
+	FREE(oidv);
+
+	/* ...or in the pool */
+	PMEMoid vec;
+	ret = pmemobj_zalloc(pop, &vec, sizeof(PMEMoid) * n, 0);
+	UT_ASSERTeq(ret, 0);
+	oidv = pmemobj_direct(vec);
+	ret = pmemobj_xalloc_bulk(pop, oidv, n, BULK_SIZE, BULK_TYPE_NUM,
+		POBJ_XALLOC_ZERO, NULL, NULL);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(count_bulk(pop), 2 * n);
+	for (size_t i = 0; i < n; ++i) {
+		UT_ASSERTeq(pmemobj_type_num(oidv[i]), BULK_TYPE_NUM);
+		pmemobj_free(&oidv[i]);
+	}
+
+	/* a failed constructor rolls back the entire batch */
+	int countdown = (int)n / 2;
+	ret = pmemobj_xalloc_bulk(pop, oidv, n, BULK_SIZE, BULK_TYPE_NUM,
+		0, bulk_constr, &countdown);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, ECANCELED);
+	UT_ASSERTeq(count_bulk(pop), n);
+	pmemobj_free(&vec);
+
+	/* the size of the batch can't overflow the internal buffers */
+	ret = pmemobj_xalloc_bulk(pop, &vec, SIZE_MAX / 2, BULK_SIZE,
+		BULK_TYPE_NUM, 0, NULL, NULL);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, ENOMEM);
+	UT_ASSERTeq(count_bulk(pop), n);
+
+	for (size_t i = 0; i < n; ++i)
+		pmemobj_defer_free(pop, pmemobj_oid(
+			(char *)pop + act[i].heap.offset),
+			&act[i]);
+	UT_ASSERTeq(pmemobj_publish(pop, act, n), 0);
+	UT_ASSERTeq(count_bulk(pop), 0);
+
+	FREE(act);
+}
+
 static void
 test_duplicate(PMEMobjpool *pop)
 {
@@ -345,6 +457,8 @@ main(int argc, char *argv[])
 
 	test_duplicate(pop);
 
+	test_bulk(pop, POBJ_MAX_ACTIONS * 2);
+
 	pmemobj_close(pop);
 
 	DONE(NULL);
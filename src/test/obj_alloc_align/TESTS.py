@@ -0,0 +1,30 @@
+#!../env.py
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright 2020, Intel Corporation
+#
+
+from os import path
+import testframework as t
+
+
+class BASE(t.BaseTest):
+    test_type = t.Medium
+
+    def run(self, ctx):
+        testfile = path.join(ctx.testdir, 'testfile0')
+        ctx.exec('obj_alloc_align', testfile, self.mode)
+
+
+class TEST0(BASE):
+    "atomic allocations with a requested alignment"
+    mode = 'a'
+
+
+class TEST1(BASE):
+    "transactional allocations with a requested alignment"
+    mode = 't'
+
+
+class TEST2(BASE):
+    "invalid alignments"
+    mode = 'i'
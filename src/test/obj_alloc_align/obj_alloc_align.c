@@ -0,0 +1,273 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * obj_alloc_align.c -- tests for the POBJ_XALLOC_ALIGN allocation flag
+ *
+ * usage: obj_alloc_align file-name a|t|i
+ *
+ * Verifies that the objects allocated with a requested alignment are aligned
+ * and don't overlap, both for the atomic (a) and transactional (t)
+ * allocations, and that invalid alignments are rejected (i).
+ */
+
+#include "unittest.h"
+
+#define LAYOUT "obj_alloc_align"
+#define TYPE_NUM 3
+#define NOBJS 4
+
+static PMEMobjpool *Pop;
+
+static const size_t Alignments[] = {
+	64, 256, 4096, 1 << 16, 1 << 21
+};
+
+static const size_t Sizes[] = {
+	1, 100, 1000, 5000, 70000, 1 << 20
+};
+
+#define NALIGNMENTS (sizeof(Alignments) / sizeof(Alignments[0]))
+#define NSIZES (sizeof(Sizes) / sizeof(Sizes[0]))
+
+/*
+ * check_objs -- verifies the alignment of the objects and that they don't
+ *	overlap
+ */
+static void
+check_objs(PMEMoid *oids, size_t n, size_t size, size_t alignment)
+{
+	for (size_t i = 0; i < n; ++i) {
+		UT_ASSERT(!OID_IS_NULL(oids[i]));
+
+		char *p = pmemobj_direct(oids[i]);
+		UT_ASSERTeq((uintptr_t)p % alignment, 0);
+		UT_ASSERT(pmemobj_alloc_usable_size(oids[i]) >= size);
+		UT_ASSERTeq(pmemobj_type_num(oids[i]), TYPE_NUM);
+
+		pmemobj_memset_persist(Pop, p, (int)i, size);
+	}
+
+	for (size_t i = 0; i < n; ++i) {
+		char *p = pmemobj_direct(oids[i]);
+		UT_ASSERTeq(p[0], (char)i);
+		UT_ASSERTeq(p[size - 1], (char)i);
+	}
+}
+
+/*
+ * free_objs -- frees the objects
+ */
+static void
+free_objs(PMEMoid *oids, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		pmemobj_free(&oids[i]);
+}
+
+/*
+ * test_atomic -- atomic allocations with a requested alignment
+ */
+static void
+test_atomic(const char *path)
+{
+	PMEMoid oids[NOBJS];
+	struct pobj_action act[NOBJS];
+
+	for (size_t a = 0; a < NALIGNMENTS; ++a) {
+		size_t alignment = Alignments[a];
+		uint64_t flags = POBJ_XALLOC_ALIGN(alignment);
+
+		for (size_t s = 0; s < NSIZES; ++s) {
+			size_t size = Sizes[s];
+
+			for (size_t i = 0; i < NOBJS; ++i) {
+				int ret = pmemobj_xalloc(Pop, &oids[i], size,
+					TYPE_NUM, flags, NULL, NULL);
+				UT_ASSERTeq(ret, 0);
+			}
+			check_objs(oids, NOBJS, size, alignment);
+			free_objs(oids, NOBJS);
+
+			int ret = pmemobj_xalloc_bulk(Pop, oids, NOBJS, size,
+				TYPE_NUM, flags | POBJ_XALLOC_ZERO, NULL, NULL);
+			UT_ASSERTeq(ret, 0);
+			for (size_t i = 0; i < NOBJS; ++i) {
+				char *p = pmemobj_direct(oids[i]);
+				UT_ASSERTeq(p[size - 1], 0);
+			}
+			check_objs(oids, NOBJS, size, alignment);
+			free_objs(oids, NOBJS);
+
+			for (size_t i = 0; i < NOBJS; ++i) {
+				oids[i] = pmemobj_xreserve(Pop, &act[i], size,
+					TYPE_NUM, flags);
+				UT_ASSERT(!OID_IS_NULL(oids[i]));
+			}
+			pmemobj_publish(Pop, act, NOBJS);
+			check_objs(oids, NOBJS, size, alignment);
+			free_objs(oids, NOBJS);
+		}
+	}
+
+	/* objects allocated before the pool is reopened can be freed */
+	for (size_t i = 0; i < NOBJS; ++i) {
+		int ret = pmemobj_xalloc(Pop, &oids[i], Sizes[i],
+			TYPE_NUM, POBJ_XALLOC_ALIGN(Alignments[i]), NULL, NULL);
+		UT_ASSERTeq(ret, 0);
+	}
+
+	PMEMoid root = pmemobj_root(Pop, sizeof(oids));
+	pmemobj_memcpy_persist(Pop, pmemobj_direct(root), oids,
+		sizeof(oids));
+	pmemobj_close(Pop);
+
+	Pop = pmemobj_open(path, LAYOUT);
+	UT_ASSERTne(Pop, NULL);
+
+	memcpy(oids, pmemobj_direct(pmemobj_root(Pop, sizeof(oids))),
+		sizeof(oids));
+	for (size_t i = 0; i < NOBJS; ++i) {
+		UT_ASSERTeq((uintptr_t)pmemobj_direct(oids[i]) %
+			Alignments[i], 0);
+		pmemobj_free(&oids[i]);
+	}
+
+	for (size_t i = 0; i < NOBJS; ++i) {
+		int ret = pmemobj_xalloc(Pop, &oids[i], Sizes[i],
+			TYPE_NUM, POBJ_XALLOC_ALIGN(Alignments[i]), NULL, NULL);
+		UT_ASSERTeq(ret, 0);
+		UT_ASSERTeq((uintptr_t)pmemobj_direct(oids[i]) %
+			Alignments[i], 0);
+	}
+	free_objs(oids, NOBJS);
+}
+
+/*
+ * test_tx -- transactional allocations with a requested alignment
+ */
+static void
+test_tx(void)
+{
+	PMEMoid oids[NOBJS];
+
+	for (size_t a = 0; a < NALIGNMENTS; ++a) {
+		size_t alignment = Alignments[a];
+
+		for (size_t s = 0; s < NSIZES; ++s) {
+			size_t size = Sizes[s];
+
+			TX_BEGIN(Pop) {
+				for (size_t i = 0; i < NOBJS; ++i)
+					oids[i] = pmemobj_tx_xalloc(size,
+						TYPE_NUM,
+						POBJ_XALLOC_ALIGN(alignment));
+			} TX_ONABORT {
+				UT_ASSERT(0);
+			} TX_END
+
+			check_objs(oids, NOBJS, size, alignment);
+			free_objs(oids, NOBJS);
+		}
+	}
+
+	/* the aborted allocations return to the run */
+	PMEMoid oid = OID_NULL;
+	TX_BEGIN(Pop) {
+		oid = pmemobj_tx_xalloc(100, TYPE_NUM, POBJ_XALLOC_ALIGN(256));
+		pmemobj_tx_abort(ECANCELED);
+	} TX_END
+
+	TX_BEGIN(Pop) {
+		PMEMoid o = pmemobj_tx_xalloc(100, TYPE_NUM,
+			POBJ_XALLOC_ALIGN(256));
+		UT_ASSERTeq(o.off, oid.off);
+		pmemobj_tx_free(o);
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+}
+
+/*
+ * test_invalid -- alignments that can't be satisfied
+ */
+static void
+test_invalid(void)
+{
+	PMEMoid oid;
+	struct pobj_action act;
+
+	int ret = pmemobj_xalloc(Pop, &oid, 100, TYPE_NUM,
+		POBJ_XALLOC_ALIGN(100), NULL, NULL);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	ret = pmemobj_xalloc(Pop, &oid, 100, TYPE_NUM,
+		POBJ_XALLOC_ALIGN(1 << 22), NULL, NULL);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	ret = pmemobj_xalloc(Pop, &oid, 1 << 25, TYPE_NUM,
+		POBJ_XALLOC_ALIGN(4096), NULL, NULL);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	ret = pmemobj_xalloc(Pop, &oid, 100, TYPE_NUM,
+		POBJ_XALLOC_ALIGN(256) | POBJ_CLASS_ID(1), NULL, NULL);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	oid = pmemobj_xreserve(Pop, &act, 100, TYPE_NUM,
+		POBJ_XALLOC_ALIGN(3));
+	UT_ASSERT(OID_IS_NULL(oid));
+	UT_ASSERTeq(errno, EINVAL);
+
+	TX_BEGIN(Pop) {
+		oid = pmemobj_tx_xalloc(100, TYPE_NUM,
+			POBJ_XALLOC_ALIGN(48) | POBJ_XALLOC_NO_ABORT);
+		UT_ASSERT(OID_IS_NULL(oid));
+		UT_ASSERTeq(errno, EINVAL);
+
+		oid = pmemobj_tx_xalloc(100, TYPE_NUM,
+			POBJ_XALLOC_ALIGN(48));
+		UT_ASSERT(0);
+	} TX_ONCOMMIT {
+		UT_ASSERT(0);
+	} TX_ONABORT {
+		UT_ASSERTeq(errno, EINVAL);
+	} TX_END
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_alloc_align");
+
+	if (argc != 3 || strlen(argv[2]) != 1)
+		UT_FATAL("usage: %s file-name a|t|i", argv[0]);
+
+	const char *path = argv[1];
+
+	Pop = pmemobj_create(path, LAYOUT, PMEMOBJ_MIN_POOL * 32,
+		S_IWUSR | S_IRUSR);
+	if (Pop == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	switch (argv[2][0]) {
+		case 'a':
+			test_atomic(path);
+			break;
+		case 't':
+			test_tx();
+			break;
+		case 'i':
+			test_invalid();
+			break;
+		default:
+			UT_FATAL("unknown mode %c", argv[2][0]);
+	}
+
+	pmemobj_close(Pop);
+
+	DONE(NULL);
+}
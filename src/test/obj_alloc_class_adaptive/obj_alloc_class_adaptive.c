@@ -0,0 +1,147 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * obj_alloc_class_adaptive.c -- unit test for the allocation classes derived
+ *	from the sampled allocation sizes
+ *
+ * usage: obj_alloc_class_adaptive file-name e|d
+ *
+ * Allocates many objects of a size that is poorly fitted by the default
+ * allocation classes, with the adaptive classes either enabled (e) or
+ * disabled (d), and verifies which class the later allocations come from.
+ */
+
+#include "unittest.h"
+
+#define LAYOUT "obj_alloc_class_adaptive"
+#define NOBJS 4096
+
+/* wastes a quarter of every 128 byte unit of the default class */
+#define OBJ_SIZE 80
+
+static PMEMoid Objs[NOBJS];
+
+/*
+ * check_derived -- verifies the information about the derived class
+ */
+static void
+check_derived(PMEMobjpool *pop)
+{
+	unsigned nclasses;
+	int ret = pmemobj_ctl_get(pop, "heap.alloc_class.adaptive.nclasses",
+		&nclasses);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(nclasses, 1);
+
+	size_t size;
+	ret = pmemobj_ctl_get(pop, "heap.alloc_class.adaptive.derived.0.size",
+		&size);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(size, OBJ_SIZE);
+
+	unsigned waste;
+	ret = pmemobj_ctl_get(pop, "heap.alloc_class.adaptive.derived.0.waste",
+		&waste);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERT(waste > 10);
+
+	unsigned class_id;
+	ret = pmemobj_ctl_get(pop,
+		"heap.alloc_class.adaptive.derived.0.class_id", &class_id);
+	UT_ASSERTeq(ret, 0);
+
+	char query[64];
+	SNPRINTF(query, sizeof(query), "heap.alloc_class.%u.desc", class_id);
+
+	struct pobj_alloc_class_desc desc;
+	ret = pmemobj_ctl_get(pop, query, &desc);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(desc.header_type, POBJ_HEADER_COMPACT);
+	UT_ASSERTeq(desc.unit_size, OBJ_SIZE + 16);
+
+	/* there's no such index */
+	ret = pmemobj_ctl_get(pop, "heap.alloc_class.adaptive.derived.1.size",
+		&size);
+	UT_ASSERTeq(ret, -1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_alloc_class_adaptive");
+
+	if (argc != 3 || (argv[2][0] != 'e' && argv[2][0] != 'd'))
+		UT_FATAL("usage: %s file-name e|d", argv[0]);
+
+	const char *path = argv[1];
+	int enabled = argv[2][0] == 'e';
+
+	PMEMobjpool *pop = pmemobj_create(path, LAYOUT,
+		PMEMOBJ_MIN_POOL * 4, S_IWUSR | S_IRUSR);
+	if (pop == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	ssize_t sample_rate = 0;
+	int ret = pmemobj_ctl_set(pop, "heap.alloc_class.adaptive.sample_rate",
+		&sample_rate);
+	UT_ASSERTeq(ret, -1);
+
+	ssize_t max_waste = 101;
+	ret = pmemobj_ctl_set(pop, "heap.alloc_class.adaptive.max_waste",
+		&max_waste);
+	UT_ASSERTeq(ret, -1);
+
+	sample_rate = 1;
+	ret = pmemobj_ctl_set(pop, "heap.alloc_class.adaptive.sample_rate",
+		&sample_rate);
+	UT_ASSERTeq(ret, 0);
+
+	ret = pmemobj_ctl_set(pop, "heap.alloc_class.adaptive.enabled",
+		&enabled);
+	UT_ASSERTeq(ret, 0);
+
+	for (unsigned i = 0; i < NOBJS; ++i) {
+		ret = pmemobj_alloc(pop, &Objs[i], OBJ_SIZE, 0, NULL, NULL);
+		UT_ASSERTeq(ret, 0);
+		memset(pmemobj_direct(Objs[i]), (int)(i & 0xFF), OBJ_SIZE);
+	}
+
+	size_t first = pmemobj_alloc_usable_size(Objs[0]);
+	size_t last = pmemobj_alloc_usable_size(Objs[NOBJS - 1]);
+	UT_ASSERT(first > OBJ_SIZE);
+
+	if (enabled) {
+		check_derived(pop);
+
+		/* the objects allocated before the class was derived remain */
+		UT_ASSERTeq(last, OBJ_SIZE);
+	} else {
+		unsigned nclasses;
+		ret = pmemobj_ctl_get(pop,
+			"heap.alloc_class.adaptive.nclasses", &nclasses);
+		UT_ASSERTeq(ret, 0);
+		UT_ASSERTeq(nclasses, 0);
+		UT_ASSERTeq(last, first);
+	}
+
+	pmemobj_close(pop);
+
+	ret = pmemobj_check(path, LAYOUT);
+	UT_ASSERTeq(ret, 1);
+
+	pop = pmemobj_open(path, LAYOUT);
+	if (pop == NULL)
+		UT_FATAL("!pmemobj_open: %s", path);
+
+	for (unsigned i = 0; i < NOBJS; ++i) {
+		unsigned char *data = pmemobj_direct(Objs[i]);
+		for (size_t j = 0; j < OBJ_SIZE; ++j)
+			UT_ASSERTeq(data[j], (unsigned char)(i & 0xFF));
+		pmemobj_free(&Objs[i]);
+	}
+
+	pmemobj_close(pop);
+
+	DONE(NULL);
+}
@@ -20,6 +20,15 @@
  * non-exists arena id
  *
  * obj_ctl_arenas <file> m - test for heap.narenas.max (RW)
+ *
+ * obj_ctl_arenas <file> t - mt test for heap.thread_cache.capacity (RW)
+ * and heap.thread_cache.flush
+ *
+ * obj_ctl_arenas <poolset> u - test for heap.numa.*,
+ * heap.arena.[idx].numa_node (RW) and heap.thread.numa_node (RW),
+ * the poolset is expected to consist of two parts of PART_SIZE each
+ *
+ * obj_ctl_arenas <file> p - mt test for heap.arena.mode (RW)
  */
 
 #include <sched.h>
@@ -37,6 +46,10 @@
 #define NTHREADX 16
 #define NARENAS 16
 #define DEFAULT_ARENAS_MAX (1 << 10)
+#define THREAD_CACHE_CAPACITY 32
+#define THREAD_CACHE_MAX (1 << 10)
+#define PART_SIZE ((size_t)1024 * 1024 * 64)	/* 64 megabytes */
+#define NUMA_NODES 2
 
 static os_mutex_t lock;
 static os_cond_t cond;
@@ -238,18 +251,98 @@ worker_arena_ref_obj(struct arena_alloc *ref)
 	UT_ASSERTeq(ret, 0);
 }
 
+static int
+constructor_fail(PMEMobjpool *pop, void *ptr, void *arg)
+{
+	return -1;
+}
+
+static void *
+worker_thread_cache(void *arg)
+{
+	int ret;
+	PMEMoid oid[NOBJECT_THREAD];
+
+	for (int i = 0; i < NOBJECT_THREAD; i++) {
+		ret = pmemobj_xalloc(pop, &oid[i], alloc_class[0].unit_size,
+				0, POBJ_CLASS_ID(128), NULL, NULL);
+		UT_ASSERTeq(ret, 0);
+
+		/* blocks taken from the cache must be unique */
+		for (int j = 0; j < i; j++)
+			UT_ASSERTne(oid[i].off, oid[j].off);
+
+		/* canceled reservation goes back into the cache */
+		ret = pmemobj_xalloc(pop, NULL, alloc_class[0].unit_size,
+				0, POBJ_CLASS_ID(128), constructor_fail, NULL);
+		UT_ASSERTne(ret, 0);
+	}
+
+	for (int i = 0; i < NOBJECT_THREAD; i += 2)
+		pmemobj_free(&oid[i]);
+
+	ret = pmemobj_ctl_exec(pop, "heap.thread_cache.flush", NULL);
+	UT_ASSERTeq(ret, 0);
+
+	/* the remaining objects are released after the thread exits */
+	for (int i = 0; i < NOBJECT_THREAD; i++) {
+		ret = pmemobj_alloc(pop, NULL, 64, 0, NULL, NULL);
+		UT_ASSERTeq(ret, 0);
+	}
+
+	return NULL;
+}
+
+static void *
+worker_arena_mode(void *arg)
+{
+	int ret;
+	unsigned arena_id;
+	unsigned bound = (unsigned)(uintptr_t)arg;
+	PMEMoid oid[NOBJECT_THREAD];
+
+	/* threads assigned to an arena explicitly keep using it */
+	if (bound != 0) {
+		ret = pmemobj_ctl_set(pop, "heap.thread.arena_id", &bound);
+		UT_ASSERTeq(ret, 0);
+	}
+
+	for (int i = 0; i < NOBJECT_THREAD; i++) {
+		ret = pmemobj_xalloc(pop, &oid[i], alloc_class[0].unit_size,
+				0, POBJ_CLASS_ID(128), NULL, NULL);
+		UT_ASSERTeq(ret, 0);
+
+		for (int j = 0; j < i; j++)
+			UT_ASSERTne(oid[i].off, oid[j].off);
+
+		ret = pmemobj_ctl_get(pop, "heap.thread.arena_id", &arena_id);
+		UT_ASSERTeq(ret, 0);
+		UT_ASSERTne(arena_id, 0);
+		if (bound != 0)
+			UT_ASSERTeq(arena_id, bound);
+	}
+
+	for (int i = 0; i < NOBJECT_THREAD; i++)
+		pmemobj_free(&oid[i]);
+
+	return NULL;
+}
+
 int
 main(int argc, char *argv[])
 {
 	START(argc, argv, "obj_ctl_arenas");
 
 	if (argc != 3)
-		UT_FATAL("usage: %s poolset [n|s|c|f|q|m|a]", argv[0]);
+		UT_FATAL("usage: %s poolset [n|s|c|f|q|m|a|t|u|p]", argv[0]);
 
 	const char *path = argv[1];
 	char t = argv[2][0];
 
-	if ((pop = pmemobj_create(path, LAYOUT, PMEMOBJ_MIN_POOL * 20,
+	/* the poolset used by the NUMA test defines the size of the pool */
+	size_t poolsize = t == 'u' ? 0 : PMEMOBJ_MIN_POOL * 20;
+
+	if ((pop = pmemobj_create(path, LAYOUT, poolsize,
 		S_IWUSR | S_IRUSR)) == NULL)
 		UT_FATAL("!pmemobj_open: %s", path);
 
@@ -448,6 +541,207 @@ main(int argc, char *argv[])
 		ret = pmemobj_ctl_get(pop, "heap.narenas.max", &max);
 		UT_ASSERTeq(ret, 0);
 		UT_ASSERTeq(DEFAULT_ARENAS_MAX + 1, max);
+	} else if (t == 't') {
+		ssize_t capacity;
+
+		/* thread cache is disabled by default */
+		ret = pmemobj_ctl_get(pop, "heap.thread_cache.capacity",
+				&capacity);
+		UT_ASSERTeq(ret, 0);
+		UT_ASSERTeq(capacity, 0);
+
+		capacity = THREAD_CACHE_MAX + 1;
+		ret = pmemobj_ctl_set(pop, "heap.thread_cache.capacity",
+				&capacity);
+		UT_ASSERTne(ret, 0);
+
+		capacity = THREAD_CACHE_CAPACITY;
+		ret = pmemobj_ctl_set(pop, "heap.thread_cache.capacity",
+				&capacity);
+		UT_ASSERTeq(ret, 0);
+		ret = pmemobj_ctl_get(pop, "heap.thread_cache.capacity",
+				&capacity);
+		UT_ASSERTeq(ret, 0);
+		UT_ASSERTeq(capacity, THREAD_CACHE_CAPACITY);
+
+		create_alloc_class();
+
+		os_thread_t threads[NTHREADX];
+
+		for (int i = 0; i < NTHREADX; i++)
+			THREAD_CREATE(&threads[i], NULL,
+					worker_thread_cache, NULL);
+
+		/* the caches of the running threads are drained on update */
+		for (int i = 0; i < NTHREADX; i++) {
+			ret = pmemobj_ctl_set(pop, "heap.thread_cache.capacity",
+					&capacity);
+			UT_ASSERTeq(ret, 0);
+		}
+
+		for (int i = 0; i < NTHREADX; i++)
+			THREAD_JOIN(&threads[i], NULL);
+
+		size_t nobjects = 0;
+		PMEMoid oid, oid2;
+		POBJ_FOREACH_SAFE(pop, oid, oid2) {
+			pmemobj_free(&oid);
+			nobjects++;
+		}
+		UT_ASSERTeq(nobjects, NTHREADX * NOBJECT_THREAD * 3 / 2);
+	} else if (t == 'u') {
+		int enabled = 1;
+		unsigned nnodes = 1;
+		ret = pmemobj_ctl_get(pop, "heap.numa.enabled", &enabled);
+		UT_ASSERTeq(ret, 0);
+		UT_ASSERTeq(enabled, 0);
+		ret = pmemobj_ctl_get(pop, "heap.numa.nnodes", &nnodes);
+		UT_ASSERTeq(ret, 0);
+		UT_ASSERTeq(nnodes, 0);
+
+		/* every part of the poolset is placed on a different node */
+		ssize_t fake_nodes = NUMA_NODES;
+		ret = pmemobj_ctl_set(pop, "heap.numa.fake_nodes", &fake_nodes);
+		UT_ASSERTeq(ret, 0);
+		enabled = 1;
+		ret = pmemobj_ctl_set(pop, "heap.numa.enabled", &enabled);
+		UT_ASSERTeq(ret, 0);
+		ret = pmemobj_ctl_get(pop, "heap.numa.nnodes", &nnodes);
+		UT_ASSERTeq(ret, 0);
+		UT_ASSERTeq(nnodes, NUMA_NODES);
+
+		char query[CTL_QUERY_LEN];
+		size_t node_size;
+		unsigned narenas;
+		unsigned narenas_total;
+		unsigned narenas_nodes = 0;
+		ret = pmemobj_ctl_get(pop, "heap.narenas.total",
+				&narenas_total);
+		UT_ASSERTeq(ret, 0);
+
+		for (unsigned node = 0; node < NUMA_NODES; ++node) {
+			SNPRINTF(query, CTL_QUERY_LEN,
+				"heap.numa.node.%u.size", node);
+			ret = pmemobj_ctl_get(pop, query, &node_size);
+			UT_ASSERTeq(ret, 0);
+			UT_ASSERT(node_size > 0 && node_size <= PART_SIZE);
+
+			SNPRINTF(query, CTL_QUERY_LEN,
+				"heap.numa.node.%u.narenas", node);
+			ret = pmemobj_ctl_get(pop, query, &narenas);
+			UT_ASSERTeq(ret, 0);
+			narenas_nodes += narenas;
+		}
+		UT_ASSERTeq(narenas_nodes, narenas_total);
+
+		ret = pmemobj_ctl_get(pop, "heap.numa.node.2.size", &node_size);
+		UT_ASSERTne(ret, 0);
+
+		/* the arenas are distributed among the nodes evenly */
+		ssize_t arena_node;
+		ret = pmemobj_ctl_get(pop, "heap.arena.1.numa_node",
+				&arena_node);
+		UT_ASSERTeq(ret, 0);
+		UT_ASSERTeq(arena_node, 0);
+		if (narenas_total > 1) {
+			ret = pmemobj_ctl_get(pop, "heap.arena.2.numa_node",
+					&arena_node);
+			UT_ASSERTeq(ret, 0);
+			UT_ASSERTeq(arena_node, 1);
+		}
+
+		arena_node = NUMA_NODES;
+		ret = pmemobj_ctl_set(pop, "heap.arena.1.numa_node",
+				&arena_node);
+		UT_ASSERTne(ret, 0);
+		arena_node = 1;
+		ret = pmemobj_ctl_set(pop, "heap.arena.1.numa_node",
+				&arena_node);
+		UT_ASSERTeq(ret, 0);
+
+		ssize_t thread_node = NUMA_NODES;
+		ret = pmemobj_ctl_set(pop, "heap.thread.numa_node",
+				&thread_node);
+		UT_ASSERTne(ret, 0);
+		thread_node = 1;
+		ret = pmemobj_ctl_set(pop, "heap.thread.numa_node",
+				&thread_node);
+		UT_ASSERTeq(ret, 0);
+		thread_node = 0;
+		ret = pmemobj_ctl_get(pop, "heap.thread.numa_node",
+				&thread_node);
+		UT_ASSERTeq(ret, 0);
+		UT_ASSERTeq(thread_node, 1);
+
+		/* huge allocations are served from the memory of the node */
+		PMEMoid oid;
+		ret = pmemobj_alloc(pop, &oid, CHUNKSIZE * 4, 0, NULL, NULL);
+		UT_ASSERTeq(ret, 0);
+		UT_ASSERT(oid.off >= PART_SIZE);
+
+		uint64_t local;
+		ret = pmemobj_ctl_get(pop, "heap.numa.node.1.local", &local);
+		UT_ASSERTeq(ret, 0);
+		UT_ASSERTne(local, 0);
+
+		pmemobj_free(&oid);
+
+		enabled = 0;
+		ret = pmemobj_ctl_set(pop, "heap.numa.enabled", &enabled);
+		UT_ASSERTeq(ret, 0);
+		ret = pmemobj_ctl_get(pop, "heap.numa.nnodes", &nnodes);
+		UT_ASSERTeq(ret, 0);
+		UT_ASSERTeq(nnodes, 0);
+	} else if (t == 'p') {
+		enum pobj_arena_mode mode;
+		ret = pmemobj_ctl_get(pop, "heap.arena.mode", &mode);
+		UT_ASSERTeq(ret, 0);
+		UT_ASSERTeq(mode, POBJ_ARENA_MODE_THREAD);
+
+		mode = (enum pobj_arena_mode)(POBJ_ARENA_MODE_CPU + 1);
+		ret = pmemobj_ctl_set(pop, "heap.arena.mode", &mode);
+		UT_ASSERTeq(ret, -1);
+		UT_ASSERTeq(errno, EINVAL);
+
+		mode = POBJ_ARENA_MODE_CPU;
+		ret = pmemobj_ctl_set(pop, "heap.arena.mode", &mode);
+		UT_ASSERTeq(ret, 0);
+		ret = pmemobj_ctl_get(pop, "heap.arena.mode", &mode);
+		UT_ASSERTeq(ret, 0);
+		UT_ASSERTeq(mode, POBJ_ARENA_MODE_CPU);
+
+		create_alloc_class();
+
+		unsigned arena_id;
+		ret = pmemobj_ctl_exec(pop, "heap.arena.create", &arena_id);
+		UT_ASSERTeq(ret, 0);
+
+		os_thread_t threads[NTHREADX];
+
+		for (int i = 0; i < NTHREADX; i++)
+			THREAD_CREATE(&threads[i], NULL, worker_arena_mode,
+				(void *)(uintptr_t)(i == 0 ? arena_id : 0));
+
+		for (int i = 0; i < NTHREADX; i++)
+			THREAD_JOIN(&threads[i], NULL);
+
+		/* the arena of the bound thread wasn't used by the others */
+		check_arena_size(arena_id, 0);
+
+		mode = POBJ_ARENA_MODE_THREAD;
+		ret = pmemobj_ctl_set(pop, "heap.arena.mode", &mode);
+		UT_ASSERTeq(ret, 0);
+
+		for (int i = 0; i < NTHREADX; i++)
+			THREAD_CREATE(&threads[i], NULL, worker_arena_mode,
+				NULL);
+
+		for (int i = 0; i < NTHREADX; i++)
+			THREAD_JOIN(&threads[i], NULL);
+
+		PMEMoid oid;
+		POBJ_FOREACH(pop, oid)
+			UT_ASSERT(0);
 	} else {
 		UT_ASSERT(0);
 	}
@@ -0,0 +1,35 @@
+#!../env.py
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright 2020, Intel Corporation
+#
+
+from os import path
+import testframework as t
+
+
+class BASE(t.BaseTest):
+    test_type = t.Medium
+
+    def run(self, ctx):
+        testfile = path.join(ctx.testdir, 'testfile0')
+        ctx.exec('obj_ctl_free_batch', testfile, self.mode)
+
+
+class TEST0(BASE):
+    "frees published once the queue is full or on request"
+    mode = 'b'
+
+
+class TEST1(BASE):
+    "frees published once the oldest one is too old"
+    mode = 'i'
+
+
+class TEST2(BASE):
+    "frees queued by exited threads"
+    mode = 't'
+
+
+class TEST3(BASE):
+    "frees published while other threads request flushes"
+    mode = 'f'
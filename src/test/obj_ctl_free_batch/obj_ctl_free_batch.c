@@ -0,0 +1,389 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * obj_ctl_free_batch.c -- tests for the heap.free_batch ctl namespace
+ *
+ * usage: obj_ctl_free_batch file-name b|i|t|f
+ *
+ * Frees objects with the batching enabled and verifies that they remain
+ * allocated until the batch is published: once the queue is full, on request,
+ * when the batching is disabled and when the pool is closed (b), once the
+ * oldest queued free gets too old (i) or when the frees were queued by threads
+ * which already exited (t). Also verifies that the batches of the threads can
+ * be published while other threads request flushes (f).
+ */
+
+#include "unittest.h"
+
+#define LAYOUT "obj_ctl_free_batch"
+#define TYPE_NUM 1
+#define OBJ_SIZE 128
+#define NOBJS 32
+#define CAPACITY 8
+#define NTHREADS 4
+#define NROUNDS 100
+
+static PMEMobjpool *Pop;
+
+/*
+ * count_objs -- returns the number of allocated objects
+ */
+static size_t
+count_objs(void)
+{
+	size_t n = 0;
+	PMEMoid oid;
+	POBJ_FOREACH(Pop, oid) {
+		if (pmemobj_type_num(oid) == TYPE_NUM)
+			n++;
+	}
+
+	return n;
+}
+
+/*
+ * get_stat -- returns the value of a free batch counter
+ */
+static uint64_t
+get_stat(const char *name)
+{
+	char query[64];
+	SNPRINTF(query, sizeof(query), "heap.free_batch.%s", name);
+
+	uint64_t value;
+	int ret = pmemobj_ctl_get(Pop, query, &value);
+	UT_ASSERTeq(ret, 0);
+
+	return value;
+}
+
+/*
+ * configure -- enables the batching with the given limits
+ */
+static void
+configure(ssize_t capacity, ssize_t interval)
+{
+	int ret = pmemobj_ctl_set(Pop, "heap.free_batch.capacity", &capacity);
+	UT_ASSERTeq(ret, 0);
+	ret = pmemobj_ctl_set(Pop, "heap.free_batch.interval", &interval);
+	UT_ASSERTeq(ret, 0);
+
+	int enabled = 1;
+	ret = pmemobj_ctl_set(Pop, "heap.free_batch.enabled", &enabled);
+	UT_ASSERTeq(ret, 0);
+}
+
+/*
+ * alloc_objs -- allocates objects into the array
+ */
+static void
+alloc_objs(PMEMoid *oids, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		int ret = pmemobj_alloc(Pop, &oids[i], OBJ_SIZE, TYPE_NUM,
+			NULL, NULL);
+		UT_ASSERTeq(ret, 0);
+	}
+}
+
+/*
+ * free_objs -- frees objects from the array
+ */
+static void
+free_objs(PMEMoid *oids, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		pmemobj_free(&oids[i]);
+		UT_ASSERT(OID_IS_NULL(oids[i]));
+	}
+}
+
+/*
+ * test_basic -- frees published when the queue is full, on request, when
+ *	the batching is disabled and when the pool is closed
+ */
+static void
+test_basic(const char *path)
+{
+	int enabled;
+	ssize_t capacity;
+	ssize_t interval;
+	int ret = pmemobj_ctl_get(Pop, "heap.free_batch.enabled", &enabled);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(enabled, 0);
+	ret = pmemobj_ctl_get(Pop, "heap.free_batch.capacity", &capacity);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(capacity, 64);
+	ret = pmemobj_ctl_get(Pop, "heap.free_batch.interval", &interval);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(interval, 100);
+
+	capacity = 0;
+	ret = pmemobj_ctl_set(Pop, "heap.free_batch.capacity", &capacity);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+	interval = -1;
+	ret = pmemobj_ctl_set(Pop, "heap.free_batch.interval", &interval);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	PMEMoid oids[NOBJS];
+	alloc_objs(oids, NOBJS);
+
+	/* the batching is disabled by default */
+	free_objs(oids, 1);
+	UT_ASSERTeq(count_objs(), NOBJS - 1);
+	UT_ASSERTeq(get_stat("batches"), 0);
+
+	configure(CAPACITY, 0);
+
+	/* the frees are queued until the queue is full */
+	free_objs(oids + 1, CAPACITY - 1);
+	UT_ASSERTeq(count_objs(), NOBJS - 1);
+	UT_ASSERTeq(get_stat("freed"), 0);
+
+	free_objs(oids + CAPACITY, 1);
+	UT_ASSERTeq(count_objs(), NOBJS - 1 - CAPACITY);
+	UT_ASSERTeq(get_stat("batches"), 1);
+	UT_ASSERTeq(get_stat("freed"), CAPACITY);
+
+	/* ...or a flush is requested */
+	free_objs(oids + CAPACITY + 1, 3);
+	UT_ASSERTeq(count_objs(), NOBJS - 1 - CAPACITY);
+	ret = pmemobj_ctl_exec(Pop, "heap.free_batch.flush", NULL);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(count_objs(), NOBJS - 4 - CAPACITY);
+	UT_ASSERTeq(get_stat("batches"), 2);
+	UT_ASSERTeq(get_stat("freed"), CAPACITY + 3);
+
+	/* flushing an empty queue publishes nothing */
+	ret = pmemobj_ctl_exec(Pop, "heap.free_batch.flush", NULL);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(get_stat("batches"), 2);
+
+	/* handles residing in the pool are freed right away */
+	PMEMoid root = pmemobj_root(Pop, sizeof(PMEMoid));
+	PMEMoid *roid = pmemobj_direct(root);
+	ret = pmemobj_alloc(Pop, roid, OBJ_SIZE, TYPE_NUM, NULL, NULL);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(count_objs(), NOBJS - 3 - CAPACITY);
+	pmemobj_free(roid);
+	UT_ASSERT(OID_IS_NULL(*roid));
+	UT_ASSERTeq(count_objs(), NOBJS - 4 - CAPACITY);
+
+	/* disabling the batching publishes the queued frees */
+	size_t first = CAPACITY + 4;
+	free_objs(oids + first, 2);
+	UT_ASSERTeq(count_objs(), NOBJS - 4 - CAPACITY);
+	enabled = 0;
+	ret = pmemobj_ctl_set(Pop, "heap.free_batch.enabled", &enabled);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(count_objs(), NOBJS - 6 - CAPACITY);
+	UT_ASSERTeq(get_stat("freed"), CAPACITY + 5);
+
+	/* and so does closing the pool */
+	configure(CAPACITY, 0);
+	free_objs(oids + first + 2, 2);
+	pmemobj_close(Pop);
+
+	Pop = pmemobj_open(path, LAYOUT);
+	UT_ASSERTne(Pop, NULL);
+	UT_ASSERTeq(count_objs(), NOBJS - 8 - CAPACITY);
+}
+
+/*
+ * wait_ms -- waits for the given number of milliseconds
+ */
+static void
+wait_ms(unsigned ms)
+{
+	struct timespec start;
+	struct timespec now;
+	os_clock_gettime(CLOCK_MONOTONIC, &start);
+
+	do {
+		os_clock_gettime(CLOCK_MONOTONIC, &now);
+	} while ((now.tv_sec - start.tv_sec) * 1000 +
+		(now.tv_nsec - start.tv_nsec) / 1000000 < ms);
+}
+
+/*
+ * test_interval -- frees published once the oldest one gets too old
+ */
+static void
+test_interval(void)
+{
+	PMEMoid oids[NOBJS];
+	alloc_objs(oids, NOBJS);
+
+	configure(NOBJS, 10);
+
+	free_objs(oids, 2);
+	UT_ASSERTeq(count_objs(), NOBJS);
+
+	wait_ms(20);
+
+	/* the age is only checked when another free is queued */
+	UT_ASSERTeq(count_objs(), NOBJS);
+	free_objs(oids + 2, 1);
+	UT_ASSERTeq(count_objs(), NOBJS - 3);
+	UT_ASSERTeq(get_stat("batches"), 1);
+
+	/* without the limit the frees stay queued */
+	ssize_t interval = 0;
+	int ret = pmemobj_ctl_set(Pop, "heap.free_batch.interval", &interval);
+	UT_ASSERTeq(ret, 0);
+
+	free_objs(oids + 3, 2);
+	wait_ms(20);
+	free_objs(oids + 5, 1);
+	UT_ASSERTeq(count_objs(), NOBJS - 3);
+
+	ret = pmemobj_ctl_exec(Pop, "heap.free_batch.flush", NULL);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(count_objs(), NOBJS - 6);
+}
+
+/*
+ * worker -- allocates and frees objects, leaving some of the frees queued
+ */
+static void *
+worker(void *arg)
+{
+	PMEMoid oids[NOBJS];
+	alloc_objs(oids, NOBJS);
+	free_objs(oids, NOBJS);
+
+	return NULL;
+}
+
+/*
+ * test_threads -- frees queued by threads which already exited
+ */
+static void
+test_threads(void)
+{
+	configure(CAPACITY + 1, 0);
+
+	os_thread_t threads[NTHREADS];
+	for (int i = 0; i < NTHREADS; ++i)
+		THREAD_CREATE(&threads[i], NULL, worker, NULL);
+
+	for (int i = 0; i < NTHREADS; ++i)
+		THREAD_JOIN(&threads[i], NULL);
+
+	/*
+	 * Every thread left some of its frees queued, the batches of the
+	 * threads that were still running might have taken them over.
+	 */
+	size_t left = NOBJS % (CAPACITY + 1);
+	size_t n = count_objs();
+	UT_ASSERT(n >= left && n <= NTHREADS * left);
+
+	/* which are published by the next batch of any thread */
+	PMEMoid oids[CAPACITY + 1];
+	alloc_objs(oids, CAPACITY + 1);
+	free_objs(oids, CAPACITY + 1);
+	UT_ASSERTeq(count_objs(), 0);
+	UT_ASSERTeq(get_stat("freed"), NTHREADS * NOBJS + CAPACITY + 1);
+}
+
+/* set once the workers of test_flush are done */
+static int Workers_done;
+
+/*
+ * round_worker -- allocates and frees objects many times
+ */
+static void *
+round_worker(void *arg)
+{
+	PMEMoid oids[NOBJS];
+	for (int i = 0; i < NROUNDS; ++i) {
+		alloc_objs(oids, NOBJS);
+		free_objs(oids, NOBJS);
+	}
+
+	return NULL;
+}
+
+/*
+ * flusher -- requests flushes until the workers are done
+ */
+static void *
+flusher(void *arg)
+{
+	int done = 0;
+	while (!done) {
+		int ret = pmemobj_ctl_exec(Pop, "heap.free_batch.flush", NULL);
+		UT_ASSERTeq(ret, 0);
+		util_atomic_load32(&Workers_done, &done);
+	}
+
+	return NULL;
+}
+
+/*
+ * test_flush -- batches of the threads published while flushes are
+ *	requested by another thread
+ */
+static void
+test_flush(void)
+{
+	configure(CAPACITY, 0);
+
+	os_thread_t flush_thread;
+	THREAD_CREATE(&flush_thread, NULL, flusher, NULL);
+
+	os_thread_t threads[NTHREADS];
+	for (int i = 0; i < NTHREADS; ++i)
+		THREAD_CREATE(&threads[i], NULL, round_worker, NULL);
+
+	for (int i = 0; i < NTHREADS; ++i)
+		THREAD_JOIN(&threads[i], NULL);
+
+	util_atomic_store32(&Workers_done, 1);
+	THREAD_JOIN(&flush_thread, NULL);
+
+	int ret = pmemobj_ctl_exec(Pop, "heap.free_batch.flush", NULL);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(count_objs(), 0);
+	UT_ASSERTeq(get_stat("freed"), NTHREADS * NROUNDS * NOBJS);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_ctl_free_batch");
+
+	if (argc != 3 || strlen(argv[2]) != 1)
+		UT_FATAL("usage: %s file-name b|i|t|f", argv[0]);
+
+	const char *path = argv[1];
+
+	Pop = pmemobj_create(path, LAYOUT, PMEMOBJ_MIN_POOL * 4,
+		S_IWUSR | S_IRUSR);
+	if (Pop == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	switch (argv[2][0]) {
+		case 'b':
+			test_basic(path);
+			break;
+		case 'i':
+			test_interval();
+			break;
+		case 't':
+			test_threads();
+			break;
+		case 'f':
+			test_flush();
+			break;
+		default:
+			UT_FATAL("unknown mode %c", argv[2][0]);
+	}
+
+	pmemobj_close(Pop);
+
+	DONE(NULL);
+}
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2017, Intel Corporation */
+/* Copyright 2017-2020, Intel Corporation */
 
 /*
  * obj_ctl_heap_size.c -- tests for the ctl entry points: heap.size.*
@@ -10,6 +10,108 @@
 #define LAYOUT "obj_ctl_heap_size"
 #define CUSTOM_GRANULARITY ((1 << 20) * 10)
 #define OBJ_SIZE 1024
+#define CHUNKSIZE ((size_t)1024 * 256)	/* 256 kilobytes */
+#define HUGE_OBJ_SIZE (CHUNKSIZE - 64)
+#define WATERMARK (CHUNKSIZE * 32)
+#define MAX_ALLOCATED (CUSTOM_GRANULARITY * 4)
+
+/*
+ * get_extensions -- returns the value of a heap extension counter
+ */
+static uint64_t
+get_extensions(PMEMobjpool *pop, const char *name)
+{
+	char query[64];
+	SNPRINTF(query, sizeof(query), "heap.size.extensions.%s", name);
+
+	uint64_t value;
+	int ret = pmemobj_ctl_get(pop, query, &value);
+	UT_ASSERTeq(ret, 0);
+
+	return value;
+}
+
+/*
+ * wait_ms -- waits for the given number of milliseconds
+ */
+static void
+wait_ms(unsigned ms)
+{
+	struct timespec start;
+	struct timespec now;
+	os_clock_gettime(CLOCK_MONOTONIC, &start);
+
+	do {
+		os_clock_gettime(CLOCK_MONOTONIC, &now);
+	} while ((now.tv_sec - start.tv_sec) * 1000 +
+		(now.tv_nsec - start.tv_nsec) / 1000000 < ms);
+}
+
+/*
+ * test_watermark -- allocates objects with the background extension of the
+ *	heap enabled, the heap is extended before it runs out of free chunks
+ */
+static void
+test_watermark(PMEMobjpool *pop)
+{
+	ssize_t watermark;
+	int ret = pmemobj_ctl_get(pop, "heap.size.watermark", &watermark);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(watermark, 0);
+
+	watermark = -1;
+	ret = pmemobj_ctl_set(pop, "heap.size.watermark", &watermark);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	ssize_t granularity = CUSTOM_GRANULARITY;
+	ret = pmemobj_ctl_set(pop, "heap.size.granularity", &granularity);
+	UT_ASSERTeq(ret, 0);
+
+	watermark = WATERMARK;
+	ret = pmemobj_ctl_set(pop, "heap.size.watermark", &watermark);
+	UT_ASSERTeq(ret, 0);
+	ret = pmemobj_ctl_get(pop, "heap.size.watermark", &watermark);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(watermark, WATERMARK);
+
+	/*
+	 * Give the extender some time after every allocation, it's supposed
+	 * to extend the heap while there are still free chunks left.
+	 */
+	size_t allocated = 0;
+	while (allocated < MAX_ALLOCATED &&
+	    get_extensions(pop, "async") < 2) {
+		ret = pmemobj_alloc(pop, NULL, HUGE_OBJ_SIZE, 0, NULL, NULL);
+		UT_ASSERTeq(ret, 0);
+		allocated += HUGE_OBJ_SIZE;
+
+		wait_ms(1);
+	}
+
+	UT_ASSERTeq(get_extensions(pop, "async"), 2);
+	UT_ASSERTeq(get_extensions(pop, "failed"), 0);
+
+	uint64_t time_ns = get_extensions(pop, "time_ns");
+	uint64_t max_ns = get_extensions(pop, "max_ns");
+	UT_ASSERTne(max_ns, 0);
+	UT_ASSERT(max_ns <= time_ns);
+
+	/* with the watermark disabled the heap is extended on demand */
+	watermark = 0;
+	ret = pmemobj_ctl_set(pop, "heap.size.watermark", &watermark);
+	UT_ASSERTeq(ret, 0);
+
+	uint64_t sync = get_extensions(pop, "sync");
+	allocated = 0;
+	while (allocated < CUSTOM_GRANULARITY * 2) {
+		ret = pmemobj_alloc(pop, NULL, HUGE_OBJ_SIZE, 0, NULL, NULL);
+		UT_ASSERTeq(ret, 0);
+		allocated += HUGE_OBJ_SIZE;
+	}
+
+	UT_ASSERT(get_extensions(pop, "sync") > sync);
+}
 
 int
 main(int argc, char *argv[])
@@ -17,7 +119,7 @@ main(int argc, char *argv[])
 	START(argc, argv, "obj_ctl_heap_size");
 
 	if (argc != 3)
-		UT_FATAL("usage: %s poolset [w|x]", argv[0]);
+		UT_FATAL("usage: %s poolset [w|x|a]", argv[0]);
 
 	const char *path = argv[1];
 	char t = argv[2][0];
@@ -27,6 +129,13 @@ main(int argc, char *argv[])
 	if ((pop = pmemobj_open(path, LAYOUT)) == NULL)
 		UT_FATAL("!pmemobj_open: %s", path);
 
+	if (t == 'a') {
+		test_watermark(pop);
+		pmemobj_close(pop);
+
+		DONE(NULL);
+	}
+
 	int ret = 0;
 	size_t disable_granularity = 0;
 	ret = pmemobj_ctl_set(pop, "heap.size.granularity",
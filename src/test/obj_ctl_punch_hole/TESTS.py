@@ -0,0 +1,33 @@
+#!../env.py
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright 2020, Intel Corporation
+#
+
+from os import path
+import testframework as t
+
+
+class BASE(t.BaseTest):
+    test_type = t.Medium
+
+    def run(self, ctx):
+        testfile = path.join(ctx.testdir, 'testfile0')
+        ctx.exec('obj_ctl_punch_hole', testfile, self.mode)
+
+
+@t.windows_exclude
+class TEST0(BASE):
+    "deallocation of the blocks of free chunks on request"
+    mode = 'r'
+
+
+@t.windows_exclude
+class TEST1(BASE):
+    "automatic deallocation of the blocks of free chunks"
+    mode = 'a'
+
+
+@t.windows_exclude
+class TEST2(BASE):
+    "automatic passes disabled when the blocks cannot be deallocated"
+    mode = 'u'
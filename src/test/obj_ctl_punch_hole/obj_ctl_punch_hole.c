@@ -0,0 +1,244 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * obj_ctl_punch_hole.c -- tests for the heap.punch_hole ctl namespace
+ *
+ * usage: obj_ctl_punch_hole file-name r|a|u
+ *
+ * Frees a huge object surrounded by live ones and verifies that the file
+ * blocks backing it are returned to the file system, either by explicit
+ * passes (r) or by the automatic ones performed when huge objects are
+ * freed (a), without affecting the neighboring objects. In the u mode the
+ * pool is mapped privately, where the blocks cannot be deallocated, and the
+ * automatic passes are expected to be disabled.
+ */
+
+#include "unittest.h"
+
+#define LAYOUT "obj_ctl_punch_hole"
+#define NOBJS 3
+#define OBJ_SIZE (4 * 1024 * 1024)
+
+static PMEMoid Objs[NOBJS];
+
+/*
+ * file_blocks -- returns the number of blocks allocated for the file
+ */
+static os_off_t
+file_blocks(const char *path)
+{
+	os_stat_t st;
+	STAT(path, &st);
+
+	return st.st_blocks;
+}
+
+/*
+ * reclaimed -- returns the total number of bytes reclaimed from the pool
+ */
+static uint64_t
+reclaimed(PMEMobjpool *pop)
+{
+	uint64_t bytes;
+	int ret = pmemobj_ctl_get(pop, "heap.punch_hole.reclaimed", &bytes);
+	UT_ASSERTeq(ret, 0);
+
+	return bytes;
+}
+
+/*
+ * run_pass -- performs a single pass and returns the reclaimed bytes
+ */
+static uint64_t
+run_pass(PMEMobjpool *pop)
+{
+	uint64_t bytes;
+	int ret = pmemobj_ctl_exec(pop, "heap.punch_hole.run", &bytes);
+	UT_ASSERTeq(ret, 0);
+
+	return bytes;
+}
+
+/*
+ * test_run -- verifies the passes performed on request
+ */
+static void
+test_run(PMEMobjpool *pop, const char *path)
+{
+	/* the first pass only finds out which chunks are free */
+	UT_ASSERTeq(run_pass(pop), 0);
+
+	pmemobj_free(&Objs[1]);
+
+	os_off_t blocks = file_blocks(path);
+
+	/* the freed object wasn't idle during the previous pass */
+	uint64_t bytes = run_pass(pop);
+	UT_ASSERTeq(reclaimed(pop), bytes);
+
+	bytes = run_pass(pop);
+	UT_ASSERT(bytes >= OBJ_SIZE - 2 * (size_t)Ut_pagesize);
+	UT_ASSERT(file_blocks(path) < blocks);
+
+	/* blocks are never reclaimed twice */
+	UT_ASSERTeq(run_pass(pop), 0);
+
+	ssize_t min_size = -1;
+	int ret = pmemobj_ctl_set(pop, "heap.punch_hole.min_size", &min_size);
+	UT_ASSERTeq(ret, -1);
+}
+
+/*
+ * test_auto -- verifies the passes performed when huge objects are freed
+ */
+static void
+test_auto(PMEMobjpool *pop, const char *path)
+{
+	int enabled;
+	int ret = pmemobj_ctl_get(pop, "heap.punch_hole.enabled", &enabled);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(enabled, 0);
+
+	ssize_t interval = 0;
+	ret = pmemobj_ctl_set(pop, "heap.punch_hole.interval", &interval);
+	UT_ASSERTeq(ret, 0);
+
+	enabled = 1;
+	ret = pmemobj_ctl_set(pop, "heap.punch_hole.enabled", &enabled);
+	UT_ASSERTeq(ret, 0);
+
+	PMEMoid tmp;
+	ret = pmemobj_alloc(pop, &tmp, OBJ_SIZE, 0, NULL, NULL);
+	UT_ASSERTeq(ret, 0);
+
+	/* the free of the first object makes the pass notice its chunks */
+	pmemobj_free(&Objs[1]);
+	UT_ASSERTeq(reclaimed(pop), 0);
+
+	os_off_t blocks = file_blocks(path);
+
+	pmemobj_free(&tmp);
+	UT_ASSERT(reclaimed(pop) >= OBJ_SIZE - 2 * (size_t)Ut_pagesize);
+	UT_ASSERT(file_blocks(path) < blocks);
+}
+
+/*
+ * test_unsupported -- verifies that the automatic passes are disabled once
+ *	the file blocks turn out not to be deallocatable, returns the pool
+ *	reopened without the private mapping
+ */
+static PMEMobjpool *
+test_unsupported(PMEMobjpool *pop, const char *path)
+{
+	pmemobj_close(pop);
+
+	int cow = 1;
+	int ret = pmemobj_ctl_set(NULL, "copy_on_write.at_open", &cow);
+	UT_ASSERTeq(ret, 0);
+
+	pop = pmemobj_open(path, LAYOUT);
+	if (pop == NULL)
+		UT_FATAL("!pmemobj_open: %s", path);
+
+	ssize_t interval = 0;
+	ret = pmemobj_ctl_set(pop, "heap.punch_hole.interval", &interval);
+	UT_ASSERTeq(ret, 0);
+
+	int enabled = 1;
+	ret = pmemobj_ctl_set(pop, "heap.punch_hole.enabled", &enabled);
+	UT_ASSERTeq(ret, 0);
+
+	PMEMoid tmp;
+	ret = pmemobj_alloc(pop, &tmp, OBJ_SIZE, 0, NULL, NULL);
+	UT_ASSERTeq(ret, 0);
+
+	pmemobj_free(&Objs[1]);
+	pmemobj_free(&tmp);
+
+	ret = pmemobj_ctl_get(pop, "heap.punch_hole.enabled", &enabled);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(enabled, 0);
+	UT_ASSERTeq(reclaimed(pop), 0);
+
+	uint64_t bytes;
+	ret = pmemobj_ctl_exec(pop, "heap.punch_hole.run", &bytes);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EACCES);
+
+	pmemobj_close(pop);
+
+	cow = 0;
+	ret = pmemobj_ctl_set(NULL, "copy_on_write.at_open", &cow);
+	UT_ASSERTeq(ret, 0);
+
+	pop = pmemobj_open(path, LAYOUT);
+	if (pop == NULL)
+		UT_FATAL("!pmemobj_open: %s", path);
+
+	return pop;
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_ctl_punch_hole");
+
+	if (argc != 3 || strchr("rau", argv[2][0]) == NULL)
+		UT_FATAL("usage: %s file-name r|a|u", argv[0]);
+
+	const char *path = argv[1];
+
+	int global;
+	int ret = pmemobj_ctl_get(NULL, "fallocate.punch_hole", &global);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(global, 0);
+
+	PMEMobjpool *pop = pmemobj_create(path, LAYOUT,
+		PMEMOBJ_MIN_POOL * 4, S_IWUSR | S_IRUSR);
+	if (pop == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	/* only the freed objects are reclaimed, regardless of their size */
+	ssize_t min_size = OBJ_SIZE;
+	ret = pmemobj_ctl_set(pop, "heap.punch_hole.min_size", &min_size);
+	UT_ASSERTeq(ret, 0);
+
+	for (unsigned i = 0; i < NOBJS; ++i) {
+		ret = pmemobj_alloc(pop, &Objs[i], OBJ_SIZE, 0, NULL, NULL);
+		UT_ASSERTeq(ret, 0);
+		pmemobj_memset_persist(pop, pmemobj_direct(Objs[i]),
+			(int)i + 1, OBJ_SIZE);
+	}
+
+	if (argv[2][0] == 'r')
+		test_run(pop, path);
+	else if (argv[2][0] == 'a')
+		test_auto(pop, path);
+	else
+		pop = test_unsupported(pop, path);
+
+	/* the memory of the freed object can be used again */
+	ret = pmemobj_alloc(pop, &Objs[1], OBJ_SIZE, 0, NULL, NULL);
+	UT_ASSERTeq(ret, 0);
+	pmemobj_memset_persist(pop, pmemobj_direct(Objs[1]), 2, OBJ_SIZE);
+
+	pmemobj_close(pop);
+
+	ret = pmemobj_check(path, LAYOUT);
+	UT_ASSERTeq(ret, 1);
+
+	pop = pmemobj_open(path, LAYOUT);
+	if (pop == NULL)
+		UT_FATAL("!pmemobj_open: %s", path);
+
+	for (unsigned i = 0; i < NOBJS; ++i) {
+		unsigned char *data = pmemobj_direct(Objs[i]);
+		for (size_t j = 0; j < OBJ_SIZE; ++j)
+			UT_ASSERTeq(data[j], i + 1);
+	}
+
+	pmemobj_close(pop);
+
+	DONE(NULL);
+}
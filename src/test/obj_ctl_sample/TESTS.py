@@ -0,0 +1,25 @@
+#!../env.py
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright 2020, Intel Corporation
+#
+
+from os import path
+import testframework as t
+
+
+class BASE(t.BaseTest):
+    test_type = t.Medium
+
+    def run(self, ctx):
+        testfile = path.join(ctx.testdir, 'testfile0')
+        ctx.exec('obj_ctl_sample', testfile, self.mode)
+
+
+class TEST0(BASE):
+    "every n-th allocation recorded in the ring of samples"
+    mode = 'b'
+
+
+class TEST1(BASE):
+    "allocations sampled by multiple threads"
+    mode = 't'
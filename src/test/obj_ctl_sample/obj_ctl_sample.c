@@ -0,0 +1,267 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * obj_ctl_sample.c -- tests for the heap.sample ctl namespace
+ *
+ * usage: obj_ctl_sample file-name b|t
+ *
+ * Enables the allocation sampling and verifies that every n-th allocation of
+ * a thread is recorded in the ring of samples (b), also when the allocations
+ * are made by multiple threads (t).
+ */
+
+#include "unittest.h"
+
+#define LAYOUT "obj_ctl_sample"
+#define TYPE_NUM 7
+#define TX_TYPE_NUM 9
+#define OBJ_SIZE 100
+#define NOBJS 40
+#define RATE 4
+#define CAPACITY 16
+#define NTHREADS 4
+#define THREAD_NOBJS 100
+
+static PMEMobjpool *Pop;
+
+/*
+ * get_total -- returns the number of samples taken
+ */
+static uint64_t
+get_total(void)
+{
+	uint64_t total;
+	int ret = pmemobj_ctl_get(Pop, "heap.sample.total", &total);
+	UT_ASSERTeq(ret, 0);
+
+	return total;
+}
+
+/*
+ * set_rate -- changes the sampling rate
+ */
+static void
+set_rate(ssize_t rate)
+{
+	int ret = pmemobj_ctl_set(Pop, "heap.sample.rate", &rate);
+	UT_ASSERTeq(ret, 0);
+}
+
+/*
+ * dump -- copies at most n most recent samples and returns their number
+ */
+static size_t
+dump(struct pobj_alloc_sample *samples, size_t n)
+{
+	struct pobj_alloc_samples s = {n, samples};
+	int ret = pmemobj_ctl_exec(Pop, "heap.sample.dump", &s);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERT(s.nsamples <= n);
+
+	return s.nsamples;
+}
+
+/*
+ * alloc_objs -- allocates objects into the array
+ */
+static void
+alloc_objs(PMEMoid *oids, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		int ret = pmemobj_alloc(Pop, &oids[i], OBJ_SIZE, TYPE_NUM,
+			NULL, NULL);
+		UT_ASSERTeq(ret, 0);
+	}
+}
+
+/*
+ * test_basic -- every n-th allocation recorded in the ring of samples
+ */
+static void
+test_basic(void)
+{
+	ssize_t rate;
+	ssize_t capacity;
+	int ret = pmemobj_ctl_get(Pop, "heap.sample.rate", &rate);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(rate, 0);
+	ret = pmemobj_ctl_get(Pop, "heap.sample.capacity", &capacity);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(capacity, 1024);
+
+	rate = -1;
+	ret = pmemobj_ctl_set(Pop, "heap.sample.rate", &rate);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+	capacity = 0;
+	ret = pmemobj_ctl_set(Pop, "heap.sample.capacity", &capacity);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+	ret = pmemobj_ctl_exec(Pop, "heap.sample.dump", NULL);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	struct pobj_alloc_sample samples[CAPACITY * 2];
+	PMEMoid oids[NOBJS];
+
+	/* the sampling is disabled by default */
+	alloc_objs(oids, NOBJS);
+	UT_ASSERTeq(get_total(), 0);
+	UT_ASSERTeq(dump(samples, CAPACITY * 2), 0);
+
+	capacity = CAPACITY;
+	ret = pmemobj_ctl_set(Pop, "heap.sample.capacity", &capacity);
+	UT_ASSERTeq(ret, 0);
+	set_rate(RATE);
+
+	ssize_t arena_id;
+	ret = pmemobj_ctl_get(Pop, "heap.thread.arena_id", &arena_id);
+	UT_ASSERTeq(ret, 0);
+
+	/* the first allocation is sampled, then every RATE-th one */
+	alloc_objs(oids, NOBJS);
+	UT_ASSERTeq(get_total(), NOBJS / RATE);
+
+	size_t n = dump(samples, CAPACITY * 2);
+	UT_ASSERTeq(n, NOBJS / RATE);
+	for (size_t i = 0; i < n; ++i) {
+		UT_ASSERTeq(samples[i].seq, i);
+		UT_ASSERTeq(samples[i].size, OBJ_SIZE);
+		UT_ASSERTeq(samples[i].type_num, TYPE_NUM);
+		UT_ASSERTeq(samples[i].off, oids[i * RATE].off);
+		UT_ASSERTne(samples[i].class_id, 0);
+		UT_ASSERTeq(samples[i].arena_id, (unsigned)arena_id);
+#ifdef __GLIBC__
+		UT_ASSERTne(samples[i].frames[0], NULL);
+#endif
+	}
+
+	/* the capacity can't change once the ring is in use */
+	ret = pmemobj_ctl_set(Pop, "heap.sample.capacity", &capacity);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EBUSY);
+
+	/* only the most recent samples are kept */
+	alloc_objs(oids, NOBJS);
+	UT_ASSERTeq(get_total(), 2 * NOBJS / RATE);
+
+	n = dump(samples, CAPACITY * 2);
+	UT_ASSERTeq(n, CAPACITY);
+	for (size_t i = 0; i < n; ++i)
+		UT_ASSERTeq(samples[i].seq, 2 * NOBJS / RATE - CAPACITY + i);
+
+	n = dump(samples, 3);
+	UT_ASSERTeq(n, 3);
+	UT_ASSERTeq(samples[0].seq, 2 * NOBJS / RATE - 3);
+	UT_ASSERTeq(samples[2].seq, 2 * NOBJS / RATE - 1);
+	UT_ASSERTeq(samples[2].off, oids[NOBJS - RATE].off);
+
+	/* transactional allocations are sampled as well */
+	set_rate(1);
+	PMEMoid oid = OID_NULL;
+	TX_BEGIN(Pop) {
+		oid = pmemobj_tx_alloc(OBJ_SIZE * 2, TX_TYPE_NUM);
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+
+	n = dump(samples, 1);
+	UT_ASSERTeq(n, 1);
+	UT_ASSERTeq(samples[0].type_num, TX_TYPE_NUM);
+	UT_ASSERTeq(samples[0].size, OBJ_SIZE * 2);
+	UT_ASSERTeq(samples[0].off, oid.off);
+
+	/* every object of a bulk allocation is sampled */
+	ret = pmemobj_xalloc_bulk(Pop, oids, CAPACITY, OBJ_SIZE, TYPE_NUM, 0,
+		NULL, NULL);
+	UT_ASSERTeq(ret, 0);
+
+	n = dump(samples, CAPACITY);
+	UT_ASSERTeq(n, CAPACITY);
+	for (size_t i = 0; i < n; ++i) {
+		UT_ASSERTeq(samples[i].size, OBJ_SIZE);
+		UT_ASSERTeq(samples[i].off, oids[i].off);
+	}
+
+	/* disabling the sampling keeps the samples */
+	uint64_t total = get_total();
+	set_rate(0);
+	alloc_objs(oids, NOBJS);
+	UT_ASSERTeq(get_total(), total);
+	UT_ASSERTeq(dump(samples, CAPACITY * 2), CAPACITY);
+}
+
+/*
+ * worker -- allocates objects
+ */
+static void *
+worker(void *arg)
+{
+	PMEMoid oids[THREAD_NOBJS];
+	alloc_objs(oids, THREAD_NOBJS);
+
+	return NULL;
+}
+
+/*
+ * test_threads -- allocations sampled by multiple threads
+ */
+static void
+test_threads(void)
+{
+	set_rate(1);
+
+	os_thread_t threads[NTHREADS];
+	for (int i = 0; i < NTHREADS; ++i)
+		THREAD_CREATE(&threads[i], NULL, worker, NULL);
+
+	for (int i = 0; i < NTHREADS; ++i)
+		THREAD_JOIN(&threads[i], NULL);
+
+	UT_ASSERTeq(get_total(), NTHREADS * THREAD_NOBJS);
+
+	struct pobj_alloc_sample *samples =
+		MALLOC(sizeof(*samples) * NTHREADS * THREAD_NOBJS);
+
+	size_t n = dump(samples, NTHREADS * THREAD_NOBJS);
+	UT_ASSERTeq(n, NTHREADS * THREAD_NOBJS);
+	for (size_t i = 0; i < n; ++i) {
+		UT_ASSERTeq(samples[i].seq, i);
+		UT_ASSERTeq(samples[i].type_num, TYPE_NUM);
+		UT_ASSERTne(samples[i].arena_id, 0);
+	}
+
+	FREE(samples);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_ctl_sample");
+
+	if (argc != 3 || strlen(argv[2]) != 1)
+		UT_FATAL("usage: %s file-name b|t", argv[0]);
+
+	const char *path = argv[1];
+
+	Pop = pmemobj_create(path, LAYOUT, PMEMOBJ_MIN_POOL * 4,
+		S_IWUSR | S_IRUSR);
+	if (Pop == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	switch (argv[2][0]) {
+		case 'b':
+			test_basic();
+			break;
+		case 't':
+			test_threads();
+			break;
+		default:
+			UT_FATAL("unknown mode %c", argv[2][0]);
+	}
+
+	pmemobj_close(Pop);
+
+	DONE(NULL);
+}
@@ -0,0 +1,25 @@
+#!../env.py
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright 2020, Intel Corporation
+#
+
+from os import path
+import testframework as t
+
+
+class BASE(t.BaseTest):
+    test_type = t.Medium
+
+    def run(self, ctx):
+        testfile = path.join(ctx.testdir, 'testfile0')
+        ctx.exec('obj_ctl_shared_runs', testfile, self.mode)
+
+
+class TEST0(BASE):
+    "blocks claimed from the runs of an explicit arena by multiple threads"
+    mode = 'e'
+
+
+class TEST1(BASE):
+    "blocks claimed from the runs of the thread's arena, then disabled"
+    mode = 't'
@@ -0,0 +1,220 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * obj_ctl_shared_runs.c -- tests for the heap.shared_runs ctl namespace
+ *
+ * usage: obj_ctl_shared_runs file-name e|t
+ *
+ * Enables claiming the blocks of the active runs without locking the buckets
+ * and verifies that the objects allocated concurrently by multiple threads
+ * from the same arena don't overlap, both when the arena is given explicitly
+ * (e) and when it is the arena assigned to the threads (t). The latter also
+ * checks that no blocks are claimed once this is disabled again.
+ */
+
+#include "unittest.h"
+
+#define LAYOUT "obj_ctl_shared_runs"
+#define TYPE_NUM 5
+#define OBJ_SIZE 128
+#define NTHREADS 4
+#define THREAD_NOBJS 1000
+
+static PMEMobjpool *Pop;
+
+static PMEMoid Oids[NTHREADS][THREAD_NOBJS];
+
+static unsigned Arena_id;
+
+struct worker_args {
+	unsigned idx;
+	int explicit_arena;
+};
+
+/*
+ * get_claims -- reads the number of blocks claimed from the test arena
+ */
+static uint64_t
+get_claims(void)
+{
+	char query[128];
+	SNPRINTF(query, sizeof(query), "stats.heap.arena.%u.claims", Arena_id);
+
+	uint64_t claims;
+	int ret = pmemobj_ctl_get(Pop, query, &claims);
+	UT_ASSERTeq(ret, 0);
+
+	return claims;
+}
+
+/*
+ * set_shared_runs -- enables or disables the shared runs
+ */
+static void
+set_shared_runs(int enabled)
+{
+	int ret = pmemobj_ctl_set(Pop, "heap.shared_runs.enabled", &enabled);
+	UT_ASSERTeq(ret, 0);
+
+	int value;
+	ret = pmemobj_ctl_get(Pop, "heap.shared_runs.enabled", &value);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(value, enabled);
+}
+
+/*
+ * worker -- allocates objects from the test arena and fills them with
+ *	the index of the thread
+ */
+static void *
+worker(void *arg)
+{
+	struct worker_args *args = arg;
+	uint64_t flags = 0;
+
+	if (args->explicit_arena) {
+		flags = POBJ_ARENA_ID(Arena_id);
+	} else {
+		int ret = pmemobj_ctl_set(Pop, "heap.thread.arena_id",
+			&Arena_id);
+		UT_ASSERTeq(ret, 0);
+	}
+
+	for (unsigned i = 0; i < THREAD_NOBJS; ++i) {
+		PMEMoid *oid = &Oids[args->idx][i];
+		int ret = pmemobj_xalloc(Pop, oid, OBJ_SIZE, TYPE_NUM, flags,
+			NULL, NULL);
+		UT_ASSERTeq(ret, 0);
+
+		pmemobj_memset_persist(Pop, pmemobj_direct(*oid),
+			(int)args->idx, OBJ_SIZE);
+	}
+
+	return NULL;
+}
+
+/*
+ * run_workers -- allocates the objects by multiple threads at once and
+ *	verifies that none of them were overwritten
+ */
+static void
+run_workers(int explicit_arena)
+{
+	os_thread_t threads[NTHREADS];
+	struct worker_args args[NTHREADS];
+
+	for (unsigned t = 0; t < NTHREADS; ++t) {
+		args[t].idx = t;
+		args[t].explicit_arena = explicit_arena;
+		THREAD_CREATE(&threads[t], NULL, worker, &args[t]);
+	}
+
+	for (unsigned t = 0; t < NTHREADS; ++t)
+		THREAD_JOIN(&threads[t], NULL);
+
+	for (unsigned t = 0; t < NTHREADS; ++t) {
+		for (unsigned i = 0; i < THREAD_NOBJS; ++i) {
+			char *p = pmemobj_direct(Oids[t][i]);
+			UT_ASSERTeq(p[0], (char)t);
+			UT_ASSERTeq(p[OBJ_SIZE - 1], (char)t);
+		}
+	}
+}
+
+/*
+ * free_objs -- frees all of the objects
+ */
+static void
+free_objs(void)
+{
+	for (unsigned t = 0; t < NTHREADS; ++t) {
+		for (unsigned i = 0; i < THREAD_NOBJS; ++i)
+			pmemobj_free(&Oids[t][i]);
+	}
+}
+
+/*
+ * test_explicit -- blocks claimed from the runs of an explicit arena
+ */
+static void
+test_explicit(void)
+{
+	set_shared_runs(1);
+
+	run_workers(1);
+
+	uint64_t claims = get_claims();
+	UT_ASSERT(claims > 0);
+	UT_ASSERT(claims <= NTHREADS * THREAD_NOBJS);
+
+	free_objs();
+
+	/* the freed blocks can be claimed again */
+	run_workers(1);
+	UT_ASSERT(get_claims() > claims);
+
+	free_objs();
+}
+
+/*
+ * test_thread -- blocks claimed from the runs of the thread's arena
+ */
+static void
+test_thread(void)
+{
+	set_shared_runs(1);
+
+	run_workers(0);
+
+	uint64_t claims = get_claims();
+	UT_ASSERT(claims > 0);
+
+	free_objs();
+
+	/* the blocks are taken from the buckets the regular way again */
+	set_shared_runs(0);
+
+	run_workers(0);
+	UT_ASSERTeq(get_claims(), claims);
+
+	free_objs();
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_ctl_shared_runs");
+
+	if (argc != 3 || strlen(argv[2]) != 1)
+		UT_FATAL("usage: %s file-name e|t", argv[0]);
+
+	const char *path = argv[1];
+
+	Pop = pmemobj_create(path, LAYOUT, PMEMOBJ_MIN_POOL * 8,
+		S_IWUSR | S_IRUSR);
+	if (Pop == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	int enabled = 1;
+	int ret = pmemobj_ctl_set(Pop, "stats.enabled", &enabled);
+	UT_ASSERTeq(ret, 0);
+
+	ret = pmemobj_ctl_exec(Pop, "heap.arena.create", &Arena_id);
+	UT_ASSERTeq(ret, 0);
+
+	switch (argv[2][0]) {
+		case 'e':
+			test_explicit();
+			break;
+		case 't':
+			test_thread();
+			break;
+		default:
+			UT_FATAL("unknown mode %c", argv[2][0]);
+	}
+
+	pmemobj_close(Pop);
+
+	DONE(NULL);
+}
@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2017-2019, Intel Corporation */
+/* Copyright 2017-2020, Intel Corporation */
 
 /*
  * obj_ctl_stats.c -- tests for the libpmemobj statistics module
@@ -7,6 +7,235 @@
 
 #include "unittest.h"
 
+#define NTHREADS 4
+#define NOBJS_PER_THREAD 250
+#define NOBJS (NTHREADS * NOBJS_PER_THREAD)
+#define UNIT_SIZE 144
+#define HUGE_SIZE (4 * 1024 * 1024)
+
+static PMEMobjpool *Pop;
+static unsigned Class_id;
+static PMEMoid Objs[NOBJS];
+
+/*
+ * class_stat -- reads a statistic of the test allocation class
+ */
+static uint64_t
+class_stat(const char *name)
+{
+	char query[128];
+	SNPRINTF(query, sizeof(query), "stats.heap.class.%u.%s",
+		Class_id, name);
+
+	uint64_t value;
+	int ret = pmemobj_ctl_get(Pop, query, &value);
+	UT_ASSERTeq(ret, 0);
+
+	return value;
+}
+
+/*
+ * arenas_allocations -- sums up the allocations made from all arenas
+ */
+static uint64_t
+arenas_allocations(void)
+{
+	unsigned narenas;
+	int ret = pmemobj_ctl_get(Pop, "heap.narenas.total", &narenas);
+	UT_ASSERTeq(ret, 0);
+
+	uint64_t sum = 0;
+	for (unsigned i = 1; i <= narenas; ++i) {
+		char query[128];
+		SNPRINTF(query, sizeof(query),
+			"stats.heap.arena.%u.allocations", i);
+
+		uint64_t value;
+		ret = pmemobj_ctl_get(Pop, query, &value);
+		UT_ASSERTeq(ret, 0);
+		sum += value;
+	}
+
+	return sum;
+}
+
+/*
+ * huge_stat -- reads a statistic of free chunks
+ */
+static uint64_t
+huge_stat(const char *name)
+{
+	char query[128];
+	SNPRINTF(query, sizeof(query), "stats.heap.huge.%s", name);
+
+	uint64_t value;
+	int ret = pmemobj_ctl_get(Pop, query, &value);
+	UT_ASSERTeq(ret, 0);
+
+	return value;
+}
+
+/*
+ * worker -- allocates objects of the test allocation class
+ */
+static void *
+worker(void *arg)
+{
+	unsigned idx = *(unsigned *)arg;
+
+	for (unsigned i = 0; i < NOBJS_PER_THREAD; ++i) {
+		int ret = pmemobj_xalloc(Pop,
+			&Objs[idx * NOBJS_PER_THREAD + i], UNIT_SIZE - 16,
+			0, POBJ_CLASS_ID(Class_id), NULL, NULL);
+		UT_ASSERTeq(ret, 0);
+	}
+
+	return NULL;
+}
+
+/*
+ * test_heap_stats -- verifies the per-class, per-arena and huge chunk
+ *	statistics
+ */
+static void
+test_heap_stats(PMEMobjpool *pop)
+{
+	Pop = pop;
+
+	enum pobj_stats_enabled enabled = POBJ_STATS_ENABLED_BOTH;
+	int ret = pmemobj_ctl_set(pop, "stats.enabled", &enabled);
+	UT_ASSERTeq(ret, 0);
+
+	struct pobj_alloc_class_desc desc;
+	desc.header_type = POBJ_HEADER_COMPACT;
+	desc.unit_size = UNIT_SIZE;
+	desc.units_per_block = 1000;
+	desc.alignment = 0;
+	ret = pmemobj_ctl_set(pop, "heap.alloc_class.new.desc", &desc);
+	UT_ASSERTeq(ret, 0);
+	Class_id = desc.class_id;
+
+	UT_ASSERTeq(class_stat("allocations"), 0);
+	UT_ASSERTeq(class_stat("runs"), 0);
+
+	uint64_t arena_allocs = arenas_allocations();
+
+	os_thread_t threads[NTHREADS];
+	unsigned idx[NTHREADS];
+	for (unsigned i = 0; i < NTHREADS; ++i) {
+		idx[i] = i;
+		THREAD_CREATE(&threads[i], NULL, worker, &idx[i]);
+	}
+
+	for (unsigned i = 0; i < NTHREADS; ++i)
+		THREAD_JOIN(&threads[i], NULL);
+
+	/* the counters of exited threads are kept */
+	UT_ASSERTeq(class_stat("allocations"), NOBJS);
+	UT_ASSERTeq(class_stat("frees"), 0);
+	UT_ASSERTeq(class_stat("live_bytes"), NOBJS * UNIT_SIZE);
+	UT_ASSERTeq(arenas_allocations() - arena_allocs, NOBJS);
+
+	uint64_t runs = class_stat("runs");
+	UT_ASSERT(runs > 0);
+	UT_ASSERTeq(class_stat("free_blocks"),
+		runs * desc.units_per_block - NOBJS);
+
+	for (unsigned i = 0; i < NOBJS / 2; ++i)
+		pmemobj_free(&Objs[i]);
+
+	UT_ASSERTeq(class_stat("frees"), NOBJS / 2);
+	UT_ASSERTeq(class_stat("live_bytes"), NOBJS / 2 * UNIT_SIZE);
+
+	uint64_t lock_waits = class_stat("lock_waits");
+	UT_ASSERT(lock_waits <= NOBJS);
+
+	uint64_t free_bytes = huge_stat("free_bytes");
+
+	PMEMoid huge[3];
+	for (unsigned i = 0; i < 3; ++i) {
+		ret = pmemobj_alloc(pop, &huge[i], HUGE_SIZE, 0, NULL, NULL);
+		UT_ASSERTeq(ret, 0);
+	}
+
+	/* the free chunks are accounted as soon as they are allocated */
+	UT_ASSERT(huge_stat("free_bytes") <= free_bytes - 3 * HUGE_SIZE);
+
+	free_bytes = huge_stat("free_bytes");
+	UT_ASSERT(huge_stat("largest_free") <= free_bytes);
+
+	pmemobj_free(&huge[1]);
+
+	/* the freed chunks are separated from the rest of free space */
+	UT_ASSERT(huge_stat("free_bytes") >= free_bytes + HUGE_SIZE);
+	UT_ASSERT(huge_stat("fragmentation") > 0);
+	UT_ASSERT(huge_stat("fragmentation") < 100);
+
+	uint64_t value;
+	ret = pmemobj_ctl_get(pop, "stats.heap.class.254.runs", &value);
+	UT_ASSERTeq(ret, -1);
+	ret = pmemobj_ctl_get(pop, "stats.heap.arena.0.allocations", &value);
+	UT_ASSERTeq(ret, -1);
+
+	pmemobj_free(&huge[0]);
+	pmemobj_free(&huge[2]);
+	for (unsigned i = NOBJS / 2; i < NOBJS; ++i)
+		pmemobj_free(&Objs[i]);
+}
+
+/*
+ * tx_stat -- reads a statistic of transactions
+ */
+static uint64_t
+tx_stat(PMEMobjpool *pop, const char *name)
+{
+	char query[128];
+	SNPRINTF(query, sizeof(query), "stats.tx.%s", name);
+
+	uint64_t value;
+	int ret = pmemobj_ctl_get(pop, query, &value);
+	UT_ASSERTeq(ret, 0);
+
+	return value;
+}
+
+/*
+ * test_tx_stats -- verifies that the cache lines shared by the modified
+ *	ranges are flushed once at commit
+ */
+static void
+test_tx_stats(PMEMobjpool *pop)
+{
+	PMEMoid oid;
+	int ret = pmemobj_xalloc(pop, &oid, 1024, 0, POBJ_XALLOC_ALIGN(64),
+		NULL, NULL);
+	UT_ASSERTeq(ret, 0);
+	char *p = pmemobj_direct(oid);
+	UT_ASSERTeq((uintptr_t)p % 64, 0);
+
+	uint64_t range_lines = tx_stat(pop, "range_lines");
+	uint64_t flushed_lines = tx_stat(pop, "flushed_lines");
+
+	TX_BEGIN(pop) {
+		/* 8 ranges in two cache lines */
+		for (unsigned i = 0; i < 8; ++i) {
+			pmemobj_tx_add_range_direct(p + i * 16, 8);
+			p[i * 16] = 1;
+		}
+
+		/* a range in a cache line of its own */
+		pmemobj_tx_add_range_direct(p + 512, 8);
+		p[512] = 1;
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+
+	UT_ASSERTeq(tx_stat(pop, "range_lines") - range_lines, 9);
+	UT_ASSERTeq(tx_stat(pop, "flushed_lines") - flushed_lines, 3);
+
+	pmemobj_free(&oid);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -18,7 +247,7 @@ main(int argc, char *argv[])
 	const char *path = argv[1];
 
 	PMEMobjpool *pop;
-	if ((pop = pmemobj_create(path, "ctl", PMEMOBJ_MIN_POOL,
+	if ((pop = pmemobj_create(path, "ctl", PMEMOBJ_MIN_POOL * 4,
 		S_IWUSR | S_IRUSR)) == NULL)
 		UT_FATAL("!pmemobj_create: %s", path);
 
@@ -93,6 +322,9 @@ main(int argc, char *argv[])
 	UT_ASSERTeq(ret, 0);
 	UT_ASSERTeq(tmp, run_allocated); /* shouldn't change */
 
+	test_heap_stats(pop);
+	test_tx_stats(pop);
+
 	pmemobj_close(pop);
 
 	DONE(NULL);
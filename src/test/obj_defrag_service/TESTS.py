@@ -0,0 +1,25 @@
+#!../env.py
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright 2020, Intel Corporation
+#
+
+from os import path
+import testframework as t
+
+
+class BASE(t.BaseTest):
+    test_type = t.Medium
+
+    def run(self, ctx):
+        testfile = path.join(ctx.testdir, 'testfile0')
+        ctx.exec('obj_defrag_service', testfile, self.mode)
+
+
+class TEST0(BASE):
+    "defragmentation performed in steps"
+    mode = 's'
+
+
+class TEST1(BASE):
+    "defragmentation performed by a worker"
+    mode = 'w'
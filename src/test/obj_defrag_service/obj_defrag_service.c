@@ -0,0 +1,278 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * obj_defrag_service.c -- unit test for the background defragmentation
+ *
+ * usage: obj_defrag_service file-name s|w
+ *
+ * Fills the heap with small objects, frees three out of every four of them
+ * and reopens the pool, which leaves the heap with sparsely occupied runs.
+ * Those are then compacted either by explicit steps (s) or by a worker
+ * thread (w).
+ */
+
+#include "unittest.h"
+#include "os_thread.h"
+
+#define LAYOUT "obj_defrag_service"
+#define NOBJS 8192
+#define OBJ_DATA_SIZE 56
+
+struct object {
+	uint64_t idx;
+	unsigned char data[OBJ_DATA_SIZE];
+};
+
+struct root {
+	PMEMoid objs[NOBJS];
+};
+
+static os_mutex_t Lock;
+static os_cond_t Cond;
+static unsigned Nlocks;
+static int Locked;
+
+/*
+ * refs_cb -- returns the only reference to the object, stored in the root
+ */
+static int
+refs_cb(PMEMobjpool *pop, PMEMoid oid, PMEMoid **refs, size_t nrefs,
+	void *arg)
+{
+	struct root *r = arg;
+	struct object *o = pmemobj_direct(oid);
+
+	UT_ASSERT(Locked);
+	UT_ASSERT(nrefs >= 1);
+	UT_ASSERT(o->idx < NOBJS);
+	UT_ASSERT(OID_EQUALS(r->objs[o->idx], oid));
+
+	refs[0] = &r->objs[o->idx];
+
+	return 1;
+}
+
+/*
+ * lock_cb -- marks the beginning of a batch
+ */
+static void
+lock_cb(PMEMobjpool *pop, void *arg)
+{
+	os_mutex_lock(&Lock);
+	UT_ASSERT(!Locked);
+	Locked = 1;
+	Nlocks++;
+	os_cond_broadcast(&Cond);
+	os_mutex_unlock(&Lock);
+}
+
+/*
+ * unlock_cb -- marks the end of a batch
+ */
+static void
+unlock_cb(PMEMobjpool *pop, void *arg)
+{
+	os_mutex_lock(&Lock);
+	UT_ASSERT(Locked);
+	Locked = 0;
+	os_mutex_unlock(&Lock);
+}
+
+/*
+ * object_construct -- initializes the object with its index
+ */
+static int
+object_construct(PMEMobjpool *pop, void *ptr, void *arg)
+{
+	struct object *o = ptr;
+	o->idx = *(uint64_t *)arg;
+	memset(o->data, (int)(o->idx & 0xff), sizeof(o->data));
+	pmemobj_persist(pop, o, sizeof(*o));
+
+	return 0;
+}
+
+/*
+ * fill_heap -- allocates the objects and frees most of them
+ */
+static void
+fill_heap(PMEMobjpool *pop, struct root *r)
+{
+	for (uint64_t i = 0; i < NOBJS; ++i) {
+		int ret = pmemobj_alloc(pop, &r->objs[i],
+			sizeof(struct object), 0, object_construct, &i);
+		UT_ASSERTeq(ret, 0);
+	}
+
+	for (uint64_t i = 0; i < NOBJS; ++i) {
+		if (i % 4 != 0)
+			pmemobj_free(&r->objs[i]);
+	}
+}
+
+/*
+ * verify_objects -- checks that all objects survived the relocation
+ */
+static void
+verify_objects(struct root *r)
+{
+	for (uint64_t i = 0; i < NOBJS; ++i) {
+		if (i % 4 != 0) {
+			UT_ASSERT(OID_IS_NULL(r->objs[i]));
+			continue;
+		}
+
+		struct object *o = pmemobj_direct(r->objs[i]);
+		UT_ASSERTeq(o->idx, i);
+		for (size_t j = 0; j < sizeof(o->data); ++j)
+			UT_ASSERTeq(o->data[j], (unsigned char)(i & 0xff));
+	}
+}
+
+/*
+ * defrag_steps -- performs the defragmentation until nothing gets relocated
+ */
+static void
+defrag_steps(PMEMobjpool *pop)
+{
+	struct pobj_defrag_result result;
+	uint64_t relocated = 0;
+
+	do {
+		int ret = pmemobj_ctl_exec(pop, "heap.defrag.step", &result);
+		UT_ASSERTeq(ret, 0);
+		UT_ASSERT(result.relocated <= result.total);
+		relocated += result.relocated;
+	} while (result.relocated != 0);
+
+	uint64_t total;
+	int ret = pmemobj_ctl_get(pop, "heap.defrag.relocated", &total);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(total, relocated);
+}
+
+/*
+ * worker -- runs the defragmentation worker
+ */
+static void *
+worker(void *arg)
+{
+	PMEMobjpool *pop = arg;
+
+	int unused;
+	int ret = pmemobj_ctl_get(pop, "heap.defrag.worker", &unused);
+	UT_ASSERTeq(ret, 0);
+
+	return NULL;
+}
+
+/*
+ * defrag_worker -- lets the worker perform a couple of steps
+ */
+static void
+defrag_worker(PMEMobjpool *pop)
+{
+	ssize_t interval = 0;
+	int ret = pmemobj_ctl_set(pop, "heap.defrag.interval", &interval);
+	UT_ASSERTeq(ret, 0);
+
+	os_thread_t t;
+	THREAD_CREATE(&t, NULL, worker, pop);
+
+	/* the first step is complete once the second one begins */
+	os_mutex_lock(&Lock);
+	while (Nlocks < 2)
+		os_cond_wait(&Cond, &Lock);
+	os_mutex_unlock(&Lock);
+
+	int unused;
+	ret = pmemobj_ctl_get(pop, "heap.defrag.stop", &unused);
+	UT_ASSERTeq(ret, 0);
+
+	THREAD_JOIN(&t, NULL);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_defrag_service");
+
+	if (argc != 3 || strchr("sw", argv[2][0]) == NULL)
+		UT_FATAL("usage: %s file-name s|w", argv[0]);
+
+	const char *path = argv[1];
+
+	os_mutex_init(&Lock);
+	os_cond_init(&Cond);
+
+	PMEMobjpool *pop = pmemobj_create(path, LAYOUT, PMEMOBJ_MIN_POOL * 4,
+		S_IWUSR | S_IRUSR);
+	if (pop == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	PMEMoid root = pmemobj_root(pop, sizeof(struct root));
+	struct root *r = pmemobj_direct(root);
+	fill_heap(pop, r);
+	pmemobj_close(pop);
+
+	/* after reopening, all runs are given to the recyclers */
+	pop = pmemobj_open(path, LAYOUT);
+	if (pop == NULL)
+		UT_FATAL("!pmemobj_open: %s", path);
+
+	r = pmemobj_direct(pmemobj_root(pop, sizeof(struct root)));
+
+	/* the callbacks are required */
+	struct pobj_defrag_result result;
+	int ret = pmemobj_ctl_exec(pop, "heap.defrag.step", &result);
+	UT_ASSERTne(ret, 0);
+	UT_ASSERTeq(errno, EINVAL);
+
+	struct pobj_defrag_callbacks callbacks = {
+		refs_cb, lock_cb, unlock_cb, r
+	};
+	ret = pmemobj_ctl_set(pop, "heap.defrag.callbacks", &callbacks);
+	UT_ASSERTeq(ret, 0);
+
+	struct pobj_defrag_callbacks callbacks_out;
+	ret = pmemobj_ctl_get(pop, "heap.defrag.callbacks", &callbacks_out);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(callbacks_out.refs, refs_cb);
+	UT_ASSERTeq(callbacks_out.arg, r);
+
+	/* populates the heap */
+	PMEMoid oid;
+	ret = pmemobj_alloc(pop, &oid, sizeof(struct object), 0, NULL, NULL);
+	UT_ASSERTeq(ret, 0);
+	pmemobj_free(&oid);
+
+	if (argv[2][0] == 's')
+		defrag_steps(pop);
+	else
+		defrag_worker(pop);
+
+	uint64_t relocated;
+	ret = pmemobj_ctl_get(pop, "heap.defrag.relocated", &relocated);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTne(relocated, 0);
+
+	uint64_t reclaimed;
+	ret = pmemobj_ctl_get(pop, "heap.defrag.reclaimed", &reclaimed);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTne(reclaimed, 0);
+
+	UT_ASSERT(!Locked);
+
+	verify_objects(r);
+
+	pmemobj_close(pop);
+
+	ret = pmemobj_check(path, LAYOUT);
+	UT_ASSERTeq(ret, 1);
+
+	os_cond_destroy(&Cond);
+	os_mutex_destroy(&Lock);
+
+	DONE(NULL);
+}
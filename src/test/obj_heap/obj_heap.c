@@ -226,8 +226,8 @@ do_fault_injection_heap_boot()
 
 	pmemobj_inject_fault_at(PMEM_MALLOC, 1, "heap_boot");
 
-	int r = heap_boot(NULL, NULL, heap_size, &pop->heap_size, NULL, p_ops,
-			NULL, NULL);
+	int r = heap_boot(NULL, NULL, heap_size, &pop->heap_size, NULL, 0,
+			p_ops, NULL, NULL);
 	UT_ASSERTne(r, 0);
 	UT_ASSERTeq(errno, ENOMEM);
 }
@@ -240,8 +240,7 @@ do_fault_injection_recycler()
 
 	pmemobj_inject_fault_at(PMEM_MALLOC, 1, "recycler_new");
 
-	size_t active_arenas = 1;
-	struct recycler *r = recycler_new(NULL, 0, &active_arenas);
+	struct recycler *r = recycler_new(NULL, 0);
 	UT_ASSERTeq(r, NULL);
 	UT_ASSERTeq(errno, ENOMEM);
 }
@@ -314,7 +313,7 @@ test_heap(void)
 		&pop->heap_size, p_ops) == 0);
 	UT_ASSERT(heap_boot(heap, heap_start, heap_size,
 		&pop->heap_size,
-		pop, p_ops, s, pop->set) == 0);
+		pop, 0, p_ops, s, pop->set) == 0);
 	UT_ASSERT(heap_buckets_init(heap) == 0);
 	UT_ASSERT(pop->heap.rt != NULL);
 
@@ -412,12 +411,15 @@ test_heap_with_size()
 	struct palloc_heap *heap = &pop->heap;
 	struct pmem_ops *p_ops = &pop->p_ops;
 
+	struct stats *st = stats_new(pop);
+	UT_ASSERTne(st, NULL);
+
 	UT_ASSERT(heap_check(heap_start, heap_size) != 0);
 	UT_ASSERT(heap_init(heap_start, heap_size,
 		&pop->heap_size, p_ops) == 0);
 	UT_ASSERT(heap_boot(heap, heap_start, heap_size,
 		&pop->heap_size,
-		pop, p_ops, NULL, pop->set) == 0);
+		pop, 0, p_ops, st, pop->set) == 0);
 	UT_ASSERT(heap_buckets_init(heap) == 0);
 	UT_ASSERT(pop->heap.rt != NULL);
 
@@ -445,6 +447,8 @@ test_heap_with_size()
 	heap_cleanup(heap);
 	UT_ASSERT(heap->rt == NULL);
 
+	stats_delete(pop, st);
+
 	FREE(pop->set);
 	MUNMAP_ANON_ALIGNED(mpop, size);
 }
@@ -479,7 +483,7 @@ test_recycler(void)
 		&pop->heap_size, p_ops) == 0);
 	UT_ASSERT(heap_boot(heap, heap_start, heap_size,
 		&pop->heap_size,
-		pop, p_ops, s, pop->set) == 0);
+		pop, 0, p_ops, s, pop->set) == 0);
 	UT_ASSERT(heap_buckets_init(heap) == 0);
 	UT_ASSERT(pop->heap.rt != NULL);
 
@@ -494,9 +498,7 @@ test_recycler(void)
 
 	int ret;
 
-	size_t active_arenas = 1;
-	struct recycler *r = recycler_new(&pop->heap, 10000 /* never recalc */,
-		&active_arenas);
+	struct recycler *r = recycler_new(&pop->heap, 10000 /* never recalc */);
 
 	UT_ASSERTne(r, NULL);
 
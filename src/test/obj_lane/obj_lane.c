@@ -127,10 +127,14 @@ test_lane_hold_release(void)
 	pop->p.lanes_desc.runtime_nlanes = 1,
 	pop->p.lanes_desc.lane = &mock_lane;
 	pop->p.lanes_desc.next_lane_idx = 0;
+	pop->p.lanes_desc.mode = POBJ_LANE_MODE_THREAD;
+	pop->p.lanes_desc.nwaiters = 0;
 
 	pop->p.lanes_desc.lane_locks = CALLOC(OBJ_NLANES, sizeof(uint64_t));
 	pop->p.lanes_offset = (uint64_t)&pop->l - (uint64_t)&pop->p;
 	pop->p.uuid_lo = 123456;
+	pop->p.tx_params = tx_params_new();
+	UT_ASSERTne(pop->p.tx_params, NULL);
 	base_ptr = &pop->p;
 
 	struct lane *lane;
@@ -158,6 +162,7 @@ test_lane_hold_release(void)
 
 	SIGACTION(SIGABRT, &old, NULL);
 
+	tx_params_delete(pop->p.tx_params);
 	FREE(pop->p.lanes_desc.lane_locks);
 	FREE(pop);
 	operation_delete(ctx);
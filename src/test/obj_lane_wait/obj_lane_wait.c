@@ -0,0 +1,188 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * obj_lane_wait.c -- unit test for the threads waiting for a free lane
+ *
+ * usage: obj_lane_wait file-name
+ *
+ * Runs with a single lane, so that every thread beginning a transaction while
+ * another one is in progress has to wait for it.
+ */
+
+#include "unittest.h"
+
+#define LAYOUT "obj_lane_wait"
+#define NTHREADS 8
+#define NTX 1000
+
+struct root {
+	uint64_t counters[NTHREADS];
+};
+
+static PMEMobjpool *Pop;
+static struct root *Root;
+
+/* set by the waiter right before it begins its transaction */
+static int Waiting;
+
+/*
+ * get_stat -- reads the value of one of the lane statistics
+ */
+static uint64_t
+get_stat(const char *name)
+{
+	char query[128];
+	SNPRINTF(query, sizeof(query), "stats.lane.%s", name);
+
+	uint64_t value;
+	int ret = pmemobj_ctl_get(Pop, query, &value);
+	UT_ASSERTeq(ret, 0);
+
+	return value;
+}
+
+/*
+ * tx_increment -- increments the counter of the thread in a transaction
+ */
+static void
+tx_increment(unsigned idx)
+{
+	TX_BEGIN(Pop) {
+		pmemobj_tx_add_range_direct(&Root->counters[idx],
+			sizeof(Root->counters[idx]));
+		Root->counters[idx]++;
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+}
+
+/*
+ * waiter -- begins a transaction while the only lane is held
+ */
+static void *
+waiter(void *arg)
+{
+	util_atomic_store32(&Waiting, 1);
+	tx_increment(0);
+
+	return NULL;
+}
+
+/*
+ * test_wait -- the thread which finds the lane busy waits until it's
+ *	released
+ */
+static void
+test_wait(void)
+{
+	uint64_t waits = get_stat("waits");
+	uint64_t wait_time = get_stat("wait_time");
+
+	os_thread_t thread;
+
+	TX_BEGIN(Pop) {
+		THREAD_CREATE(&thread, NULL, waiter, NULL);
+
+		int waiting = 0;
+		while (!waiting)
+			util_atomic_load32(&Waiting, &waiting);
+
+		/* give the waiter the time to find the lane busy */
+		usleep(100000);
+
+		/* the lane is still held, so the waiter couldn't finish */
+		UT_ASSERTeq(Root->counters[0], 0);
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+
+	THREAD_JOIN(&thread, NULL);
+
+	UT_ASSERTeq(Root->counters[0], 1);
+	UT_ASSERTeq(get_stat("waits"), waits + 1);
+	UT_ASSERT(get_stat("wait_time") > wait_time);
+}
+
+/*
+ * committer -- performs the transactions of the thread
+ */
+static void *
+committer(void *arg)
+{
+	unsigned idx = (unsigned)(uintptr_t)arg;
+
+	for (unsigned i = 0; i < NTX; ++i)
+		tx_increment(idx);
+
+	return NULL;
+}
+
+/*
+ * test_mt -- many threads share the lane in the given mode
+ */
+static void
+test_mt(enum pobj_lane_mode mode)
+{
+	int ret = pmemobj_ctl_set(Pop, "lane.mode", &mode);
+	UT_ASSERTeq(ret, 0);
+
+	enum pobj_lane_mode mode_out;
+	ret = pmemobj_ctl_get(Pop, "lane.mode", &mode_out);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(mode_out, mode);
+
+	uint64_t counters[NTHREADS];
+	for (unsigned i = 0; i < NTHREADS; ++i)
+		counters[i] = Root->counters[i];
+
+	os_thread_t threads[NTHREADS];
+	for (unsigned i = 0; i < NTHREADS; ++i)
+		THREAD_CREATE(&threads[i], NULL, committer,
+			(void *)(uintptr_t)i);
+
+	for (unsigned i = 0; i < NTHREADS; ++i)
+		THREAD_JOIN(&threads[i], NULL);
+
+	for (unsigned i = 0; i < NTHREADS; ++i)
+		UT_ASSERTeq(Root->counters[i], counters[i] + NTX);
+}
+
+/*
+ * test_invalid -- the modes outside of the enum are rejected
+ */
+static void
+test_invalid(void)
+{
+	enum pobj_lane_mode mode = (enum pobj_lane_mode)2;
+	int ret = pmemobj_ctl_set(Pop, "lane.mode", &mode);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_lane_wait");
+
+	if (argc != 2)
+		UT_FATAL("usage: %s file-name", argv[0]);
+
+	const char *path = argv[1];
+
+	Pop = pmemobj_create(path, LAYOUT, PMEMOBJ_MIN_POOL,
+		S_IWUSR | S_IRUSR);
+	if (Pop == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	Root = pmemobj_direct(pmemobj_root(Pop, sizeof(struct root)));
+
+	test_wait();
+	test_mt(POBJ_LANE_MODE_THREAD);
+	test_mt(POBJ_LANE_MODE_CPU);
+	test_invalid();
+
+	pmemobj_close(Pop);
+
+	DONE(NULL);
+}
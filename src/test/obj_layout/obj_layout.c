@@ -1,5 +1,5 @@
 // SPDX-License-Identifier: BSD-3-Clause
-/* Copyright 2016-2019, Intel Corporation */
+/* Copyright 2016-2020, Intel Corporation */
 
 /*
  * obj_layout.c -- unit test for layout
@@ -96,6 +96,9 @@ main(int argc, char *argv[])
 	ASSERT_ALIGNED_BEGIN(struct zone_header);
 	ASSERT_ALIGNED_FIELD(struct zone_header, magic);
 	ASSERT_ALIGNED_FIELD(struct zone_header, size_idx);
+	ASSERT_ALIGNED_FIELD(struct zone_header, summary_flags);
+	ASSERT_ALIGNED_FIELD(struct zone_header, summary_run_classes);
+	ASSERT_ALIGNED_FIELD(struct zone_header, summary_run_id);
 	ASSERT_ALIGNED_FIELD(struct zone_header, reserved);
 	ASSERT_ALIGNED_CHECK(struct zone_header);
 	UT_COMPILE_ERROR_ON(sizeof(struct zone_header) !=
@@ -12,6 +12,7 @@
 #include "unittest.h"
 #include "valgrind_internal.h"
 #include "set.h"
+#include "tx.h"
 
 #define MOCK_POOL_SIZE (PMEMOBJ_MIN_POOL * 3)
 #define TEST_MEGA_ALLOC_SIZE (10 * 1024 * 1024)
@@ -283,9 +284,12 @@ test_mock_pool_allocs(void)
 	heap_init(heap_start, heap_size, &mock_pop->heap_size,
 		&mock_pop->p_ops);
 	heap_boot(&mock_pop->heap, heap_start, heap_size, &mock_pop->heap_size,
-		mock_pop, &mock_pop->p_ops, s, mock_pop->set);
+		mock_pop, 0, &mock_pop->p_ops, s, mock_pop->set);
 	heap_buckets_init(&mock_pop->heap);
 
+	mock_pop->tx_params = tx_params_new();
+	UT_ASSERTne(mock_pop->tx_params, NULL);
+
 	/* initialize runtime lanes structure */
 	mock_pop->lanes_desc.runtime_nlanes = (unsigned)mock_pop->nlanes;
 	lane_boot(mock_pop);
@@ -333,6 +337,7 @@ test_mock_pool_allocs(void)
 
 	stats_delete(mock_pop, s);
 	lane_cleanup(mock_pop);
+	tx_params_delete(mock_pop->tx_params);
 	heap_cleanup(&mock_pop->heap);
 
 	FREE(mock_pop->set);
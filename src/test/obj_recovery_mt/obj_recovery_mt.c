@@ -0,0 +1,189 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * obj_recovery_mt.c -- unit test for the multi-threaded pool recovery
+ *
+ * usage: obj_recovery_mt file-name c|o [nthreads]
+ *
+ * The 'c' command creates a pool and exits while many threads are in the
+ * middle of a transaction. The 'o' command opens the pool using the given
+ * number of boot threads, if any, and verifies that all of the transactions
+ * were rolled back.
+ */
+
+#include "unittest.h"
+
+#define LAYOUT "obj_recovery_mt"
+#define NTHREADS 16
+#define NOBJS 64
+#define OBJ_SIZE 128
+#define HUGE_SIZE (1 << 20)
+#define SNAPSHOT_SIZE (1 << 16) /* large enough to extend the undo log */
+#define PATTERN 0xab
+
+struct root {
+	uint64_t counters[NTHREADS];
+	char data[NTHREADS][SNAPSHOT_SIZE];
+	PMEMoid objs[NTHREADS][NOBJS];
+};
+
+static PMEMobjpool *pop;
+static struct root *root;
+
+static os_mutex_t lock;
+static os_cond_t cond;
+static unsigned nready;
+
+/*
+ * crash_worker -- starts a transaction and waits for the process to exit
+ */
+static void *
+crash_worker(void *arg)
+{
+	unsigned idx = (unsigned)(uintptr_t)arg;
+
+	TX_BEGIN(pop) {
+		pmemobj_tx_add_range_direct(&root->counters[idx],
+			sizeof(root->counters[idx]));
+		root->counters[idx] = UINT64_MAX;
+
+		pmemobj_tx_add_range_direct(root->data[idx], SNAPSHOT_SIZE);
+		memset(root->data[idx], ~PATTERN, SNAPSHOT_SIZE);
+
+		pmemobj_tx_free(root->objs[idx][0]);
+		for (unsigned i = 0; i < NOBJS; ++i)
+			pmemobj_tx_alloc(OBJ_SIZE, 0);
+		pmemobj_tx_alloc(HUGE_SIZE, 0);
+
+		pmemobj_persist(pop, root, sizeof(*root));
+
+		os_mutex_lock(&lock);
+		nready++;
+		os_cond_broadcast(&cond);
+
+		/* never woken up, the process exits in the meantime */
+		while (1)
+			os_cond_wait(&cond, &lock);
+	} TX_END
+
+	return NULL;
+}
+
+/*
+ * do_create -- creates the pool and simulates a crash in the middle of many
+ *	concurrent transactions
+ */
+static void
+do_create(const char *path)
+{
+	if ((pop = pmemobj_create(path, LAYOUT, PMEMOBJ_MIN_POOL * 16,
+		S_IWUSR | S_IRUSR)) == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	root = pmemobj_direct(pmemobj_root(pop, sizeof(struct root)));
+
+	for (unsigned i = 0; i < NTHREADS; ++i) {
+		root->counters[i] = i;
+		memset(root->data[i], PATTERN, SNAPSHOT_SIZE);
+		for (unsigned j = 0; j < NOBJS; ++j) {
+			int ret = pmemobj_alloc(pop, &root->objs[i][j],
+				OBJ_SIZE, 0, NULL, NULL);
+			UT_ASSERTeq(ret, 0);
+		}
+	}
+	pmemobj_persist(pop, root, sizeof(*root));
+
+	os_mutex_init(&lock);
+	os_cond_init(&cond);
+
+	os_thread_t threads[NTHREADS];
+	for (unsigned i = 0; i < NTHREADS; ++i)
+		THREAD_CREATE(&threads[i], NULL, crash_worker,
+			(void *)(uintptr_t)i);
+
+	os_mutex_lock(&lock);
+	while (nready != NTHREADS)
+		os_cond_wait(&cond, &lock);
+	os_mutex_unlock(&lock);
+
+	exit(0); /* simulate a crash */
+}
+
+/*
+ * do_open -- opens the pool and verifies its state
+ */
+static void
+do_open(const char *path)
+{
+	if ((pop = pmemobj_open(path, LAYOUT)) == NULL)
+		UT_FATAL("!pmemobj_open: %s", path);
+
+	root = pmemobj_direct(pmemobj_root(pop, sizeof(struct root)));
+
+	for (unsigned i = 0; i < NTHREADS; ++i) {
+		UT_ASSERTeq(root->counters[i], i);
+		for (unsigned j = 0; j < SNAPSHOT_SIZE; ++j)
+			UT_ASSERTeq((unsigned char)root->data[i][j], PATTERN);
+	}
+
+	unsigned nobjs = 0;
+	PMEMoid oid;
+	POBJ_FOREACH(pop, oid)
+		nobjs++;
+	UT_ASSERTeq(nobjs, NTHREADS * NOBJS);
+
+	/* the recovered heap must be usable */
+	for (unsigned i = 0; i < NTHREADS; ++i) {
+		int ret = pmemobj_alloc(pop, &oid, HUGE_SIZE, 0, NULL, NULL);
+		UT_ASSERTeq(ret, 0);
+		pmemobj_free(&oid);
+	}
+
+	for (unsigned i = 0; i < NTHREADS; ++i)
+		for (unsigned j = 0; j < NOBJS; ++j)
+			pmemobj_free(&root->objs[i][j]);
+
+	pmemobj_close(pop);
+
+	UT_ASSERTeq(pmemobj_check(path, LAYOUT), 1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_recovery_mt");
+
+	if (argc < 3 || argc > 4)
+		UT_FATAL("usage: %s file-name c|o [nthreads]", argv[0]);
+
+	const char *path = argv[1];
+
+	if (argv[2][0] == 'c') {
+		do_create(path);
+	} else if (argv[2][0] == 'o') {
+		if (argc == 4) {
+			long long nthreads = -1;
+			int ret = pmemobj_ctl_set(NULL, "heap.boot.nthreads",
+				&nthreads);
+			UT_ASSERTne(ret, 0);
+
+			nthreads = atoll(argv[3]);
+			ret = pmemobj_ctl_set(NULL, "heap.boot.nthreads",
+				&nthreads);
+			UT_ASSERTeq(ret, 0);
+		}
+
+		unsigned nthreads;
+		int ret = pmemobj_ctl_get(NULL, "heap.boot.nthreads",
+			&nthreads);
+		UT_ASSERTeq(ret, 0);
+		UT_OUT("boot threads: %u", nthreads);
+
+		do_open(path);
+	} else {
+		UT_FATAL("invalid command %s", argv[2]);
+	}
+
+	DONE(NULL);
+}
@@ -0,0 +1,355 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * obj_tx_commit_async.c -- unit test for the asynchronous commit of
+ *	transactions
+ *
+ * usage: obj_tx_commit_async file-name
+ */
+
+#include "unittest.h"
+#include "util.h"
+
+#define LAYOUT "obj_tx_commit_async"
+#define NWORKERS 2
+#define NTHREADS 4
+#define NTX 256
+#define QUEUE_DEPTH 4
+#define SNAPSHOT_SIZE (1 << 12)
+#define OBJ_SIZE 64
+#define OBJ_TYPE 1
+
+struct root {
+	uint64_t counters[NTHREADS];
+	PMEMoid objs[NTHREADS];
+	char buf[NTHREADS][SNAPSHOT_SIZE];
+};
+
+static PMEMobjpool *Pop;
+static struct root *Root;
+
+/* the callbacks of the transactions not performed by the committers */
+#define MAIN_IDX NTHREADS
+
+/* durability callbacks received on behalf of each thread */
+static uint64_t Durable[NTHREADS + 1];
+
+/*
+ * durable_cb -- counts the transactions of the thread that became durable
+ */
+static void
+durable_cb(PMEMobjpool *pop, void *arg)
+{
+	UT_ASSERTeq(pop, Pop);
+
+	unsigned idx = (unsigned)(uintptr_t)arg;
+	util_fetch_and_add64(&Durable[idx], 1);
+}
+
+/*
+ * get_durable -- returns the number of callbacks received for the thread
+ */
+static uint64_t
+get_durable(unsigned idx)
+{
+	uint64_t durable;
+	util_atomic_load64(&Durable[idx], &durable);
+
+	return durable;
+}
+
+/*
+ * get_async_commits -- returns the number of transactions committed by
+ *	the workers
+ */
+static uint64_t
+get_async_commits(void)
+{
+	uint64_t async_commits;
+	int ret = pmemobj_ctl_get(Pop, "tx.post_commit.async_commits",
+		&async_commits);
+	UT_ASSERTeq(ret, 0);
+
+	return async_commits;
+}
+
+/*
+ * worker -- runs the post-commit worker until it is stopped
+ */
+static void *
+worker(void *arg)
+{
+	void *unused;
+	int ret = pmemobj_ctl_get(Pop, "tx.post_commit.worker", &unused);
+	UT_ASSERTeq(ret, 0);
+
+	return NULL;
+}
+
+/*
+ * tx_increment -- increments the counter of the thread and replaces its
+ *	object, which was allocated by the previous transaction of the thread,
+ *	in an asynchronously committed transaction
+ */
+static void
+tx_increment(unsigned idx)
+{
+	TX_BEGIN(Pop) {
+		pmemobj_tx_add_range_direct(&Root->counters[idx],
+			sizeof(Root->counters[idx]));
+		pmemobj_tx_add_range_direct(Root->buf[idx], SNAPSHOT_SIZE);
+		pmemobj_tx_add_range_direct(&Root->objs[idx],
+			sizeof(Root->objs[idx]));
+
+		Root->counters[idx]++;
+		memset(Root->buf[idx], (int)Root->counters[idx], SNAPSHOT_SIZE);
+
+		pmemobj_tx_free(Root->objs[idx]);
+		Root->objs[idx] = pmemobj_tx_alloc(OBJ_SIZE, OBJ_TYPE);
+
+		pmemobj_tx_commit_async(durable_cb, (void *)(uintptr_t)idx);
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+}
+
+/*
+ * committer -- performs the transactions of the thread
+ */
+static void *
+committer(void *arg)
+{
+	unsigned idx = (unsigned)(uintptr_t)arg;
+
+	for (unsigned i = 0; i < NTX; ++i)
+		tx_increment(idx);
+
+	return NULL;
+}
+
+/*
+ * check_root -- verifies the state of the root object
+ */
+static void
+check_root(uint64_t expected)
+{
+	for (unsigned i = 0; i < NTHREADS; ++i) {
+		UT_ASSERTeq(Root->counters[i], expected);
+		for (unsigned j = 0; j < SNAPSHOT_SIZE; ++j)
+			UT_ASSERTeq(Root->buf[i][j], (char)expected);
+	}
+
+	/* only the object of the last transaction of each thread is left */
+	unsigned nobjs = 0;
+	PMEMoid oid;
+	POBJ_FOREACH(Pop, oid) {
+		if (pmemobj_type_num(oid) == OBJ_TYPE)
+			nobjs++;
+	}
+	UT_ASSERTeq(nobjs, NTHREADS);
+}
+
+/*
+ * test_inline -- without the workers the transaction is durable before the
+ *	commit returns
+ */
+static void
+test_inline(void)
+{
+	for (unsigned i = 0; i < NTHREADS; ++i) {
+		tx_increment(i);
+		UT_ASSERTeq(get_durable(i), 1);
+	}
+
+	UT_ASSERTeq(get_async_commits(), 0);
+}
+
+/*
+ * test_nested -- the callbacks of nested transactions are called once the
+ *	outermost transaction is durable, and never if it's aborted
+ */
+static void
+test_nested(void)
+{
+	TX_BEGIN(Pop) {
+		TX_BEGIN(Pop) {
+			pmemobj_tx_add_range_direct(&Root->counters[0],
+				sizeof(Root->counters[0]));
+			Root->counters[0]++;
+			pmemobj_tx_commit_async(durable_cb, (void *)0);
+		} TX_END
+
+		pmemobj_tx_abort(ECANCELED);
+	} TX_ONCOMMIT {
+		UT_ASSERT(0);
+	} TX_END
+
+	UT_ASSERTeq(get_durable(0), 1);
+
+	TX_BEGIN(Pop) {
+		TX_BEGIN(Pop) {
+			pmemobj_tx_commit_async(durable_cb, (void *)1);
+		} TX_END
+
+		UT_ASSERTeq(get_durable(1), 1);
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+
+	UT_ASSERTeq(get_durable(1), 2);
+}
+
+/*
+ * test_shadow -- the shadow copies are written to the pool before the commit
+ *	returns
+ */
+static void
+test_shadow(void)
+{
+	TX_BEGIN(Pop) {
+		char *buf = pmemobj_tx_shadow_range_direct(Root->buf[0],
+			SNAPSHOT_SIZE);
+		UT_ASSERTne(buf, NULL);
+		memcpy(buf, Root->buf[0], SNAPSHOT_SIZE);
+		buf[0]++;
+
+		pmemobj_tx_commit_async(durable_cb, (void *)MAIN_IDX);
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+
+	UT_ASSERTeq(Root->buf[0][0], (char)(Root->buf[0][1] + 1));
+
+	TX_BEGIN(Pop) {
+		pmemobj_tx_add_range_direct(Root->buf[0], 1);
+		Root->buf[0][0]--;
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+}
+
+/*
+ * test_ordered -- the ranges modified by an asynchronously committed
+ *	transaction are snapshotted, and its objects freed, only once it's
+ *	durable
+ */
+static void
+test_ordered(void)
+{
+	uint64_t async_commits = get_async_commits();
+	PMEMoid oid = OID_NULL;
+
+	TX_BEGIN(Pop) {
+		pmemobj_tx_add_range_direct(&Root->counters[0],
+			sizeof(Root->counters[0]));
+		Root->counters[0]++;
+
+		oid = pmemobj_tx_alloc(OBJ_SIZE, OBJ_TYPE + 1);
+
+		pmemobj_tx_commit_async(durable_cb, (void *)MAIN_IDX);
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+
+	TX_BEGIN(Pop) {
+		pmemobj_tx_add_range_direct(&Root->counters[0],
+			sizeof(Root->counters[0]));
+		UT_ASSERTeq(get_async_commits(), async_commits + 1);
+
+		Root->counters[0]--;
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+
+	pmemobj_free(&oid);
+	UT_ASSERT(OID_IS_NULL(oid));
+
+	PMEMoid o;
+	POBJ_FOREACH(Pop, o)
+		UT_ASSERTne(pmemobj_type_num(o), OBJ_TYPE + 1);
+}
+
+/*
+ * test_workers -- the transactions are completed by the post-commit workers
+ *	while many threads commit at once
+ */
+static void
+test_workers(void)
+{
+	os_thread_t workers[NWORKERS];
+	for (unsigned i = 0; i < NWORKERS; ++i)
+		THREAD_CREATE(&workers[i], NULL, worker, NULL);
+
+	uint64_t durable[NTHREADS + 1];
+	for (unsigned i = 0; i <= NTHREADS; ++i)
+		durable[i] = get_durable(i);
+
+	os_thread_t threads[NTHREADS];
+	for (unsigned i = 0; i < NTHREADS; ++i)
+		THREAD_CREATE(&threads[i], NULL, committer,
+			(void *)(uintptr_t)i);
+
+	for (unsigned i = 0; i < NTHREADS; ++i)
+		THREAD_JOIN(&threads[i], NULL);
+
+	test_shadow();
+	test_ordered();
+
+	void *unused;
+	int ret = pmemobj_ctl_get(Pop, "tx.post_commit.stop", &unused);
+	UT_ASSERTeq(ret, 0);
+
+	for (unsigned i = 0; i < NWORKERS; ++i)
+		THREAD_JOIN(&workers[i], NULL);
+
+	/* every commit is reported once the workers are stopped */
+	for (unsigned i = 0; i < NTHREADS; ++i)
+		UT_ASSERTeq(get_durable(i), durable[i] + NTX);
+	UT_ASSERTeq(get_durable(MAIN_IDX), durable[MAIN_IDX] + 2);
+
+	uint64_t async_commits = get_async_commits();
+	UT_ASSERTne(async_commits, 0);
+	UT_ASSERT(async_commits <= NTHREADS * NTX + 2);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_tx_commit_async");
+
+	if (argc != 2)
+		UT_FATAL("usage: %s file-name", argv[0]);
+
+	const char *path = argv[1];
+
+	Pop = pmemobj_create(path, LAYOUT, PMEMOBJ_MIN_POOL * 4,
+		S_IWUSR | S_IRUSR);
+	if (Pop == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	Root = pmemobj_direct(pmemobj_root(Pop, sizeof(struct root)));
+
+	int depth = QUEUE_DEPTH;
+	int ret = pmemobj_ctl_set(Pop, "tx.post_commit.queue_depth", &depth);
+	UT_ASSERTeq(ret, 0);
+
+	test_inline();
+	test_nested();
+	test_workers();
+
+	check_root(NTX + 1);
+
+	pmemobj_close(Pop);
+
+	/* the reported transactions must not be rolled back by recovery */
+	Pop = pmemobj_open(path, LAYOUT);
+	UT_ASSERTne(Pop, NULL);
+
+	Root = pmemobj_direct(pmemobj_root(Pop, sizeof(struct root)));
+	check_root(NTX + 1);
+
+	pmemobj_close(Pop);
+
+	DONE(NULL);
+}
@@ -0,0 +1,212 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * obj_tx_group_commit.c -- tests for the transaction group commit
+ *
+ * usage: obj_tx_group_commit file-name
+ */
+
+#include "unittest.h"
+
+#define LAYOUT "obj_tx_group_commit"
+#define NTHREADS 8
+#define NTX 128
+#define WINDOW 100 /* microseconds */
+#define WINDOW_MAX 1000000 /* microseconds */
+#define BUF_SIZE 4096
+
+struct root {
+	uint64_t counters[NTHREADS];
+	char buf[NTHREADS][BUF_SIZE];
+};
+
+static PMEMobjpool *pop;
+static struct root *root;
+
+/*
+ * tx_increment -- increments the counter of the thread in a transaction
+ */
+static void
+tx_increment(unsigned idx)
+{
+	TX_BEGIN(pop) {
+		pmemobj_tx_add_range_direct(&root->counters[idx],
+			sizeof(root->counters[idx]));
+		pmemobj_tx_add_range_direct(root->buf[idx], BUF_SIZE);
+
+		root->counters[idx]++;
+		memset(root->buf[idx], (int)root->counters[idx], BUF_SIZE);
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+}
+
+/*
+ * committer -- performs transactions on the counter of the thread
+ */
+static void *
+committer(void *arg)
+{
+	unsigned idx = (unsigned)(uintptr_t)arg;
+
+	for (unsigned i = 0; i < NTX; ++i)
+		tx_increment(idx);
+
+	return NULL;
+}
+
+/*
+ * check_counters -- verifies the state of the root object
+ */
+static void
+check_counters(uint64_t expected)
+{
+	for (unsigned i = 0; i < NTHREADS; ++i) {
+		UT_ASSERTeq(root->counters[i], expected);
+		for (unsigned j = 0; j < BUF_SIZE; ++j)
+			UT_ASSERTeq(root->buf[i][j], (char)expected);
+	}
+}
+
+/*
+ * elapsed_ms -- returns the number of milliseconds since start
+ */
+static uint64_t
+elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+	os_clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)((now.tv_sec - start->tv_sec) * 1000 +
+		(now.tv_nsec - start->tv_nsec) / 1000000);
+}
+
+/*
+ * get_stats -- reads the group commit statistics
+ */
+static void
+get_stats(uint64_t *groups, uint64_t *commits)
+{
+	int ret = pmemobj_ctl_get(pop, "tx.group_commit.groups", groups);
+	UT_ASSERTeq(ret, 0);
+	ret = pmemobj_ctl_get(pop, "tx.group_commit.commits", commits);
+	UT_ASSERTeq(ret, 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_tx_group_commit");
+
+	if (argc != 2)
+		UT_FATAL("usage: %s file-name", argv[0]);
+
+	const char *path = argv[1];
+
+	if ((pop = pmemobj_create(path, LAYOUT, PMEMOBJ_MIN_POOL * 4,
+		S_IWUSR | S_IRUSR)) == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	PMEMoid oid = pmemobj_root(pop, sizeof(struct root));
+	root = pmemobj_direct(oid);
+
+	long long window = -1;
+	int ret = pmemobj_ctl_get(pop, "tx.group_commit.window", &window);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(window, 0);
+
+	window = -1;
+	ret = pmemobj_ctl_set(pop, "tx.group_commit.window", &window);
+	UT_ASSERTne(ret, 0);
+	window = 1LL << 40;
+	ret = pmemobj_ctl_set(pop, "tx.group_commit.window", &window);
+	UT_ASSERTne(ret, 0);
+
+	/* group commit is disabled by default */
+	tx_increment(0);
+	uint64_t groups;
+	uint64_t commits;
+	get_stats(&groups, &commits);
+	UT_ASSERTeq(groups, 0);
+	UT_ASSERTeq(commits, 0);
+
+	window = WINDOW;
+	ret = pmemobj_ctl_set(pop, "tx.group_commit.window", &window);
+	UT_ASSERTeq(ret, 0);
+
+	/* a lone transaction forms a group of its own */
+	tx_increment(0);
+	get_stats(&groups, &commits);
+	UT_ASSERTeq(groups, 1);
+	UT_ASSERTeq(commits, 1);
+
+	/* a lone transaction doesn't wait for the window to pass */
+	window = WINDOW_MAX;
+	ret = pmemobj_ctl_set(pop, "tx.group_commit.window", &window);
+	UT_ASSERTeq(ret, 0);
+
+	struct timespec start;
+	os_clock_gettime(CLOCK_MONOTONIC, &start);
+	tx_increment(0);
+	UT_ASSERT(elapsed_ms(&start) < WINDOW_MAX / 1000 / 2);
+
+	get_stats(&groups, &commits);
+	UT_ASSERTeq(groups, 2);
+	UT_ASSERTeq(commits, 2);
+
+	window = WINDOW;
+	ret = pmemobj_ctl_set(pop, "tx.group_commit.window", &window);
+	UT_ASSERTeq(ret, 0);
+
+	/* bring all counters to the same value */
+	for (unsigned i = 1; i < NTHREADS; ++i) {
+		while (root->counters[i] != root->counters[0])
+			tx_increment(i);
+	}
+	uint64_t base = root->counters[0];
+
+	get_stats(&groups, &commits);
+	uint64_t groups_before = groups;
+	uint64_t commits_before = commits;
+
+	os_thread_t threads[NTHREADS];
+	for (unsigned i = 0; i < NTHREADS; ++i)
+		THREAD_CREATE(&threads[i], NULL, committer,
+			(void *)(uintptr_t)i);
+
+	for (unsigned i = 0; i < NTHREADS; ++i)
+		THREAD_JOIN(&threads[i], NULL);
+
+	check_counters(base + NTX);
+
+	get_stats(&groups, &commits);
+	UT_ASSERTeq(commits - commits_before, NTHREADS * NTX);
+	UT_ASSERT(groups > groups_before);
+	UT_ASSERT(groups - groups_before <= NTHREADS * NTX);
+
+	/* disabling the group commit stops the accounting */
+	window = 0;
+	ret = pmemobj_ctl_set(pop, "tx.group_commit.window", &window);
+	UT_ASSERTeq(ret, 0);
+
+	for (unsigned i = 0; i < NTHREADS; ++i)
+		tx_increment(i);
+
+	uint64_t commits_after;
+	get_stats(&groups, &commits_after);
+	UT_ASSERTeq(commits_after, commits);
+
+	pmemobj_close(pop);
+
+	/* committed transactions must not be rolled back by the recovery */
+	pop = pmemobj_open(path, LAYOUT);
+	UT_ASSERTne(pop, NULL);
+
+	root = pmemobj_direct(pmemobj_root(pop, sizeof(struct root)));
+	check_counters(base + NTX + 1);
+
+	pmemobj_close(pop);
+
+	DONE(NULL);
+}
@@ -0,0 +1,18 @@
+#!../env.py
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright 2020, Intel Corporation
+#
+
+from os import path
+import testframework as t
+
+
+# the pages are snapshotted eagerly under Valgrind and on Windows
+@t.windows_exclude
+@t.require_valgrind_disabled('memcheck', 'pmemcheck', 'helgrind', 'drd')
+class TEST0(t.BaseTest):
+    test_type = t.Medium
+
+    def run(self, ctx):
+        testfile = path.join(ctx.testdir, 'testfile0')
+        ctx.exec('obj_tx_lazy_snapshot', testfile)
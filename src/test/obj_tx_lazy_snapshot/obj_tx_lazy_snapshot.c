@@ -0,0 +1,305 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * obj_tx_lazy_snapshot.c -- unit test for the ranges snapshotted on the
+ *	first write to their pages
+ *
+ * usage: obj_tx_lazy_snapshot file-name
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "unittest.h"
+
+#define LAYOUT_NAME "tx_lazy_snapshot"
+
+#define NPAGES 64
+#define DATA_SIZE (NPAGES * Ut_pagesize)
+
+/*
+ * get_lazy_pages -- reads the number of pages snapshotted on write
+ */
+static uint64_t
+get_lazy_pages(PMEMobjpool *pop)
+{
+	uint64_t pages;
+	int ret = pmemobj_ctl_get(pop, "stats.tx.lazy_pages", &pages);
+	UT_ASSERTeq(ret, 0);
+
+	return pages;
+}
+
+/*
+ * check_range -- verifies that all bytes of the range are equal to c
+ */
+static void
+check_range(const char *p, size_t size, char c)
+{
+	for (size_t i = 0; i < size; ++i)
+		UT_ASSERTeq(p[i], c);
+}
+
+/*
+ * page_of -- returns the first page-aligned address in the data plus n pages
+ */
+static char *
+page_of(char *data, size_t n)
+{
+	uintptr_t p = ALIGN_UP((uintptr_t)data, Ut_pagesize);
+	return (char *)p + n * Ut_pagesize;
+}
+
+/*
+ * test_commit -- only the written pages are snapshotted and the others
+ *	become writable again after commit
+ */
+static void
+test_commit(PMEMobjpool *pop)
+{
+	PMEMoid root = pmemobj_root(pop, DATA_SIZE);
+	char *data = pmemobj_direct(root);
+
+	uint64_t pages = get_lazy_pages(pop);
+
+	TX_BEGIN(pop) {
+		pmemobj_tx_xadd_range(root, 0, DATA_SIZE,
+			POBJ_XADD_LAZY_SNAPSHOT);
+
+		/* reads don't snapshot anything */
+		check_range(data, DATA_SIZE, 0);
+
+		page_of(data, 1)[0] = 'a';
+		page_of(data, 1)[Ut_pagesize - 1] = 'a';
+		memset(page_of(data, 5), 'a', 2 * Ut_pagesize);
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+
+	UT_ASSERTeq(get_lazy_pages(pop), pages + 3);
+
+	UT_ASSERTeq(page_of(data, 1)[0], 'a');
+	UT_ASSERTeq(page_of(data, 1)[Ut_pagesize - 1], 'a');
+	check_range(page_of(data, 5), 2 * Ut_pagesize, 'a');
+	check_range(page_of(data, 7), Ut_pagesize, 0);
+
+	/* the untouched pages are writable outside of the transaction */
+	pmemobj_memset_persist(pop, data, 'b', DATA_SIZE);
+}
+
+/*
+ * test_abort -- the written pages are restored, including the partial pages
+ *	at the ends of the range, which are snapshotted right away
+ */
+static void
+test_abort(PMEMobjpool *pop)
+{
+	PMEMoid root = pmemobj_root(pop, DATA_SIZE);
+	char *data = pmemobj_direct(root);
+
+	/* the object begins and ends in the middle of a page */
+	UT_ASSERTne((uintptr_t)data % Ut_pagesize, 0);
+
+	uint64_t pages = get_lazy_pages(pop);
+
+	TX_BEGIN(pop) {
+		pmemobj_tx_xadd_range_direct(data, DATA_SIZE,
+			POBJ_XADD_LAZY_SNAPSHOT);
+
+		data[0] = 'c';
+		data[DATA_SIZE - 1] = 'c';
+		memset(page_of(data, 10), 'c', Ut_pagesize);
+		memset(page_of(data, 20), 'c', 10);
+
+		pmemobj_tx_abort(ECANCELED);
+	} TX_ONCOMMIT {
+		UT_ASSERT(0);
+	} TX_END
+
+	UT_ASSERTeq(get_lazy_pages(pop), pages + 2);
+
+	check_range(data, DATA_SIZE, 'b');
+}
+
+/*
+ * test_overlap -- mixes the lazily snapshotted ranges with the regular ones
+ *	and with each other
+ */
+static void
+test_overlap(PMEMobjpool *pop)
+{
+	PMEMoid root = pmemobj_root(pop, DATA_SIZE);
+	char *data = pmemobj_direct(root);
+
+	uint64_t pages = get_lazy_pages(pop);
+
+	TX_BEGIN(pop) {
+		/* modified before the pages are protected */
+		char *p = page_of(data, 2);
+		pmemobj_tx_add_range_direct(p + 100, 100);
+		memset(p + 100, 'd', 100);
+
+		pmemobj_tx_xadd_range_direct(page_of(data, 0),
+			8 * Ut_pagesize, POBJ_XADD_LAZY_SNAPSHOT);
+		pmemobj_tx_xadd_range_direct(page_of(data, 4),
+			8 * Ut_pagesize, POBJ_XADD_LAZY_SNAPSHOT);
+
+		/* snapshotted regularly while the page is protected */
+		p = page_of(data, 3);
+		pmemobj_tx_add_range_direct(p, 100);
+		memset(p, 'd', Ut_pagesize);
+
+		memset(page_of(data, 2), 'd', Ut_pagesize);
+		memset(page_of(data, 6), 'd', Ut_pagesize);
+		memset(page_of(data, 11), 'd', Ut_pagesize);
+
+		/* the page is already snapshotted, so it isn't protected */
+		TX_BEGIN(pop) {
+			pmemobj_tx_xadd_range_direct(page_of(data, 11),
+				Ut_pagesize, POBJ_XADD_LAZY_SNAPSHOT);
+			memset(page_of(data, 11), 'e', Ut_pagesize);
+		} TX_ONABORT {
+			UT_ASSERT(0);
+		} TX_END
+
+		check_range(page_of(data, 11), Ut_pagesize, 'e');
+
+		pmemobj_tx_abort(ECANCELED);
+	} TX_ONCOMMIT {
+		UT_ASSERT(0);
+	} TX_END
+
+	UT_ASSERTeq(get_lazy_pages(pop), pages + 4);
+
+	check_range(data, DATA_SIZE, 'b');
+}
+
+/*
+ * test_flags -- the other flags of the range apply to the pages snapshotted
+ *	on write, and ranges smaller than a page are snapshotted right away
+ */
+static void
+test_flags(PMEMobjpool *pop)
+{
+	PMEMoid root = pmemobj_root(pop, DATA_SIZE);
+	char *data = pmemobj_direct(root);
+
+	uint64_t pages = get_lazy_pages(pop);
+
+	TX_BEGIN(pop) {
+		pmemobj_tx_xadd_range_direct(page_of(data, 0), Ut_pagesize / 2,
+			POBJ_XADD_LAZY_SNAPSHOT);
+		memset(page_of(data, 0), 'f', Ut_pagesize / 2);
+
+		/* nothing to snapshot, so nothing to protect */
+		pmemobj_tx_xadd_range_direct(page_of(data, 1), Ut_pagesize,
+			POBJ_XADD_LAZY_SNAPSHOT | POBJ_XADD_NO_SNAPSHOT);
+		memset(page_of(data, 1), 'f', Ut_pagesize);
+
+		pmemobj_tx_xadd_range_direct(page_of(data, 2), Ut_pagesize,
+			POBJ_XADD_LAZY_SNAPSHOT | POBJ_XADD_NO_FLUSH);
+		memset(page_of(data, 2), 'f', Ut_pagesize);
+		pmemobj_persist(pop, page_of(data, 2), Ut_pagesize);
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+
+	UT_ASSERTeq(get_lazy_pages(pop), pages + 1);
+
+	check_range(page_of(data, 0), Ut_pagesize / 2, 'f');
+	check_range(page_of(data, 1), 2 * Ut_pagesize, 'f');
+}
+
+/*
+ * test_fail -- the page which cannot be snapshotted is made writable again
+ *	by the abort, even if the transaction doesn't jump out of the handler
+ */
+static void
+test_fail(PMEMobjpool *pop)
+{
+	PMEMoid root = pmemobj_root(pop, DATA_SIZE);
+	char *data = pmemobj_direct(root);
+
+	uint64_t pages = get_lazy_pages(pop);
+
+	int ret = pmemobj_tx_begin(pop, NULL, TX_PARAM_NONE);
+	UT_ASSERTeq(ret, 0);
+
+	/*
+	 * The snapshot of a page doesn't fit in the undo log of the lane,
+	 * which wasn't extended by any of the previous transactions.
+	 */
+	ret = pmemobj_tx_log_auto_alloc(TX_LOG_TYPE_SNAPSHOT, 0);
+	UT_ASSERTeq(ret, 0);
+
+	ret = pmemobj_tx_xadd_range_direct(page_of(data, 4), 4 * Ut_pagesize,
+		POBJ_XADD_LAZY_SNAPSHOT);
+	UT_ASSERTeq(ret, 0);
+
+	/* the write isn't repeated forever nor passed on to the default */
+	page_of(data, 5)[0] = 'g';
+	UT_ASSERTeq(pmemobj_tx_stage(), TX_STAGE_ONABORT);
+	UT_ASSERTeq(page_of(data, 5)[0], 'g');
+
+	ret = pmemobj_tx_end();
+	UT_ASSERTne(ret, 0);
+
+	UT_ASSERTeq(get_lazy_pages(pop), pages);
+
+	/* none of the pages is left protected */
+	pmemobj_memset_persist(pop, page_of(data, 4), 0, 4 * Ut_pagesize);
+}
+
+/*
+ * test_reopen -- verifies that the lazily snapshotted pages are committed
+ */
+static PMEMobjpool *
+test_reopen(PMEMobjpool *pop, const char *path)
+{
+	pmemobj_close(pop);
+
+	pop = pmemobj_open(path, LAYOUT_NAME);
+	if (pop == NULL)
+		UT_FATAL("!pmemobj_open: %s", path);
+
+	PMEMoid root = pmemobj_root(pop, DATA_SIZE);
+	char *data = pmemobj_direct(root);
+
+	check_range(page_of(data, 0), Ut_pagesize / 2, 'f');
+	check_range(page_of(data, 1), 2 * Ut_pagesize, 'f');
+	check_range(page_of(data, 3), Ut_pagesize, 'b');
+
+	return pop;
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_tx_lazy_snapshot");
+
+	if (argc != 2)
+		UT_FATAL("usage: %s file-name", argv[0]);
+
+	const char *path = argv[1];
+
+	PMEMobjpool *pop = pmemobj_create(path, LAYOUT_NAME,
+		PMEMOBJ_MIN_POOL * 4, S_IWUSR | S_IRUSR);
+	if (pop == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	int enabled = 1;
+	int ret = pmemobj_ctl_set(pop, "stats.enabled", &enabled);
+	UT_ASSERTeq(ret, 0);
+
+	test_fail(pop);
+	test_commit(pop);
+	test_abort(pop);
+	test_overlap(pop);
+	test_flags(pop);
+	pop = test_reopen(pop, path);
+
+	pmemobj_close(pop);
+
+	DONE(NULL);
+}
@@ -0,0 +1,206 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * obj_tx_log_retain.c -- tests for the tx.log ctl namespace
+ *
+ * usage: obj_tx_log_retain file-name
+ *
+ * Verifies that the logs allocated to extend the undo log of a lane are kept
+ * for the following transactions once enabled, within the configured limit,
+ * and that they are released as their learned usage decays.
+ */
+
+#include "unittest.h"
+
+#define LAYOUT "obj_tx_log_retain"
+#define OBJ_SIZE (1 << 20)
+#define LARGE_TX (1 << 19)
+#define SMALL_TX 64
+#define MB (1 << 20)
+
+static PMEMobjpool *Pop;
+static PMEMoid Obj;
+
+/*
+ * get_stat -- reads the value of one of the tx statistics
+ */
+static uint64_t
+get_stat(const char *name)
+{
+	char query[128];
+	SNPRINTF(query, sizeof(query), "stats.tx.%s", name);
+
+	uint64_t value;
+	int ret = pmemobj_ctl_get(Pop, query, &value);
+	UT_ASSERTeq(ret, 0);
+
+	return value;
+}
+
+/*
+ * set_retain -- sets the log retain parameters and reads them back
+ */
+static void
+set_retain(long long max, int decay)
+{
+	int ret = pmemobj_ctl_set(Pop, "tx.log.retain_max", &max);
+	UT_ASSERTeq(ret, 0);
+
+	ret = pmemobj_ctl_set(Pop, "tx.log.retain_decay", &decay);
+	UT_ASSERTeq(ret, 0);
+
+	long long max_out;
+	ret = pmemobj_ctl_get(Pop, "tx.log.retain_max", &max_out);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(max_out, max);
+
+	int decay_out;
+	ret = pmemobj_ctl_get(Pop, "tx.log.retain_decay", &decay_out);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(decay_out, decay);
+}
+
+/*
+ * run_tx -- snapshots the given number of bytes of the object in a
+ *	transaction and returns the number of logs allocated by it
+ */
+static uint64_t
+run_tx(size_t size)
+{
+	uint64_t extends = get_stat("log_extends");
+
+	TX_BEGIN(Pop) {
+		pmemobj_tx_add_range(Obj, 0, size);
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+
+	return get_stat("log_extends") - extends;
+}
+
+/*
+ * test_default -- the logs are allocated by every large transaction
+ */
+static void
+test_default(void)
+{
+	run_tx(LARGE_TX);
+
+	uint64_t frees = get_stat("log_frees");
+	uint64_t extends = run_tx(LARGE_TX);
+	UT_ASSERT(extends > 0);
+	UT_ASSERTeq(get_stat("log_frees") - frees, extends);
+}
+
+/*
+ * test_retain -- the logs of a large transaction are reused by the
+ *	following ones
+ */
+static void
+test_retain(void)
+{
+	set_retain(MB, 0);
+
+	run_tx(LARGE_TX);
+
+	uint64_t frees = get_stat("log_frees");
+	for (int i = 0; i < 3; ++i) {
+		UT_ASSERTeq(run_tx(LARGE_TX), 0);
+		UT_ASSERTeq(run_tx(SMALL_TX), 0);
+	}
+	UT_ASSERTeq(get_stat("log_frees"), frees);
+}
+
+/*
+ * test_decay -- the logs are released once small transactions make the
+ *	learned usage decay, and allocated again when needed
+ */
+static void
+test_decay(void)
+{
+	set_retain(MB, 50);
+
+	uint64_t frees = get_stat("log_frees");
+	for (int i = 0; i < 64; ++i)
+		run_tx(SMALL_TX);
+	UT_ASSERT(get_stat("log_frees") > frees);
+
+	UT_ASSERT(run_tx(LARGE_TX) > 0);
+	UT_ASSERTeq(run_tx(LARGE_TX), 0);
+}
+
+/*
+ * test_limit -- only the logs which fit in the maximum capacity are
+ *	retained
+ */
+static void
+test_limit(void)
+{
+	set_retain(0, 0);
+	run_tx(SMALL_TX);
+	uint64_t unlimited = run_tx(LARGE_TX);
+
+	set_retain(LARGE_TX / 4, 0);
+	run_tx(LARGE_TX);
+
+	uint64_t limited = run_tx(LARGE_TX);
+	UT_ASSERT(limited > 0);
+	UT_ASSERT(limited < unlimited);
+
+	/* disabling the retention releases the logs */
+	set_retain(0, 0);
+	uint64_t frees = get_stat("log_frees");
+	run_tx(SMALL_TX);
+	UT_ASSERT(get_stat("log_frees") > frees);
+}
+
+/*
+ * test_invalid -- the parameters outside of their ranges are rejected
+ */
+static void
+test_invalid(void)
+{
+	long long max = -1;
+	int ret = pmemobj_ctl_set(Pop, "tx.log.retain_max", &max);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+
+	int decay = 101;
+	ret = pmemobj_ctl_set(Pop, "tx.log.retain_decay", &decay);
+	UT_ASSERTeq(ret, -1);
+	UT_ASSERTeq(errno, EINVAL);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_tx_log_retain");
+
+	if (argc != 2)
+		UT_FATAL("usage: %s file-name", argv[0]);
+
+	const char *path = argv[1];
+
+	Pop = pmemobj_create(path, LAYOUT, PMEMOBJ_MIN_POOL * 4,
+		S_IWUSR | S_IRUSR);
+	if (Pop == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	int enabled = 1;
+	int ret = pmemobj_ctl_set(Pop, "stats.enabled", &enabled);
+	UT_ASSERTeq(ret, 0);
+
+	ret = pmemobj_zalloc(Pop, &Obj, OBJ_SIZE, 0);
+	UT_ASSERTeq(ret, 0);
+
+	test_default();
+	test_retain();
+	test_decay();
+	test_limit();
+	test_invalid();
+
+	pmemobj_close(Pop);
+
+	DONE(NULL);
+}
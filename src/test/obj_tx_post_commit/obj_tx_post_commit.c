@@ -0,0 +1,248 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * obj_tx_post_commit.c -- tests for the asynchronous post-commit workers
+ *
+ * usage: obj_tx_post_commit file-name
+ */
+
+#include "unittest.h"
+
+#define LAYOUT "obj_tx_post_commit"
+#define NWORKERS 2
+#define NTHREADS 8
+#define NTX 256
+#define QUEUE_DEPTH 4
+#define MAX_ATTEMPTS 1000000
+#define SNAPSHOT_SIZE (1 << 14) /* large enough to extend the undo log */
+
+struct root {
+	uint64_t counters[NTHREADS];
+	char buf[NTHREADS][SNAPSHOT_SIZE];
+};
+
+static PMEMobjpool *pop;
+static struct root *root;
+
+/*
+ * worker -- runs the post-commit worker until it is stopped
+ */
+static void *
+worker(void *arg)
+{
+	void *unused;
+	int ret = pmemobj_ctl_get(pop, "tx.post_commit.worker", &unused);
+	UT_ASSERTeq(ret, 0);
+
+	return NULL;
+}
+
+/*
+ * tx_increment -- increments the counter of the thread in a transaction
+ *	that also snapshots a large buffer and allocates an object
+ */
+static void
+tx_increment(unsigned idx)
+{
+	TX_BEGIN(pop) {
+		pmemobj_tx_add_range_direct(&root->counters[idx],
+			sizeof(root->counters[idx]));
+		pmemobj_tx_add_range_direct(root->buf[idx], SNAPSHOT_SIZE);
+
+		root->counters[idx]++;
+		memset(root->buf[idx], (int)root->counters[idx], SNAPSHOT_SIZE);
+
+		PMEMoid oid = pmemobj_tx_alloc(64, 0);
+		pmemobj_tx_free(oid);
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+}
+
+/*
+ * tx_user_buffer -- increments the counter in a transaction with a buffer
+ *	appended to the undo log, the buffer is freed right after
+ */
+static void
+tx_user_buffer(unsigned idx)
+{
+	size_t sizes[] = {sizeof(root->counters[idx]), SNAPSHOT_SIZE};
+	size_t size = pmemobj_tx_log_snapshots_max_size(sizes, 2);
+
+	PMEMoid buf;
+	int ret = pmemobj_alloc(pop, &buf, size, 0, NULL, NULL);
+	UT_ASSERTeq(ret, 0);
+
+	TX_BEGIN(pop) {
+		pmemobj_tx_log_append_buffer(TX_LOG_TYPE_SNAPSHOT,
+			pmemobj_direct(buf), size);
+		pmemobj_tx_add_range_direct(&root->counters[idx],
+			sizeof(root->counters[idx]));
+		pmemobj_tx_add_range_direct(root->buf[idx], SNAPSHOT_SIZE);
+
+		root->counters[idx]++;
+		memset(root->buf[idx], (int)root->counters[idx], SNAPSHOT_SIZE);
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+
+	pmemobj_free(&buf);
+}
+
+/*
+ * committer -- performs transactions on the counter of the thread
+ */
+static void *
+committer(void *arg)
+{
+	unsigned idx = (unsigned)(uintptr_t)arg;
+
+	for (unsigned i = 0; i < NTX; ++i)
+		tx_increment(idx);
+
+	return NULL;
+}
+
+/*
+ * check_counters -- verifies the state of the root object
+ */
+static void
+check_counters(uint64_t expected)
+{
+	for (unsigned i = 0; i < NTHREADS; ++i) {
+		UT_ASSERTeq(root->counters[i], expected);
+		for (unsigned j = 0; j < SNAPSHOT_SIZE; ++j)
+			UT_ASSERTeq(root->buf[i][j], (char)expected);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_tx_post_commit");
+
+	if (argc != 2)
+		UT_FATAL("usage: %s file-name", argv[0]);
+
+	const char *path = argv[1];
+
+	if ((pop = pmemobj_create(path, LAYOUT, PMEMOBJ_MIN_POOL * 4,
+		S_IWUSR | S_IRUSR)) == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	PMEMoid oid = pmemobj_root(pop, sizeof(struct root));
+	root = pmemobj_direct(oid);
+
+	int depth = -1;
+	int ret = pmemobj_ctl_get(pop, "tx.post_commit.queue_depth", &depth);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(depth, 0);
+
+	depth = -1;
+	ret = pmemobj_ctl_set(pop, "tx.post_commit.queue_depth", &depth);
+	UT_ASSERTne(ret, 0);
+	depth = 1 << 20;
+	ret = pmemobj_ctl_set(pop, "tx.post_commit.queue_depth", &depth);
+	UT_ASSERTne(ret, 0);
+
+	depth = QUEUE_DEPTH;
+	ret = pmemobj_ctl_set(pop, "tx.post_commit.queue_depth", &depth);
+	UT_ASSERTeq(ret, 0);
+
+	/* without workers the cleanup is done inline */
+	tx_increment(0);
+	uint64_t queued;
+	ret = pmemobj_ctl_get(pop, "tx.post_commit.queued", &queued);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(queued, 0);
+
+	os_thread_t workers[NWORKERS];
+	for (unsigned i = 0; i < NWORKERS; ++i)
+		THREAD_CREATE(&workers[i], NULL, worker, NULL);
+
+	/* wait for the workers to pick up the post-commit work */
+	for (unsigned i = 0; queued == 0 && i < MAX_ATTEMPTS; ++i) {
+		tx_increment(0);
+		ret = pmemobj_ctl_get(pop, "tx.post_commit.queued", &queued);
+		UT_ASSERTeq(ret, 0);
+	}
+	UT_ASSERTne(queued, 0);
+
+	/* bring all counters to the same value */
+	for (unsigned i = 1; i < NTHREADS; ++i) {
+		while (root->counters[i] != root->counters[0])
+			tx_increment(i);
+	}
+	uint64_t base = root->counters[0];
+
+	os_thread_t threads[NTHREADS];
+	for (unsigned i = 0; i < NTHREADS; ++i)
+		THREAD_CREATE(&threads[i], NULL, committer,
+			(void *)(uintptr_t)i);
+
+	for (unsigned i = 0; i < NTHREADS; ++i)
+		THREAD_JOIN(&threads[i], NULL);
+
+	/* the undo logs with user buffers are cleaned up inline */
+	size_t pending;
+	do {
+		ret = pmemobj_ctl_get(pop, "tx.post_commit.pending", &pending);
+		UT_ASSERTeq(ret, 0);
+		usleep(1000);
+	} while (pending != 0);
+
+	ret = pmemobj_ctl_get(pop, "tx.post_commit.queued", &queued);
+	UT_ASSERTeq(ret, 0);
+
+	for (unsigned i = 0; i < NTHREADS; ++i)
+		tx_user_buffer(i);
+
+	uint64_t queued_userbuf;
+	ret = pmemobj_ctl_get(pop, "tx.post_commit.queued", &queued_userbuf);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(queued_userbuf, queued);
+
+	void *unused;
+	ret = pmemobj_ctl_get(pop, "tx.post_commit.stop", &unused);
+	UT_ASSERTeq(ret, 0);
+
+	for (unsigned i = 0; i < NWORKERS; ++i)
+		THREAD_JOIN(&workers[i], NULL);
+
+	ret = pmemobj_ctl_get(pop, "tx.post_commit.pending", &pending);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(pending, 0);
+
+	uint64_t overflows;
+	ret = pmemobj_ctl_get(pop, "tx.post_commit.overflows", &overflows);
+	UT_ASSERTeq(ret, 0);
+
+	ret = pmemobj_ctl_get(pop, "tx.post_commit.queued", &queued);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTne(queued, 0);
+
+	check_counters(base + NTX + 1);
+
+	/* stopped workers no longer take the work */
+	for (unsigned i = 0; i < NTHREADS; ++i)
+		tx_increment(i);
+
+	uint64_t queued_after;
+	ret = pmemobj_ctl_get(pop, "tx.post_commit.queued", &queued_after);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(queued_after, queued);
+
+	pmemobj_close(pop);
+
+	/* committed transactions must not be rolled back by the recovery */
+	pop = pmemobj_open(path, LAYOUT);
+	UT_ASSERTne(pop, NULL);
+
+	root = pmemobj_direct(pmemobj_root(pop, sizeof(struct root)));
+	check_counters(base + NTX + 2);
+
+	pmemobj_close(pop);
+
+	DONE(NULL);
+}
@@ -0,0 +1,275 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * obj_tx_shadow.c -- unit test for the shadow copies of transactions
+ *
+ * usage: obj_tx_shadow file-name
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "unittest.h"
+
+#define LAYOUT_NAME "tx_shadow"
+
+#define SMALL_SIZE 256
+#define LARGE_SIZE (64 * 1024)
+#define BUFFER_SIZE (2 * LARGE_SIZE)
+
+TOID_DECLARE_ROOT(struct root);
+TOID_DECLARE(struct object, 1);
+
+struct object {
+	uint64_t value;
+};
+
+struct root {
+	char small[SMALL_SIZE];
+	char large[LARGE_SIZE];
+	uint64_t value;
+	TOID(struct object) obj;
+};
+
+/*
+ * check_range -- verifies that all bytes of the range are equal to c
+ */
+static void
+check_range(const char *p, size_t size, char c)
+{
+	for (size_t i = 0; i < size; ++i)
+		UT_ASSERTeq(p[i], c);
+}
+
+/*
+ * test_commit -- modifies the shadow copies together with other changes
+ *	and commits them
+ */
+static void
+test_commit(PMEMobjpool *pop)
+{
+	TOID(struct root) root = POBJ_ROOT(pop, struct root);
+	struct root *rootp = D_RW(root);
+
+	TX_BEGIN(pop) {
+		char *large = pmemobj_tx_shadow_range(root.oid,
+			offsetof(struct root, large), LARGE_SIZE);
+		UT_ASSERTne(large, NULL);
+		UT_ASSERTne(large, rootp->large);
+		check_range(large, LARGE_SIZE, 0);
+
+		memset(large, 'a', LARGE_SIZE);
+
+		/* the pool is not modified until commit */
+		check_range(rootp->large, LARGE_SIZE, 0);
+
+		/* ranges inside of the shadow copy share it */
+		char *p = pmemobj_tx_shadow_range_direct(&rootp->large[10], 5);
+		UT_ASSERTeq(p, large + 10);
+
+		const char *r = pmemobj_tx_read_direct(&rootp->large[100], 10);
+		UT_ASSERTeq(r, large + 100);
+
+		r = pmemobj_tx_read_direct(rootp->small, SMALL_SIZE);
+		UT_ASSERTeq(r, rootp->small);
+
+		char *small = pmemobj_tx_shadow_range_direct(rootp->small,
+			SMALL_SIZE);
+		UT_ASSERTne(small, NULL);
+		memset(small, 'b', SMALL_SIZE);
+
+		TX_ADD_FIELD(root, value);
+		D_RW(root)->value = 5;
+
+		TX_SET(root, obj, TX_NEW(struct object));
+		D_RW(D_RW(root)->obj)->value = 6;
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+
+	check_range(rootp->large, LARGE_SIZE, 'a');
+	check_range(rootp->small, SMALL_SIZE, 'b');
+	UT_ASSERTeq(D_RO(root)->value, 5);
+	UT_ASSERTeq(D_RO(D_RO(root)->obj)->value, 6);
+}
+
+/*
+ * test_abort -- discards the shadow copies of an aborted transaction
+ */
+static void
+test_abort(PMEMobjpool *pop)
+{
+	TOID(struct root) root = POBJ_ROOT(pop, struct root);
+	struct root *rootp = D_RW(root);
+
+	TX_BEGIN(pop) {
+		char *small = pmemobj_tx_shadow_range_direct(rootp->small,
+			SMALL_SIZE);
+		UT_ASSERTne(small, NULL);
+		memset(small, 'c', SMALL_SIZE);
+
+		char *large = pmemobj_tx_shadow_range_direct(rootp->large,
+			LARGE_SIZE);
+		UT_ASSERTne(large, NULL);
+		memset(large, 'c', LARGE_SIZE);
+
+		pmemobj_tx_abort(ECANCELED);
+	} TX_ONCOMMIT {
+		UT_ASSERT(0);
+	} TX_END
+
+	check_range(rootp->small, SMALL_SIZE, 'b');
+	check_range(rootp->large, LARGE_SIZE, 'a');
+
+	/* outside of a transaction the pool is read directly */
+	UT_ASSERTeq(pmemobj_tx_read_direct(rootp->small, SMALL_SIZE),
+		rootp->small);
+}
+
+/*
+ * test_overlap -- tries to create shadow copies which partially overlap
+ *	the existing ones
+ */
+static void
+test_overlap(PMEMobjpool *pop)
+{
+	TOID(struct root) root = POBJ_ROOT(pop, struct root);
+	struct root *rootp = D_RW(root);
+
+	TX_BEGIN(pop) {
+		pmemobj_tx_set_failure_behavior(POBJ_TX_FAILURE_RETURN);
+
+		char *p = pmemobj_tx_shadow_range_direct(&rootp->small[64],
+			64);
+		UT_ASSERTne(p, NULL);
+		memset(p, 'd', 64);
+
+		errno = 0;
+		UT_ASSERTeq(pmemobj_tx_shadow_range_direct(&rootp->small[0],
+			100), NULL);
+		UT_ASSERTeq(errno, EINVAL);
+
+		errno = 0;
+		UT_ASSERTeq(pmemobj_tx_shadow_range_direct(&rootp->small[100],
+			100), NULL);
+		UT_ASSERTeq(errno, EINVAL);
+
+		errno = 0;
+		UT_ASSERTeq(pmemobj_tx_read_direct(&rootp->small[0], 100),
+			NULL);
+		UT_ASSERTeq(errno, EINVAL);
+
+		errno = 0;
+		UT_ASSERTeq(pmemobj_tx_shadow_range(root.oid, 0, 0), NULL);
+		UT_ASSERTeq(errno, EINVAL);
+
+		/* adjacent ranges are fine */
+		p = pmemobj_tx_shadow_range_direct(&rootp->small[128], 64);
+		UT_ASSERTne(p, NULL);
+		memset(p, 'e', 64);
+
+		UT_ASSERTeq(pmemobj_tx_stage(), TX_STAGE_WORK);
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+
+	check_range(&rootp->small[0], 64, 'b');
+	check_range(&rootp->small[64], 64, 'd');
+	check_range(&rootp->small[128], 64, 'e');
+	check_range(&rootp->small[192], 64, 'b');
+
+	/* without the failure behavior set, the transaction is aborted */
+	TX_BEGIN(pop) {
+		char *p = pmemobj_tx_shadow_range_direct(&rootp->small[0], 64);
+		UT_ASSERTne(p, NULL);
+		memset(p, 'f', 64);
+
+		pmemobj_tx_shadow_range_direct(&rootp->small[32], 64);
+		UT_ASSERT(0);
+	} TX_ONCOMMIT {
+		UT_ASSERT(0);
+	} TX_ONABORT {
+		UT_ASSERTeq(errno, EINVAL);
+	} TX_END
+
+	check_range(&rootp->small[0], 64, 'b');
+}
+
+/*
+ * test_user_buffer -- stores the shadow copy in a user provided redo log
+ *	buffer
+ */
+static void
+test_user_buffer(PMEMobjpool *pop)
+{
+	TOID(struct root) root = POBJ_ROOT(pop, struct root);
+	struct root *rootp = D_RW(root);
+
+	PMEMoid buffer;
+	int ret = pmemobj_alloc(pop, &buffer, BUFFER_SIZE, 0, NULL, NULL);
+	UT_ASSERTeq(ret, 0);
+
+	TX_BEGIN(pop) {
+		pmemobj_tx_log_append_buffer(TX_LOG_TYPE_INTENT,
+			pmemobj_direct(buffer), BUFFER_SIZE);
+
+		char *large = pmemobj_tx_shadow_range_direct(rootp->large,
+			LARGE_SIZE);
+		UT_ASSERTne(large, NULL);
+		memset(large, 'g', LARGE_SIZE);
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+
+	check_range(rootp->large, LARGE_SIZE, 'g');
+
+	pmemobj_free(&buffer);
+}
+
+/*
+ * test_reopen -- verifies that the committed shadow copies are persistent
+ */
+static PMEMobjpool *
+test_reopen(PMEMobjpool *pop, const char *path)
+{
+	pmemobj_close(pop);
+
+	pop = pmemobj_open(path, LAYOUT_NAME);
+	if (pop == NULL)
+		UT_FATAL("!pmemobj_open: %s", path);
+
+	TOID(struct root) root = POBJ_ROOT(pop, struct root);
+
+	check_range(D_RO(root)->large, LARGE_SIZE, 'g');
+	check_range(&D_RO(root)->small[64], 64, 'd');
+	UT_ASSERTeq(D_RO(root)->value, 5);
+
+	return pop;
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_tx_shadow");
+
+	if (argc != 2)
+		UT_FATAL("usage: %s file-name", argv[0]);
+
+	const char *path = argv[1];
+
+	PMEMobjpool *pop = pmemobj_create(path, LAYOUT_NAME,
+		PMEMOBJ_MIN_POOL * 4, S_IWUSR | S_IRUSR);
+	if (pop == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	test_commit(pop);
+	test_abort(pop);
+	test_overlap(pop);
+	test_user_buffer(pop);
+	pop = test_reopen(pop, path);
+
+	pmemobj_close(pop);
+
+	DONE(NULL);
+}
@@ -0,0 +1,41 @@
+#!../env.py
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright 2020, Intel Corporation
+#
+
+from os import path
+import testframework as t
+
+
+class BASE(t.BaseTest):
+    test_type = t.Medium
+
+    def run(self, ctx):
+        testfile = path.join(ctx.testdir, 'testfile0')
+        ctx.exec('obj_ulog_checksum', testfile, 'c', self.create)
+        ctx.exec('obj_ulog_checksum', testfile, 'o', self.open,
+                 self.create)
+
+
+class TEST0(BASE):
+    "logs written with Fletcher64 recovered with Fletcher64 selected"
+    create = 0
+    open = 0
+
+
+class TEST1(BASE):
+    "logs written with CRC32C recovered with CRC32C selected"
+    create = 1
+    open = 1
+
+
+class TEST2(BASE):
+    "logs written with Fletcher64 recovered with CRC32C selected"
+    create = 0
+    open = 1
+
+
+class TEST3(BASE):
+    "logs written with CRC32C recovered with Fletcher64 selected"
+    create = 1
+    open = 0
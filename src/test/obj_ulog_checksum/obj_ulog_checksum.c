@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * obj_ulog_checksum.c -- unit test for the checksum algorithms of the logs
+ *
+ * usage: obj_ulog_checksum file-name c|o 0|1 [0|1]
+ *
+ * Selects Fletcher64 (0) or CRC32C (1) as the checksum of the logs, runs
+ * a few committed and aborted transactions, and then either interrupts
+ * a transaction which modified the pool (c) or verifies that the pool was
+ * recovered from such an interrupted transaction (o). The logs must be
+ * recovered regardless of the algorithm selected while they are recovered.
+ *
+ * The last argument of (o) tells whether the pool was created with CRC32C,
+ * and so whether it is expected to have the ULOG_CRC32C feature.
+ */
+
+#include <string.h>
+
+#include "unittest.h"
+#include "libpmempool.h"
+
+#define LAYOUT_NAME "ulog_checksum"
+
+#define SMALL_SIZE 64
+#define LARGE_SIZE (64 * 1024)
+
+TOID_DECLARE_ROOT(struct root);
+
+struct root {
+	char small[SMALL_SIZE];
+	char large[LARGE_SIZE];
+	PMEMoid obj;
+};
+
+/*
+ * check_range -- verifies that all bytes of the range are equal to c
+ */
+static void
+check_range(const char *p, size_t size, char c)
+{
+	for (size_t i = 0; i < size; ++i)
+		UT_ASSERTeq(p[i], c);
+}
+
+/*
+ * set_crc32c -- selects the checksum of the logs
+ */
+static void
+set_crc32c(PMEMobjpool *pop, int crc32c)
+{
+	int ret = pmemobj_ctl_set(pop, "tx.checksum.crc32c", &crc32c);
+	UT_ASSERTeq(ret, 0);
+
+	int value;
+	ret = pmemobj_ctl_get(pop, "tx.checksum.crc32c", &value);
+	UT_ASSERTeq(ret, 0);
+	UT_ASSERTeq(value, crc32c);
+}
+
+/*
+ * modify -- snapshots and modifies the root object in a transaction
+ */
+static void
+modify(PMEMobjpool *pop, struct root *rootp, char c)
+{
+	pmemobj_tx_add_range_direct(rootp->small, SMALL_SIZE);
+	memset(rootp->small, c, SMALL_SIZE);
+
+	pmemobj_tx_add_range_direct(rootp->large, LARGE_SIZE);
+	memset(rootp->large, c, LARGE_SIZE);
+
+	pmemobj_tx_free(rootp->obj);
+	pmemobj_tx_add_range_direct(&rootp->obj, sizeof(rootp->obj));
+	rootp->obj = pmemobj_tx_zalloc(LARGE_SIZE, 0);
+}
+
+/*
+ * test_tx -- commits and aborts transactions
+ */
+static void
+test_tx(PMEMobjpool *pop, char c)
+{
+	TOID(struct root) root = POBJ_ROOT(pop, struct root);
+	struct root *rootp = D_RW(root);
+
+	TX_BEGIN(pop) {
+		modify(pop, rootp, c);
+	} TX_ONABORT {
+		UT_ASSERT(0);
+	} TX_END
+
+	TX_BEGIN(pop) {
+		modify(pop, rootp, (char)(c + 1));
+		pmemobj_tx_abort(ECANCELED);
+	} TX_ONCOMMIT {
+		UT_ASSERT(0);
+	} TX_END
+
+	check_range(rootp->small, SMALL_SIZE, c);
+	check_range(rootp->large, LARGE_SIZE, c);
+	UT_ASSERT(!OID_IS_NULL(rootp->obj));
+}
+
+/*
+ * test_crash -- exits in the middle of a transaction
+ */
+static void
+test_crash(PMEMobjpool *pop)
+{
+	TOID(struct root) root = POBJ_ROOT(pop, struct root);
+	struct root *rootp = D_RW(root);
+
+	TX_BEGIN(pop) {
+		modify(pop, rootp, 'x');
+		pmemobj_persist(pop, rootp, sizeof(*rootp));
+
+		/* simulate a crash */
+		exit(0);
+	} TX_END
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_ulog_checksum");
+
+	if (argc < 4 || strlen(argv[2]) != 1)
+		UT_FATAL("usage: %s file-name c|o 0|1 [0|1]", argv[0]);
+
+	const char *path = argv[1];
+	int crc32c = atoi(argv[3]);
+
+	PMEMobjpool *pop;
+	int value;
+	int ret;
+	int feature;
+	switch (argv[2][0]) {
+		case 'c':
+			pop = pmemobj_create(path, LAYOUT_NAME,
+				PMEMOBJ_MIN_POOL * 4, S_IWUSR | S_IRUSR);
+			if (pop == NULL)
+				UT_FATAL("!pmemobj_create: %s", path);
+
+			/* Fletcher64 is used unless CRC32C is selected */
+			ret = pmemobj_ctl_get(pop, "tx.checksum.crc32c",
+				&value);
+			UT_ASSERTeq(ret, 0);
+			UT_ASSERTeq(value, 0);
+
+			set_crc32c(pop, crc32c);
+			test_tx(pop, 'a');
+			test_tx(pop, 'b');
+			test_crash(pop);
+			break;
+		case 'o':
+			if (argc != 5)
+				UT_FATAL("usage: %s file-name o 0|1 0|1",
+					argv[0]);
+
+			/* enabling CRC32C is recorded in the pool header */
+			feature = pmempool_feature_query(path,
+				PMEMPOOL_FEAT_ULOG_CRC32C, 0);
+			UT_ASSERTeq(feature, atoi(argv[4]));
+
+			pop = pmemobj_open(path, LAYOUT_NAME);
+			if (pop == NULL)
+				UT_FATAL("!pmemobj_open: %s", path);
+
+			/* and CRC32C stays selected for such pools */
+			ret = pmemobj_ctl_get(pop, "tx.checksum.crc32c",
+				&value);
+			UT_ASSERTeq(ret, 0);
+			UT_ASSERTeq(value, feature);
+
+			TOID(struct root) root = POBJ_ROOT(pop, struct root);
+			check_range(D_RO(root)->small, SMALL_SIZE, 'b');
+			check_range(D_RO(root)->large, LARGE_SIZE, 'b');
+
+			set_crc32c(pop, crc32c);
+			test_tx(pop, 'c');
+
+			pmemobj_close(pop);
+
+			/* the feature is never cleared by the library */
+			ret = pmempool_feature_query(path,
+				PMEMPOOL_FEAT_ULOG_CRC32C, 0);
+			UT_ASSERTeq(ret, feature | crc32c);
+			break;
+		default:
+			UT_FATAL("unknown mode %c", argv[2][0]);
+	}
+
+	DONE(NULL);
+}
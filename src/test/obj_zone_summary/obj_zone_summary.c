@@ -0,0 +1,178 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright 2020, Intel Corporation */
+
+/*
+ * obj_zone_summary.c -- unit test for the persistent zone summaries
+ *
+ * usage: obj_zone_summary file-name 0|1
+ *
+ * Creates a pool with two zones and fills the first one entirely. Then the
+ * pool is reopened a couple of times and the number of zones that had to be
+ * populated to satisfy the first allocation is printed. With the summaries
+ * enabled, the full zone is skipped once its summary is up to date, unless
+ * something was freed in it while the summaries were disabled.
+ */
+
+#include <inttypes.h>
+
+#include "unittest.h"
+#include "obj.h"
+#include "heap_layout.h"
+
+#define LAYOUT "obj_zone_summary"
+#define FILL_CHUNKS 4096
+#define HUGE_SIZE (1 << 22)
+#define SMALL_SIZE 64
+
+static PMEMobjpool *pop;
+
+/*
+ * obj_zone -- returns the id of the zone in which the object lies
+ */
+static unsigned
+obj_zone(PMEMoid oid)
+{
+	uint64_t heap_start = pop->heap_offset + sizeof(struct heap_header);
+
+	return (unsigned)((oid.off - heap_start) / ZONE_MAX_SIZE);
+}
+
+/*
+ * alloc_chunks -- allocates an object which occupies exactly nchunks chunks
+ */
+static PMEMoid
+alloc_chunks(unsigned nchunks)
+{
+	PMEMoid oid;
+	size_t size = nchunks * CHUNKSIZE - ALLOC_HDR_COMPACT_SIZE;
+
+	int ret = pmemobj_alloc(pop, &oid, size, 0, NULL, NULL);
+	UT_ASSERTeq(ret, 0);
+
+	return oid;
+}
+
+/*
+ * zones_populated -- returns the number of zones populated so far
+ */
+static uint64_t
+zones_populated(void)
+{
+	uint64_t n;
+	int ret = pmemobj_ctl_get(pop, "stats.heap.zones_populated", &n);
+	UT_ASSERTeq(ret, 0);
+
+	return n;
+}
+
+/*
+ * do_create -- creates the pool and fills its first zone
+ */
+static void
+do_create(const char *path)
+{
+	pop = pmemobj_create(path, LAYOUT, 0, S_IWUSR | S_IRUSR);
+	if (pop == NULL)
+		UT_FATAL("!pmemobj_create: %s", path);
+
+	for (unsigned i = 0; i < MAX_CHUNK / FILL_CHUNKS; ++i)
+		UT_ASSERTeq(obj_zone(alloc_chunks(FILL_CHUNKS)), 0);
+
+	if (MAX_CHUNK % FILL_CHUNKS != 0)
+		UT_ASSERTeq(obj_zone(alloc_chunks(MAX_CHUNK % FILL_CHUNKS)), 0);
+
+	UT_OUT("create: zones populated %" PRIu64, zones_populated());
+
+	pmemobj_close(pop);
+}
+
+/*
+ * do_alloc -- reopens the pool and allocates a single object
+ */
+static void
+do_alloc(const char *path, size_t size, int free)
+{
+	pop = pmemobj_open(path, LAYOUT);
+	if (pop == NULL)
+		UT_FATAL("!pmemobj_open: %s", path);
+
+	PMEMoid oid;
+	int ret = pmemobj_alloc(pop, &oid, size, 0, NULL, NULL);
+	UT_ASSERTeq(ret, 0);
+
+	UT_OUT("alloc %zu: zone %u, zones populated %" PRIu64, size,
+		obj_zone(oid), zones_populated());
+
+	if (free)
+		pmemobj_free(&oid);
+
+	pmemobj_close(pop);
+}
+
+/*
+ * do_free_disabled -- reopens the pool with the summaries disabled and frees
+ *	the first object, which lies in the full zone
+ */
+static void
+do_free_disabled(const char *path, int enabled)
+{
+	int disabled = 0;
+	int ret = pmemobj_ctl_set(NULL, "heap.boot.zone_summary", &disabled);
+	UT_ASSERTeq(ret, 0);
+
+	pop = pmemobj_open(path, LAYOUT);
+	if (pop == NULL)
+		UT_FATAL("!pmemobj_open: %s", path);
+
+	PMEMoid oid = pmemobj_first(pop);
+	UT_ASSERTeq(obj_zone(oid), 0);
+	pmemobj_free(&oid);
+
+	pmemobj_close(pop);
+
+	ret = pmemobj_ctl_set(NULL, "heap.boot.zone_summary", &enabled);
+	UT_ASSERTeq(ret, 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	START(argc, argv, "obj_zone_summary");
+
+	if (argc != 3)
+		UT_FATAL("usage: %s file-name 0|1", argv[0]);
+
+	const char *path = argv[1];
+
+	int enabled = atoi(argv[2]);
+	int ret = pmemobj_ctl_set(NULL, "heap.boot.zone_summary", &enabled);
+	UT_ASSERTeq(ret, 0);
+
+	ret = pmemobj_ctl_get(NULL, "heap.boot.zone_summary", &enabled);
+	UT_ASSERTeq(ret, 0);
+	UT_OUT("zone summary: %d", enabled);
+
+	do_create(path);
+
+	/* the summary of the first zone is only accurate after this one */
+	do_alloc(path, HUGE_SIZE, 1);
+	do_alloc(path, HUGE_SIZE, 1);
+
+	/* the second one finds the run created by the first one */
+	do_alloc(path, SMALL_SIZE, 0);
+	do_alloc(path, SMALL_SIZE, 0);
+
+	/* the summary of the first zone doesn't know about this free */
+	do_free_disabled(path, enabled);
+	do_alloc(path, HUGE_SIZE, 0);
+
+	pop = pmemobj_open(path, LAYOUT);
+	if (pop == NULL)
+		UT_FATAL("!pmemobj_open: %s", path);
+	pmemobj_close(pop);
+
+	ret = pmemobj_check(path, LAYOUT);
+	UT_ASSERTeq(ret, 1);
+
+	DONE(NULL);
+}
@@ -1,6 +1,6 @@
 #!/usr/bin/env bash
 # SPDX-License-Identifier: BSD-3-Clause
-# Copyright 2018-2019, Intel Corporation
+# Copyright 2018-2020, Intel Corporation
 
 #
 # src/test/pmempool_feature/common.sh -- common part of pmempool_feature tests
@@ -159,6 +159,20 @@ function pmempool_feature_test_CHECK_BAD_BLOCKS() {
 	pmempool_feature_disable "CHECK_BAD_BLOCKS"
 }
 
+# pmempool_feature_test_ULOG_CRC32C -- test ULOG_CRC32C
+function pmempool_feature_test_ULOG_CRC32C() {
+	# PMEMPOOL_FEAT_ULOG_CRC32C is disabled by default
+	pmempool_feature_query "ULOG_CRC32C"
+
+	pmempool_feature_enable "ULOG_CRC32C"
+
+	# the logs may be checksummed with CRC32C so it cannot be disabled
+	exit_func=expect_abnormal_exit
+	pmempool_feature_disable "ULOG_CRC32C" "no-query" # UNSUPPORTED
+	exit_func=expect_normal_exit
+	pmempool_feature_query "ULOG_CRC32C"
+}
+
 # pmempool_feature_remote_init -- initialization remote replics
 function pmempool_feature_remote_init() {
 	require_nodes 2